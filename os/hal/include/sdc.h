@@ -103,6 +103,15 @@
 #if !defined(SDC_NICE_WAITING) || defined(__DOXYGEN__)
 #define SDC_NICE_WAITING                TRUE
 #endif
+
+/**
+ * @brief   Enables the asynchronous block API.
+ * @note    Requires a low level driver implementing
+ *          @p sdc_lld_start_request() and @p sdc_lld_wait_idle().
+ */
+#if !defined(SDC_USE_ASYNC) || defined(__DOXYGEN__)
+#define SDC_USE_ASYNC                   FALSE
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -113,6 +122,52 @@
 /* Driver data structures and types.                                         */
 /*===========================================================================*/
 
+#if SDC_USE_ASYNC || defined(__DOXYGEN__)
+struct SDCDriver;
+
+/**
+ * @brief   Type of an asynchronous block request.
+ */
+typedef struct SDCRequest SDCRequest;
+
+/**
+ * @brief   Request completion callback type.
+ */
+typedef void (*sdccallback_t)(struct SDCDriver *sdcp, SDCRequest *rqp);
+
+/**
+ * @brief   Structure representing an asynchronous block request.
+ * @details The storage belongs to the caller and must stay valid until
+ *          the completion callback has been invoked.
+ */
+struct SDCRequest {
+  /**
+   * @brief Write request, read otherwise.
+   */
+  bool_t                    write;
+  /**
+   * @brief First block of the transfer.
+   */
+  uint32_t                  startblk;
+  /**
+   * @brief Transfer buffer.
+   */
+  uint8_t                   *buf;
+  /**
+   * @brief Number of blocks.
+   */
+  uint32_t                  n;
+  /**
+   * @brief Completion callback or @p NULL.
+   */
+  sdccallback_t             end_cb;
+  /**
+   * @brief Operation status, valid once completed.
+   */
+  bool_t                    status;
+};
+#endif /* SDC_USE_ASYNC */
+
 #include "sdc_lld.h"
 
 /*===========================================================================*/
@@ -177,6 +232,13 @@ extern "C" {
   bool_t sdcSync(SDCDriver *sdcp);
   bool_t sdcGetInfo(SDCDriver *sdcp, BlockDeviceInfo *bdip);
   bool_t sdcErase(SDCDriver *mmcp, uint32_t startblk, uint32_t endblk);
+#if SDC_USE_ASYNC
+  bool_t sdcStartRead(SDCDriver *sdcp, SDCRequest *rqp, uint32_t startblk,
+                      uint8_t *buf, uint32_t n, sdccallback_t end_cb);
+  bool_t sdcStartWrite(SDCDriver *sdcp, SDCRequest *rqp, uint32_t startblk,
+                       const uint8_t *buf, uint32_t n, sdccallback_t end_cb);
+  void sdcWaitIdle(SDCDriver *sdcp);
+#endif
   bool_t _sdc_wait_for_transfer_state(SDCDriver *sdcp);
 #ifdef __cplusplus
 }
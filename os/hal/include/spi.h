@@ -65,6 +65,15 @@
 #if !defined(SPI_USE_MUTUAL_EXCLUSION) || defined(__DOXYGEN__)
 #define SPI_USE_MUTUAL_EXCLUSION    TRUE
 #endif
+
+/**
+ * @brief   Enables the transactions API.
+ * @note    Requires a low level driver implementing
+ *          @p spi_lld_transaction().
+ */
+#if !defined(SPI_USE_TRANSACTIONS) || defined(__DOXYGEN__)
+#define SPI_USE_TRANSACTIONS        FALSE
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -90,6 +99,44 @@ typedef enum {
   SPI_COMPLETE = 4                  /**< Asynchronous operation complete.   */
 } spistate_t;
 
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Transaction step operations.
+ */
+typedef enum {
+  SPI_STEP_SELECT = 0,              /**< Slave select assertion.            */
+  SPI_STEP_UNSELECT = 1,            /**< Slave select de-assertion.         */
+  SPI_STEP_IGNORE = 2,              /**< Idle words, data ignored.          */
+  SPI_STEP_EXCHANGE = 3,            /**< Simultaneous transmit/receive.     */
+  SPI_STEP_SEND = 4,                /**< Transmit only.                     */
+  SPI_STEP_RECEIVE = 5              /**< Receive only.                      */
+} spistepop_t;
+
+/**
+ * @brief   Structure representing one step of a transaction.
+ * @note    The buffers are organized as uint8_t arrays for data sizes below
+ *          or equal to 8 bits else it is organized as uint16_t arrays.
+ */
+typedef struct {
+  /**
+   * @brief Step operation.
+   */
+  spistepop_t               op;
+  /**
+   * @brief Number of words, unused by the select steps.
+   */
+  size_t                    n;
+  /**
+   * @brief Transmit buffer or @p NULL.
+   */
+  const void                *txbuf;
+  /**
+   * @brief Receive buffer or @p NULL.
+   */
+  void                      *rxbuf;
+} SPIStep;
+#endif /* SPI_USE_TRANSACTIONS */
+
 #include "spi_lld.h"
 
 /*===========================================================================*/
@@ -203,6 +250,26 @@ typedef enum {
   spi_lld_receive(spip, n, rxbuf);                                          \
 }
 
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Starts a transaction.
+ * @details This asynchronous function starts the steps of a transaction as
+ *          a single operation, the slave select is driven by the steps.
+ * @post    At the end of the last step the configured callback is invoked.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] steps     the transaction steps, must stay valid until the
+ *                      operation completes
+ * @param[in] n         number of steps
+ *
+ * @iclass
+ */
+#define spiStartTransactionI(spip, steps, n) {                              \
+  (spip)->state = SPI_ACTIVE;                                               \
+  spi_lld_transaction(spip, steps, n);                                      \
+}
+#endif /* SPI_USE_TRANSACTIONS */
+
 /**
  * @brief   Exchanges one frame using a polled wait.
  * @details This synchronous function exchanges one frame using a polled
@@ -310,11 +377,17 @@ extern "C" {
                         const void *txbuf, void *rxbuf);
   void spiStartSend(SPIDriver *spip, size_t n, const void *txbuf);
   void spiStartReceive(SPIDriver *spip, size_t n, void *rxbuf);
+#if SPI_USE_TRANSACTIONS
+  void spiStartTransaction(SPIDriver *spip, const SPIStep *steps, size_t n);
+#endif
 #if SPI_USE_WAIT
   void spiIgnore(SPIDriver *spip, size_t n);
   void spiExchange(SPIDriver *spip, size_t n, const void *txbuf, void *rxbuf);
   void spiSend(SPIDriver *spip, size_t n, const void *txbuf);
   void spiReceive(SPIDriver *spip, size_t n, void *rxbuf);
+#if SPI_USE_TRANSACTIONS
+  void spiTransaction(SPIDriver *spip, const SPIStep *steps, size_t n);
+#endif
 #endif /* SPI_USE_WAIT */
 #if SPI_USE_MUTUAL_EXCLUSION
   void spiAcquireBus(SPIDriver *spip);
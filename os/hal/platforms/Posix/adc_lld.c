@@ -22,15 +22,42 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "ch.h"
 #include "hal.h"
-#include <math.h> 
+#include "simio.h"
+#include "simutil.h"
+
 #if HAL_USE_ADC || defined(__DOXYGEN__)
 
 /*===========================================================================*/
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @brief   Sine generator frequency when not given, in Hz.
+ */
+#define ADC_SINE_TONE       50
+
+/**
+ * @brief   Ticks taken converting @p n samples at @p rate, rounded up.
+ */
+#define ADC_TICKS(n, rate)                                                  \
+  ((systime_t)(((uint64_t)(n) * CH_FREQUENCY + (rate) - 1) / (rate)))
+
+/**
+ * @brief   Nanoseconds taken converting @p n samples at @p rate.
+ */
+#define ADC_NS(n, rate)     ((int64_t)((uint64_t)(n) * 1000000000 / (rate)))
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -45,51 +72,306 @@ ADCDriver ADCD1;
 /*===========================================================================*/
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
+static WORKING_AREA(wsp, 256);
 
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
-//create this thread to emulate if the buffer is circular
-static WORKING_AREA(circular,128);
-static msg_t buffer_thread(void *arg)
-{
-    (void)arg;
-    while(ADCD1.toConvert)
-    {
-
-        int n=0;
- #if CONVERT     
-        float exp = powf(2, ADCD1.grpp->bits);
-        float adc_val = ADCD1.grpp->volt_range /exp;
-        
-        uint32_t    volt_input[ADCD1.grpp->buffer_size]; 
-        float sample[ADCD1.grpp->buffer_size];
-        n = 0;
-        for(;n < (int)ADCD1.grpp->buffer_size;n++)
-        {
-            sample[n] = exp *  ADCD1.samples[n]/ADCD1.grpp->volt_range; 
-            volt_input[n] = sample[n]*adc_val;    
-            sim_printf(ADC_IO, "sample: %hd\n", sample[n]);
-            sim_printf(ADC_IO, "sample: %.2f\n", volt_input[n]);
-        }
-        ADCD1.adc_val = sample;
-        ADCD1.volt_input = volt_input;
-#else
 
-        for(;n < (int)ADCD1.grpp->buffer_size; n++)
-        {
-         //  printf("sample %d: %d \n",n ,ADCD1.samples[n]);
-           sim_printf(ADC_IO, "sample: %hd\n", ADCD1.samples[n]);
-        } 
-#endif 
-  chThdSleepMilliseconds(1000);       
-    } 
-    return -1;
+/**
+ * @brief   Selects the samples source.
+ * @details The source is one of "vha", "file:<path>", "sine",
+ *          "sine:<hz>", "ramp" or "noise", the VHA when not given.
+ *          A file holds raw host order samples, all the channels of a
+ *          sample in a row, and is played in a loop.
+ *
+ * @param[in] adcp      pointer to the @p ADCDriver object
+ * @param[in] spec      the source, NULL for the VHA
+ *
+ * @notapi
+ */
+static void adc_source_open(ADCDriver *adcp, const char *spec) {
+  struct stat st;
+  void *p;
+  int fd;
+
+  adcp->tone = ADC_SINE_TONE;
+  if (spec == NULL || !strcmp(spec, "vha"))
+    adcp->source = ADC_SOURCE_VHA;
+  else if (!strcmp(spec, "sine"))
+    adcp->source = ADC_SOURCE_SINE;
+  else if (!strncmp(spec, "sine:", 5) && atoi(spec + 5) > 0) {
+    adcp->source = ADC_SOURCE_SINE;
+    adcp->tone = atoi(spec + 5);
+  }
+  else if (!strcmp(spec, "ramp"))
+    adcp->source = ADC_SOURCE_RAMP;
+  else if (!strcmp(spec, "noise"))
+    adcp->source = ADC_SOURCE_NOISE;
+  else if (!strncmp(spec, "file:", 5)) {
+    if ((fd = open(spec + 5, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+      eprintf("cannot open ADC samples %s", spec + 5);
+      exit(EXIT_FAILURE);
+    }
+    adcp->file_size = st.st_size / sizeof(adcsample_t);
+    if (adcp->file_size == 0) {
+      eprintf("ADC samples file %s is empty", spec + 5);
+      exit(EXIT_FAILURE);
+    }
+
+    /* the mapping outlives the descriptor */
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      eprintf("cannot map ADC samples %s", spec + 5);
+      exit(EXIT_FAILURE);
+    }
+    adcp->file = p;
+    adcp->source = ADC_SOURCE_FILE;
+  }
+  else {
+    eprintf("unknown ADC source %s", spec);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Converts the next samples of the stream.
+ * @details The VHA is sent the line "convert <n>" and replies with the
+ *          @p n samples, host order, all the channels of a sample in a
+ *          row. On a failed exchange the samples read as zero.
+ *
+ * @param[in] adcp      pointer to the @p ADCDriver object
+ * @param[in] grpp      the conversion group
+ * @param[out] buf      where the samples go
+ * @param[in] n         number of samples
+ * @param[in] rate      sample rate in Hz
+ * @return              FALSE if the exchange with the VHA failed.
+ *
+ * @notapi
+ */
+static bool_t adc_source_fill(ADCDriver *adcp, const ADCConversionGroup *grpp,
+                              adcsample_t *buf, size_t n, uint32_t rate) {
+  size_t nch = grpp->num_channels, i, c;
+  unsigned bits = grpp->bits != 0 ? grpp->bits : PLATFORM_ADC_BITS;
+  uint32_t max = (1U << bits) - 1, x;
+  double mid = max / 2.0, phase;
+  ssize_t nb;
+
+  switch (adcp->source) {
+  case ADC_SOURCE_VHA:
+    if (sim_printf(ADC_IO, "convert %u", (unsigned)n) < 0) {
+      eprintf("ADC convert request failed");
+      memset(buf, 0, n * nch * sizeof(adcsample_t));
+      return FALSE;
+    }
+    if ((nb = sim_read_exact(ADC_IO, buf, n * nch * sizeof(adcsample_t))) !=
+        (ssize_t)(n * nch * sizeof(adcsample_t))) {
+      eprintf("ADC receive got %d of %u bytes", (int)nb,
+              (unsigned)(n * nch * sizeof(adcsample_t)));
+      memset(buf, 0, n * nch * sizeof(adcsample_t));
+      return FALSE;
+    }
+    break;
+  case ADC_SOURCE_FILE:
+    for (i = 0; i < n * nch; i++)
+      buf[i] = adcp->file[((size_t)adcp->position * nch + i) % adcp->file_size];
+    break;
+  case ADC_SOURCE_SINE:
+    /* channels evenly out of phase, the phase reduced to keep precision */
+    for (i = 0; i < n; i++) {
+      phase = 2 * M_PI *
+              ((uint64_t)adcp->tone * (adcp->position + i) % rate) / rate;
+      for (c = 0; c < nch; c++)
+        buf[i * nch + c] = (adcsample_t)(mid + mid *
+                                         sin(phase + 2 * M_PI * c / nch) + 0.5);
+    }
+    break;
+  case ADC_SOURCE_RAMP:
+    for (i = 0; i < n * nch; i++)
+      buf[i] = (adcsample_t)(((size_t)adcp->position * nch + i) & max);
+    break;
+  case ADC_SOURCE_NOISE:
+    /* hashing the sample index makes the noise reproducible */
+    for (i = 0; i < n * nch; i++) {
+      x = (uint32_t)((size_t)adcp->position * nch + i);
+      x = ((x >> 16) ^ x) * 0x45D9F3BU;
+      x = ((x >> 16) ^ x) * 0x45D9F3BU;
+      buf[i] = (adcsample_t)(((x >> 16) ^ x) & max);
+    }
+    break;
+  }
+  adcp->position += n;
+  return TRUE;
 }
+
+/**
+ * @brief   Host time in nanoseconds.
+ *
+ * @notapi
+ */
+static int64_t adc_host_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief   How late a hand over is, in nanoseconds.
+ * @details With the real clock the host time counts: the kernel catches
+ *          up with the ticks elapsed while the host was busy one timer at
+ *          a time, a consumer slower than the stream would not show in
+ *          the system time.
+ *
+ * @param[in] deadline  system time of the hand over
+ * @param[in] host_base host time of the stream start
+ * @param[in] n         samples converted since the stream start
+ * @param[in] rate      sample rate in Hz
+ *
+ * @notapi
+ */
+static int64_t adc_lateness(systime_t deadline, int64_t host_base,
+                            uint32_t n, uint32_t rate) {
+
+  if (port_is_virtual_clock())
+    return (int32_t)(chTimeNow() - deadline) * (int64_t)(1000000000 /
+                                                         CH_FREQUENCY);
+  return adc_host_ns() - host_base - ADC_NS(n, rate);
+}
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Sampling thread, plays the part of the DMA engine.
+ * @details Each half buffer, or the whole buffer when not circular, is
+ *          converted ahead and handed over at the time the hardware
+ *          would have filled it, as an interrupt would. A half buffer
+ *          handed over after the other half should have been refilled
+ *          too is an overrun. A failed exchange with the VHA ends the
+ *          conversion with @p ADC_ERR_DMAFAILURE.
+ */
+static msg_t sampling_thread(void *arg) {
+  ADCDriver *adcp = (ADCDriver*)arg;
+  const ADCConversionGroup *grpp;
+  adcsample_t *samples;
+  size_t depth, rows, half;
+  uint32_t session, rate, done, streamed;
+  systime_t base, deadline, delta;
+  int64_t host_base, slack;
+  bool_t kicked = FALSE, alive;
+
+  chRegSetThreadName("adc_sampling");
+  while (TRUE) {
+    if (!kicked)
+      chBSemWait(&adcp->kick);
+    kicked = FALSE;
+
+    /* the driver fields change on restart, the conversion is copied */
+    chSysLock();
+    if (adcp->state != ADC_ACTIVE) {
+      chSysUnlock();
+      continue;
+    }
+    session = adcp->session;
+    grpp = adcp->grpp;
+    samples = adcp->samples;
+    depth = adcp->depth;
+    chSysUnlock();
+
+    rate = grpp->frequency != 0 ? grpp->frequency : PLATFORM_ADC_FREQUENCY;
+    rows = grpp->circular && depth > 1 ? depth / 2 : depth;
+    adcp->position = 0;
+    if (adcp->source == ADC_SOURCE_VHA &&
+        sim_printf(ADC_IO, "start %u %u %u", (unsigned)rate,
+                   (unsigned)grpp->num_channels,
+                   (unsigned)(grpp->bits != 0 ? grpp->bits :
+                                                PLATFORM_ADC_BITS)) < 0)
+      eprintf("ADC start request failed");
+
+    /* the other half is overwritten a half later, plus a tick of jitter */
+    slack = ADC_NS(depth - rows, rate) +
+            (port_is_virtual_clock() ? 0 : 1000000000 / CH_FREQUENCY);
+    base = chTimeNow();
+    host_base = adc_host_ns();
+    done = streamed = 0;
+    half = 0;
+    while (session == adcp->session) {
+      if (!adc_source_fill(adcp, grpp,
+                           samples + half * rows * grpp->num_channels,
+                           rows, rate)) {
+        CH_IRQ_PROLOGUE();
+        chSysLockFromIsr();
+        alive = session == adcp->session;
+        chSysUnlockFromIsr();
+        if (alive) {
+          _adc_isr_error_code(adcp, ADC_ERR_DMAFAILURE);
+        }
+        CH_IRQ_EPILOGUE();
+        break;
+      }
+      done += rows;
+      streamed += rows;
+
+      /* the samples are handed over when the hardware would have them */
+      deadline = base + ADC_TICKS(done, rate);
+      delta = deadline - chTimeNow();
+      if (delta != 0 && delta <= ADC_TICKS(rows, rate) &&
+          chBSemWaitTimeout(&adcp->kick, delta) == RDY_OK) {
+        /* restarted meanwhile */
+        kicked = TRUE;
+        break;
+      }
+      if (grpp->circular &&
+          adc_lateness(deadline, host_base, streamed, rate) > slack) {
+        adcp->overruns++;
+#if PLATFORM_ADC_STOP_ON_OVERRUN
+        CH_IRQ_PROLOGUE();
+        chSysLockFromIsr();
+        alive = session == adcp->session;
+        chSysUnlockFromIsr();
+        if (alive) {
+          _adc_isr_error_code(adcp, ADC_ERR_OVERFLOW);
+        }
+        CH_IRQ_EPILOGUE();
+        break;
+#else
+        /* the lost time is not made up for, the stream goes on from now */
+        base = chTimeNow();
+        host_base = adc_host_ns();
+        done = streamed = 0;
+#endif
+      }
+
+      CH_IRQ_PROLOGUE();
+      chSysLockFromIsr();
+      alive = session == adcp->session;
+      chSysUnlockFromIsr();
+      if (alive) {
+        if (rows < depth && half == 0) {
+          _adc_isr_half_code(adcp);
+        }
+        else {
+          _adc_isr_full_code(adcp);
+        }
+      }
+      CH_IRQ_EPILOGUE();
+      if (!alive || !grpp->circular)
+        break;
+
+      half = rows < depth ? half ^ 1 : 0;
+      while (done >= rate) {
+        base += CH_FREQUENCY;
+        done -= rate;
+      }
+    }
+  }
+
+  return 0;
+}
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
@@ -104,6 +386,8 @@ void adc_lld_init(void) {
 #if PLATFORM_ADC_USE_ADC1
   /* Driver initialization.*/
   adcObjectInit(&ADCD1);
+  chBSemInit(&ADCD1.kick, TRUE);
+  ADCD1.thd = NULL;
 #endif /* PLATFORM_ADC_USE_ADC1 */
 }
 
@@ -116,16 +400,13 @@ void adc_lld_init(void) {
  */
 void adc_lld_start(ADCDriver *adcp) {
 
-  if (adcp->state == ADC_STOP) {
-    /* Enables the peripheral.*/
-#if PLATFORM_ADC_USE_ADC1
-    if (&ADCD1 == adcp) {
-
-    }
-#endif /* PLATFORM_ADC_USE_ADC1 */
+  /* the sampling thread is created once and kept across stops */
+  if (adcp->thd == NULL) {
+    adc_source_open(adcp, sim_get_adc_source());
+    adcp->thd = chThdCreateI(wsp, sizeof(wsp), PLATFORM_ADC_THREAD_PRIORITY,
+                             sampling_thread, (void*)adcp);
+    chSchWakeupS(adcp->thd, RDY_OK);
   }
-  /* Configures the peripheral.*/
-
 }
 
 /**
@@ -136,17 +417,7 @@ void adc_lld_start(ADCDriver *adcp) {
  * @notapi
  */
 void adc_lld_stop(ADCDriver *adcp) {
-
-  if (adcp->state == ADC_READY) {
-    /* Resets the peripheral.*/
-
-    /* Disables the peripheral.*/
-#if PLATFORM_ADC_USE_ADC1
-    if (&ADCD1 == adcp) {
-
-    }
-#endif /* PLATFORM_ADC_USE_ADC1 */
-  }
+  (void)adcp;
 }
 
 /**
@@ -158,47 +429,15 @@ void adc_lld_stop(ADCDriver *adcp) {
  */
 void adc_lld_start_conversion(ADCDriver *adcp) {
 
-  (void)adcp;
-  const ADCConversionGroup *grrp = adcp->grpp;
-  adcp->toConvert = true;
-  if(grrp->circular)
-  { //going to be a thread... 
-      chThdCreateStatic(circular, sizeof(circular), NORMALPRIO, buffer_thread, NULL);
-  }
-  else 
-  {
-
-        int n=0;
- #if CONVERT
-        //prints out the calculated digital outputs if there's no digit outputs within
-        //the buffer.      
-        float exp = powf(2, grrp->bits);
-        float adc_val = grrp->volt_range /exp;
-        float sample[adcp->grpp->buffer_size];
-        uint32_t    volt_input[adcp->grpp->buffer_size]; 
-        n = 0;
-        for(;n < (int)grrp->buffer_size;n++)
-        {
-            sample[n] = exp * adcp->samples[n]/grrp->volt_range; 
-            volt_input[n] = sample[n]* adc_val;    
-            sim_printf(ADC_IO, "sample: %.2f\n", sample[n]);
-            sim_printf(ADC_IO, "sample: %.2f\n", volt_input[n]);
-        }
-        adcp->adc_val = sample;
-        adcp->volt_input = volt_input;
-#else
-
-      //prints out the digital outputs
-        for(;n < (int)grrp->buffer_size; n++)
-        {
-            sim_printf(ADC_IO, "sample: %hd\n", adcp->samples[n]);
-        } 
-#endif        
-  } 
+  adcp->session++;
+  chBSemSignalI(&adcp->kick);
 }
 
 /**
  * @brief   Stops an ongoing conversion.
+ * @note    The portable code also calls this from the ISR code, with the
+ *          kernel unlocked, the sampling thread only learns of the stop
+ *          when it wakes up.
  *
  * @param[in] adcp      pointer to the @p ADCDriver object
  *
@@ -206,9 +445,7 @@ void adc_lld_start_conversion(ADCDriver *adcp) {
  */
 void adc_lld_stop_conversion(ADCDriver *adcp) {
 
-
-  (void)adcp;
-  adcp->toConvert= false;
+  adcp->session++;
 }
 
 #endif /* HAL_USE_ADC */
@@ -47,11 +47,41 @@
 #if !defined(PLATFORM_ADC_USE_ADC1) || defined(__DOXYGEN__)
 #define PLATFORM_ADC_USE_ADC1               TRUE
 #endif
-/** @} */
-//if no digital values 
-#if !defined(CONVERT) 
-#define CONVERT                             FALSE
+
+/**
+ * @brief   Sampling thread priority.
+ * @note    The thread plays the part of the DMA engine, it must run
+ *          ahead of the threads consuming the samples.
+ */
+#if !defined(PLATFORM_ADC_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_ADC_THREAD_PRIORITY        (NORMALPRIO + 2)
+#endif
+
+/**
+ * @brief   Sample rate of the groups not specifying one, in Hz.
+ */
+#if !defined(PLATFORM_ADC_FREQUENCY) || defined(__DOXYGEN__)
+#define PLATFORM_ADC_FREQUENCY              1000
+#endif
+
+/**
+ * @brief   Resolution of the groups not specifying one, in bits.
+ */
+#if !defined(PLATFORM_ADC_BITS) || defined(__DOXYGEN__)
+#define PLATFORM_ADC_BITS                   12
 #endif
+
+/**
+ * @brief   Overrun handling.
+ * @details If set to @p TRUE an overrun ends the conversion through the
+ *          error callback as on real hardware, else the overruns are
+ *          only counted and the stream goes on.
+ * @note    The default is @p FALSE.
+ */
+#if !defined(PLATFORM_ADC_STOP_ON_OVERRUN) || defined(__DOXYGEN__)
+#define PLATFORM_ADC_STOP_ON_OVERRUN        FALSE
+#endif
+/** @} */
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
@@ -80,6 +110,17 @@ typedef enum {
   ADC_ERR_OVERFLOW = 1                      /**< ADC overflow condition.    */
 } adcerror_t;
 
+/**
+ * @brief   Samples source, selected with the --sim_adc_source option.
+ */
+typedef enum {
+  ADC_SOURCE_VHA = 0,                       /**< Requested from the VHA.    */
+  ADC_SOURCE_FILE = 1,                      /**< Raw samples file, looped.  */
+  ADC_SOURCE_SINE = 2,                      /**< Sine wave generator.       */
+  ADC_SOURCE_RAMP = 3,                      /**< Ramp generator.            */
+  ADC_SOURCE_NOISE = 4                      /**< White noise generator.     */
+} adcsource_t;
+
 /**
  * @brief   Type of a structure representing an ADC driver.
  */
@@ -129,9 +170,16 @@ typedef struct {
    */
   adcerrorcallback_t        error_cb;
   /* End of the mandatory fields.*/
-  int                       volt_range;
-  int                       bits;
-  int                    buffer_size;
+  /**
+   * @brief   Sample rate in Hz, each sample converts all the channels.
+   * @note    Zero selects @p PLATFORM_ADC_FREQUENCY.
+   */
+  uint32_t                  frequency;
+  /**
+   * @brief   Resolution of the generated samples in bits.
+   * @note    Zero selects @p PLATFORM_ADC_BITS.
+   */
+  uint8_t                   bits;
 } ADCConversionGroup;
 
 /**
@@ -186,11 +234,44 @@ struct ADCDriver {
   ADC_DRIVER_EXT_FIELDS
 #endif
   /* End of the mandatory fields.*/
-bool        toConvert;
-#if CONVERT
-float       *adc_val;
-float    *volt_input;
-#endif
+  /**
+   * @brief   Sampling thread.
+   */
+  Thread                    *thd;
+  /**
+   * @brief   Signalled at each conversion start and stop.
+   */
+  BinarySemaphore           kick;
+  /**
+   * @brief   Incremented at each conversion start and stop, tells the
+   *          sampling thread its conversion is over.
+   */
+  uint32_t                  session;
+  /**
+   * @brief   Half buffers delivered too late to be consumed.
+   */
+  uint32_t                  overruns;
+  /**
+   * @brief   Samples source.
+   */
+  adcsource_t               source;
+  /**
+   * @brief   Sine generator frequency in Hz.
+   */
+  uint32_t                  tone;
+  /**
+   * @brief   Mapped samples file.
+   */
+  const adcsample_t         *file;
+  /**
+   * @brief   Samples in the mapped file.
+   */
+  size_t                    file_size;
+  /**
+   * @brief   Samples converted in the current conversion, the position
+   *          of the generators.
+   */
+  uint32_t                  position;
 };
 
 /*===========================================================================*/
@@ -22,6 +22,10 @@
  * @{
  */
 
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
@@ -32,6 +36,23 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @brief   Injected events read at once.
+ */
+#define EXT_BATCH           256
+
+/**
+ * @brief   System time in microseconds, wrapping at 32 bits.
+ */
+#define EXT_NOW_US()                                                        \
+  ((uint32_t)((uint64_t)chTimeNow() * 1000000 / CH_FREQUENCY))
+
+/**
+ * @brief   Ticks to wait for @p us microseconds, rounded up.
+ */
+#define EXT_US2ST(us)                                                       \
+  ((systime_t)(((uint64_t)(us) * CH_FREQUENCY + 999999) / 1000000))
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -48,33 +69,180 @@ EXTDriver EXTD1;
 /*===========================================================================*/
 static WORKING_AREA(wsp, 128);
 static Thread *rthd;
+static EXTEvent batch[EXT_BATCH];
+
+static WORKING_AREA(pin_wsp, 128);
+static Thread *pin_thd;
 
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Raises the callbacks of the channels following changed pins.
+ * @note    Called inside the IRQ prologue.
+ *
+ * @param[in] extp      pointer to the @p EXTDriver object
+ * @param[in] port      index of the port in the bank
+ * @param[in] changed   pins that changed
+ * @param[in] pins      pins level
+ */
+static void ext_serve_pins(EXTDriver *extp, uint32_t port,
+                           uint32_t changed, uint32_t pins) {
+  const EXTChannelConfig *ccp;
+  expchannel_t channel;
+  uint32_t edge;
+
+  for (channel = 0; channel < EXT_MAX_CHANNELS; channel++) {
+    if (!(changed & (1U << channel)) || !extp->channelsEnabled[channel])
+      continue;
+    ccp = &extp->config->channels[channel];
+    edge = pins & (1U << channel) ? EXT_CH_MODE_RISING_EDGE :
+                                    EXT_CH_MODE_FALLING_EDGE;
+    if (ccp->cb != NULL && (ccp->mode & edge) &&
+        ((ccp->mode & EXT_MODE_GPIO_MASK) >> EXT_MODE_GPIO_OFF) == port)
+      ccp->cb(extp, channel);
+  }
+}
+
+/**
+ * @brief   Raises the callback of an injected event.
+ * @note    Called inside the IRQ prologue.
+ *
+ * @param[in] extp      pointer to the @p EXTDriver object
+ * @param[in] evp       the event, due now
+ */
+static void ext_serve_event(EXTDriver *extp, const EXTEvent *evp) {
+  const EXTChannelConfig *ccp = NULL;
+  EXTStats *stp = &extp->stats;
+  int64_t latency;
+
+  chSysLockFromIsr();
+  if (extp->state == EXT_ACTIVE && evp->channel < EXT_MAX_CHANNELS &&
+      extp->channelsEnabled[evp->channel]) {
+    ccp = &extp->config->channels[evp->channel];
+    if (ccp->cb == NULL || !(ccp->mode & evp->edge & EXT_CH_MODE_EDGES_MASK))
+      ccp = NULL;
+  }
+  if (ccp == NULL)
+    stp->dropped++;
+  else {
+    latency = (int32_t)(EXT_NOW_US() - evp->time);
+    if (stp->events == 0 || latency < stp->latency_min)
+      stp->latency_min = latency;
+    if (stp->events == 0 || latency > stp->latency_max)
+      stp->latency_max = latency;
+    stp->latency_sum += latency;
+    stp->events++;
+  }
+  chSysUnlockFromIsr();
+
+  if (ccp != NULL)
+    ccp->cb(extp, evp->channel);
+}
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Plays the events injected by the VHA.
+ * @details The VHA sends frames of @p EXTEvent records. The events are
+ *          dispatched in order, each one at the first tick not before
+ *          its timestamp, all the events due at a tick under a single
+ *          IRQ prologue.
+ */
 static msg_t read_thread(void *arg) {
   EXTDriver *extp = (EXTDriver*)arg;
-  uint8_t channel;
+  uint32_t arrival;
+  ssize_t nb, part;
+  unsigned i, n;
+  int32_t delta;
+
+  chRegSetThreadName("ext_inject");
   while (TRUE) {
-    int nb = sim_read(EXT_IO, &channel, sizeof channel);
+    nb = sim_read(EXT_IO, batch, sizeof batch);
     if (nb < 0) {
       /* don't spam errors too quickly */
       chThdSleep(S2ST(1));
+      continue;
+    }
+
+    /* a record split across frames */
+    part = nb % sizeof(EXTEvent);
+    if (part != 0) {
+      if (sim_read_exact(EXT_IO, (uint8_t*)batch + nb,
+                         sizeof(EXTEvent) - part) < 0)
+        continue;
+      nb += sizeof(EXTEvent) - part;
+    }
+    n = nb / sizeof(EXTEvent);
+
+    /* late when due before the current tick */
+    arrival = EXT_NOW_US() - 1000000 / CH_FREQUENCY;
+    chSysLock();
+    extp->stats.batches++;
+    for (i = 0; i < n; i++)
+      if ((int32_t)(batch[i].time - arrival) <= 0)
+        extp->stats.late++;
+    chSysUnlock();
+
+    for (i = 0; i < n; ) {
+      delta = (int32_t)(batch[i].time - EXT_NOW_US());
+      if (delta > 0)
+        chThdSleep(EXT_US2ST(delta));
+
+      CH_IRQ_PROLOGUE();
+      do {
+        ext_serve_event(extp, &batch[i++]);
+      } while (i < n && (int32_t)(batch[i].time - EXT_NOW_US()) <= 0);
+      CH_IRQ_EPILOGUE();
     }
-    else if (nb > 0) {
-      if (channel < EXT_MAX_CHANNELS
-          && extp->channelsEnabled[channel]
-          && extp->config->channels[channel].cb) {
-        CH_IRQ_PROLOGUE();
-        extp->config->channels[channel].cb(extp, channel);
-        CH_IRQ_EPILOGUE();
-      }
+  }
+  return 0;
+}
+
+/**
+ * @brief   Watches the input pins of the shared GPIO bank.
+ * @details Sleeps on the bank doorbell and raises the callbacks for
+ *          the inputs that changed since the last look. Pulses shorter
+ *          than a wakeup are not seen, only levels are shared.
+ */
+static msg_t pin_thread(void *arg) {
+  EXTDriver *extp = (EXTDriver*)arg;
+  struct pollfd pfd = { vio_bell, POLLIN, 0 };
+  uint32_t last[SIMGPIO_PORTS], pins, changed;
+  unsigned i;
+  char buf[64];
+
+  chRegSetThreadName("ext_pins");
+  for (i = 0; i < SIMGPIO_PORTS; i++)
+    last[i] = vio_bank.regs.port[i].pin;
+
+  while (TRUE) {
+    /* pairs with the test process writing pin before the doorbell */
+    __atomic_store_n(&vio_bank.regs.sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < SIMGPIO_PORTS; i++)
+      if (vio_bank.regs.port[i].pin != last[i])
+        break;
+    /* no wait slot left, the pins are polled every tick */
+    if (i == SIMGPIO_PORTS &&
+        port_wait_io(&pfd, 1, TIME_INFINITE) == RDY_RESET)
+      chThdSleep(1);
+    __atomic_store_n(&vio_bank.regs.sleeping, 0, __ATOMIC_RELAXED);
+    while (read(vio_bell, buf, sizeof buf) > 0)
+      ;
+
+    CH_IRQ_PROLOGUE();
+    for (i = 0; i < SIMGPIO_PORTS; i++) {
+      pins = vio_bank.regs.port[i].pin;
+      changed = (pins ^ last[i]) & ~vio_bank.regs.port[i].dir;
+      last[i] = pins;
+      if (changed && extp->state == EXT_ACTIVE)
+        ext_serve_pins(extp, i, changed, pins);
     }
+    CH_IRQ_EPILOGUE();
   }
   return 0;
 }
@@ -112,9 +280,22 @@ void ext_lld_start(EXTDriver *extp) {
     extp->state = EXT_ACTIVE;
     for (i = 0; i < EXT_MAX_CHANNELS; i++)
       extp->channelsEnabled[i] = TRUE;
+    memset(&extp->stats, 0, sizeof(extp->stats));
+
+    /* the threads are kept across stops */
+    if (rthd == NULL) {
+      rthd = chThdCreateI(wsp, sizeof(wsp), PLATFORM_EXT_THREAD_PRIORITY,
+                          read_thread, (void*)extp);
+      chSchWakeupS(rthd, RDY_OK);
+    }
 
-    rthd = chThdCreateI(wsp, sizeof(wsp), NORMALPRIO, read_thread, (void*)extp);
-    chSchWakeupS(rthd, RDY_OK);
+    /* input pins of a shared bank */
+    if (vio_bell >= 0 && pin_thd == NULL) {
+      pin_thd = chThdCreateI(pin_wsp, sizeof(pin_wsp),
+                             PLATFORM_EXT_THREAD_PRIORITY, pin_thread,
+                             (void*)extp);
+      chSchWakeupS(pin_thd, RDY_OK);
+    }
 
   }
 
@@ -130,10 +311,7 @@ void ext_lld_start(EXTDriver *extp) {
  */
 void ext_lld_stop(EXTDriver *extp) {
   if (extp->state == EXT_ACTIVE) {
-    /* Resets the peripheral.*/
-    sim_disconnect();
-
-    /* Disables the peripheral.*/
+    /* Disables the peripheral, events injected meanwhile are dropped.*/
     extp->state = EXT_STOP;
   }
 }
@@ -162,6 +340,21 @@ void ext_lld_channel_disable(EXTDriver *extp, expchannel_t channel) {
   extp->channelsEnabled[channel] = FALSE;
 }
 
+/**
+ * @brief   Copies the injected events statistics.
+ *
+ * @param[in] extp      pointer to the @p EXTDriver object
+ * @param[out] stp      the statistics
+ *
+ * @api
+ */
+void ext_lld_get_stats(EXTDriver *extp, EXTStats *stp) {
+
+  chSysLock();
+  *stp = extp->stats;
+  chSysUnlock();
+}
+
 #endif /* HAL_USE_EXT */
 
 /** @} */
@@ -38,6 +38,25 @@
  */
 #define EXT_MAX_CHANNELS    20
 
+/**
+ * @name    EXT channels mode
+ * @details Channel @p n follows pad @p n of the selected VIO port.
+ * @{
+ */
+#define EXT_MODE_GPIO_MASK  0xF0        /**< @brief Port field mask.    */
+#define EXT_MODE_GPIO_OFF   4           /**< @brief Port field offset.  */
+/** @} */
+
+/**
+ * @name    EXT channels port selection
+ * @{
+ */
+#define EXT_MODE_VIO1       0           /**< @brief IOPORT1 identifier. */
+#define EXT_MODE_VIO2       1           /**< @brief IOPORT2 identifier. */
+#define EXT_MODE_VIO3       2           /**< @brief IOPORT3 identifier. */
+#define EXT_MODE_VIO4       3           /**< @brief IOPORT4 identifier. */
+/** @} */
+
 /*===========================================================================*/
 /* Driver pre-compile time settings.                                         */
 /*===========================================================================*/
@@ -53,6 +72,15 @@
 #if !defined(PLATFORM_EXT_USE_EXT1) || defined(__DOXYGEN__)
 #define PLATFORM_EXT_USE_EXT1               TRUE
 #endif
+
+/**
+ * @brief   EXT threads priority.
+ * @details The threads playing the injected events and watching the
+ *          shared GPIO inputs stand for the interrupt sources.
+ */
+#if !defined(PLATFORM_EXT_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_EXT_THREAD_PRIORITY        (HIGHPRIO - 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -93,6 +121,37 @@ typedef struct {
   extcallback_t         cb;
 } EXTChannelConfig;
 
+/**
+ * @brief   Event injected by the VHA.
+ * @details The VHA sends frames holding any number of these records,
+ *          in host byte order.
+ */
+typedef struct {
+  uint32_t              time;       /**< System time of the edge, us,
+                                         wrapping at 32 bits.       */
+  uint16_t              channel;    /**< EXT channel.               */
+  uint16_t              edge;       /**< @p EXT_CH_MODE_RISING_EDGE or
+                                         @p EXT_CH_MODE_FALLING_EDGE. */
+} EXTEvent;
+
+/**
+ * @brief   Injected events statistics.
+ * @details The latency is the delay between an event timestamp and its
+ *          callback, in system time so it has the tick resolution,
+ *          cumulated since @p extStart().
+ */
+typedef struct {
+  uint32_t              batches;    /**< Frames received.           */
+  uint32_t              events;     /**< Callbacks invoked.         */
+  uint32_t              dropped;    /**< Events with no callback to
+                                         invoke.                    */
+  uint32_t              late;       /**< Events received after their
+                                         tick.                      */
+  int64_t               latency_min; /**< Lowest latency, us.       */
+  int64_t               latency_max; /**< Highest latency, us.      */
+  int64_t               latency_sum; /**< Latencies total, us.      */
+} EXTStats;
+
 /**
  * @brief   Driver configuration structure.
  * @note    It could be empty on some architectures.
@@ -120,6 +179,10 @@ struct EXTDriver {
   /* End of the mandatory fields.*/
 
   bool                      channelsEnabled[EXT_MAX_CHANNELS];
+  /**
+   * @brief Injected events statistics.
+   */
+  EXTStats                  stats;
 };
 
 /*===========================================================================*/
@@ -142,6 +205,7 @@ extern "C" {
   void ext_lld_stop(EXTDriver *extp);
   void ext_lld_channel_enable(EXTDriver *extp, expchannel_t channel);
   void ext_lld_channel_disable(EXTDriver *extp, expchannel_t channel);
+  void ext_lld_get_stats(EXTDriver *extp, EXTStats *stp);
 #ifdef __cplusplus
 }
 #endif
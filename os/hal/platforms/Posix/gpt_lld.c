@@ -22,8 +22,16 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
 #include "ch.h"
 #include "hal.h"
+#include "simutil.h"
 
 #if HAL_USE_GPT || defined(__DOXYGEN__)
 
@@ -31,9 +39,7 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
-/*Linux real time clock ID and signal*/
-#define CLOCKID CLOCK_REALTIME
-#define SIG SIGRTMIN
+#define GPT_NS_PER_S        1000000000LL
 
 /*===========================================================================*/
 /* Driver exported variables.                                                */
@@ -43,14 +49,14 @@
  * @brief   GPTD1 driver identifier.
  */
 #if POSIX_GPT_USE_GPT1 || defined(__DOXYGEN__)
-  GPTDriver GPTD1;
+GPTDriver GPTD1;
 #endif
 
 /**
  * @brief   GPTD2 driver identifier.
  */
 #if POSIX_GPT_USE_GPT2 || defined(__DOXYGEN__)
-  GPTDriver GPTD2;
+GPTDriver GPTD2;
 #endif
 
 /*===========================================================================*/
@@ -61,55 +67,129 @@
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
-/*
-* Error handling macro.
-*/ 
-#define errExit(msg)    do { perror(msg); exit(EXIT_FAILURE); \
-                               } while (0)
-/* 
-* This handler function deals with real time event signals that occur. 
-*/
-static void handler(int sig, siginfo_t *si, void *uc) {
-  printf("Caught signal %d\n", sig);
-  signal(sig, SIG_IGN);
-}
+/**
+ * @brief   Host monotonic time in nanoseconds.
+ *
+ * @notapi
+ */
+static int64_t gpt_host_ns(void) {
+  struct timespec ts;
 
-/*
-* This function establishes the declared handler for the signals. 
-*/
-void establish_sighandler(GPTDriver *gptp) {
-  printf("Establishing handler for signal %d\n", SIG);
-  gptp->sa.sa_flags = SA_SIGINFO;
-  gptp->sa.sa_sigaction = handler;
-  sigemptyset(&(gptp->sa.sa_mask));
-  if (sigaction(SIG, &(gptp->sa), NULL) == -1)
-    errExit("sigaction");
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * GPT_NS_PER_S + ts.tv_nsec;
 }
 
-/*
-* This function is used to block signals for safe handling.
-*/
-void block(GPTDriver *gptp) {
-  printf("Blocking signal %d\n", SIG);
-  sigemptyset(&(gptp->mask));
-  sigaddset(&(gptp->mask), SIG);
-  if (sigprocmask(SIG_BLOCK, &(gptp->mask), NULL) == -1)
-    errExit("sigprocmask");
+/**
+ * @brief   Converts timer ticks to nanoseconds.
+ *
+ * @param[in] gptp      pointer to the @p GPTDriver object
+ * @param[in] interval  time interval in ticks
+ *
+ * @notapi
+ */
+static int64_t gpt_ticks_ns(GPTDriver *gptp, gptcnt_t interval) {
+
+  return (int64_t)interval * GPT_NS_PER_S / gptp->config->frequency;
 }
 
-/*
-* This function is used to unblock signals for safe handling. 
-*/ 
-void unblock(GPTDriver *gptp) {
-  printf("Unblocking signal %d\n", SIG);
-  if (sigprocmask(SIG_UNBLOCK, &(gptp->mask), NULL) == -1)
-     errExit("sigprocmask");
+/**
+ * @brief   Programs the host timer.
+ *
+ * @param[in] gptp      pointer to the @p GPTDriver object
+ * @param[in] deadline  host time of the first expiry, zero to disarm
+ * @param[in] period    period in ns, zero for a single expiry
+ *
+ * @notapi
+ */
+static void gpt_arm(GPTDriver *gptp, int64_t deadline, int64_t period) {
+  struct itimerspec its;
+
+  /* the expirations not read yet are dropped */
+  its.it_value.tv_sec = deadline / GPT_NS_PER_S;
+  its.it_value.tv_nsec = deadline % GPT_NS_PER_S;
+  its.it_interval.tv_sec = period / GPT_NS_PER_S;
+  its.it_interval.tv_nsec = period % GPT_NS_PER_S;
+  if (timerfd_settime(gptp->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    eprintf("cannot program the GPT timer");
+    exit(EXIT_FAILURE);
+  }
 }
 
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Shared IRQ handler.
+ *
+ * @param[in] gptp      pointer to a @p GPTDriver object
+ */
+static void gpt_lld_serve_interrupt(GPTDriver *gptp) {
+  gptstate_t state;
+
+  chSysLockFromIsr();
+  state = gptp->state;
+  if (state == GPT_ONESHOT) {
+    gptp->state = GPT_READY;                /* Back in GPT_READY state.     */
+    gpt_lld_stop_timer(gptp);               /* Timer automatically stopped. */
+  }
+  chSysUnlockFromIsr();
+
+  /* stopped meanwhile */
+  if (state != GPT_ONESHOT && state != GPT_CONTINUOUS)
+    return;
+  if (gptp->config->callback != NULL)
+    gptp->config->callback(gptp);
+}
+
+/**
+ * @brief   Timer thread, plays the part of the interrupt controller.
+ * @details Sleeps on the host timer through the port I/O wait, so the
+ *          idle thread wakes at the expiry instead of the next system
+ *          tick, and serves each expiry as an interrupt. Expiries
+ *          coalesced by a busy system count as missed periods.
+ */
+static msg_t timer_thread(void *arg) {
+  GPTDriver *gptp = (GPTDriver*)arg;
+  struct pollfd pfd = {gptp->fd, POLLIN, 0};
+  GPTStats *stp = &gptp->stats;
+  uint64_t expirations;
+  int64_t jitter;
+
+  chRegSetThreadName("gpt_timer");
+  while (TRUE) {
+    /* no wait slot left, the timer is polled every tick */
+    if (port_wait_io(&pfd, 1, TIME_INFINITE) == RDY_RESET)
+      chThdSleep(1);
+
+    /* nothing to read when stopped or rearmed meanwhile */
+    if (read(gptp->fd, &expirations, sizeof expirations) !=
+        sizeof expirations)
+      continue;
+
+    CH_IRQ_PROLOGUE();
+
+    chSysLockFromIsr();
+    gptp->deadline += (int64_t)(expirations - 1) * gptp->period;
+    jitter = gpt_host_ns() - gptp->deadline;
+    gptp->deadline += gptp->period;
+    if (stp->callbacks == 0 || jitter < stp->jitter_min)
+      stp->jitter_min = jitter;
+    if (stp->callbacks == 0 || jitter > stp->jitter_max)
+      stp->jitter_max = jitter;
+    stp->jitter_sum += jitter;
+    stp->callbacks++;
+    stp->missed += (uint32_t)(expirations - 1);
+    chSysUnlockFromIsr();
+
+    gpt_lld_serve_interrupt(gptp);
+
+    CH_IRQ_EPILOGUE();
+  }
+
+  return 0;
+}
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
@@ -125,10 +205,14 @@ void gpt_lld_init(void) {
 #if POSIX_GPT_USE_GPT1
   /* Driver initialization.*/
   gptObjectInit(&GPTD1);
+  GPTD1.fd = -1;
+  GPTD1.thd = NULL;
 #endif
 #if POSIX_GPT_USE_GPT2
   /* Driver initialization.*/
   gptObjectInit(&GPTD2);
+  GPTD2.fd = -1;
+  GPTD2.thd = NULL;
 #endif
 }
 
@@ -140,19 +224,26 @@ void gpt_lld_init(void) {
  * @notapi
  */
 void gpt_lld_start(GPTDriver *gptp) {
-  
-  if (gptp->state == GPT_STOP) {
-    /* Enables the peripheral.*/
-    /* Configures the peripheral.*/
-    block(gptp);
-    establish_sighandler(gptp);
-    gptp->sev.sigev_notify = SIGEV_SIGNAL;
-    gptp->sev.sigev_signo = SIG;
-    gptp->sev.sigev_value.sival_ptr = &(gptp->timerid);
-    if (timer_create(CLOCKID, &(gptp->sev), &(gptp->timerid)) == -1) 
-      errExit("timer_create");
+
+  chDbgAssert(gptp->config->frequency > 0 &&
+              gptp->config->frequency <= GPT_NS_PER_S,
+              "gpt_lld_start(), #1", "invalid frequency");
+
+  /* the host timer and its thread are created once and kept across stops */
+  if (gptp->fd < 0) {
+    gptp->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (gptp->fd < 0) {
+      eprintf("cannot create the GPT timer");
+      exit(EXIT_FAILURE);
+    }
+    gptp->thd = chThdCreateI(gptp->wa, sizeof(gptp->wa),
+                             POSIX_GPT_THREAD_PRIORITY, timer_thread,
+                             (void*)gptp);
+    chSchWakeupS(gptp->thd, RDY_OK);
   }
+  memset(&gptp->stats, 0, sizeof(gptp->stats));
 }
+
 /**
  * @brief   Deactivates the GPT peripheral.
  *
@@ -161,16 +252,14 @@ void gpt_lld_start(GPTDriver *gptp) {
  * @notapi
  */
 void gpt_lld_stop(GPTDriver *gptp) {
-  
-  if (gptp->state == GPT_READY) {
-    /* Resets the peripheral.*/
-    /* Disables the peripheral.*/
-      timer_delete((&gptp->timerid));
-  }
+
+  if (gptp->state == GPT_READY)
+    gpt_arm(gptp, 0, 0);
 }
 
 /**
- * @brief   Starts the timer in continuous mode.
+ * @brief   Starts the timer.
+ * @details The mode, one shot or continuous, is the driver state.
  *
  * @param[in] gptp      pointer to the @p GPTDriver object
  * @param[in] interval  period in ticks
@@ -178,23 +267,11 @@ void gpt_lld_stop(GPTDriver *gptp) {
  * @notapi
  */
 void gpt_lld_start_timer(GPTDriver *gptp, gptcnt_t interval) {
+  int64_t ns = gpt_ticks_ns(gptp, interval);
 
-  unblock(gptp);
-  establish_sighandler(gptp);
-  gptp->sev.sigev_notify = SIGEV_SIGNAL;
-  gptp->sev.sigev_signo = SIG;
-  gptp->sev.sigev_value.sival_ptr = &(gptp->timerid);
-  gptp->freq_nanosecs = (double)interval;
-  printf("freq_nanosecs: %d\n", interval);
-  gptp->its.it_value.tv_sec = ((double)interval) / (double)CH_FREQUENCY;
-  printf("tv_sec: %d\n", gptp->its.it_value.tv_sec);
-  gptp->its.it_value.tv_nsec = ((double)interval / CH_FREQUENCY) * 100000000;
-  printf("tv_nsec: %d\n", gptp->its.it_value.tv_nsec);
-  gptp->its.it_interval.tv_sec = gptp->its.it_value.tv_sec;
-  gptp->its.it_interval.tv_nsec = gptp->its.it_value.tv_nsec;
-  
-  if (timer_settime(gptp->timerid, 0, &(gptp->its), NULL) == -1)
-    errExit("timer_settime: start_timer");
+  gptp->period = gptp->state == GPT_CONTINUOUS ? ns : 0;
+  gptp->deadline = gpt_host_ns() + ns;
+  gpt_arm(gptp, gptp->deadline, gptp->period);
 }
 
 /**
@@ -206,16 +283,27 @@ void gpt_lld_start_timer(GPTDriver *gptp, gptcnt_t interval) {
  */
 void gpt_lld_stop_timer(GPTDriver *gptp) {
 
-  (void)gptp;
-  block(gptp);
-  gptp->freq_nanosecs = 0;
-  gptp->its.it_value.tv_sec = 0;
-  gptp->its.it_value.tv_nsec = 0;
-  gptp->its.it_interval.tv_sec = gptp->its.it_value.tv_sec;
-  gptp->its.it_interval.tv_nsec = gptp->its.it_value.tv_nsec;
-  
-  if (timer_settime(gptp->timerid, 0, &(gptp->its), NULL) == -1)
-    errExit("timer_settime: stop_timer");
+  gpt_arm(gptp, 0, 0);
+}
+
+/**
+ * @brief   Changes the interval of GPT peripheral.
+ * @details This function changes the interval of a running GPT unit.
+ * @pre     The GPT unit must have been activated using @p gptStart().
+ * @pre     The GPT unit must have been running in continuous mode using
+ *          @p gptStartContinuous().
+ * @post    The GPT unit interval is changed to the new value.
+ * @note    The function has effect at the next cycle start.
+ *
+ * @param[in] gptp      pointer to a @p GPTDriver object
+ * @param[in] interval  new cycle time in timer ticks
+ *
+ * @notapi
+ */
+void gpt_lld_change_interval(GPTDriver *gptp, gptcnt_t interval) {
+
+  gptp->period = gpt_ticks_ns(gptp, interval);
+  gpt_arm(gptp, gptp->deadline, gptp->period);
 }
 
 /**
@@ -223,6 +311,8 @@ void gpt_lld_stop_timer(GPTDriver *gptp) {
  * @details This function specifically polls the timer waiting for completion
  *          in order to not have extra delays caused by interrupt servicing,
  *          this function is only recommended for short delays.
+ * @note    The host clock is polled, the delay can be well below the
+ *          system tick.
  *
  * @param[in] gptp      pointer to the @p GPTDriver object
  * @param[in] interval  time interval in ticks
@@ -230,12 +320,25 @@ void gpt_lld_stop_timer(GPTDriver *gptp) {
  * @notapi
  */
 void gpt_lld_polled_delay(GPTDriver *gptp, gptcnt_t interval) {
+  int64_t deadline = gpt_host_ns() + gpt_ticks_ns(gptp, interval);
+
+  while (gpt_host_ns() < deadline)
+    ;
+}
+
+/**
+ * @brief   Copies the callback timing statistics.
+ *
+ * @param[in] gptp      pointer to the @p GPTDriver object
+ * @param[out] stp      the statistics
+ *
+ * @api
+ */
+void gpt_lld_get_stats(GPTDriver *gptp, GPTStats *stp) {
 
-  (void)gptp;
-  (void)interval;
-  block(gptp);
-  chThdSleepMilliseconds(interval);
-  unblock(gptp);
+  chSysLock();
+  *stp = gptp->stats;
+  chSysUnlock();
 }
 
 #endif /* HAL_USE_GPT */
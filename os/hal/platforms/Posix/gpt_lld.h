@@ -25,32 +25,12 @@
 #ifndef _GPT_LLD_H_
 #define _GPT_LLD_H_
 
-/*#include <sys/types.h>
-#include <stdlib.h>       
-#include <stdio.h>       
-#include <sys/time.h>
-#include <sys/times.h>
-#include <signal.h>
-#include <unistd.h>
-#include "ch.h"
-#include "hal.h"*/
-
-#include <sys/types.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <signal.h>
-#include <time.h>
-
 #if HAL_USE_GPT || defined(__DOXYGEN__)
 
 /*===========================================================================*/
 /* Driver constants.                                                         */
 /*===========================================================================*/
 
-/* Linux real time clock ID and signal */
-#define CLOCKID CLOCK_REALTIME
-#define SIG SIGRTMIN
-
 /*===========================================================================*/
 /* Driver pre-compile time settings.                                         */
 /*===========================================================================*/
@@ -78,6 +58,15 @@
 #if !defined(POSIX_GPT_USE_GPT2) || defined(__DOXYGEN__)
 #define POSIX_GPT_USE_GPT2                  TRUE
 #endif
+
+/**
+ * @brief   Timer threads priority.
+ * @note    The threads play the part of the interrupt controller, they
+ *          must run ahead of the application threads.
+ */
+#if !defined(POSIX_GPT_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define POSIX_GPT_THREAD_PRIORITY           (HIGHPRIO - 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -117,6 +106,20 @@ typedef struct {
   /* End of the mandatory fields.*/
 } GPTConfig;
 
+/**
+ * @brief   Callback timing statistics.
+ * @details The jitter is the delay between the host timer expiry and
+ *          the callback, cumulated since @p gptStart().
+ */
+typedef struct {
+  uint32_t                  callbacks;      /**< Callbacks invoked.         */
+  uint32_t                  missed;         /**< Periods lost, continuous
+                                                 mode only.                 */
+  int64_t                   jitter_min;     /**< Lowest jitter, ns.         */
+  int64_t                   jitter_max;     /**< Highest jitter, ns.        */
+  int64_t                   jitter_sum;     /**< Jitters total, ns.         */
+} GPTStats;
+
 /**
  * @brief   Structure representing a GPT driver.
  */
@@ -133,44 +136,33 @@ struct GPTDriver {
   GPT_DRIVER_EXT_FIELDS
 #endif
   /* End of the mandatory fields.*/
-  
-/* Timer ID for current GPTD */
-  timer_t timerid;
-
-/* Current signal value */ 
-  struct sigevent sev;
-
-/* Interval timer value */
-  struct itimerspec its;
-
-/* Other struct variables to help set sigevent and itimerspec */
-  long long freq_nanosecs;
-  sigset_t mask;
-  struct sigaction sa;
+  /**
+   * @brief   Host timer, a timerfd on the monotonic clock.
+   */
+  int                       fd;
+  /**
+   * @brief   Period in continuous mode, ns.
+   */
+  int64_t                   period;
+  /**
+   * @brief   Host time of the next expiry, ns.
+   */
+  int64_t                   deadline;
+  /**
+   * @brief   Callback timing statistics.
+   */
+  GPTStats                  stats;
+  /**
+   * @brief   Thread serving the host timer.
+   */
+  Thread                    *thd;
+  WORKING_AREA(wa, 256);
 };
 
 /*===========================================================================*/
 /* Driver macros.                                                            */
 /*===========================================================================*/
 
-/**
- * @brief   Changes the interval of GPT peripheral.
- * @details This function changes the interval of a running GPT unit.
- * @pre     The GPT unit must have been activated using @p gptStart().
- * @pre     The GPT unit must have been running in continuous mode using
- *          @p gptStartContinuous().
- * @post    The GPT unit interval is changed to the new value.
- * @note    The function has effect at the next cycle start.
- *
- * @param[in] gptp      pointer to a @p GPTDriver object
- * @param[in] interval  new cycle time in timer ticks
- * @notapi
- */
-#define gpt_lld_change_interval(gptp, interval) {                           \
-  (void)gptp;                                                               \
-  (void)interval;                                                           \
-}
-
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
@@ -191,7 +183,9 @@ extern "C" {
   void gpt_lld_stop(GPTDriver *gptp);
   void gpt_lld_start_timer(GPTDriver *gptp, gptcnt_t period);
   void gpt_lld_stop_timer(GPTDriver *gptp);
+  void gpt_lld_change_interval(GPTDriver *gptp, gptcnt_t interval);
   void gpt_lld_polled_delay(GPTDriver *gptp, gptcnt_t interval);
+  void gpt_lld_get_stats(GPTDriver *gptp, GPTStats *stp);
 #ifdef __cplusplus
 }
 #endif
@@ -22,19 +22,26 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
+#include "simutil.h"
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
 #if HAL_USE_I2C || defined(__DOXYGEN__)
 
 /*===========================================================================*/
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @brief   Nanoseconds in a system tick.
+ */
+#define I2C_TICK_NS         (1000000000U / CH_FREQUENCY)
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -49,19 +56,302 @@ I2CDriver I2CD1;
 /*===========================================================================*/
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
- buffer_stream bs_1;
+static WORKING_AREA(wsp, 256);
+
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Memory model start condition.
+ */
+static bool_t mem_start(I2CModel *mp, bool_t read) {
+  I2CMemModel *mmp = (I2CMemModel*)mp;
+
+  /* no answer during the write cycle, the master polls for the ACK */
+  if (mmp->busy && chTimeNow() - mmp->write_start < mmp->write_time)
+    return FALSE;
+  mmp->busy = FALSE;
+  if (!read)
+    mmp->addr_seen = 0;
+  return TRUE;
+}
 
+/**
+ * @brief   Memory model byte write.
+ */
+static bool_t mem_write(I2CModel *mp, uint8_t b) {
+  I2CMemModel *mmp = (I2CMemModel*)mp;
+
+  if (mmp->addr_seen < mmp->addr_bytes) {
+    if (mmp->addr_seen++ == 0)
+      mmp->ptr = 0;
+    mmp->ptr = ((mmp->ptr << 8) | b) % mmp->size;
+    return TRUE;
+  }
+  mmp->mem[mmp->ptr] = b;
+  mmp->written = TRUE;
+  if (mmp->page != 0)
+    mmp->ptr = mmp->ptr - mmp->ptr % mmp->page +
+               (mmp->ptr + 1) % mmp->page;
+  else
+    mmp->ptr = (mmp->ptr + 1) % mmp->size;
+  return TRUE;
+}
+
+/**
+ * @brief   Memory model byte read.
+ */
+static uint8_t mem_read(I2CModel *mp) {
+  I2CMemModel *mmp = (I2CMemModel*)mp;
+  uint8_t b = mmp->mem[mmp->ptr];
+
+  mmp->ptr = (mmp->ptr + 1) % mmp->size;
+  return b;
+}
+
+/**
+ * @brief   Memory model stop condition, starts the write cycle.
+ */
+static void mem_stop(I2CModel *mp) {
+  I2CMemModel *mmp = (I2CMemModel*)mp;
+
+  if (mmp->written && mmp->write_time != 0) {
+    mmp->busy = TRUE;
+    mmp->write_start = chTimeNow();
+  }
+  mmp->written = FALSE;
+}
+
+/**
+ * @brief   Carries out a transfer with an in-process model.
+ * @details The transfer stops at the first NACK, as the master would.
+ *
+ * @param[in] mp        the model
+ * @param[in] txbuf     pointer to the transmit buffer
+ * @param[in] txbytes   number of bytes to be transmitted
+ * @param[out] rxbuf    pointer to the receive buffer
+ * @param[in] rxbytes   number of bytes to be received
+ * @param[out] bits     bits clocked on the bus
+ *
+ * @return              FALSE on a NACK.
+ *
+ * @notapi
+ */
+static bool_t i2c_model_transfer(I2CModel *mp,
+                                 const uint8_t *txbuf, size_t txbytes,
+                                 uint8_t *rxbuf, size_t rxbytes,
+                                 uint32_t *bits) {
+  bool_t ack = TRUE;
+  size_t i;
+
+  /* start and stop, 9 clocks a byte with its acknowledge */
+  *bits = 2;
+  if (txbytes > 0) {
+    *bits += 9;
+    ack = mp->start(mp, FALSE);
+    for (i = 0; ack && i < txbytes; i++) {
+      *bits += 9;
+      ack = mp->write(mp, txbuf[i]);
+    }
+  }
+  if (ack && rxbytes > 0) {
+    /* a repeated start after the transmit phase */
+    *bits += txbytes > 0 ? 10 : 9;
+    ack = mp->start(mp, TRUE);
+    for (i = 0; ack && i < rxbytes; i++) {
+      *bits += 9;
+      rxbuf[i] = mp->read(mp);
+    }
+  }
+  mp->stop(mp);
+  return ack;
+}
 
+/**
+ * @brief   Posts a transfer to the VHA and waits for its end.
+ * @details The frame is the line "transfer <addr> <txbytes> <rxbytes>"
+ *          followed by the data to be transmitted. The VHA replies with
+ *          a status byte, zero for an ACK, and the received data.
+ * @note    A request left by a caller that timed out before the transfer
+ *          thread took it is replaced.
+ *
+ * @param[in] i2cp      pointer to the @p I2CDriver object
+ * @param[in] txbuf     pointer to the transmit buffer
+ * @param[in] txbytes   number of bytes to be transmitted
+ * @param[out] rxbuf    pointer to the receive buffer
+ * @param[in] rxbytes   number of bytes to be received
+ * @param[in] timeout   the number of ticks before the operation timeouts
+ *
+ * @return              The operation status.
+ *
+ * @notapi
+ */
+static msg_t i2c_vha_transfer(I2CDriver *i2cp,
+                              const uint8_t *txbuf, size_t txbytes,
+                              uint8_t *rxbuf, size_t rxbytes,
+                              systime_t timeout) {
+  char line[64];
+  size_t n;
+  msg_t msg;
+
+  /* the frame is owned by the transfer thread, the caller may time out */
+  if (i2cp->frame != NULL)
+    free(i2cp->frame);
+  n = sprintf(line, "transfer %u %u %u\n", (unsigned)i2cp->addr,
+              (unsigned)txbytes, (unsigned)rxbytes);
+  i2cp->frame = malloc(n + txbytes);
+  chDbgAssert(i2cp->frame != NULL, "i2c_vha_transfer(), #1", "out of memory");
+  memcpy(i2cp->frame, line, n);
+  if (txbytes > 0)
+    memcpy(i2cp->frame + n, txbuf, txbytes);
+  i2cp->framesize = n + txbytes;
+  i2cp->rxbuf = rxbuf;
+  i2cp->rxbytes = rxbytes;
+  i2cp->seq++;
+
+  i2cp->thread = chThdSelf();
+  chBSemSignalI(&i2cp->request);
+  msg = chSchGoSleepTimeoutS(THD_STATE_SUSPENDED, timeout);
+  i2cp->thread = NULL;
+  return msg;
+}
+
+/**
+ * @brief   Carries out a transfer.
+ * @details The transfers to an attached model complete in-process, the
+ *          others go to the VHA. Either way the caller is then delayed
+ *          by the time of the transfer on the bus.
+ *
+ * @param[in] i2cp      pointer to the @p I2CDriver object
+ * @param[in] addr      slave device address
+ * @param[in] txbuf     pointer to the transmit buffer
+ * @param[in] txbytes   number of bytes to be transmitted
+ * @param[out] rxbuf    pointer to the receive buffer
+ * @param[in] rxbytes   number of bytes to be received
+ * @param[in] timeout   the number of ticks before the operation timeouts
+ *
+ * @return              The operation status.
+ *
+ * @notapi
+ */
+static msg_t i2c_transfer(I2CDriver *i2cp, i2caddr_t addr,
+                          const uint8_t *txbuf, size_t txbytes,
+                          uint8_t *rxbuf, size_t rxbytes,
+                          systime_t timeout) {
+  I2CModel *mp;
+  uint32_t bits;
+  uint64_t ns;
+  systime_t ticks;
+  msg_t msg;
+
+  chDbgCheck(addr <= 0x7F, "i2c_transfer");
+
+  i2cp->addr = addr;
+  i2cp->errors = 0;
+  for (mp = i2cp->models; mp != NULL && mp->addr != addr; mp = mp->next)
+    ;
+  if (mp != NULL) {
+    msg = i2c_model_transfer(mp, txbuf, txbytes, rxbuf, rxbytes, &bits) ?
+          RDY_OK : RDY_RESET;
+  }
+  else {
+    msg = i2c_vha_transfer(i2cp, txbuf, txbytes, rxbuf, rxbytes, timeout);
+    bits = 2 + 9 * (txbytes + rxbytes + (txbytes > 0) + (rxbytes > 0)) +
+           (txbytes > 0 && rxbytes > 0);
+  }
+  if (msg == RDY_RESET && i2cp->errors == I2CD_NO_ERROR)
+    i2cp->errors |= I2CD_ACK_FAILURE;
+  if (msg == RDY_TIMEOUT || i2cp->config->clock == 0)
+    return msg;
+
+  /* the bus time, the fractions of tick carried over to the next transfer */
+  ns = i2cp->bus_ns + (uint64_t)bits * 1000000000 / i2cp->config->clock;
+  ticks = (systime_t)(ns / I2C_TICK_NS);
+  i2cp->bus_ns = (uint32_t)(ns % I2C_TICK_NS);
+  if (ticks > 0) {
+    if (timeout != TIME_INFINITE && ticks > timeout) {
+      chThdSleepS(timeout);
+      return RDY_TIMEOUT;
+    }
+    chThdSleepS(ticks);
+  }
+  return msg;
+}
 
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief   Transfer thread, serves the transfers to the VHA.
+ * @details The transfer functions run with the kernel locked and only
+ *          post the transfer. This thread talks to the VHA with the
+ *          kernel unlocked and wakes the caller as an interrupt would.
+ *          The request is taken whole when served and its reply goes to
+ *          its own caller only, the reply of a caller that timed out is
+ *          dropped. A failed exchange with the VHA is a bus error.
+ */
+static msg_t transfer_thread(void *arg) {
+  I2CDriver *i2cp = (I2CDriver*)arg;
+  uint8_t *frame, *rxbuf, *reply;
+  size_t framesize, rxbytes;
+  uint32_t seq;
+  ssize_t nb;
+  bool_t ok;
+  Thread *tp;
+
+  chRegSetThreadName("i2c_transfer");
+  while (TRUE) {
+    chBSemWait(&i2cp->request);
+
+    chSysLock();
+    frame = i2cp->frame;
+    framesize = i2cp->framesize;
+    rxbuf = i2cp->rxbuf;
+    rxbytes = i2cp->rxbytes;
+    seq = i2cp->seq;
+    i2cp->frame = NULL;
+    chSysUnlock();
+
+    reply = malloc(1 + rxbytes);
+    chDbgAssert(reply != NULL, "transfer_thread(), #1", "out of memory");
+    ok = sim_write(I2C_IO, frame, framesize) == (ssize_t)framesize;
+    free(frame);
+    if (!ok)
+      eprintf("I2C send of %u bytes failed", (unsigned)framesize);
+    else if ((nb = sim_read_exact(I2C_IO, reply, 1 + rxbytes)) !=
+             (ssize_t)(1 + rxbytes)) {
+      eprintf("I2C receive got %d of %u bytes", (int)nb,
+              (unsigned)(1 + rxbytes));
+      ok = FALSE;
+    }
+
+    CH_IRQ_PROLOGUE();
+    chSysLockFromIsr();
+    /* nothing to do if the caller timed out */
+    if ((tp = i2cp->thread) != NULL && i2cp->seq == seq) {
+      i2cp->thread = NULL;
+      if (!ok)
+        i2cp->errors |= I2CD_BUS_ERROR;
+      else if (reply[0] == 0)
+        memcpy(rxbuf, reply + 1, rxbytes);
+      tp->p_u.rdymsg = ok && reply[0] == 0 ? RDY_OK : RDY_RESET;
+      chSchReadyI(tp);
+    }
+    chSysUnlockFromIsr();
+    CH_IRQ_EPILOGUE();
+
+    free(reply);
+  }
+
+  return 0;
+}
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
+
 /**
  * @brief   Low level I2C driver initialization.
  *
@@ -71,6 +361,12 @@ void i2c_lld_init(void) {
 
 #if PLATFORM_I2C_USE_I2C1
   i2cObjectInit(&I2CD1);
+  I2CD1.thread = NULL;
+  I2CD1.models = NULL;
+  I2CD1.thd = NULL;
+  I2CD1.frame = NULL;
+  I2CD1.seq = 0;
+  chBSemInit(&I2CD1.request, TRUE);
 #endif /* PLATFORM_I2C_USE_I2C1 */
 }
 
@@ -83,16 +379,14 @@ void i2c_lld_init(void) {
  */
 void i2c_lld_start(I2CDriver *i2cp) {
 
-  if (i2cp->state == I2C_STOP) {
-    /* Enables the peripheral.*/
-#if PLATFORM_I2C_USE_I2C1
-     if (&I2CD1 == i2cp) {
+  i2cp->bus_ns = 0;
 
-    }
-#endif /* PLATFORM_I2C_USE_I2C1 */
+  /* the transfer thread is created once and kept across stops */
+  if (i2cp->thd == NULL) {
+    i2cp->thd = chThdCreateI(wsp, sizeof(wsp), PLATFORM_I2C_THREAD_PRIORITY,
+                             transfer_thread, (void*)i2cp);
+    chSchWakeupS(i2cp->thd, RDY_OK);
   }
-  /* Configures the peripheral.*/
-
 }
 
 /**
@@ -103,22 +397,11 @@ void i2c_lld_start(I2CDriver *i2cp) {
  * @notapi
  */
 void i2c_lld_stop(I2CDriver *i2cp) {
-
-  if (i2cp->state != I2C_STOP) {
-    /* Resets the peripheral.*/
-    /* Disables the peripheral.*/
-#if PLATFORM_I2C_USE_I2C1
-    if (&I2CD1 == i2cp) {
-
-    }
-#endif /* PLATFORM_I2C_USE_I2C1 */
-  }
+  (void)i2cp;
 }
 
 /**
  * @brief   Receives data via the I2C bus as master.
- * @details Number of receiving bytes must be more than 1 on STM32F1x. This is
- *          hardware restriction.
  *
  * @param[in] i2cp      pointer to the @p I2CDriver object
  * @param[in] addr      slave device address
@@ -142,23 +425,13 @@ msg_t i2c_lld_master_receive_timeout(I2CDriver *i2cp, i2caddr_t addr,
                                      uint8_t *rxbuf, size_t rxbytes,
                                      systime_t timeout) {
 
-   chDbgCheck((rxbytes > 1), "i2c_lld_master_recive_timeout");
-
-   i2cp->addr = addr << 1;
-   i2cp->errors = 0;
-
-   sim_read_timeout(I2C_IO, (void*)rxbuf, rxbytes,timeout);
-   printf("in Recieve\n");
-
-
-  return RDY_TIMEOUT;
-
+  return i2c_transfer(i2cp, addr, NULL, 0, rxbuf, rxbytes, timeout);
 }
 
 /**
  * @brief   Transmits data via the I2C bus as master.
- * @details Number of receiving bytes must be 0 or more than 1 on STM32F1x.
- *          This is hardware restriction.
+ * @details With a receive phase the data is received after a repeated
+ *          start, without releasing the bus.
  *
  * @param[in] i2cp      pointer to the @p I2CDriver object
  * @param[in] addr      slave device address
@@ -185,17 +458,80 @@ msg_t i2c_lld_master_transmit_timeout(I2CDriver *i2cp, i2caddr_t addr,
                                       uint8_t *rxbuf, size_t rxbytes,
                                       systime_t timeout) {
 
+  return i2c_transfer(i2cp, addr, txbuf, txbytes, rxbuf, rxbytes, timeout);
+}
 
+/**
+ * @brief   Attaches a device model to the bus.
+ * @details The transfers to the model address are served in-process
+ *          from then on.
+ *
+ * @param[in] i2cp      pointer to the @p I2CDriver object
+ * @param[in] mp        the model
+ *
+ * @api
+ */
+void i2c_lld_attach(I2CDriver *i2cp, I2CModel *mp) {
 
-   i2cp->addr = addr << 1;
-   i2cp->errors = 0;
-   sim_read_timeout(I2C_IO, (void*)rxbuf, rxbytes, timeout);
-   printf("in Recieve2\n");
+  chDbgCheck(mp->addr <= 0x7F, "i2c_lld_attach");
 
-   sim_write(I2C_IO, (void*)txbuf, txbytes);
+  chSysLock();
+  mp->next = i2cp->models;
+  i2cp->models = mp;
+  chSysUnlock();
+}
 
-  return RDY_TIMEOUT;
+/**
+ * @brief   Detaches a device model from the bus.
+ *
+ * @param[in] i2cp      pointer to the @p I2CDriver object
+ * @param[in] mp        the model
+ *
+ * @api
+ */
+void i2c_lld_detach(I2CDriver *i2cp, I2CModel *mp) {
+  I2CModel **mpp;
+
+  chSysLock();
+  for (mpp = &i2cp->models; *mpp != NULL; mpp = &(*mpp)->next)
+    if (*mpp == mp) {
+      *mpp = mp->next;
+      break;
+    }
+  chSysUnlock();
+}
 
+/**
+ * @brief   Initializes a memory device model.
+ *
+ * @param[out] mmp      the model
+ * @param[in] addr      7 bits address
+ * @param[in] mem       device contents
+ * @param[in] size      device size in bytes
+ * @param[in] addr_bytes address bytes, 1 for a register map, 2 for large
+ *                      EEPROMs
+ * @param[in] page      writes wrap within pages of this size, 0 for none
+ * @param[in] write_time write cycle in ticks, 0 for none
+ *
+ * @api
+ */
+void i2c_lld_mem_init(I2CMemModel *mmp, i2caddr_t addr,
+                      uint8_t *mem, size_t size, uint8_t addr_bytes,
+                      size_t page, systime_t write_time) {
+
+  chDbgCheck((size > 0) && (addr_bytes > 0), "i2c_lld_mem_init");
+
+  memset(mmp, 0, sizeof(*mmp));
+  mmp->model.addr = addr;
+  mmp->model.start = mem_start;
+  mmp->model.write = mem_write;
+  mmp->model.read = mem_read;
+  mmp->model.stop = mem_stop;
+  mmp->mem = mem;
+  mmp->size = size;
+  mmp->addr_bytes = addr_bytes;
+  mmp->page = page;
+  mmp->write_time = write_time;
 }
 
 #endif /* HAL_USE_I2C */
@@ -47,12 +47,18 @@
 #if !defined(PLATFORM_I2C_USE_I2C1) || defined(__DOXYGEN__)
 #define PLATFORM_I2C_USE_I2C1               TRUE
 #endif
+
+/**
+ * @brief   VHA transfers thread priority.
+ */
+#if !defined(PLATFORM_I2C_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_I2C_THREAD_PRIORITY        (NORMALPRIO + 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
-#define SIZE 10000
 /*===========================================================================*/
 /* Driver data structures and types.                                         */
 /*===========================================================================*/
@@ -88,17 +94,95 @@ typedef enum{
  */
 typedef struct {
   i2copmode_t mode;
+  /**
+   * @brief   Bus clock in Hz, the transfers take the time of their bits
+   *          on the bus. Zero for transfers taking no time.
+   */
   uint32_t                  clock;
   i2cdutycycle_t duty_cycle; 
 
 } I2CConfig;
 
+/**
+ * @brief   Type of a structure representing an I2C device model.
+ */
+typedef struct I2CModel I2CModel;
+
+/**
+ * @brief   I2C device model.
+ * @details A model attached to the bus serves the transfers to its
+ *          address in-process, the others go to the VHA. The hooks
+ *          follow the bus conditions and run with the kernel locked,
+ *          as an interrupt handler would.
+ */
+struct I2CModel {
+  /**
+   * @brief   Next model on the bus.
+   */
+  I2CModel                  *next;
+  /**
+   * @brief   7 bits address.
+   */
+  i2caddr_t                 addr;
+  /**
+   * @brief   Start or repeated start addressing the device.
+   * @return                FALSE to NACK the address.
+   */
+  bool_t                    (*start)(I2CModel *mp, bool_t read);
+  /**
+   * @brief   Byte written by the master.
+   * @return                FALSE to NACK the byte.
+   */
+  bool_t                    (*write)(I2CModel *mp, uint8_t b);
+  /**
+   * @brief   Byte read by the master.
+   */
+  uint8_t                   (*read)(I2CModel *mp);
+  /**
+   * @brief   Stop condition.
+   */
+  void                      (*stop)(I2CModel *mp);
+};
+
+/**
+ * @brief   Memory device model, a register map or an EEPROM.
+ * @details The first bytes written set the address, the next ones are
+ *          stored, reads go on from the address. The address survives
+ *          a repeated start, so a write of the address followed by a
+ *          read is a register read.
+ */
 typedef struct {
-    uint8_t *rxbuffer;
-    const uint8_t *txbuffer;
-    bool isMalloc;
-    bool isAllocate;
-}buffer_stream;
+  /**
+   * @brief   Model hooks, must be the first field.
+   */
+  I2CModel                  model;
+  /**
+   * @brief   Device contents.
+   */
+  uint8_t                   *mem;
+  /**
+   * @brief   Device size in bytes.
+   */
+  size_t                    size;
+  /**
+   * @brief   Address bytes, 1 for a register map, 2 for large EEPROMs.
+   */
+  uint8_t                   addr_bytes;
+  /**
+   * @brief   Writes wrap within pages of this size, 0 for no pages.
+   */
+  size_t                    page;
+  /**
+   * @brief   Write cycle, the device NACKs its address meanwhile.
+   */
+  systime_t                 write_time;
+  /* End of the configuration.*/
+  size_t                    ptr;
+  uint8_t                   addr_seen;
+  bool_t                    written;
+  bool_t                    busy;
+  systime_t                 write_start;
+} I2CMemModel;
 /**
  * @brief   Type of a structure representing an I2C driver.
  */
@@ -134,10 +218,50 @@ struct I2CDriver {
   I2C_DRIVER_EXT_FIELDS
 #endif
   /* End of the mandatory fields.*/
-  i2caddr_t addr;
- 
-  Thread *thread ;
-  //I2C_TypeDef *i2c;
+  /**
+   * @brief   Current slave address.
+   */
+  i2caddr_t                 addr;
+  /**
+   * @brief   Thread waiting for a VHA transfer.
+   */
+  Thread                    *thread;
+  /**
+   * @brief   Device models on the bus.
+   */
+  I2CModel                  *models;
+  /**
+   * @brief   Bus time not slept yet, ns.
+   */
+  uint32_t                  bus_ns;
+  /**
+   * @brief   Thread serving the VHA transfers.
+   */
+  Thread                    *thd;
+  /**
+   * @brief   Signalled when a VHA transfer is posted.
+   */
+  BinarySemaphore           request;
+  /**
+   * @brief   VHA transfer frame.
+   */
+  uint8_t                   *frame;
+  /**
+   * @brief   VHA transfer frame size.
+   */
+  size_t                    framesize;
+  /**
+   * @brief   VHA transfer receive buffer.
+   */
+  uint8_t                   *rxbuf;
+  /**
+   * @brief   VHA transfer receive size.
+   */
+  size_t                    rxbytes;
+  /**
+   * @brief   Sequence number of the last VHA transfer posted.
+   */
+  uint32_t                  seq;
 };
 
 
@@ -177,6 +301,11 @@ extern "C" {
   msg_t i2c_lld_master_receive_timeout(I2CDriver *i2cp, i2caddr_t addr,
                                        uint8_t *rxbuf, size_t rxbytes,
                                        systime_t timeout);
+  void i2c_lld_attach(I2CDriver *i2cp, I2CModel *mp);
+  void i2c_lld_detach(I2CDriver *i2cp, I2CModel *mp);
+  void i2c_lld_mem_init(I2CMemModel *mmp, i2caddr_t addr,
+                        uint8_t *mem, size_t size, uint8_t addr_bytes,
+                        size_t page, systime_t write_time);
 #ifdef __cplusplus
 }
 #endif
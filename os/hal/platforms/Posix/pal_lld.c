@@ -22,9 +22,19 @@
  * @{
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
+#include "simutil.h"
 
 #if HAL_USE_PAL || defined(__DOXYGEN__)
 
@@ -33,43 +43,95 @@
 /*===========================================================================*/
 
 /**
- * @brief   VIO1 simulated port.
+ * @brief   VIO ports register bank.
+ * @details Process private unless --sim_gpio maps the shared bank over it.
  */
-sim_vio_port_t vio_port_1;
+sim_vio_bank_t vio_bank;
 
 /**
- * @brief   VIO2 simulated port.
- */
-sim_vio_port_t vio_port_2;
-/**
- * @brief   VIO1 simulated port.
+ * @brief   Doorbell rung by the test process after driving the inputs.
+ * @details -1 when the bank is not shared.
  */
-sim_vio_port_t vio_port_3;
-
-/**
- * @brief   VIO2 simulated port.
- */
-sim_vio_port_t vio_port_4;
+int vio_bell = -1;
 
 /*===========================================================================*/
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
 
+/**
+ * @brief   Name of the shared bank.
+ */
+static const char *vio_name;
+
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
-char* port_lookup(ioportid_t port) {
-  if (port == IOPORT1)
-    return "IOPORT1";
-  else if (port == IOPORT2)
-    return "IOPORT2";
-  else if (port == IOPORT3)
-    return "IOPORT3";
-  else if (port == IOPORT4)
-    return "IOPORT4";
-  else
-    return "IOPORT_UNKNOWN";
+/**
+ * @brief   Removes the shared bank and its doorbell at exit.
+ */
+static void vio_unlink(void) {
+  char path[256];
+
+  (void)shm_unlink(vio_name);
+  snprintf(path, sizeof path, SIMGPIO_BELL_FMT, vio_name);
+  (void)unlink(path);
+}
+
+/**
+ * @brief   Creates the shared bank and its doorbell.
+ * @details The bank is mapped over @p vio_bank, so the port identifiers
+ *          keep their link time addresses.
+ *
+ * @param[in] name      bank name without a leading slash
+ */
+static void vio_create(const char *name) {
+  char path[256];
+  int fd;
+
+  vio_name = name;
+  snprintf(path, sizeof path, SIMGPIO_BELL_FMT, name);
+  if (mkfifo(path, 0600) < 0 && errno != EEXIST) {
+    eprintf("gpio doorbell %s %s", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if ((vio_bell = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+      (fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+    eprintf("gpio bank %s %s", name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (ftruncate(fd, sizeof(vio_bank)) < 0 ||
+      mmap(&vio_bank, sizeof(vio_bank), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    eprintf("gpio bank %s %s", name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  atexit(vio_unlink);
+  printf("gpio bank shm:%s\n", name);
+}
+
+/**
+ * @brief   Appends a latch change to the event ring.
+ *
+ * @param[in] port      port identifier
+ * @param[in] changed   latch bits that changed
+ */
+static void vio_publish(ioportid_t port, uint32_t changed) {
+  uint32_t head = vio_bank.regs.head;
+  simgpio_event_t *ev;
+
+  if (head - __atomic_load_n(&vio_bank.regs.tail, __ATOMIC_ACQUIRE) >=
+      SIMGPIO_EVENTS) {
+    vio_bank.regs.dropped++;
+    return;
+  }
+  ev = &vio_bank.regs.event[head & (SIMGPIO_EVENTS - 1)];
+  ev->time = chTimeNow();
+  ev->port = port - vio_bank.regs.port;
+  ev->changed = changed;
+  ev->latch = port->latch;
+  __atomic_store_n(&vio_bank.regs.head, head + 1, __ATOMIC_RELEASE);
 }
 
 /*===========================================================================*/
@@ -80,6 +142,30 @@ char* port_lookup(ioportid_t port) {
 /* Driver exported functions.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Posix I/O ports configuration.
+ * @details Maps the register bank, shared when a name was given with
+ *          --sim_gpio, and loads the initial ports setup.
+ *
+ * @param[in] config    the Posix ports configuration
+ *
+ * @notapi
+ */
+void _pal_lld_init(const PALConfig *config) {
+  const char *name = sim_get_gpio_name();
+
+  if (name != NULL)
+    vio_create(name);
+  vio_bank.regs.nports = SIMGPIO_PORTS;
+  vio_bank.regs.nevents = SIMGPIO_EVENTS;
+  vio_bank.regs.version = SIMGPIO_VERSION;
+  vio_bank.regs.port[0] = config->VP1Data;
+  vio_bank.regs.port[1] = config->VP2Data;
+  vio_bank.regs.port[2] = config->VP3Data;
+  vio_bank.regs.port[3] = config->VP4Data;
+  __atomic_store_n(&vio_bank.regs.magic, SIMGPIO_MAGIC, __ATOMIC_RELEASE);
+}
+
 /**
  * @brief   Writes a bits mask on a I/O port.
  *
@@ -88,9 +174,12 @@ char* port_lookup(ioportid_t port) {
  *
  * @notapi
  */
- void _pal_lld_writeport(ioportid_t port, uint32_t bits) {
-  sim_printf(PAL_IO, "set %s latch to 0x%02x (was 0x%02x)\n", port_lookup(port), bits, port->latch);
+void _pal_lld_writeport(ioportid_t port, uint32_t bits) {
+  uint32_t changed = port->latch ^ bits;
+
   port->latch = bits;
+  if (changed && vio_bell >= 0)
+    vio_publish(port, changed);
 }
 
 /**
@@ -119,7 +208,8 @@ void _pal_lld_setgroupmode(ioportid_t port,
     port->dir &= ~mask;
     break;
   case PAL_MODE_UNCONNECTED:
-    port->latch |= mask;
+    _pal_lld_writeport(port, port->latch | mask);
+    /* falls through */
   case PAL_MODE_OUTPUT_PUSHPULL:
     port->dir |= mask;
     break;
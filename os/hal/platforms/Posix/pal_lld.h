@@ -25,6 +25,8 @@
 #ifndef _PAL_LLD_H_
 #define _PAL_LLD_H_
 
+#include "simgpio.h"
+
 #if HAL_USE_PAL || defined(__DOXYGEN__)
 
 /*===========================================================================*/
@@ -42,25 +44,21 @@
 
 /**
  * @brief   VIO port structure.
+ * @details The ports live in a @p simgpio_bank_t, shared with a test
+ *          process when started with --sim_gpio.
  */
-typedef struct {
-  /**
-   * @brief   VIO_LATCH register.
-   * @details This register represents the output latch of the VIO port.
-   */
-  uint32_t          latch;
-  /**
-   * @brief   VIO_PIN register.
-   * @details This register represents the logical level at the VIO port
-   *          pin level.
-   */
-  uint32_t          pin;
-  /**
-   * @brief   VIO_DIR register.
-   * @details Direction of the VIO port bits, 0=input, 1=output.
-   */
-  uint32_t          dir;
-} sim_vio_port_t;
+typedef simgpio_port_t sim_vio_port_t;
+
+/**
+ * @brief   VIO ports register bank.
+ * @details Page aligned and padded to whole pages, so the shared bank
+ *          can be mapped over it while the port identifiers stay
+ *          constant.
+ */
+typedef union {
+  simgpio_bank_t    regs;
+  uint8_t           pages[SIMGPIO_BANK_SIZE];
+} __attribute__((aligned(SIMGPIO_PAGE))) sim_vio_bank_t;
 
 /**
  * @brief   Virtual I/O ports static initializer.
@@ -121,22 +119,22 @@ typedef sim_vio_port_t *ioportid_t;
 /**
  * @brief   VIO port 1 identifier.
  */
-#define IOPORT1         (&vio_port_1)
+#define IOPORT1         (&vio_bank.regs.port[0])
 
 /**
  * @brief   VIO port 2 identifier.
  */
-#define IOPORT2         (&vio_port_2)
+#define IOPORT2         (&vio_bank.regs.port[1])
 
 /**
  * @brief   VIO port 3 identifier.
  */
-#define IOPORT3         (&vio_port_3)
+#define IOPORT3         (&vio_bank.regs.port[2])
 
 /**
  * @brief   VIO port 4 identifier.
  */
-#define IOPORT4         (&vio_port_4)
+#define IOPORT4         (&vio_bank.regs.port[3])
 
 /*===========================================================================*/
 /* Implementation, some of the following macros could be implemented as      */
@@ -150,11 +148,7 @@ typedef sim_vio_port_t *ioportid_t;
  *
  * @notapi
  */
-#define pal_lld_init(config)                                                \
-  (vio_port_1 = (config)->VP1Data,                                          \
-   vio_port_2 = (config)->VP2Data,                                          \
-   vio_port_3 = (config)->VP3Data,                                          \
-   vio_port_4 = (config)->VP4Data)
+#define pal_lld_init(config) _pal_lld_init(config)
 
 
 /**
@@ -165,7 +159,8 @@ typedef sim_vio_port_t *ioportid_t;
  *
  * @notapi
  */
-#define pal_lld_readport(port) ((port)->pin)
+#define pal_lld_readport(port)                                              \
+  (((port)->latch & (port)->dir) | ((port)->pin & ~(port)->dir))
 
 /**
  * @brief   Reads the output latch.
@@ -179,6 +174,15 @@ typedef sim_vio_port_t *ioportid_t;
  */
 #define pal_lld_readlatch(port) ((port)->latch)
 
+/**
+ * @brief   Writes a bits mask on a I/O port.
+ * @details The change is published to the bank event ring.
+ *
+ * @param[in] port      port identifier
+ * @param[in] bits      bits to be written on the specified port
+ *
+ * @notapi
+ */
 #define pal_lld_writeport(port, bits) _pal_lld_writeport((port), (bits))
 
 /**
@@ -197,10 +201,8 @@ typedef sim_vio_port_t *ioportid_t;
   _pal_lld_setgroupmode(port, mask << offset, mode)
 
 #if !defined(__DOXYGEN__)
-extern sim_vio_port_t vio_port_1;
-extern sim_vio_port_t vio_port_2;
-extern sim_vio_port_t vio_port_3;
-extern sim_vio_port_t vio_port_4;
+extern sim_vio_bank_t vio_bank;
+extern int vio_bell;
 extern const PALConfig pal_default_config;
 #endif
 
@@ -15,6 +15,9 @@ PLATFORMSRC = ${CHIBIOS}/os/hal/platforms/Posix/hal_lld.c         \
 ifndef CH_DEMO
 PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/simio.c
 PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/simutil.c
+PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/simhex.c
+PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/simshm.c
+PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/simcap.c
 PLATFORMSRC+= ${CHIBIOS}/os/hal/platforms/Posix/sim_preempt.c
 endif
 
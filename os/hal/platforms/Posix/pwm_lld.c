@@ -22,10 +22,19 @@
  * @{
  */
 
-#include "ch.h"
-#include "hal.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "simio.h"
+#include "simutil.h"
 
 #if HAL_USE_PWM || defined(__DOXYGEN__)
 
@@ -33,6 +42,8 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+#define PWM_NS_PER_S        1000000000LL
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -48,14 +59,273 @@ PWMDriver PWMD1;
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
 
+/**
+ * @brief   Width trace file, NULL when not tracing.
+ */
+static FILE *trace;
+
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Host monotonic time in nanoseconds.
+ *
+ * @notapi
+ */
+static int64_t pwm_host_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * PWM_NS_PER_S + ts.tv_nsec;
+}
+
+/**
+ * @brief   Converts timer ticks to nanoseconds.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[in] n         timer ticks
+ *
+ * @notapi
+ */
+static int64_t pwm_ticks_ns(PWMDriver *pwmp, pwmcnt_t n) {
+
+  return (int64_t)n * PWM_NS_PER_S / pwmp->config->frequency;
+}
+
+/**
+ * @brief   Appends a record to the width trace.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[in] channel   the channel, zero for the driver events
+ * @param[in] event     the @p PWM_TRACE_* event
+ * @param[in] value     the event value
+ * @param[in] cycle     first cycle affected
+ *
+ * @notapi
+ */
+static void pwm_trace(PWMDriver *pwmp, unsigned channel, unsigned event,
+                      uint32_t value, uint32_t cycle) {
+  PWMTraceRecord rec;
+
+  (void)pwmp;
+  if (trace == NULL)
+    return;
+  rec.time = chTimeNow();
+  rec.cycle = cycle;
+  rec.channel = channel;
+  rec.event = event;
+  rec.value = value;
+  if (fwrite(&rec, sizeof rec, 1, trace) != 1) {
+    eprintf("PWM trace %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Loads the preload registers at a cycle start.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ *
+ * @notapi
+ */
+static void pwm_load(PWMDriver *pwmp) {
+
+  pwmp->cycle_ns = pwmp->period_ns;
+  pwmp->active = pwmp->enabled;
+  memcpy(pwmp->active_width, pwmp->width, sizeof(pwmp->width));
+  pwmp->fired = 0;
+}
+
+/**
+ * @brief   Brings the counter up to a host time.
+ * @details The cycle starts crossed are counted for the timer thread,
+ *          the preload registers are loaded at the first one.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[in] now       host time, ns
+ *
+ * @notapi
+ */
+static void pwm_sync(PWMDriver *pwmp, int64_t now) {
+  int64_t n;
+
+  if (now < pwmp->origin + pwmp->cycle_ns)
+    return;
+  pwmp->origin += pwmp->cycle_ns;
+  pwm_load(pwmp);
+  n = (now - pwmp->origin) / pwmp->cycle_ns;
+  pwmp->origin += n * pwmp->cycle_ns;
+  pwmp->cycle += (uint32_t)n + 1;
+  pwmp->crossed += (uint32_t)n + 1;
+}
+
+/**
+ * @brief   Host time a channel compare matches in the current cycle.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[in] channel   the channel
+ * @return              The match time, zero when the channel has no
+ *                      callback due in this cycle.
+ *
+ * @notapi
+ */
+static int64_t pwm_match(PWMDriver *pwmp, pwmchannel_t channel) {
+  int64_t ns;
+
+  if (!(pwmp->active & ~pwmp->fired & (1U << channel)) ||
+      pwmp->config->channels[channel].callback == NULL ||
+      pwmp->active_width[channel] == 0)
+    return 0;
+  ns = pwm_ticks_ns(pwmp, pwmp->active_width[channel]);
+  return ns < pwmp->cycle_ns ? pwmp->origin + ns : 0;
+}
+
+/**
+ * @brief   Next host time a callback is due.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @return              The time, zero when no callback is enabled.
+ *
+ * @notapi
+ */
+static int64_t pwm_next(PWMDriver *pwmp) {
+  bool_t periodic = pwmp->config->callback != NULL;
+  int64_t next = 0, t;
+  pwmchannel_t ch;
+
+  for (ch = 0; ch < PWM_CHANNELS; ch++) {
+    if (((pwmp->active | pwmp->enabled) & (1U << ch)) &&
+        pwmp->config->channels[ch].callback != NULL)
+      periodic = TRUE;
+    t = pwm_match(pwmp, ch);
+    if (t != 0 && (next == 0 || t < next))
+      next = t;
+  }
+
+  /* the next cycle start loads the preload registers */
+  t = pwmp->origin + pwmp->cycle_ns;
+  if (periodic && (next == 0 || t < next))
+    next = t;
+  return next;
+}
+
+/**
+ * @brief   Programs the host timer.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[in] next      host time of the expiry, zero to disarm
+ *
+ * @notapi
+ */
+static void pwm_arm(PWMDriver *pwmp, int64_t next) {
+  struct itimerspec its;
+
+  /* an absolute expiry in the past fires at once */
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = next / PWM_NS_PER_S;
+  its.it_value.tv_nsec = next % PWM_NS_PER_S;
+  if (timerfd_settime(pwmp->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    eprintf("cannot program the PWM timer");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Programs the host timer for the next callback.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ *
+ * @notapi
+ */
+static void pwm_rearm(PWMDriver *pwmp) {
+
+  pwm_arm(pwmp, pwm_next(pwmp));
+}
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Timer thread, plays the part of the timer interrupt.
+ * @details Sleeps on the host timer until the next cycle start or channel
+ *          compare match with a callback, then invokes the period callback
+ *          and the callbacks of the channels matched, by width.
+ */
+static msg_t pwm_thread(void *arg) {
+  PWMDriver *pwmp = (PWMDriver*)arg;
+  struct pollfd pfd = {pwmp->fd, POLLIN, 0};
+  PWMStats *stp = &pwmp->stats;
+  uint32_t crossed, due, n;
+  uint64_t expirations;
+  int64_t now, deadline, jitter, t;
+  pwmchannel_t ch, first;
+
+  chRegSetThreadName("pwm_timer");
+  while (TRUE) {
+    /* no wait slot left, the timer is polled every tick */
+    if (port_wait_io(&pfd, 1, TIME_INFINITE) == RDY_RESET)
+      chThdSleep(1);
+
+    /* nothing to read when stopped or rearmed meanwhile */
+    if (read(pwmp->fd, &expirations, sizeof expirations) !=
+        sizeof expirations)
+      continue;
+
+    CH_IRQ_PROLOGUE();
+
+    chSysLockFromIsr();
+    crossed = due = 0;
+    deadline = 0;
+    if (pwmp->state == PWM_READY) {
+      now = pwm_host_ns();
+      deadline = pwm_next(pwmp);
+      pwm_sync(pwmp, now);
+      crossed = pwmp->crossed;
+      pwmp->crossed = 0;
+      for (ch = 0; ch < PWM_CHANNELS; ch++) {
+        t = pwm_match(pwmp, ch);
+        if (t != 0 && t <= now) {
+          due |= 1U << ch;
+          pwmp->fired |= 1U << ch;
+        }
+      }
+      n = (crossed && pwmp->config->callback != NULL) + __builtin_popcount(due);
+      if (n != 0 && deadline != 0) {
+        jitter = now - deadline;
+        if (stp->callbacks == 0 || jitter < stp->jitter_min)
+          stp->jitter_min = jitter;
+        if (stp->callbacks == 0 || jitter > stp->jitter_max)
+          stp->jitter_max = jitter;
+        stp->jitter_sum += jitter;
+      }
+      stp->callbacks += n;
+      stp->missed += crossed > 1 ? crossed - 1 : 0;
+    }
+    chSysUnlockFromIsr();
+
+    if (crossed && pwmp->config->callback != NULL)
+      pwmp->config->callback(pwmp);
+    while (due != 0) {
+      for (ch = 0, first = PWM_CHANNELS; ch < PWM_CHANNELS; ch++)
+        if ((due & (1U << ch)) && (first == PWM_CHANNELS ||
+            pwmp->active_width[ch] < pwmp->active_width[first]))
+          first = ch;
+      due &= ~(1U << first);
+      pwmp->config->channels[first].callback(pwmp);
+    }
+
+    chSysLockFromIsr();
+    pwm_rearm(pwmp);
+    chSysUnlockFromIsr();
+
+    CH_IRQ_EPILOGUE();
+  }
+
+  return 0;
+}
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
@@ -69,19 +339,56 @@ void pwm_lld_init(void) {
 #if PLATFORM_PWM_USE_PWM1
   /* Driver initialization.*/
   pwmObjectInit(&PWMD1);
-
+  PWMD1.fd = -1;
+  PWMD1.thd = NULL;
 #endif /* PLATFORM_PWM_USE_PWM1 */
 }
 
 /**
  * @brief   Configures and activates the PWM peripheral.
+ * @details The counter starts at once, the first cycle is the cycle 0.
  *
  * @param[in] pwmp      pointer to the @p PWMDriver object
  *
  * @notapi
  */
 void pwm_lld_start(PWMDriver *pwmp) {
-  (void)pwmp;
+  const char *path = sim_get_pwm_trace();
+
+  chDbgAssert(pwmp->config->frequency > 0 &&
+              pwmp->config->frequency <= PWM_NS_PER_S && pwmp->period > 0,
+              "pwm_lld_start(), #1", "invalid frequency or period");
+
+  /* the host timer and its thread are created once and kept across stops */
+  if (pwmp->fd < 0) {
+    pwmp->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pwmp->fd < 0) {
+      eprintf("cannot create the PWM timer");
+      exit(EXIT_FAILURE);
+    }
+    pwmp->thd = chThdCreateI(pwmp->wa, sizeof(pwmp->wa),
+                             PLATFORM_PWM_THREAD_PRIORITY, pwm_thread,
+                             (void*)pwmp);
+    chSchWakeupS(pwmp->thd, RDY_OK);
+  }
+  if (path != NULL && trace == NULL && (trace = fopen(path, "wb")) == NULL) {
+    eprintf("PWM trace %s %s", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&pwmp->stats, 0, sizeof(pwmp->stats));
+  memset(pwmp->width, 0, sizeof(pwmp->width));
+  pwmp->enabled = 0;
+  pwmp->cycle = 0;
+  pwmp->crossed = 0;
+  pwmp->period_ns = pwm_ticks_ns(pwmp, pwmp->period);
+  pwm_load(pwmp);
+  pwmp->origin = pwm_host_ns();
+  pwm_trace(pwmp, 0, PWM_TRACE_START, pwmp->config->frequency, 0);
+  pwm_trace(pwmp, 0, PWM_TRACE_PERIOD, pwmp->period, 0);
+
+  /* armed by the first callback enabled */
+  pwm_rearm(pwmp);
 }
 
 /**
@@ -91,9 +398,15 @@ void pwm_lld_start(PWMDriver *pwmp) {
  *
  * @notapi
  */
-
 void pwm_lld_stop(PWMDriver *pwmp) {
-  (void)pwmp;
+
+  if (pwmp->state == PWM_READY) {
+    pwm_sync(pwmp, pwm_host_ns());
+    pwm_trace(pwmp, 0, PWM_TRACE_STOP, 0, pwmp->cycle);
+    if (trace != NULL)
+      fflush(trace);
+    pwm_arm(pwmp, 0);
+  }
 }
 
 /**
@@ -113,8 +426,13 @@ void pwm_lld_stop(PWMDriver *pwmp) {
  * @notapi
  */
 void pwm_lld_change_period(PWMDriver *pwmp, pwmcnt_t period) {
-  (void)pwmp;
-  sim_printf(PWM_IO, "period %hd", period);
+
+  chDbgAssert(period > 0, "pwm_lld_change_period(), #1", "invalid period");
+
+  pwm_sync(pwmp, pwm_host_ns());
+  pwmp->period_ns = pwm_ticks_ns(pwmp, period);
+  pwm_trace(pwmp, 0, PWM_TRACE_PERIOD, period, pwmp->cycle + 1);
+  pwm_rearm(pwmp);
 }
 
 /**
@@ -134,8 +452,12 @@ void pwm_lld_change_period(PWMDriver *pwmp, pwmcnt_t period) {
 void pwm_lld_enable_channel(PWMDriver *pwmp,
                             pwmchannel_t channel,
                             pwmcnt_t width) {
-  (void)pwmp;
-  sim_printf(PWM_IO, "enable channel %hhd width %hd", channel, width);
+
+  pwm_sync(pwmp, pwm_host_ns());
+  pwmp->width[channel] = width;
+  pwmp->enabled |= 1U << channel;
+  pwm_trace(pwmp, channel, PWM_TRACE_ENABLE, width, pwmp->cycle + 1);
+  pwm_rearm(pwmp);
 }
 
 /**
@@ -153,8 +475,26 @@ void pwm_lld_enable_channel(PWMDriver *pwmp,
  * @notapi
  */
 void pwm_lld_disable_channel(PWMDriver *pwmp, pwmchannel_t channel) {
-  (void)pwmp;
-  sim_printf(PWM_IO, "disable channel %hhd", channel);
+
+  pwm_sync(pwmp, pwm_host_ns());
+  pwmp->enabled &= ~(1U << channel);
+  pwm_trace(pwmp, channel, PWM_TRACE_DISABLE, 0, pwmp->cycle + 1);
+  pwm_rearm(pwmp);
+}
+
+/**
+ * @brief   Copies the callback timing statistics.
+ *
+ * @param[in] pwmp      pointer to the @p PWMDriver object
+ * @param[out] stp      the statistics
+ *
+ * @api
+ */
+void pwm_lld_get_stats(PWMDriver *pwmp, PWMStats *stp) {
+
+  chSysLock();
+  *stp = pwmp->stats;
+  chSysUnlock();
 }
 
 #endif /* HAL_USE_PWM */
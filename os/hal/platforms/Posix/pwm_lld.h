@@ -36,6 +36,18 @@
  */
 #define PWM_CHANNELS                        4
 
+/**
+ * @name    Trace record events
+ * @{
+ */
+#define PWM_TRACE_START                     0   /**< @brief Started, value
+                                                     is the frequency.  */
+#define PWM_TRACE_PERIOD                    1   /**< @brief Period set.   */
+#define PWM_TRACE_ENABLE                    2   /**< @brief Width set.    */
+#define PWM_TRACE_DISABLE                   3   /**< @brief Channel off.  */
+#define PWM_TRACE_STOP                      4   /**< @brief Stopped.      */
+/** @} */
+
 /*===========================================================================*/
 /* Driver pre-compile time settings.                                         */
 /*===========================================================================*/
@@ -51,6 +63,14 @@
 #if !defined(PLATFORM_PWM_USE_PWM1) || defined(__DOXYGEN__)
 #define PLATFORM_PWM_USE_PWM1               TRUE
 #endif
+
+/**
+ * @brief   PWM timer thread priority.
+ * @details The thread standing for the timer interrupt.
+ */
+#if !defined(PLATFORM_PWM_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_PWM_THREAD_PRIORITY        (HIGHPRIO - 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -126,6 +146,37 @@ typedef struct {
   /* End of the mandatory fields.*/
 } PWMConfig;
 
+/**
+ * @brief   Width trace record.
+ * @details With --sim_pwm_trace every change is appended to the trace
+ *          file, in host byte order. A change takes effect at the start
+ *          of the cycle @p cycle, as the preload registers of a timer
+ *          would, so a host tool can rebuild the exact waveform.
+ */
+typedef struct {
+  uint32_t                  time;           /**< System time, ticks.        */
+  uint32_t                  cycle;          /**< First cycle affected.      */
+  uint16_t                  channel;        /**< Channel, zero for the
+                                                 driver events.             */
+  uint16_t                  event;          /**< @p PWM_TRACE_* event.      */
+  uint32_t                  value;          /**< Frequency, period or width
+                                                 in timer ticks.            */
+} PWMTraceRecord;
+
+/**
+ * @brief   Callback timing statistics.
+ * @details The jitter is the delay between the time a callback is due
+ *          and the time it is invoked, cumulated since @p pwmStart().
+ */
+typedef struct {
+  uint32_t                  callbacks;      /**< Callbacks invoked.         */
+  uint32_t                  missed;         /**< Cycle starts served late
+                                                 by a whole cycle.          */
+  int64_t                   jitter_min;     /**< Lowest jitter, ns.         */
+  int64_t                   jitter_max;     /**< Highest jitter, ns.        */
+  int64_t                   jitter_sum;     /**< Jitters total, ns.         */
+} PWMStats;
+
 /**
  * @brief   Structure representing an PWM driver.
  * @note    Implementations may extend this structure to contain more,
@@ -148,6 +199,59 @@ struct PWMDriver {
   PWM_DRIVER_EXT_FIELDS
 #endif
   /* End of the mandatory fields.*/
+  /**
+   * @brief   Host timer, a timerfd on the monotonic clock.
+   */
+  int                       fd;
+  /**
+   * @brief   Host time the current cycle started, ns.
+   */
+  int64_t                   origin;
+  /**
+   * @brief   Length of the current cycle, ns.
+   */
+  int64_t                   cycle_ns;
+  /**
+   * @brief   Cycle length, preload, ns.
+   */
+  int64_t                   period_ns;
+  /**
+   * @brief   Cycles since @p pwmStart().
+   */
+  uint32_t                  cycle;
+  /**
+   * @brief   Cycle starts not served yet by the timer thread.
+   */
+  uint32_t                  crossed;
+  /**
+   * @brief   Enabled channels mask, preload.
+   */
+  uint32_t                  enabled;
+  /**
+   * @brief   Channels width, preload.
+   */
+  pwmcnt_t                  width[PWM_CHANNELS];
+  /**
+   * @brief   Enabled channels mask in the current cycle.
+   */
+  uint32_t                  active;
+  /**
+   * @brief   Channels width in the current cycle.
+   */
+  pwmcnt_t                  active_width[PWM_CHANNELS];
+  /**
+   * @brief   Channels whose callback was invoked in the current cycle.
+   */
+  uint32_t                  fired;
+  /**
+   * @brief   Callback timing statistics.
+   */
+  PWMStats                  stats;
+  /**
+   * @brief   Thread serving the host timer.
+   */
+  Thread                    *thd;
+  WORKING_AREA(wa, 256);
 };
 
 /*===========================================================================*/
@@ -163,7 +267,8 @@ struct PWMDriver {
  *
  * @notapi
  */
-#define pwm_lld_is_channel_enabled(pwmp, channel) FALSE
+#define pwm_lld_is_channel_enabled(pwmp, channel)                           \
+  (((pwmp)->enabled & (1U << (channel))) != 0)
 
 /*===========================================================================*/
 /* External declarations.                                                    */
@@ -184,6 +289,7 @@ extern "C" {
                               pwmchannel_t channel,
                               pwmcnt_t width);
   void pwm_lld_disable_channel(PWMDriver *pwmp, pwmchannel_t channel);
+  void pwm_lld_get_stats(PWMDriver *pwmp, PWMStats *stp);
 #ifdef __cplusplus
 }
 #endif
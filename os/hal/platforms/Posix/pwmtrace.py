@@ -0,0 +1,77 @@
+"""Reader of the PWM width trace written with --sim_pwm_trace.
+
+Mirrors PWMTraceRecord in pwm_lld.h. Run as a script it rebuilds the
+channel outputs, taken as active high, as a VCD waveform:
+
+  python pwmtrace.py trace.bin > trace.vcd
+"""
+import struct
+import sys
+
+RECORD = struct.Struct('=IIHHI')  # time, cycle, channel, event, value
+
+START, PERIOD, ENABLE, DISABLE, STOP = range(5)
+
+CHANNELS = 4
+
+def read(path):
+  """The records as (time, cycle, channel, event, value)"""
+  data = open(path, 'rb').read()
+  return [RECORD.unpack_from(data, off)
+          for off in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+
+def cycles(records):
+  """Yield (start ns, period ns, {channel: width ns}) for every cycle"""
+  t, i = 0, 0
+  while i < len(records):
+    if records[i][3] != START:
+      i += 1
+      continue
+    freq = records[i][4]
+    ns = lambda n: n * 1000000000 // freq
+    period, widths, c = 0, {}, 0
+    i += 1
+    while i < len(records) and records[i][3] != START:
+      # the changes taking effect at the start of this cycle
+      while (i < len(records) and records[i][1] <= c and
+             records[i][3] not in (START, STOP)):
+        _, _, ch, ev, value = records[i]
+        if ev == PERIOD:
+          period = value
+        elif ev == ENABLE:
+          widths[ch] = value
+        elif ev == DISABLE:
+          widths.pop(ch, None)
+        i += 1
+      if i == len(records) or records[i][3] == START:
+        break
+      if records[i][3] == STOP and records[i][1] <= c:
+        i += 1
+        break
+      yield t, ns(period), dict((ch, ns(w)) for ch, w in widths.items())
+      t += ns(period)
+      c += 1
+
+def vcd(records, out):
+  ids = [chr(ord('a') + ch) for ch in range(CHANNELS)]
+  out.write('$timescale 1ns $end\n$scope module pwm $end\n')
+  for ch in range(CHANNELS):
+    out.write('$var wire 1 %s ch%d $end\n' % (ids[ch], ch))
+  out.write('$upscope $end\n$enddefinitions $end\n#0\n')
+  out.write(''.join('0%s\n' % i for i in ids))
+  level = [0] * CHANNELS
+  for start, period, widths in cycles(records):
+    changes = []
+    for ch in range(CHANNELS):
+      w = widths.get(ch, 0)
+      if w > 0:
+        changes.append((start, ch, 1))
+      if w < period:
+        changes.append((start + w, ch, 0))
+    for t, ch, v in sorted(changes):
+      if level[ch] != v:
+        out.write('#%d\n%d%s\n' % (t, v, ids[ch]))
+        level[ch] = v
+
+if __name__ == '__main__':
+  vcd(read(sys.argv[1]), sys.stdout)
@@ -26,12 +26,16 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
 #include "ch.h"
 #include "hal.h"
-
-#include <sys/time.h>
-#include <unistd.h>
-#include <signal.h>
+#include "simutil.h"
 
 #if HAL_USE_RTC || defined(__DOXYGEN__)
 
@@ -39,6 +43,8 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+#define RTC_NS_PER_S        1000000000LL
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -51,28 +57,182 @@ RTCDriver RTCD1;
 /*===========================================================================*/
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
-static WORKING_AREA(wsp, 128);
-static Thread *athd;
 
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Host real time in nanoseconds.
+ *
+ * @notapi
+ */
+static int64_t rtc_host_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * RTC_NS_PER_S + ts.tv_nsec;
+}
+
+/**
+ * @brief   Programs a host timer.
+ *
+ * @param[in] fd        the timerfd
+ * @param[in] deadline  host time of the first expiry, zero to disarm
+ * @param[in] period    period in ns, zero for a single expiry
+ *
+ * @notapi
+ */
+static void rtc_arm(int fd, int64_t deadline, int64_t period) {
+  struct itimerspec its;
+
+  /* the expirations not read yet are dropped */
+  its.it_value.tv_sec = deadline / RTC_NS_PER_S;
+  its.it_value.tv_nsec = deadline % RTC_NS_PER_S;
+  its.it_interval.tv_sec = period / RTC_NS_PER_S;
+  its.it_interval.tv_nsec = period % RTC_NS_PER_S;
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    eprintf("cannot program the RTC timer");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Programs the alarm timer from the current alarm.
+ * @note    An alarm already due fires at once.
+ *
+ * @param[in] rtcp      pointer to RTC driver structure
+ *
+ * @notapi
+ */
+static void rtc_arm_alarm(RTCDriver *rtcp) {
+  int64_t deadline, now;
+
+  if (rtcp->alarm.tv_sec == 0 && rtcp->alarm.tv_usec == 0) {
+    rtc_arm(rtcp->alarm_fd, 0, 0);
+    return;
+  }
+  deadline = (int64_t)rtcp->alarm.tv_sec * RTC_NS_PER_S +
+             (int64_t)rtcp->alarm.tv_usec * 1000 - rtcp->offset;
+  now = rtc_host_ns();
+  if (deadline < now)
+    deadline = now;
+  rtcp->deadline = deadline;
+  rtc_arm(rtcp->alarm_fd, deadline, 0);
+}
+
+/**
+ * @brief   Programs the second timer on the RTC second boundaries.
+ *
+ * @param[in] rtcp      pointer to RTC driver structure
+ *
+ * @notapi
+ */
+static void rtc_arm_second(RTCDriver *rtcp) {
+  int64_t now;
+
+  if (rtcp->callback == NULL) {
+    rtc_arm(rtcp->second_fd, 0, 0);
+    return;
+  }
+  now = rtc_host_ns() + rtcp->offset;
+  rtc_arm(rtcp->second_fd,
+          (now / RTC_NS_PER_S + 1) * RTC_NS_PER_S - rtcp->offset,
+          RTC_NS_PER_S);
+}
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief   Timer thread, plays the part of the interrupt controller.
+ * @details Sleeps on both host timers through the port I/O wait, so no
+ *          thread runs between events, and serves each expiry as an
+ *          interrupt. The RTC follows the host real time clock whatever
+ *          the simulated system clock.
+ */
+static msg_t timer_thread(void *arg) {
+  RTCDriver *rtcp = (RTCDriver*)arg;
+  struct pollfd pfd[2] = {{rtcp->alarm_fd, POLLIN, 0},
+                          {rtcp->second_fd, POLLIN, 0}};
+  RTCStats *stp = &rtcp->stats;
+  uint64_t alarms, seconds;
+  int64_t latency;
+  rtccb_t cb;
+
+  chRegSetThreadName("rtc_timer");
+  while (TRUE) {
+    /* no wait slot left, the timer is polled every tick */
+    if (port_wait_io(pfd, 2, TIME_INFINITE) == RDY_RESET)
+      chThdSleep(1);
+
+    /* nothing to read when disarmed or rearmed meanwhile */
+    if (read(rtcp->alarm_fd, &alarms, sizeof alarms) != sizeof alarms)
+      alarms = 0;
+    if (read(rtcp->second_fd, &seconds, sizeof seconds) != sizeof seconds)
+      seconds = 0;
+    if (alarms == 0 && seconds == 0)
+      continue;
+
+    CH_IRQ_PROLOGUE();
+
+    chSysLockFromIsr();
+    cb = rtcp->callback;
+    if (seconds > 0) {
+      stp->seconds++;
+      stp->missed += (uint32_t)(seconds - 1);
+    }
+    if (alarms > 0) {
+      /* the alarm is single shot, as the comparator match */
+      latency = rtc_host_ns() - rtcp->deadline;
+      if (stp->alarms == 0 || latency < stp->latency_min)
+        stp->latency_min = latency;
+      if (stp->alarms == 0 || latency > stp->latency_max)
+        stp->latency_max = latency;
+      stp->latency_sum += latency;
+      stp->alarms++;
+    }
+    chSysUnlockFromIsr();
+
+    if (cb != NULL) {
+      if (seconds > 0)
+        cb(rtcp, RTC_EVENT_SECOND);
+      if (alarms > 0)
+        cb(rtcp, RTC_EVENT_ALARM);
+    }
+
+    CH_IRQ_EPILOGUE();
+  }
+
+  return 0;
+}
+
+/**
+ * @brief   Starts the timer thread on first use.
+ * @note    The kernel is not running yet in @p rtc_lld_init().
+ *
+ * @param[in] rtcp      pointer to RTC driver structure
+ *
+ * @notapi
+ */
+static void rtc_start_thread(RTCDriver *rtcp) {
+
+  if (rtcp->thd == NULL) {
+    rtcp->thd = chThdCreateI(rtcp->wa, sizeof(rtcp->wa),
+                             POSIX_RTC_THREAD_PRIORITY, timer_thread,
+                             (void*)rtcp);
+    chSchWakeupS(rtcp->thd, RDY_OK);
+  }
+}
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
 
 /**
  * @brief   Load value of RTCCLK to prescaler registers.
- * @note    The pre-scaler must not be set on every reset as RTC clock
- *          counts are lost when it is set.
- * @note    This function designed to be called from
- *          hal_lld_backup_domain_init(). Because there is only place
- *          where possible to detect BKP domain reset event reliably.
+ * @note    Nothing to load, the RTC runs on the host real time clock.
  *
  * @notapi
  */
@@ -84,12 +244,20 @@ static Thread *athd;
  * @notapi
  */
 void rtc_lld_init(void) {
+
+  memset(&RTCD1, 0, sizeof(RTCD1));
+  RTCD1.alarm_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  RTCD1.second_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (RTCD1.alarm_fd < 0 || RTCD1.second_fd < 0) {
+    eprintf("cannot create the RTC timers");
+    exit(EXIT_FAILURE);
+  }
 }
 
 /**
  * @brief   Set current time.
- * @note    Fractional part will be silently ignored. There is no possibility
- *          to change it on STM32F1xx platform.
+ * @note    The host clock is left alone, the RTC keeps an offset from it.
+ * @note    @p tv_msec is ignored, the fractional part is @p tv_usec.
  *
  * @param[in] rtcp      pointer to RTC driver structure
  * @param[in] timespec  pointer to a @p RTCTime structure
@@ -97,8 +265,13 @@ void rtc_lld_init(void) {
  * @notapi
  */
 void rtc_lld_set_time(RTCDriver *rtcp, const RTCTime *timespec) {
-  (void)rtcp;
-  (void)timespec;
+
+  rtcp->offset = (int64_t)timespec->tv_sec * RTC_NS_PER_S +
+                 (int64_t)timespec->tv_usec * 1000 - rtc_host_ns();
+
+  /* both timers follow the new time base */
+  rtc_arm_alarm(rtcp);
+  rtc_arm_second(rtcp);
 }
 
 /**
@@ -110,42 +283,17 @@ void rtc_lld_set_time(RTCDriver *rtcp, const RTCTime *timespec) {
  * @notapi
  */
 void rtc_lld_get_time(RTCDriver *rtcp, RTCTime *timespec) {
-  (void)rtcp;
-  gettimeofday((struct timeval*)timespec, NULL);
-}
+  int64_t now = rtc_host_ns() + rtcp->offset;
 
-/**
- * @brief   Callback for rtc_lld_set_alarm()
- *
- * @notapi
- */
-void rtd_lld_alarm_do_callback(int signal) {
-  (void)signal;
-  if (RTCD1.callback) {
-    CH_IRQ_PROLOGUE();
-    RTCD1.callback(&RTCD1, RTC_EVENT_ALARM);
-    CH_IRQ_EPILOGUE();
-  }
-}
-
-/**
- * @brief   Signal every second
- *
- * @notapi
- */
-static msg_t alarm_thread(void *arg) {
-  while (TRUE) {
-    chThdSleep(1000);
-    if (RTCD1.callback) {
-      RTCD1.callback(&RTCD1, RTC_EVENT_SECOND);
-    }
-  }
+  timespec->tv_sec = (uint32_t)(now / RTC_NS_PER_S);
+  timespec->tv_usec = (uint32_t)(now % RTC_NS_PER_S / 1000);
+  timespec->tv_msec = timespec->tv_usec / 1000;
 }
 
 /**
  * @brief   Set alarm time.
- *
- * @note      Default value after BKP domain reset is 0xFFFFFFFF
+ * @details The alarm fires once, an alarm already due fires at once.
+ *          A zero alarm disarms.
  *
  * @param[in] rtcp      pointer to RTC driver structure
  * @param[in] alarm     alarm identifier
@@ -156,26 +304,18 @@ static msg_t alarm_thread(void *arg) {
 void rtc_lld_set_alarm(RTCDriver *rtcp,
                        rtcalarm_t rtcalarm,
                        const RTCAlarm *alarmspec) {
-  (void)rtcalarm;
-
-  RTCTime now;
-  rtc_lld_get_time(rtcp, &now);
 
-  struct sigaction act;
-  act.sa_handler = rtd_lld_alarm_do_callback;
-  sigemptyset(&act.sa_mask);
-  act.sa_flags = SA_RESETHAND;
+  (void)rtcalarm;
 
-  sigaction(SIGALRM, &act, NULL);
-  alarm(alarmspec->tv_sec - now.tv_sec);
+  rtcp->alarm = *alarmspec;
+  rtc_arm_alarm(rtcp);
+  rtc_start_thread(rtcp);
 }
 
 /**
  * @brief   Get current alarm.
  * @note    If an alarm has not been set then the returned alarm specification
- *          is not meaningful.
- *
- * @note    Default value after BKP domain reset is 0xFFFFFFFF.
+ *          is zero.
  *
  * @param[in] rtcp      pointer to RTC driver structure
  * @param[in] alarm     alarm identifier
@@ -187,16 +327,16 @@ void rtc_lld_get_alarm(RTCDriver *rtcp,
                        rtcalarm_t rtcalarm,
                        RTCAlarm *alarmspec) {
 
-  (void)rtcp;
   (void)rtcalarm;
 
-  alarmspec->tv_sec = alarm(0);
+  *alarmspec = rtcp->alarm;
 }
 
 /**
  * @brief   Enables or disables RTC callbacks.
  * @details This function enables or disables callbacks, use a @p NULL pointer
- *          in order to disable a callback.
+ *          in order to disable a callback. The second timer only runs
+ *          while a callback is set.
  *
  * @param[in] rtcp      pointer to RTC driver structure
  * @param[in] callback  callback function pointer or @p NULL
@@ -204,13 +344,25 @@ void rtc_lld_get_alarm(RTCDriver *rtcp,
  * @notapi
  */
 void rtc_lld_set_callback(RTCDriver *rtcp, rtccb_t callback) {
-    rtcp->callback = callback;
 
-    /* spawn thread that signals once per second */
-    if (!athd) {
-      athd = chThdCreateI(wsp, sizeof(wsp), NORMALPRIO, alarm_thread, NULL);
-      chSchWakeupS(athd, RDY_OK);
-    }
+  rtcp->callback = callback;
+  rtc_arm_second(rtcp);
+  rtc_start_thread(rtcp);
+}
+
+/**
+ * @brief   Gets the callback timing statistics.
+ *
+ * @param[in] rtcp      pointer to RTC driver structure
+ * @param[out] stp      pointer to the @p RTCStats to fill
+ *
+ * @api
+ */
+void rtc_lld_get_stats(RTCDriver *rtcp, RTCStats *stp) {
+
+  chSysLock();
+  *stp = rtcp->stats;
+  chSysUnlock();
 }
 
 #include "chrtclib.h"
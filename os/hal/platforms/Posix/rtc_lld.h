@@ -45,10 +45,29 @@
  */
 #define RTC_ALARMS                  1
 
+/**
+ * @brief   Time stamps carry microseconds in @p tv_usec.
+ */
+#define RTC_SUPPORTS_USEC           TRUE
+
 /*===========================================================================*/
 /* Driver pre-compile time settings.                                         */
 /*===========================================================================*/
 
+/**
+ * @name    Configuration options
+ * @{
+ */
+/**
+ * @brief   Timer thread priority.
+ * @note    The thread plays the part of the interrupt controller, it
+ *          must run ahead of the application threads.
+ */
+#if !defined(POSIX_RTC_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define POSIX_RTC_THREAD_PRIORITY   (HIGHPRIO - 1)
+#endif
+/** @} */
+
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
@@ -106,9 +125,14 @@ struct RTCTime {
    */
   uint32_t tv_sec;
   /**
-   * @brief Fractional part.
+   * @brief Fractional part, milliseconds.
+   * @note  Filled on reads only, @p tv_usec is the one set.
    */
   uint32_t tv_msec;
+  /**
+   * @brief Fractional part, microseconds.
+   */
+  uint32_t tv_usec;
 };
 
 /**
@@ -119,8 +143,26 @@ struct RTCAlarm {
    * @brief Seconds since UNIX epoch.
    */
   uint32_t          tv_sec;
+  /**
+   * @brief Fractional part, microseconds.
+   */
+  uint32_t          tv_usec;
 };
 
+/**
+ * @brief   Callback timing statistics.
+ * @details The latency is the delay between the alarm time and the
+ *          alarm callback.
+ */
+typedef struct {
+  uint32_t          seconds;            /**< Second events.             */
+  uint32_t          missed;             /**< Second events lost.        */
+  uint32_t          alarms;             /**< Alarm events.              */
+  int64_t           latency_min;        /**< Lowest alarm latency, ns.  */
+  int64_t           latency_max;        /**< Highest alarm latency, ns. */
+  int64_t           latency_sum;        /**< Alarm latencies total, ns. */
+} RTCStats;
+
 /**
  * @brief   Structure representing an RTC driver.
  */
@@ -129,6 +171,35 @@ struct RTCDriver{
    * @brief Callback pointer.
    */
   rtccb_t           callback;
+  /**
+   * @brief   RTC time minus the host real time clock, ns.
+   */
+  int64_t           offset;
+  /**
+   * @brief   Current alarm, zero when disarmed.
+   */
+  RTCAlarm          alarm;
+  /**
+   * @brief   Host time of the alarm or of its setting if already due, ns.
+   */
+  int64_t           deadline;
+  /**
+   * @brief   Alarm timer, a timerfd on the real time clock.
+   */
+  int               alarm_fd;
+  /**
+   * @brief   Second timer, a timerfd on the real time clock.
+   */
+  int               second_fd;
+  /**
+   * @brief   Callback timing statistics.
+   */
+  RTCStats          stats;
+  /**
+   * @brief   Thread serving the host timers.
+   */
+  Thread            *thd;
+  WORKING_AREA(wa, 256);
 };
 
 /*===========================================================================*/
@@ -158,6 +229,7 @@ extern "C" {
                          RTCAlarm *alarmspec);
   void rtc_lld_set_callback(RTCDriver *rtcp, rtccb_t callback);
   uint32_t rtc_lld_get_time_fat(RTCDriver *rtcp);
+  void rtc_lld_get_stats(RTCDriver *rtcp, RTCStats *stp);
 #ifdef __cplusplus
 }
 #endif
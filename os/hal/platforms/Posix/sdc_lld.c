@@ -22,9 +22,17 @@
  * @{
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
+#include "simutil.h"
 
 #if HAL_USE_SDC || defined(__DOXYGEN__)
 
@@ -32,6 +40,11 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @brief   Capacity granularity of a version 2.0 CSD, in bytes.
+ */
+#define SDC_IMAGE_UNIT      (1024 * MMCSD_BLOCK_SIZE)
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -51,6 +64,121 @@ SDCDriver SDCD1;
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Maps the disk image selected with @p --sim_sdc_image.
+ * @details The image size is rounded down to the CSD capacity
+ *          granularity, the tail is never accessed.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[in] path      disk image file
+ *
+ * @notapi
+ */
+static void sdc_map_image(SDCDriver *sdcp, const char *path) {
+  struct stat st;
+  void *p;
+  int fd;
+
+  if ((fd = open(path, O_RDWR)) < 0 || fstat(fd, &st) < 0) {
+    eprintf("cannot open SDC image %s", path);
+    exit(EXIT_FAILURE);
+  }
+  sdcp->image_size = st.st_size - st.st_size % SDC_IMAGE_UNIT;
+  if (sdcp->image_size == 0) {
+    eprintf("SDC image %s is smaller than %d bytes", path, SDC_IMAGE_UNIT);
+    exit(EXIT_FAILURE);
+  }
+
+  /* the mapping outlives the descriptor */
+  p = mmap(NULL, sdcp->image_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    eprintf("cannot map SDC image %s", path);
+    exit(EXIT_FAILURE);
+  }
+  sdcp->image = p;
+}
+
+/**
+ * @brief   Locates a blocks range in the disk image.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[in] startblk  first block of the range
+ * @param[in] n         number of blocks
+ *
+ * @return              Pointer to the first block, NULL if the range
+ *                      does not fit in the image.
+ *
+ * @notapi
+ */
+static uint8_t *sdc_image_blocks(SDCDriver *sdcp, uint32_t startblk,
+                                 uint32_t n) {
+
+  if ((uint64_t)startblk + n > sdcp->image_size / MMCSD_BLOCK_SIZE) {
+    sdcp->errors |= SDC_OVERFLOW_ERROR;
+    return NULL;
+  }
+  return sdcp->image + (size_t)startblk * MMCSD_BLOCK_SIZE;
+}
+
+/**
+ * @brief   Simulates the card busy time of a command.
+ * @details Sleeps for @p --sim_sdc_latency microseconds, rounded up
+ *          to a whole tick, the other threads keep running.
+ *
+ * @notapi
+ */
+static void sdc_delay(void) {
+  unsigned us = sim_get_sdc_latency();
+
+  if (us > 0)
+    chThdSleepMicroseconds(us);
+}
+
+#if SDC_USE_ASYNC || defined(__DOXYGEN__)
+/**
+ * @brief   Serves the asynchronous requests in order.
+ * @details Each request is carried out with the synchronous functions,
+ *          its callback is then invoked from ISR context and its queue
+ *          slot released. The idle waiters are woken after the last
+ *          outstanding request.
+ *
+ * @param[in] arg       pointer to the @p SDCDriver object
+ *
+ * @notapi
+ */
+static msg_t sdc_async_thread(void *arg) {
+  SDCDriver *sdcp = (SDCDriver *)arg;
+  SDCRequest *rqp;
+  msg_t msg;
+
+  chRegSetThreadName("sdc_async");
+  while (TRUE) {
+    chMBFetch(&sdcp->async_mb, &msg, TIME_INFINITE);
+    rqp = (SDCRequest *)msg;
+
+    if (rqp->write)
+      rqp->status = sdc_lld_write(sdcp, rqp->startblk, rqp->buf, rqp->n);
+    else
+      rqp->status = sdc_lld_read(sdcp, rqp->startblk, rqp->buf, rqp->n);
+
+    if (rqp->end_cb) {
+      CH_IRQ_PROLOGUE();
+      rqp->end_cb(sdcp, rqp);
+      CH_IRQ_EPILOGUE();
+    }
+
+    chSysLock();
+    chSemSignalI(&sdcp->async_slots);
+    if (--sdcp->async_pending == 0)
+      chSemResetI(&sdcp->async_idle, 0);
+    chSchRescheduleS();
+    chSysUnlock();
+  }
+  return 0;
+}
+#endif /* SDC_USE_ASYNC */
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
@@ -67,6 +195,14 @@ SDCDriver SDCD1;
 void sdc_lld_init(void) {
 
   sdcObjectInit(&SDCD1);
+  SDCD1.image = NULL;
+#if SDC_USE_ASYNC
+  chMBInit(&SDCD1.async_mb, SDCD1.async_buf, PLATFORM_SDC_ASYNC_DEPTH);
+  chSemInit(&SDCD1.async_slots, PLATFORM_SDC_ASYNC_DEPTH);
+  SDCD1.async_pending = 0;
+  chSemInit(&SDCD1.async_idle, 0);
+  SDCD1.async_thd = NULL;
+#endif
 }
 
 /**
@@ -79,12 +215,26 @@ void sdc_lld_init(void) {
 void sdc_lld_start(SDCDriver *sdcp) {
 
   if (sdcp->state == BLK_STOP) {
-
+    const char *path = sim_get_sdc_image();
+
+    if (path != NULL)
+      sdc_map_image(sdcp, path);
+#if SDC_USE_ASYNC
+    /* the serving thread is created once and kept across stops */
+    if (sdcp->async_thd == NULL) {
+      sdcp->async_thd = chThdCreateI(sdcp->async_wa, sizeof(sdcp->async_wa),
+                                     PLATFORM_SDC_ASYNC_PRIORITY,
+                                     sdc_async_thread, sdcp);
+      chSchReadyI(sdcp->async_thd);
+    }
+#endif
   }
 }
 
 /**
  * @brief   Deactivates the SDC peripheral.
+ * @note    With @p SDC_USE_ASYNC the outstanding requests have been
+ *          drained by @p sdcStop(), the image can go.
  *
  * @param[in] sdcp      pointer to the @p SDCDriver object
  *
@@ -93,7 +243,10 @@ void sdc_lld_start(SDCDriver *sdcp) {
 void sdc_lld_stop(SDCDriver *sdcp) {
 
   if (sdcp->state != BLK_STOP) {
-
+    if (sdcp->image != NULL) {
+      munmap(sdcp->image, sdcp->image_size);
+      sdcp->image = NULL;
+    }
   }
 }
 
@@ -241,16 +394,27 @@ bool_t sdc_lld_send_cmd_short_crc(SDCDriver *sdcp, uint8_t cmd, uint32_t arg,
 bool_t sdc_lld_send_cmd_long_crc(SDCDriver *sdcp, uint8_t cmd, uint32_t arg,
                                  uint32_t *resp) {
 
-  (void)sdcp;
-  (void)cmd;
   (void)arg;
-  (void)resp;
+
+  /* Version 2.0 CSD with the image capacity, C_SIZE is bits 69..48.*/
+  if (sdcp->image != NULL) {
+    uint32_t c_size = sdcp->image_size / SDC_IMAGE_UNIT - 1;
+
+    memset(resp, 0, 4 * sizeof(uint32_t));
+    if (cmd == MMCSD_CMD_SEND_CSD) {
+      resp[3] = 1U << 30;
+      resp[2] = c_size >> 16;
+      resp[1] = c_size << 16;
+    }
+  }
 
   return CH_SUCCESS;
 }
 
 /**
  * @brief   Reads one or more blocks.
+ * @details With @p --sim_sdc_image the blocks are copied from the mapped
+ *          image, otherwise they are requested from the VHA.
  *
  * @param[in] sdcp      pointer to the @p SDCDriver object
  * @param[in] startblk  first block to read
@@ -266,22 +430,33 @@ bool_t sdc_lld_send_cmd_long_crc(SDCDriver *sdcp, uint8_t cmd, uint32_t arg,
 bool_t sdc_lld_read(SDCDriver *sdcp, uint32_t startblk,
                     uint8_t *buf, uint32_t n) {
 
-  (void)sdcp;
+  if (sdcp->image != NULL) {
+    uint8_t *p = sdc_image_blocks(sdcp, startblk, n);
+
+    if (p == NULL)
+      return CH_FAILED;
+    sdc_delay();
+    memcpy(buf, p, n * MMCSD_BLOCK_SIZE);
+    return CH_SUCCESS;
+  }
 
   /* send read request with starting block and quantity */
   if (sim_printf(SDC_IO, "cmd %s startblk %08x nblks %08x",
       "read", startblk, n) <= 0)
     return CH_FAILED;
 
-  /* wait for data */
-  if ((sim_read(SDC_IO, buf, n * MMCSD_BLOCK_SIZE)) <= 0)
-      return CH_FAILED;
+  /* wait for data, the VHA may send it in several messages */
+  if (sim_read_exact(SDC_IO, buf, n * MMCSD_BLOCK_SIZE) !=
+      (ssize_t)(n * MMCSD_BLOCK_SIZE))
+    return CH_FAILED;
 
   return CH_SUCCESS;
 }
 
 /**
  * @brief   Writes one or more blocks.
+ * @details With @p --sim_sdc_image the blocks are copied into the mapped
+ *          image, otherwise they are sent to the VHA.
  *
  * @param[in] sdcp      pointer to the @p SDCDriver object
  * @param[in] startblk  first block to write
@@ -297,7 +472,15 @@ bool_t sdc_lld_read(SDCDriver *sdcp, uint32_t startblk,
 bool_t sdc_lld_write(SDCDriver *sdcp, uint32_t startblk,
                      const uint8_t *buf, uint32_t n) {
 
-  (void)sdcp;
+  if (sdcp->image != NULL) {
+    uint8_t *p = sdc_image_blocks(sdcp, startblk, n);
+
+    if (p == NULL)
+      return CH_FAILED;
+    sdc_delay();
+    memcpy(p, buf, n * MMCSD_BLOCK_SIZE);
+    return CH_SUCCESS;
+  }
 
   /* send write request with starting block and quantity */
   if (sim_printf(SDC_IO, "cmd %s startblk %08x nblks %08x",
@@ -313,6 +496,7 @@ bool_t sdc_lld_write(SDCDriver *sdcp, uint32_t startblk,
 
 /**
  * @brief   Waits for card idle condition.
+ * @details With @p --sim_sdc_image the image is flushed to its file.
  *
  * @param[in] sdcp      pointer to the @p SDCDriver object
  *
@@ -324,11 +508,63 @@ bool_t sdc_lld_write(SDCDriver *sdcp, uint32_t startblk,
  */
 bool_t sdc_lld_sync(SDCDriver *sdcp) {
 
-  (void)sdcp;
+  if (sdcp->image != NULL) {
+    sdc_delay();
+    if (msync(sdcp->image, sdcp->image_size, MS_SYNC) < 0)
+      return CH_FAILED;
+  }
+
+  return CH_SUCCESS;
+}
+
+#if SDC_USE_ASYNC || defined(__DOXYGEN__)
+/**
+ * @brief   Queues an asynchronous request.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[in] rqp       pointer to the request
+ *
+ * @return              The operation status.
+ * @retval CH_SUCCESS   the request has been queued.
+ * @retval CH_FAILED    @p PLATFORM_SDC_ASYNC_DEPTH requests are already
+ *                      outstanding.
+ *
+ * @notapi
+ */
+bool_t sdc_lld_start_request(SDCDriver *sdcp, SDCRequest *rqp) {
+
+  chSysLock();
+  if (chSemGetCounterI(&sdcp->async_slots) <= 0) {
+    chSysUnlock();
+    return CH_FAILED;
+  }
+  chSemFastWaitI(&sdcp->async_slots);
+  sdcp->async_pending++;
+  chMBPostI(&sdcp->async_mb, (msg_t)rqp);
+  chSchRescheduleS();
+  chSysUnlock();
 
   return CH_SUCCESS;
 }
 
+/**
+ * @brief   Waits for the outstanding requests to complete.
+ * @details Any number of threads can wait at the same time, they are
+ *          all woken when the last request completes.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ *
+ * @notapi
+ */
+void sdc_lld_wait_idle(SDCDriver *sdcp) {
+
+  chSysLock();
+  while (sdcp->async_pending > 0)
+    (void)chSemWaitS(&sdcp->async_idle);
+  chSysUnlock();
+}
+#endif /* SDC_USE_ASYNC */
+
 #endif /* HAL_USE_SDC */
 
 /** @} */
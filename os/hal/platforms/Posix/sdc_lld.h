@@ -46,12 +46,30 @@
 #if !defined(PLATFORM_SDC_USE_SDC1) || defined(__DOXYGEN__)
 #define PLATFORM_SDC_USE_SDC1               TRUE
 #endif
+
+/**
+ * @brief   Maximum number of outstanding asynchronous requests.
+ */
+#if !defined(PLATFORM_SDC_ASYNC_DEPTH) || defined(__DOXYGEN__)
+#define PLATFORM_SDC_ASYNC_DEPTH            4
+#endif
+
+/**
+ * @brief   Priority of the thread serving the asynchronous requests.
+ */
+#if !defined(PLATFORM_SDC_ASYNC_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_SDC_ASYNC_PRIORITY         (NORMALPRIO + 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
 
+#if SDC_USE_ASYNC && (!CH_USE_MAILBOXES || !CH_USE_SEMAPHORES)
+#error "SDC_USE_ASYNC requires CH_USE_MAILBOXES and CH_USE_SEMAPHORES"
+#endif
+
 /*===========================================================================*/
 /* Driver data structures and types.                                         */
 /*===========================================================================*/
@@ -129,6 +147,41 @@ struct SDCDriver {
    */
   uint32_t                  rca;
   /* End of the mandatory fields.*/
+  /**
+   * @brief Mapped disk image, NULL when the VHA serves the card.
+   */
+  uint8_t                   *image;
+  /**
+   * @brief Size of the mapped disk image in bytes.
+   */
+  size_t                    image_size;
+#if SDC_USE_ASYNC || defined(__DOXYGEN__)
+  /**
+   * @brief Queued asynchronous requests.
+   */
+  Mailbox                   async_mb;
+  /**
+   * @brief Storage of the requests queue.
+   */
+  msg_t                     async_buf[PLATFORM_SDC_ASYNC_DEPTH];
+  /**
+   * @brief Free slots in the requests queue.
+   */
+  Semaphore                 async_slots;
+  /**
+   * @brief Requests queued and not completed yet.
+   */
+  cnt_t                     async_pending;
+  /**
+   * @brief Waiters for the end of the requests, all woken at once.
+   */
+  Semaphore                 async_idle;
+  /**
+   * @brief Thread serving the requests, like a DMA engine would.
+   */
+  Thread                    *async_thd;
+  WORKING_AREA(async_wa, 1024);
+#endif
 };
 
 /*===========================================================================*/
@@ -191,6 +244,10 @@ extern "C" {
   bool_t sdc_lld_write(SDCDriver *sdcp, uint32_t startblk,
                        const uint8_t *buf, uint32_t n);
   bool_t sdc_lld_sync(SDCDriver *sdcp);
+#if SDC_USE_ASYNC
+  bool_t sdc_lld_start_request(SDCDriver *sdcp, SDCRequest *rqp);
+  void sdc_lld_wait_idle(SDCDriver *sdcp);
+#endif
   bool_t sdc_lld_is_card_inserted(SDCDriver *sdcp);
   bool_t sdc_lld_is_write_protected(SDCDriver *sdcp);
 #ifdef __cplusplus
@@ -45,12 +45,29 @@
 #include "ch.h"
 #include "sim_preempt.h"
 
-/* Tunable setting adjusts responsiveness of *
- * the scheduler when spinning on a socket.  *
- * Setting this value too low will cause the *
- * scheduler to lag. Too high and the socket *
- * response will lag.                        */
-#define SPIN_SLEEP_TICKS 3
+/**
+ * @brief   Sleep until an fd may be ready
+ * @note    Falls back to a one tick sleep when the
+ *          port cannot watch the fds for us
+ *
+ * @param[in] fds       The fds to wait for
+ * @param[in] nfds      The number of fds
+ * @param[in] start     Start of the wait
+ * @param[in] timeout   Ticks from start or TIME_INFINITE
+ */
+static void spin_wait(struct pollfd *fds, nfds_t nfds,
+                      systime_t start, systime_t timeout) {
+  if (timeout != TIME_INFINITE) {
+    systime_t elapsed = chTimeNow() - start;
+    if (elapsed >= timeout)
+      return;
+    timeout -= elapsed;
+  }
+
+  if (nfds > PORT_MAX_IO_WAITS ||
+      port_wait_io(fds, nfds, timeout) == RDY_RESET)
+    chThdSleep(1);
+}
 
 /**
  * @brief   Spin around a fd until data becomes
@@ -99,10 +116,10 @@ static int spin_poll(systime_t timeout, int fd) {
       }
     }
 
-    /* No data available    *
-     * force the reschedule */
+    /* No data available       *
+     * sleep until there may be */
     else if (nfds == 0) {
-      chThdSleep(SPIN_SLEEP_TICKS);
+      spin_wait(&fds, 1, start, timeout);
       continue;
     }
 
@@ -179,16 +196,17 @@ extern size_t sim_preempt_read_timeout(int fd, void *buf, size_t bufsz, systime_
 extern int sim_preempt_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
   int rv = 0;
 
-  /* set loop spin timeout */
+  /* set loop spin timeout, negative waits forever like poll() */
   systime_t start = chTimeNow();
-  systime_t end   = start + MS2ST(timeout);
+  systime_t ticks = timeout < 0 ? TIME_INFINITE : MS2ST(timeout);
+  systime_t end   = start + ticks;
 
   /* spin poll until error, spin timeout, or fds are waiting */
-  while (chTimeIsWithin(start, end)) {
+  while (ticks == TIME_INFINITE || chTimeIsWithin(start, end)) {
     if ((rv = poll(fds, nfds, 0)) != 0)
       return rv;
-    /* force reschedule */
-    chThdSleep(SPIN_SLEEP_TICKS);
+    /* sleep until an fd may be ready */
+    spin_wait(fds, nfds, start, ticks);
   }
 
   /* timeout */
@@ -210,23 +228,56 @@ extern int sim_preempt_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
  *                      -1 on error
  */
 extern int sim_preempt_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
-  struct timeval now, end, no_wait = {0,0};
-  int rv = 0;
+  struct timeval now, end, left, no_wait = {0,0};
+  struct pollfd fds[PORT_MAX_IO_WAITS];
+  fd_set rfds, wfds, efds;
+  nfds_t n = 0;
+  int fd, rv = 0;
 
   /* set loop spin timeout */
   if ((rv = gettimeofday(&now, NULL)))
     return rv;
   timeradd(&now, timeout, &end);
 
+  /* select() clobbers the sets, keep the originals for retries */
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  FD_ZERO(&efds);
+  if (readfds)   rfds = *readfds;
+  if (writefds)  wfds = *writefds;
+  if (exceptfds) efds = *exceptfds;
+
+  /* the same fds as a poll set for the port to wait on */
+  for (fd = 0; fd < nfds; fd++) {
+    short events = (FD_ISSET(fd, &rfds) ? POLLIN  : 0) |
+                   (FD_ISSET(fd, &wfds) ? POLLOUT : 0) |
+                   (FD_ISSET(fd, &efds) ? POLLPRI : 0);
+    if (!events)
+      continue;
+    if (n < PORT_MAX_IO_WAITS) {
+      fds[n].fd = fd;
+      fds[n].events = events;
+      fds[n].revents = 0;
+    }
+    n++;
+  }
+
   /* spin select until error, spin timeout, or fds are waiting */
   while (timercmp(&now, &end, <)) {
+    if (readfds)   *readfds   = rfds;
+    if (writefds)  *writefds  = wfds;
+    if (exceptfds) *exceptfds = efds;
     if ((rv = select(nfds, readfds, writefds, exceptfds, &no_wait)) != 0)
       return rv;
     /* update timer */
     if ((rv = gettimeofday(&now, NULL)))
       return rv;
-    /* force reschedule */
-    chThdSleep(SPIN_SLEEP_TICKS);
+    /* sleep until an fd may be ready */
+    if (timercmp(&now, &end, <)) {
+      timersub(&end, &now, &left);
+      spin_wait(fds, n, chTimeNow(),
+                MS2ST(left.tv_sec * 1000 + left.tv_usec / 1000) + 1);
+    }
   }
 
   /* timeout */
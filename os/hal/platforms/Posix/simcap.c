@@ -0,0 +1,395 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simcap.c
+ * @brief   Simio traffic capture and replay.
+ * @details A replay feeds the recorded input frames to the LLDs and
+ *          checks every output frame against the recording of the
+ *          same HID. With a speed of zero an input is fed as soon as
+ *          every output recorded before it has been written, which
+ *          keeps causality but skips the idle time in between.
+ *          Otherwise inputs are fed at their recorded tick divided
+ *          by the speed.
+ *
+ * @addtogroup SIMCAP
+ * @{
+ */
+
+#if defined(SIMULATOR) || defined(__DOXYGEN__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "simcap.h"
+
+/**
+ * @brief   Recording state
+ */
+static FILE *rec_file;
+
+/**
+ * @brief   Replay state
+ * @details Recorded outputs wait in @p expect_mb until the LLD
+ *          for their HID writes, @p out_pending counts them and
+ *          @p match_sem is signaled on every write.
+ */
+static FILE *play_file;
+static unsigned play_speed;
+static uint32_t play_freq;
+static uint32_t play_t0;
+static systime_t play_start;
+static bool_t play_started;
+static msg_t expectq[HID_COUNT][MB_QUEUE_SIZE];
+static Mailbox expect_mb[HID_COUNT];
+static Semaphore match_sem;
+static cnt_t out_pending;
+static simcap_stats_t stats;
+
+/**
+ * @brief   Flush and close the recording
+ *
+ * @notapi
+ */
+static void _simcap_record_close(void) {
+  if (rec_file)
+    (void)fclose(rec_file);
+  rec_file = NULL;
+}
+
+/**
+ * @brief   Start recording simio traffic
+ *
+ * @param[in] path      the capture file to create
+ *
+ * @return              0 on success, -1 and errno on failure
+ *
+ * @notapi
+ */
+extern int simcap_record_open(const char *path) {
+  simcap_file_hdr_t hdr;
+
+  if ((rec_file = fopen(path, "wb")) == NULL)
+    return -1;
+
+  memset(&hdr, 0, sizeof hdr);
+  memcpy(hdr.magic, SIMCAP_MAGIC, sizeof SIMCAP_MAGIC);
+  hdr.frequency = CH_FREQUENCY;
+
+  if (fwrite(&hdr, sizeof hdr, 1, rec_file) != 1) {
+    _simcap_record_close();
+    return -1;
+  }
+
+  atexit(_simcap_record_close);
+  return 0;
+}
+
+/**
+ * @brief   Record one frame
+ * @note    SIM_IO frames belong to simio itself and are skipped.
+ *
+ * @param[in] hid       hal identifier
+ * @param[in] dir       @p SIMCAP_IN or @p SIMCAP_OUT
+ * @param[in] buf       the frame payload
+ * @param[in] len       the payload size
+ *
+ * @notapi
+ */
+extern void simcap_record(sim_hal_id_t hid, int dir, const void *buf, size_t len) {
+  simcap_rec_hdr_t rec;
+
+  if (!rec_file || hid == SIM_IO)
+    return;
+
+  rec.tick = chTimeNow();
+  rec.hid = (uint8_t)hid;
+  rec.dir = (uint8_t)dir;
+  rec.reserved = 0;
+  rec.len = (uint32_t)len;
+
+  if (fwrite(&rec, sizeof rec, 1, rec_file) != 1 ||
+      fwrite(buf, 1, len, rec_file) != len) {
+    eprintf("capture write failed, recording stopped");
+    _simcap_record_close();
+  }
+}
+
+/**
+ * @brief   Fail the process if the replay found differences
+ *
+ * @notapi
+ */
+static void _simcap_replay_exit(void) {
+  if (simcap_replay_failed()) {
+    fflush(NULL);
+    _exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Start replaying a capture
+ * @note    Repeated calls return the already open capture.
+ *
+ * @param[in] path      the capture file
+ * @param[in] speed     0 to run as fast as causality allows, otherwise
+ *                      the multiple of the recorded pace
+ *
+ * @return              a file descriptor for the capture or -1 and
+ *                      errno on failure
+ *
+ * @notapi
+ */
+extern int simcap_replay_open(const char *path, unsigned speed) {
+  simcap_file_hdr_t hdr;
+  int i;
+
+  if (play_file)
+    return fileno(play_file);
+
+  if ((play_file = fopen(path, "rb")) == NULL)
+    return -1;
+
+  if (fread(&hdr, sizeof hdr, 1, play_file) != 1 ||
+      memcmp(hdr.magic, SIMCAP_MAGIC, sizeof SIMCAP_MAGIC) ||
+      hdr.frequency == 0) {
+    (void)fclose(play_file);
+    play_file = NULL;
+    errno = EPROTO;
+    return -1;
+  }
+
+  play_freq = hdr.frequency;
+  play_speed = speed;
+  for (i = 0; i < HID_COUNT; i++)
+    chMBInit(&expect_mb[i], expectq[i], MB_QUEUE_SIZE);
+  chSemInit(&match_sem, 0);
+
+  atexit(_simcap_replay_exit);
+  return fileno(play_file);
+}
+
+/**
+ * @brief   Read the next record of the capture
+ *
+ * @param[out] rec      the record header
+ *
+ * @return              the record as a message or NULL at the end
+ *                      of the capture
+ *
+ * @notapi
+ */
+static sim_msg_t* _simcap_read(simcap_rec_hdr_t *rec) {
+  sim_msg_t *msg;
+
+  if (fread(rec, sizeof *rec, 1, play_file) != 1)
+    return NULL;
+
+  msg = sim_msg_alloc(rec->len);
+  if (fread(msg->buf->data, 1, rec->len, play_file) != rec->len) {
+    eprintf("truncated capture");
+    sim_msg_free(msg);
+    return NULL;
+  }
+  msg->buf->dlen = rec->len;
+  msg->hid = rec->hid;
+
+  return msg;
+}
+
+/**
+ * @brief   Give up on the oldest expected output of a HID
+ *
+ * @return              TRUE if there was one
+ *
+ * @notapi
+ */
+static bool_t _simcap_drop(int hid) {
+  msg_t m;
+
+  if (chMBFetch(&expect_mb[hid], &m, TIME_IMMEDIATE) != RDY_OK)
+    return FALSE;
+
+  eprintf("replay missing hid %d frame of %u bytes",
+          hid, (unsigned)((sim_msg_t*)m)->buf->dlen);
+  sim_msg_free((sim_msg_t*)m);
+  stats.missing++;
+  out_pending--;
+  return TRUE;
+}
+
+/**
+ * @brief   Queue a recorded output for matching
+ *
+ * @notapi
+ */
+static void _simcap_expect(sim_msg_t *msg) {
+  out_pending++;
+  while (chMBPost(&expect_mb[msg->hid], (msg_t)msg, SIMCAP_TIMEOUT) != RDY_OK)
+    (void)_simcap_drop(msg->hid);
+}
+
+/**
+ * @brief   Wait until every queued output has been written
+ * @details Outputs that do not show up within @p SIMCAP_TIMEOUT
+ *          are counted as missing.
+ *
+ * @notapi
+ */
+static void _simcap_wait_outputs(void) {
+  int hid;
+
+  while (out_pending > 0) {
+    if (chSemWaitTimeout(&match_sem, SIMCAP_TIMEOUT) == RDY_OK)
+      continue;
+    for (hid = 0; hid < HID_COUNT; hid++)
+      while (_simcap_drop(hid))
+        ;
+  }
+}
+
+/**
+ * @brief   Wait until an input is due
+ *
+ * @param[in] tick      the recorded tick of the input
+ *
+ * @notapi
+ */
+static void _simcap_wait_due(uint32_t tick) {
+  systime_t due, now;
+
+  if (play_speed == 0) {
+    _simcap_wait_outputs();
+    return;
+  }
+
+  due = play_start + (systime_t)((uint64_t)(tick - play_t0) * CH_FREQUENCY /
+                                 play_freq / play_speed);
+  now = chTimeNow();
+  if ((int32_t)(due - now) > 0)
+    chThdSleep(due - now);
+}
+
+/**
+ * @brief   Get the next recorded input
+ * @details Blocks until the input is due, recorded outputs met on
+ *          the way are queued for matching.
+ *
+ * @return              the input as a message or NULL at the end of
+ *                      the capture, once every output was matched or
+ *                      given up on
+ *
+ * @notapi
+ */
+extern sim_msg_t* simcap_replay_next(void) {
+  simcap_rec_hdr_t rec;
+  sim_msg_t *msg;
+
+  while ((msg = _simcap_read(&rec)) != NULL) {
+    if (!play_started) {
+      play_started = TRUE;
+      play_start = chTimeNow();
+      play_t0 = rec.tick;
+    }
+
+    if (rec.hid == SIM_IO || rec.hid >= HID_COUNT) {
+      sim_msg_free(msg);
+      continue;
+    }
+
+    if (rec.dir == SIMCAP_OUT) {
+      _simcap_expect(msg);
+      continue;
+    }
+
+    _simcap_wait_due(rec.tick);
+    stats.inputs++;
+    return msg;
+  }
+
+  _simcap_wait_outputs();
+  return NULL;
+}
+
+/**
+ * @brief   Check an output against the recording
+ *
+ * @param[in] hid       hal identifier
+ * @param[in] buf       the frame payload
+ * @param[in] len       the payload size
+ *
+ * @notapi
+ */
+extern void simcap_replay_match(sim_hal_id_t hid, const void *buf, size_t len) {
+  sim_msg_t *exp;
+  msg_t m;
+
+  if (chMBFetch(&expect_mb[hid], &m, SIMCAP_TIMEOUT) != RDY_OK) {
+    eprintf("replay unexpected hid %d frame of %u bytes", hid, (unsigned)len);
+    stats.unexpected++;
+    return;
+  }
+
+  exp = (sim_msg_t*)m;
+  if (exp->buf->dlen != len || memcmp(exp->buf->data, buf, len)) {
+    eprintf("replay mismatch hid %d recorded %u bytes, written %u bytes",
+            hid, (unsigned)exp->buf->dlen, (unsigned)len);
+    stats.mismatched++;
+  }
+  else
+    stats.matched++;
+
+  sim_msg_free(exp);
+  out_pending--;
+  chSemSignal(&match_sem);
+}
+
+/**
+ * @brief   Copy the replay results
+ *
+ * @api
+ */
+extern void simcap_replay_stats(simcap_stats_t *st) {
+  chSysLock();
+  *st = stats;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Did the replay find any difference?
+ *
+ * @api
+ */
+extern int simcap_replay_failed(void) {
+  return stats.mismatched || stats.missing || stats.unexpected;
+}
+
+#endif /* SIMULATOR */
+
+/** @} */
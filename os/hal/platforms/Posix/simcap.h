@@ -0,0 +1,104 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simcap.h
+ * @brief   Simio traffic capture and replay.
+ * @details A capture file is a @p simcap_file_hdr_t followed by one
+ *          @p simcap_rec_hdr_t and the raw payload per frame, all in
+ *          host byte order.
+ *
+ * @addtogroup SIMCAP
+ * @{
+ */
+
+#ifndef SIMCAP_H
+#define SIMCAP_H
+
+#if defined(SIMULATOR) || defined(__DOXYGEN__)
+
+#include <stdint.h>
+#include "ch.h"
+#include "simio.h"
+#include "simutil.h"
+
+#define SIMCAP_MAGIC    "SIMCAP1"
+
+/* frame directions */
+#define SIMCAP_IN       0   /* VHA to LLD */
+#define SIMCAP_OUT      1   /* LLD to VHA */
+
+/**
+ * @brief   Time a replay waits for an expected output frame
+ */
+#ifndef SIMCAP_TIMEOUT
+#define SIMCAP_TIMEOUT S2ST(5)
+#endif
+
+/**
+ * @brief   Capture file header
+ */
+typedef struct __attribute__((packed)) {
+  char          magic[8];
+  uint32_t      frequency;  /* CH_FREQUENCY of the recording */
+  uint32_t      reserved;
+} simcap_file_hdr_t;
+
+/**
+ * @brief   Frame record header
+ */
+typedef struct __attribute__((packed)) {
+  uint32_t      tick;       /* system time when the frame was seen */
+  uint8_t       hid;
+  uint8_t       dir;
+  uint16_t      reserved;
+  uint32_t      len;
+} simcap_rec_hdr_t;
+
+/**
+ * @brief   Replay results
+ */
+typedef struct {
+  uint32_t      inputs;     /* frames fed to the LLDs */
+  uint32_t      matched;    /* outputs equal to the recording */
+  uint32_t      mismatched; /* outputs that differ from the recording */
+  uint32_t      missing;    /* recorded outputs never written */
+  uint32_t      unexpected; /* outputs with no recorded counterpart */
+} simcap_stats_t;
+
+extern int simcap_record_open(const char *path);
+extern void simcap_record(sim_hal_id_t hid, int dir, const void *buf, size_t len);
+
+extern int simcap_replay_open(const char *path, unsigned speed);
+extern sim_msg_t* simcap_replay_next(void);
+extern void simcap_replay_match(sim_hal_id_t hid, const void *buf, size_t len);
+extern void simcap_replay_stats(simcap_stats_t *st);
+extern int simcap_replay_failed(void);
+
+#endif /* SIMULATOR */
+#endif /* SIMCAP_H */
+
+/** @} */
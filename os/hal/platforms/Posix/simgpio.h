@@ -0,0 +1,116 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simgpio.h
+ * @brief   Shared memory GPIO register bank.
+ * @details The simulator creates the bank, the PAL driver keeps its
+ *          ports in it and a test process maps it to watch the
+ *          outputs and drive the inputs with no socket traffic.
+ *          Every latch change is appended to an event ring read by
+ *          the test process. After changing @p pin the test process
+ *          writes a byte to the doorbell FIFO, the EXT driver sleeps
+ *          on it and raises the channel callbacks.
+ * @note    This file has no ChibiOS dependencies so a C test harness
+ *          can include it. The python side is simgpio.py.
+ *
+ * @addtogroup SIMGPIO
+ * @{
+ */
+
+#ifndef SIMGPIO_H
+#define SIMGPIO_H
+
+#include <stdint.h>
+
+#define SIMGPIO_MAGIC   0x53475049  /* "SGPI" */
+#define SIMGPIO_VERSION 1
+
+/* ports in the bank */
+#define SIMGPIO_PORTS   4
+
+/* latch events in the ring, must be a power of two */
+#define SIMGPIO_EVENTS  4096
+
+/* the bank is mapped over whole pages, largest Linux page size */
+#define SIMGPIO_PAGE    65536
+
+/* doorbell FIFO path from the bank name */
+#define SIMGPIO_BELL_FMT "/dev/shm/%s.bell"
+
+/**
+ * @brief   Port registers
+ */
+typedef struct {
+  /**
+   * @brief   Output latch, written by the simulator.
+   */
+  volatile uint32_t   latch;
+  /**
+   * @brief   Level of the input pins, written by the test process.
+   */
+  volatile uint32_t   pin;
+  /**
+   * @brief   Direction of the bits, 0=input, 1=output.
+   */
+  volatile uint32_t   dir;
+} simgpio_port_t;
+
+/**
+ * @brief   Latch change event
+ */
+typedef struct {
+  uint32_t            time;       /* system time of the change */
+  uint32_t            port;       /* port index */
+  uint32_t            changed;    /* latch bits that changed */
+  uint32_t            latch;      /* latch after the change */
+} simgpio_event_t;
+
+/**
+ * @brief   Bank layout
+ * @note    @p head and @p tail are free running event counts. An
+ *          event that finds the ring full is counted in @p dropped.
+ */
+typedef struct {
+  uint32_t            magic;
+  uint32_t            version;
+  uint32_t            nports;     /* SIMGPIO_PORTS */
+  uint32_t            nevents;    /* SIMGPIO_EVENTS */
+  simgpio_port_t      port[SIMGPIO_PORTS];
+  volatile uint32_t   head;       /* written by the simulator */
+  volatile uint32_t   tail;       /* written by the test process */
+  volatile uint32_t   dropped;
+  volatile uint32_t   sleeping;   /* the EXT driver waits on the doorbell */
+  simgpio_event_t     event[SIMGPIO_EVENTS];
+} simgpio_bank_t;
+
+/* shared memory size, the bank rounded up to whole pages */
+#define SIMGPIO_BANK_SIZE                                                   \
+  ((sizeof(simgpio_bank_t) + SIMGPIO_PAGE - 1) & ~(SIMGPIO_PAGE - 1))
+
+#endif /* SIMGPIO_H */
+
+/** @} */
@@ -0,0 +1,101 @@
+"""Test process side of the simulator shared GPIO bank.
+
+Mirrors the layout in simgpio.h. The simulator creates the bank when
+started with --sim_gpio=<name>.
+
+  gpio = SimGpio('rig0')
+  gpio.drive(1, 1 << 0, 1)    # IOPORT2 pad 0 high
+  for tick, port, changed, latch in gpio.events():
+    ...
+  gpio.close()
+"""
+import errno
+import mmap
+import os
+import struct
+import time
+
+MAGIC   = 0x53475049
+VERSION = 1
+PORTS   = 4
+EVENTS  = 4096
+
+U32      = struct.Struct('=I')
+PORT     = struct.Struct('=III')   # latch, pin, dir
+EVENT    = struct.Struct('=IIII')  # time, port, changed, latch
+PORT0    = 16                      # offset of port[0]
+HEAD     = PORT0 + PORTS * PORT.size
+TAIL     = HEAD + 4
+DROPPED  = HEAD + 8
+EVENT0   = HEAD + 16               # offset of event[0]
+SIZE     = EVENT0 + EVENTS * EVENT.size
+
+LATCH, PIN, DIR = 0, 4, 8          # port register offsets
+
+BELL_FMT = '/dev/shm/%s.bell'
+
+class SimGpio(object):
+  def __init__(self, name, timeout=5.0):
+    """Map the bank, waiting up to timeout seconds for the simulator"""
+    end = time.time() + timeout
+    self.mem = None
+    while True:
+      try:
+        fd = os.open('/dev/shm/' + name, os.O_RDWR)
+        if os.fstat(fd).st_size >= SIZE:
+          self.mem = mmap.mmap(fd, SIZE)
+        os.close(fd)
+      except OSError as e:
+        if e.errno != errno.ENOENT:
+          raise
+      if self.mem and self._get(0) == MAGIC:
+        break
+      if time.time() > end:
+        raise IOError('no gpio bank %s' % name)
+      time.sleep(0.01)
+    if self._get(4) != VERSION:
+      raise IOError('gpio bank version %d' % self._get(4))
+    self.bell = os.open(BELL_FMT % name, os.O_WRONLY | os.O_NONBLOCK)
+
+  def close(self):
+    self.mem.close()
+    os.close(self.bell)
+
+  def _get(self, off):
+    return U32.unpack_from(self.mem, off)[0]
+
+  def _reg(self, port, reg):
+    return self._get(PORT0 + port * PORT.size + reg)
+
+  def latch(self, port):
+    return self._reg(port, LATCH)
+
+  def dir(self, port):
+    return self._reg(port, DIR)
+
+  def drive(self, port, mask, level):
+    """Drive the input pins in mask high or low"""
+    pin = self._reg(port, PIN)
+    pin = pin | mask if level else pin & ~mask
+    U32.pack_into(self.mem, PORT0 + port * PORT.size + PIN, pin)
+    # python has no store fence, always ring instead of
+    # checking the sleeping flag
+    try:
+      os.write(self.bell, '\0')
+    except OSError as e:
+      if e.errno != errno.EAGAIN:
+        raise
+
+  def events(self):
+    """Take the latch changes as (tick, port, changed, latch)"""
+    head, tail = self._get(HEAD), self._get(TAIL)
+    out = []
+    while tail != head:
+      out.append(EVENT.unpack_from(self.mem,
+                 EVENT0 + (tail & (EVENTS - 1)) * EVENT.size))
+      tail = (tail + 1) & 0xffffffff
+    U32.pack_into(self.mem, TAIL, tail)
+    return out
+
+  def dropped(self):
+    return self._get(DROPPED)
@@ -0,0 +1,389 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simhex.c
+ * @brief   Hex codec for the text simulator protocol.
+ * @details The scalar kernel works from lookup tables, the SSE2 and
+ *          AVX2 kernels convert 16 or 32 bytes per step and leave
+ *          the tail to the scalar kernel. The vector kernels are
+ *          built with per function target attributes so the rest of
+ *          the simulator keeps its baseline instruction set.
+ *
+ * @addtogroup SIMHEX
+ * @{
+ */
+
+#if defined(SIMULATOR) || defined(__DOXYGEN__)
+
+#include <string.h>
+#include <errno.h>
+
+#include "simhex.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SIMHEX_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief   A codec implementation
+ */
+typedef struct {
+  const char    *name;
+  int           (*supported)(void);
+  size_t        (*encode)(char *dst, const uint8_t *src, size_t len);
+  ssize_t       (*decode)(uint8_t *dst, const char *src, size_t len);
+} simhex_kernel_t;
+
+/**
+ * @brief   Lookup tables
+ * @details @p enc_table holds the two digits of every byte in
+ *          memory order, @p dec_table the value of every digit
+ *          or -1.
+ */
+static uint16_t enc_table[256];
+static int8_t dec_table[256];
+
+static const simhex_kernel_t *kernel;
+
+/*===========================================================================*/
+/* Scalar kernel.                                                            */
+/*===========================================================================*/
+
+static int scalar_supported(void) {
+  return 1;
+}
+
+static size_t scalar_encode(char *dst, const uint8_t *src, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    memcpy(dst + i*2, &enc_table[src[i]], 2);
+
+  return len*2;
+}
+
+static ssize_t scalar_decode(uint8_t *dst, const char *src, size_t len) {
+  int hi, lo;
+  size_t i;
+
+  for (i = 0; i < len/2; i++) {
+    hi = dec_table[(uint8_t)src[i*2]];
+    lo = dec_table[(uint8_t)src[i*2+1]];
+    if ((hi | lo) < 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    dst[i] = (uint8_t)(hi << 4 | lo);
+  }
+
+  return (ssize_t)i;
+}
+
+#if SIMHEX_X86
+
+/*===========================================================================*/
+/* SSE2 kernel.                                                              */
+/*===========================================================================*/
+
+static int sse2_supported(void) {
+  return __builtin_cpu_supports("sse2");
+}
+
+/* nibbles 0..15 to lower case digits */
+__attribute__((target("sse2")))
+static inline __m128i sse2_digits(__m128i n) {
+  __m128i gap = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                              _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), gap);
+}
+
+/* digits to nibbles, flags anything else in bad */
+__attribute__((target("sse2")))
+static inline __m128i sse2_nibbles(__m128i c, __m128i *bad) {
+  __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i a = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i dok = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+  __m128i aok = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+
+  *bad = _mm_or_si128(*bad, _mm_xor_si128(_mm_or_si128(dok, aok),
+                                          _mm_set1_epi8(-1)));
+  return _mm_or_si128(_mm_and_si128(dok, d),
+                      _mm_and_si128(aok, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+/* nibble pairs to bytes in the low half of each 16 bit lane */
+__attribute__((target("sse2")))
+static inline __m128i sse2_join(__m128i n) {
+  return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0xff)), 4),
+                      _mm_srli_epi16(n, 8));
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_encode(char *dst, const uint8_t *src, size_t len) {
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i v, hi, lo;
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    v = _mm_loadu_si128((const __m128i*)(src + i));
+    hi = sse2_digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    lo = sse2_digits(_mm_and_si128(v, mask));
+    _mm_storeu_si128((__m128i*)(dst + i*2), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i*)(dst + i*2 + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+
+  return i*2 + scalar_encode(dst + i*2, src + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static ssize_t sse2_decode(uint8_t *dst, const char *src, size_t len) {
+  __m128i bad = _mm_setzero_si128(), a, b;
+  ssize_t nb;
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    a = sse2_nibbles(_mm_loadu_si128((const __m128i*)(src + i)), &bad);
+    b = sse2_nibbles(_mm_loadu_si128((const __m128i*)(src + i + 16)), &bad);
+    _mm_storeu_si128((__m128i*)(dst + i/2),
+                     _mm_packus_epi16(sse2_join(a), sse2_join(b)));
+  }
+
+  if (_mm_movemask_epi8(bad)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((nb = scalar_decode(dst + i/2, src + i, len - i)) < 0)
+    return -1;
+  return (ssize_t)(i/2) + nb;
+}
+
+/*===========================================================================*/
+/* AVX2 kernel.                                                              */
+/*===========================================================================*/
+
+static int avx2_supported(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_digits(__m256i n) {
+  __m256i gap = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                 _mm256_set1_epi8('a' - '0' - 10));
+  return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), gap);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_nibbles(__m256i c, __m256i *bad) {
+  __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  __m256i a = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+                              _mm256_set1_epi8('a'));
+  __m256i dok = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+  __m256i aok = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(5)), a);
+
+  *bad = _mm256_or_si256(*bad, _mm256_xor_si256(_mm256_or_si256(dok, aok),
+                                                _mm256_set1_epi8(-1)));
+  return _mm256_or_si256(_mm256_and_si256(dok, d),
+                         _mm256_and_si256(aok, _mm256_add_epi8(a, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_join(__m256i n) {
+  return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0xff)), 4),
+                         _mm256_srli_epi16(n, 8));
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_encode(char *dst, const uint8_t *src, size_t len) {
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  __m256i v, hi, lo, l, h;
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    v = _mm256_loadu_si256((const __m256i*)(src + i));
+    hi = avx2_digits(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+    lo = avx2_digits(_mm256_and_si256(v, mask));
+    /* unpacking works per 128 bit lane, put the lanes back in order */
+    l = _mm256_unpacklo_epi8(hi, lo);
+    h = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i*)(dst + i*2), _mm256_permute2x128_si256(l, h, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + i*2 + 32), _mm256_permute2x128_si256(l, h, 0x31));
+  }
+
+  return i*2 + sse2_encode(dst + i*2, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static ssize_t avx2_decode(uint8_t *dst, const char *src, size_t len) {
+  __m256i bad = _mm256_setzero_si256(), a, b;
+  ssize_t nb;
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    a = avx2_nibbles(_mm256_loadu_si256((const __m256i*)(src + i)), &bad);
+    b = avx2_nibbles(_mm256_loadu_si256((const __m256i*)(src + i + 32)), &bad);
+    /* packing works per 128 bit lane, put the quadwords back in order */
+    _mm256_storeu_si256((__m256i*)(dst + i/2),
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(avx2_join(a),
+                                                                     avx2_join(b)), 0xd8));
+  }
+
+  if (_mm256_movemask_epi8(bad)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((nb = sse2_decode(dst + i/2, src + i, len - i)) < 0)
+    return -1;
+  return (ssize_t)(i/2) + nb;
+}
+
+#endif /* SIMHEX_X86 */
+
+/**
+ * @brief   Available kernels, fastest first
+ */
+static const simhex_kernel_t kernels[] = {
+#if SIMHEX_X86
+  { "avx2", avx2_supported, avx2_encode, avx2_decode },
+  { "sse2", sse2_supported, sse2_encode, sse2_decode },
+#endif
+  { "scalar", scalar_supported, scalar_encode, scalar_decode }
+};
+
+#define NKERNELS (sizeof kernels / sizeof kernels[0])
+
+/**
+ * @brief   Build the tables and pick the fastest kernel
+ *
+ * @notapi
+ */
+static void _simhex_init(void) {
+  static const char digits[] = "0123456789abcdef";
+  unsigned i;
+
+#if SIMHEX_X86
+  __builtin_cpu_init();
+#endif
+
+  memset(dec_table, -1, sizeof dec_table);
+  for (i = 0; i < 16; i++) {
+    dec_table[(uint8_t)digits[i]] = (int8_t)i;
+    /* the upper case letters, the digits have no case */
+    if (i >= 10)
+      dec_table[(uint8_t)(digits[i] & ~0x20)] = (int8_t)i;
+  }
+  for (i = 0; i < 256; i++) {
+    char pair[2] = { digits[i >> 4], digits[i & 0xf] };
+    memcpy(&enc_table[i], pair, 2);
+  }
+
+  for (i = 0; !kernels[i].supported(); i++)
+    ;
+  kernel = &kernels[i];
+}
+
+/**
+ * @brief   Encode bytes as hex digits
+ *
+ * @param[out] dst      room for 2 * @p len digits, not terminated
+ * @param[in] src       the bytes to encode
+ * @param[in] len       the number of bytes
+ *
+ * @return              the number of digits written
+ *
+ * @notapi
+ */
+extern size_t simhex_encode(char *dst, const void *src, size_t len) {
+  if (!kernel)
+    _simhex_init();
+  return kernel->encode(dst, src, len);
+}
+
+/**
+ * @brief   Decode hex digits
+ * @note    An odd trailing digit is ignored. @p dst may
+ *          be the same as @p src.
+ *
+ * @param[out] dst      room for @p len / 2 bytes
+ * @param[in] src       the digits, either case
+ * @param[in] len       the number of digits
+ *
+ * @return              the number of bytes written or -1 and
+ *                      @p EINVAL if @p src holds a non digit
+ *
+ * @notapi
+ */
+extern ssize_t simhex_decode(void *dst, const char *src, size_t len) {
+  if (!kernel)
+    _simhex_init();
+  return kernel->decode(dst, src, len);
+}
+
+/**
+ * @brief   Name of the kernel in use
+ *
+ * @api
+ */
+extern const char* simhex_kernel(void) {
+  if (!kernel)
+    _simhex_init();
+  return kernel->name;
+}
+
+/**
+ * @brief   Use a specific kernel
+ *
+ * @param[in] name      "avx2", "sse2" or "scalar"
+ *
+ * @return              0 on success, -1 and @p ENOTSUP if the kernel
+ *                      is not built in or the CPU lacks support
+ *
+ * @api
+ */
+extern int simhex_select(const char *name) {
+  unsigned i;
+
+  if (!kernel)
+    _simhex_init();
+
+  for (i = 0; i < NKERNELS; i++) {
+    if (!strcmp(kernels[i].name, name) && kernels[i].supported()) {
+      kernel = &kernels[i];
+      return 0;
+    }
+  }
+
+  errno = ENOTSUP;
+  return -1;
+}
+
+#endif /* SIMULATOR */
+
+/** @} */
@@ -0,0 +1,55 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simhex.h
+ * @brief   Hex codec for the text simulator protocol.
+ * @details Encodes to lower case digits and decodes either case. The
+ *          fastest kernel the CPU supports is picked on first use,
+ *          @p simhex_select() overrides the choice.
+ *
+ * @addtogroup SIMHEX
+ * @{
+ */
+
+#ifndef SIMHEX_H
+#define SIMHEX_H
+
+#if defined(SIMULATOR) || defined(__DOXYGEN__)
+
+#include <stdint.h>
+#include <sys/types.h>
+
+extern size_t simhex_encode(char *dst, const void *src, size_t len);
+extern ssize_t simhex_decode(void *dst, const char *src, size_t len);
+
+extern const char* simhex_kernel(void);
+extern int simhex_select(const char *name);
+
+#endif /* SIMULATOR */
+#endif /* SIMHEX_H */
+
+/** @} */
@@ -38,9 +38,12 @@
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -48,6 +51,9 @@
 #include "hal.h"
 #include "simio.h"
 #include "simutil.h"
+#include "simshm.h"
+#include "simhex.h"
+#include "simcap.h"
 #include "sim_preempt.h"
 
 /**
@@ -55,25 +61,99 @@
  */
 static msg_t readq[HID_COUNT][MB_QUEUE_SIZE];
 static Mailbox read_mb[HID_COUNT];
-// static Mailbox write_mb[HID_COUNT]; /* TODO */
-static WORKING_AREA(wap, 512);
+static sim_msg_t *read_cur[HID_COUNT];  /* partially read message per HID */
+static systime_t read_time[HID_COUNT];  /* arrival of the last message read */
+static msg_t writeq[HID_COUNT][MB_QUEUE_SIZE];
+static Mailbox write_mb[HID_COUNT];
+
+/**
+ * @brief   Writer thread state
+ * @details @p write_pending counts queued frames not yet handed
+ *          to a socket, flushing threads sleep on @p flush_sem
+ *          until it drops to zero.
+ */
+static Semaphore flush_sem;
+static cnt_t write_pending;
+
+/* maximum frames gathered into a single writev() */
+#define SIM_WRITEV_MAX 16
+
+/* longest writer sleep on a full socket before checking it is still up */
+#define SIM_WRITE_WAIT MS2ST(100)
+
+/**
+ * @brief   A connection to a VHA
+ * @details Connection 0 carries every HID without an endpoint of
+ *          its own. Each connection has its own reader and writer
+ *          thread so a slow VHA only stalls its own HIDs.
+ */
+typedef struct {
+  char*           ip_addr;
+  uint16_t        port;
+  SOCKET          sock;       /* shm doorbell or capture fd otherwise */
+  SOCKET          wsock;      /* dup of a TCP sock the writer waits on */
+  sim_proto_t     proto;      /* framing used for writes */
+  bool_t          started;    /* reader and writer are running */
+  BinarySemaphore write_bsem; /* wakes the writer when a frame is queued */
+  WORKING_AREA(war, 512);
+  WORKING_AREA(waw, 512);
+} sim_conn_t;
 
 /**
  * @brief   Define default ports for HAL drivers
  */
+static sim_conn_t sim_conn[HID_COUNT] = {
+  { .ip_addr = "127.0.0.1", .port = 27000,
+    .sock = INVALID_SOCKET, .wsock = INVALID_SOCKET }
+};
+static int sim_conn_count = 1;
+static uint8_t hid_conn[HID_COUNT];   /* connection index of each HID */
+#define CONN(hid) (&sim_conn[hid_conn[hid]])
+
+/**
+ * @brief   Command line options
+ */
 static struct sim_host_t {
-  char*     ip_addr;
-  uint16_t  port;
-  SOCKET    sock;
-} sim_host = { "127.0.0.1", 27000, 0 };
+  sim_proto_t     want;       /* framing requested on the command line */
+  sim_transport_t transport;
+  char*           shm_name;
+  simshm_t        shm;
+  char*           record;     /* capture file to write */
+  char*           replay;     /* capture file to replay */
+  unsigned        speed;      /* replay pace, 0 for fast forward */
+  char*           sdc_image;  /* disk image served by the SDC LLD */
+  unsigned        sdc_latency; /* per command SDC latency, us */
+  char*           adc_source; /* samples source of the ADC LLD */
+  char*           gpio_name;  /* shared GPIO bank of the PAL LLD */
+  char*           pwm_trace;  /* width trace of the PWM LLD */
+} sim_host = {
+  .want = SIM_PROTO_HEX,
+  .transport = SIM_TRANSPORT_TCP,
+};
+
+/**
+ * @brief   Longest sleep on the shm doorbell
+ * @details A VHA without a store fence between publishing a record
+ *          and checking the sleeping flag may miss the doorbell,
+ *          this bounds the cost to latency.
+ */
+#define SIM_SHM_WAIT_MS 10
+
+/**
+ * @brief   Negotiation request sent to the VHA as a SIM_IO text line
+ */
+#define SIM_PROTO_HELLO "proto bin"
 
 /**
  * @brief   Forward function declarations
  */
 static char* hid2str(sim_hal_id_t);
+static sim_hal_id_t str2hid(char *hid);
 static SOCKET _sim_socket(void);
-static int _sim_connect(void);
+static int _sim_connect(sim_conn_t *c);
+static int _sim_close(sim_conn_t *c);
 static msg_t read_thread(void *arg);
+static msg_t write_thread(void *arg);
 
 /**
  * @brief   One time initialization of data structures
@@ -85,10 +165,78 @@ static void _sim_init_once(void) {
   int i;
   if (!once) {
     once = TRUE;
+    sim_pool_init();
+    if (sim_host.record && simcap_record_open(sim_host.record) < 0) {
+      eprintf("record %s %s", sim_host.record, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
     for (i = 0; i < HID_COUNT; i++) {
-      chMBInit(&read_mb[i], readq[i], HID_COUNT);
+      chMBInit(&read_mb[i], readq[i], MB_QUEUE_SIZE);
+      chMBInit(&write_mb[i], writeq[i], MB_QUEUE_SIZE);
+    }
+    chSemInit(&flush_sem, 0);
+  }
+}
+
+/**
+ * @brief   Start the reader and writer of a connection
+ *
+ * @notapi
+ */
+static void _sim_conn_start(sim_conn_t *c) {
+  if (!c->started) {
+    c->started = TRUE;
+    chBSemInit(&c->write_bsem, TRUE);
+    (void)chThdCreateStatic(c->waw, sizeof(c->waw), NORMALPRIO, write_thread, c);
+    (void)chThdCreateStatic(c->war, sizeof(c->war), NORMALPRIO, read_thread, c);
+  }
+}
+
+/**
+ * @brief   Route a HID to a VHA of its own
+ * @details HIDs given the same host and port share a connection.
+ *
+ * @param[in] spec      HID=host:port
+ *
+ * @notapi
+ */
+static void _sim_endpoint(char *spec) {
+  char *eq = strchr(spec, '='), *colon = strrchr(spec, ':');
+  sim_hal_id_t hid;
+  uint16_t port;
+  int i;
+
+  if (!eq || !colon || colon < eq) {
+    eprintf("bad endpoint %s, expected HID=host:port", spec);
+    exit(EXIT_FAILURE);
+  }
+  *eq = '\0';
+  *colon = '\0';
+  port = atoi(colon + 1);
+
+  /* SIM_IO is also returned for unknown names */
+  if ((hid = str2hid(spec)) == SIM_IO) {
+    eprintf("endpoint for %s not supported", spec);
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < sim_conn_count; i++)
+    if (sim_conn[i].port == port && !strcmp(sim_conn[i].ip_addr, eq + 1))
+      break;
+
+  if (i == sim_conn_count) {
+    if (i == HID_COUNT) {
+      eprintf("too many endpoints");
+      exit(EXIT_FAILURE);
     }
+    sim_conn[i].ip_addr = strdup(eq + 1);
+    sim_conn[i].port = port;
+    sim_conn[i].sock = INVALID_SOCKET;
+    sim_conn[i].wsock = INVALID_SOCKET;
+    sim_conn_count++;
   }
+
+  hid_conn[hid] = i;
 }
 
 /**
@@ -103,21 +251,105 @@ extern void sim_getopt(int argc, char **argv) {
   struct option longopts[] = {
     {"sim_host", required_argument, NULL, 'h'},
     {"sim_port", required_argument, NULL, 'p'},
+    {"sim_proto", required_argument, NULL, 'P'},
+    {"sim_endpoint", required_argument, NULL, 'E'},
+    {"sim_transport", required_argument, NULL, 'T'},
+    {"sim_record", required_argument, NULL, 'R'},
+    {"sim_replay", required_argument, NULL, 'r'},
+    {"sim_replay_speed", required_argument, NULL, 's'},
+    {"sim_clock", required_argument, NULL, 'C'},
+    {"sim_preempt", no_argument, NULL, 'X'},
+    {"sim_sdc_image", required_argument, NULL, 'I'},
+    {"sim_sdc_latency", required_argument, NULL, 'L'},
+    {"sim_adc_source", required_argument, NULL, 'A'},
+    {"sim_gpio", required_argument, NULL, 'G'},
+    {"sim_pwm_trace", required_argument, NULL, 'W'},
     {      NULL,                 0, NULL,  0 }
   };
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "h:p:", longopts, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "h:p:P:E:T:R:r:s:C:XI:L:A:G:W:", longopts, NULL)) != -1) {
     switch (opt) {
 
-      case 'h': sim_host.ip_addr = strdup(optarg); break;
-      case 'p': sim_host.port = atoi(optarg); break;
+      case 'h': sim_conn[0].ip_addr = strdup(optarg); break;
+      case 'p': sim_conn[0].port = atoi(optarg); break;
+      case 'E': _sim_endpoint(optarg); break;
+
+      case 'P':
+        if (!strcmp(optarg, "bin"))
+          sim_host.want = SIM_PROTO_BIN;
+        else if (!strcmp(optarg, "hex"))
+          sim_host.want = SIM_PROTO_HEX;
+        else {
+          eprintf("unknown protocol %s", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'T':
+        if (!strcmp(optarg, "tcp"))
+          sim_host.transport = SIM_TRANSPORT_TCP;
+        else if (!strncmp(optarg, "shm:", 4) && optarg[4]) {
+          sim_host.transport = SIM_TRANSPORT_SHM;
+          sim_host.shm_name = strdup(optarg + 4);
+        }
+        else {
+          eprintf("unknown transport %s", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'R': sim_host.record = strdup(optarg); break;
+      case 's': sim_host.speed = atoi(optarg); break;
+
+      case 'C':
+        if (!strcmp(optarg, "virtual"))
+          port_set_virtual_clock(TRUE);
+        else if (!strcmp(optarg, "real"))
+          port_set_virtual_clock(FALSE);
+        else {
+          eprintf("unknown clock %s", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'X': port_set_preemption(TRUE); break;
+
+      /* the SDC is served in-process from the image */
+      case 'I': sim_host.sdc_image = strdup(optarg); break;
+      case 'L': sim_host.sdc_latency = atoi(optarg); break;
+
+      /* checked by the ADC LLD when started */
+      case 'A': sim_host.adc_source = strdup(optarg); break;
+
+      /* created by the PAL LLD at halInit() */
+      case 'G':
+        if (!*optarg || strchr(optarg, '/')) {
+          eprintf("bad gpio bank name %s", optarg);
+          exit(EXIT_FAILURE);
+        }
+        sim_host.gpio_name = strdup(optarg);
+        break;
+
+      /* opened by the PWM LLD when started */
+      case 'W': sim_host.pwm_trace = strdup(optarg); break;
+
+      /* a replay needs no VHA */
+      case 'r':
+        sim_host.transport = SIM_TRANSPORT_REPLAY;
+        sim_host.replay = strdup(optarg);
+        break;
 
       default:
         eprintf("usage: %s <options>", argv[0]); /* ToDo: option list help */
         exit(EXIT_FAILURE);
     }
   }
+  if (port_is_preemptive() && port_is_virtual_clock()) {
+    eprintf("--sim_preempt needs the real clock");
+    exit(EXIT_FAILURE);
+  }
+
   /* reset getopt */
   optind = 1;
 }
@@ -149,7 +381,8 @@ static char* hid2str(sim_hal_id_t hid) {
  * @notapi
  */
 static sim_hal_id_t str2hid(char *hid) {
-  if (!strcmp(hid, "PAL_IO")) return PAL_IO;
+  if (!strcmp(hid, "SIM_IO")) return SIM_IO;
+  else if (!strcmp(hid, "PAL_IO")) return PAL_IO;
   else if (!strcmp(hid, "SD1_IO")) return SD1_IO;
   else if (!strcmp(hid, "SD2_IO")) return SD2_IO;
   else if (!strcmp(hid, "EXT_IO")) return EXT_IO;
@@ -163,7 +396,7 @@ static sim_hal_id_t str2hid(char *hid) {
 }
 
 /**
- * @brief   Format data using the simulator protocol.
+ * @brief   Format data using the text simulator protocol.
  * @details Each message is formatted with a header followed
  *          by a hexadecimal encoded string and newline.
  * @note    This function allocates memory.
@@ -176,43 +409,117 @@ static sim_hal_id_t str2hid(char *hid) {
  *
  * @notapi
  */
-static sim_buf_t* _sim_encode(sim_hal_id_t hid, void *buf, size_t bufsz) {
+static sim_buf_t* _sim_encode_hex(sim_hal_id_t hid, void *buf, size_t bufsz) {
   sim_buf_t *code = sim_buf_alloc(sizeof(DUMMY_HEADER "\t") + bufsz*2);
-  char hex[3];
-  size_t i;
+  char *dptr;
+  size_t nb;
 
   sim_buf_puts(code, hid2str(hid));
-  sim_buf_puts(code, "\t");
+  sim_buf_putc(code, '\t');
 
-  for (i = 0; i < bufsz; i++) {
-    snprintf(hex, sizeof hex, "%02x", ((uint8_t*)buf)[i]);
-    sim_buf_puts(code, hex);
-  }
+  dptr = sim_buf_reserve(code, bufsz*2 + 1);
+  nb = simhex_encode(dptr, buf, bufsz);
+  dptr[nb++] = '\n';
+  sim_buf_commit(code, nb);
+
+  return code;
+}
+
+/**
+ * @brief   Format data using the binary simulator protocol.
+ * @details Each message is a @p sim_frame_hdr_t followed by
+ *          the unmodified message data.
+ * @note    This function allocates memory.
+ *
+ * @param[in] hid       hal id to use in the header
+ * @param[in] flags     frame flags
+ * @param[in] buf       the message data
+ * @param[in] bufsz     the size of buf
+ *
+ * @return              a newly allocated buffer
+ *
+ * @notapi
+ */
+static sim_buf_t* _sim_encode_bin(sim_hal_id_t hid, uint8_t flags,
+                                  void *buf, size_t bufsz) {
+  sim_buf_t *code = sim_buf_alloc(sizeof(sim_frame_hdr_t) + bufsz);
+  sim_frame_hdr_t hdr;
 
-  sim_buf_puts(code, "\n");
+  hdr.magic = SIM_FRAME_MAGIC;
+  hdr.hid = (uint8_t)hid;
+  hdr.flags = flags;
+  hdr.reserved = 0;
+  hdr.len = htonl((uint32_t)bufsz);
+
+  sim_buf_write(code, &hdr, sizeof hdr);
+  sim_buf_write(code, buf, bufsz);
 
   return code;
 }
 
 /**
- * @brief   Decode hexadecimal encodings in place.
+ * @brief   Format data using the negotiated simulator protocol.
+ * @note    This function allocates memory.
+ *
+ * @param[in] c         the connection the data is sent on
+ * @param[in] hid       hal id to use in the header
+ * @param[in] buf       the message data
+ * @param[in] bufsz     the size of buf
  *
- * @param[in,out] buf   the encoded data
+ * @return              a newly allocated buffer positioned at
+ *                      the start of the encoded data
  *
  * @notapi
  */
-static void _sim_decode(sim_buf_t *buf) {
-  char byte[3];
-  size_t i;
+static sim_buf_t* _sim_encode(sim_conn_t *c, sim_hal_id_t hid,
+                              void *buf, size_t bufsz) {
+  sim_buf_t *code;
+
+  if (c->proto == SIM_PROTO_BIN)
+    code = _sim_encode_bin(hid, 0, buf, bufsz);
+  else
+    code = _sim_encode_hex(hid, buf, bufsz);
+
+  /* done writing - reset for the socket write */
+  sim_buf_setpos(code, 0);
+
+  return code;
+}
 
-  for (i = 0; i < buf->dlen/2; i++) {
-    snprintf(byte, sizeof byte, "%c%c", buf->data[i*2], buf->data[i*2+1]);
-    buf->data[i] = (uint8_t)strtoul(byte, NULL, 16);
+/**
+ * @brief   Decode hexadecimal digits into a message.
+ * @details A read may end between the two digits of a byte,
+ *          the first one is kept in the message until the
+ *          next call.
+ *
+ * @param[in,out] msg   the message being received
+ * @param[in] src       the digits, straight from the read buffer
+ * @param[in] len       the number of digits
+ *
+ * @notapi
+ */
+static void _sim_decode(sim_msg_t *msg, const char *src, size_t len) {
+  char pair[2];
+  ssize_t nb;
+
+  if (len && msg->half) {
+    pair[0] = msg->half;
+    pair[1] = *src++;
+    len--;
+    msg->half = 0;
+    if ((nb = simhex_decode(sim_buf_reserve(msg->buf, 1), pair, 2)) < 0)
+      msg->invalid = TRUE;
+    else
+      sim_buf_commit(msg->buf, nb);
   }
 
-  /* done writing - reset for reads */
-  sim_buf_setpos(buf, 0);
-  buf->dlen = i;
+  if ((nb = simhex_decode(sim_buf_reserve(msg->buf, len/2), src, len)) < 0)
+    msg->invalid = TRUE;
+  else
+    sim_buf_commit(msg->buf, nb);
+
+  if (len & 1)
+    msg->half = src[len - 1];
 }
 
 /**
@@ -224,7 +531,7 @@ static void _sim_decode(sim_buf_t *buf) {
  * @notapi
  */
 static void _sim_enqueue(sim_msg_t *msg) {
-  sim_hal_id_t hid = str2hid(msg->header);
+  sim_hal_id_t hid = (sim_hal_id_t)msg->hid;
   msg_t status;
 
   while (TRUE) {
@@ -236,6 +543,50 @@ static void _sim_enqueue(sim_msg_t *msg) {
   };
 }
 
+/**
+ * @brief   Handle a SIM_IO message addressed to simio itself.
+ * @details A binary hello from the VHA acknowledges the
+ *          negotiation request and switches writes to the
+ *          binary framing.
+ *
+ * @param[in] c         The connection the message arrived on.
+ * @param[in] msg       The message to handle.
+ *
+ * @notapi
+ */
+static void _sim_control(sim_conn_t *c, sim_msg_t *msg) {
+  if (msg->flags & SIM_FRAME_F_HELLO) {
+    if (sim_host.want == SIM_PROTO_BIN)
+      c->proto = SIM_PROTO_BIN;
+  }
+}
+
+/**
+ * @brief   Route a completely received message.
+ *
+ * @param[in] c         The connection the message arrived on.
+ * @param[in] msg       The message to route. Ownership is
+ *                      transferred to the reader queue or
+ *                      the message is freed.
+ *
+ * @notapi
+ */
+static void _sim_dispatch(sim_conn_t *c, sim_msg_t *msg) {
+  if (msg->hid > SIM_IO && msg->hid < HID_COUNT) {
+    msg->time = chTimeNow();
+    simcap_record(msg->hid, SIMCAP_IN, msg->buf->dptr, msg->buf->dlen);
+    _sim_enqueue(msg);
+    return;
+  }
+
+  if (msg->hid == SIM_IO)
+    _sim_control(c, msg);
+  else
+    eprintf("no such queue %d", msg->hid);
+
+  sim_msg_free(msg);
+}
+
 /**
  * @brief   Parse a buffer returned from read() into a message
  *          structure.
@@ -244,35 +595,93 @@ static void _sim_enqueue(sim_msg_t *msg) {
  *          read has been completed and then queues it into the
  *          LLD reader queue.
  *
+ * @param[in] c         the connection the data arrived on
  * @param[in] buf       the raw data
  * @param[in,out] mptr  pointer to a pointer to a message
  *
  * @notapi
  */
-static void parse_buf(sim_buf_t *buf, sim_msg_t **mptr) {
+static void parse_buf(sim_conn_t *c, sim_buf_t *buf, sim_msg_t **mptr) {
   sim_msg_t *msg = *mptr;
-  size_t i;
+  sim_frame_hdr_t hdr;
+  char *eol;
+  size_t i, nb;
 
   for (i = 0; i < buf->dlen; i++) {
     switch (msg->state) {
 
       case ST_HEADER:
+        /* binary frames are detected by their first byte */
+        if (msg->hlen == 0 && (uint8_t)buf->data[i] == SIM_FRAME_MAGIC) {
+          msg->state = ST_BIN_HEADER;
+          *msg->hptr++ = buf->data[i];
+          msg->hlen++;
+          break;
+        }
         if (buf->data[i] == '\t') {
+          msg->hid = str2hid(msg->header);
           msg->state = ST_DATA;
           break;
         }
-        *msg->hptr++ = buf->data[i];
-        msg->hlen++;
+        if (msg->hlen < (ssize_t)sizeof msg->header - 1) {
+          *msg->hptr++ = buf->data[i];
+          msg->hlen++;
+        }
         break;
 
       case ST_DATA:
-        if (buf->data[i] == '\n') {
-          _sim_decode(msg->buf);
-          _sim_enqueue(msg);
-          msg = *mptr = sim_msg_alloc(MSG_BLOCK_SIZE);
+        /* decode up to the end of the line in one go */
+        eol = memchr(buf->data + i, '\n', buf->dlen - i);
+        nb = (eol ? eol : buf->data + buf->dlen) - (buf->data + i);
+        _sim_decode(msg, buf->data + i, nb);
+        i += nb;
+
+        if (!eol)
           break;
+
+        /* done writing - reset for reads */
+        sim_buf_setpos(msg->buf, 0);
+        if (msg->invalid) {
+          eprintf("invalid hex for %s", hid2str(msg->hid));
+          sim_msg_free(msg);
         }
-        sim_buf_putc(msg->buf, buf->data[i]);
+        else
+          _sim_dispatch(c, msg);
+        msg = *mptr = sim_msg_alloc(MSG_BLOCK_SIZE);
+        break;
+
+      case ST_BIN_HEADER:
+        *msg->hptr++ = buf->data[i];
+        if (++msg->hlen < (ssize_t)sizeof hdr)
+          break;
+
+        memcpy(&hdr, msg->header, sizeof hdr);
+        msg->hid = hdr.hid;
+        msg->flags = hdr.flags;
+        msg->remain = ntohl(hdr.len);
+        msg->state = ST_BIN_DATA;
+
+        if (msg->remain)
+          break;
+
+        _sim_dispatch(c, msg);
+        msg = *mptr = sim_msg_alloc(MSG_BLOCK_SIZE);
+        break;
+
+      case ST_BIN_DATA:
+        /* copy as much of the payload as this read returned */
+        nb = MIN(msg->remain, buf->dlen - i);
+        sim_buf_write(msg->buf, buf->data + i, nb);
+        msg->remain -= nb;
+        i += nb - 1;
+
+        if (msg->remain)
+          break;
+
+        /* done writing - reset for reads */
+        sim_buf_setpos(msg->buf, 0);
+        _sim_dispatch(c, msg);
+        msg = *mptr = sim_msg_alloc(MSG_BLOCK_SIZE);
         break;
 
       default:
@@ -282,31 +691,101 @@ static void parse_buf(sim_buf_t *buf, sim_msg_t **mptr) {
   }
 }
 
+/**
+ * @brief   Move records from the shared memory rings to the
+ *          reader queues.
+ * @details Sleeps on the doorbell when every ring is empty.
+ *
+ * @notapi
+ */
+static void _sim_shm_poll(void) {
+  struct pollfd pfd = { simshm_fd(&sim_host.shm), POLLIN, 0 };
+  sim_msg_t *msg;
+  ssize_t len;
+  int hid, n = 0;
+
+  for (hid = 0; hid < HID_COUNT; hid++) {
+    while ((len = simshm_peek(&sim_host.shm, hid)) >= 0) {
+      msg = sim_msg_alloc(len);
+      msg->buf->dlen = simshm_recv(&sim_host.shm, hid,
+                                   msg->buf->data, msg->buf->dsz);
+      msg->hid = hid;
+      _sim_dispatch(&sim_conn[0], msg);
+      n++;
+    }
+  }
+
+  if (n)
+    return;
+
+  if (!simshm_arm(&sim_host.shm))
+    (void)sim_preempt_poll(&pfd, 1, SIM_SHM_WAIT_MS);
+  simshm_disarm(&sim_host.shm);
+}
+
+/**
+ * @brief   Feed the next recorded input to the reader queues.
+ * @details At the end of the capture the results are printed and,
+ *          unless the application exits first, the process exits
+ *          after @p SIMCAP_TIMEOUT with a failure if any output
+ *          differed from the recording.
+ *
+ * @notapi
+ */
+static void _sim_replay_poll(void) {
+  simcap_stats_t st;
+  sim_msg_t *msg;
+
+  if ((msg = simcap_replay_next()) != NULL) {
+    _sim_dispatch(&sim_conn[0], msg);
+    return;
+  }
+
+  simcap_replay_stats(&st);
+  printf("simio replay done: %u inputs, %u matched, %u mismatched, "
+         "%u missing, %u unexpected\n", st.inputs, st.matched,
+         st.mismatched, st.missing, st.unexpected);
+
+  chThdSleep(SIMCAP_TIMEOUT);
+  exit(simcap_replay_failed() ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 /**
  * @brief   The thread responsible for reading from a VHA.
  *
+ * @param[in] arg       the connection to read from
+ *
  * @notapi
  */
 static msg_t read_thread(void *arg) {
+  sim_conn_t *c = arg;
   sim_msg_t *msg = sim_msg_alloc(MSG_BLOCK_SIZE);
-  sim_buf_t *buf = sim_buf_alloc(MSG_BLOCK_SIZE);
+  sim_buf_t *buf = sim_buf_alloc(SIM_BUF_SIZE);
   ssize_t nb;
 
-  (void)arg;
-
   while (TRUE) {
-    if (!sim_host.sock) {
+    if (c->sock == INVALID_SOCKET) {
       chThdSleep(S2ST(1));
-      if (_sim_connect() < 0)
+      if (_sim_connect(c) < 0)
         continue;
     }
 
-    nb = sim_preempt_read(sim_host.sock, buf->data, buf->dsz);
+    if (sim_host.transport == SIM_TRANSPORT_SHM) {
+      _sim_shm_poll();
+      continue;
+    }
+
+    if (sim_host.transport == SIM_TRANSPORT_REPLAY) {
+      _sim_replay_poll();
+      continue;
+    }
+
+    nb = sim_preempt_read(c->sock, buf->data, buf->dsz);
     buf->dlen = nb;
 
     if (nb < 0) {
       eprintf("read %s", strerror(errno));
-      (void)sim_disconnect();
+      (void)_sim_close(c);
     }
 
     else if (nb == 0) {
@@ -315,7 +794,7 @@ static msg_t read_thread(void *arg) {
     }
 
     else {
-      parse_buf(buf, &msg);
+      parse_buf(c, buf, &msg);
     }
   }
 
@@ -324,103 +803,396 @@ static msg_t read_thread(void *arg) {
 }
 
 /**
- * @brief   Fetch the next message from the queue and drain its
- *          buffer to emulate an actual read() call
+ * @brief   Fill an io vector from the messages queued for a HID
+ * @details Messages are drained in order, a message that does not
+ *          fit is kept in the HID's cursor for the next read. Only
+ *          the first message is waited for, later ones are taken
+ *          only if already queued, unless @p exact is set.
  *
  * @param[in] hid       hal id
- * @param[out] buf      buffer to be filled
- * @param[in] bufsz     the size of buf
- * @param[in] timeout   maximum time to wait before returning
+ * @param[in] iov       buffers to be filled
+ * @param[in] iovcnt    the number of buffers in iov
+ * @param[in] timeout   maximum time to wait for each message
+ * @param[in] exact     wait until every buffer is full
+ * @param[in] locked    called from within a system lock
  *
- * @return              the number of bytes read or, if negative an error
+ * @return              the number of bytes read or, if nothing was
+ *                      read, a negative error
+ *
+ * @notapi
  */
-static ssize_t sim_read_timeout_fetch(sim_hal_id_t hid, void *buf, size_t bufsz,
-                                      int timeout, msg_t (*fetch)(Mailbox*, msg_t*, systime_t)) {
-  static sim_msg_t *msg = NULL;
+static ssize_t _sim_readv(sim_hal_id_t hid, const struct iovec *iov,
+                          int iovcnt, systime_t timeout,
+                          bool_t exact, bool_t locked) {
+  sim_msg_t *msg;
   msg_t status = RDY_OK;
-  ssize_t nb;
+  size_t nb, off = 0, total = 0;
+  int i = 0;
 
-  if (!sim_host.sock) {
-    if (_sim_connect() < 0) {
+  if (CONN(hid)->sock == INVALID_SOCKET) {
+    /* connecting may create threads, not possible while locked */
+    if (locked || _sim_connect(CONN(hid)) < 0) {
       errno = EBADF;
       return -1;
     }
   }
 
-  if (!msg) {
-    status = fetch(&read_mb[hid], (msg_t*)&msg, timeout);
-  }
+  while (i < iovcnt) {
+    if (off == iov[i].iov_len) {
+      off = 0;
+      i++;
+      continue;
+    }
+
+    if ((msg = read_cur[hid]) == NULL) {
+      status = (locked ? chMBFetchS : chMBFetch)(&read_mb[hid], (msg_t*)&msg,
+                                                 total && !exact ? TIME_IMMEDIATE : timeout);
+      if (status != RDY_OK)
+        break;
+      read_cur[hid] = msg;
+      read_time[hid] = msg->time;
+    }
+
+    nb = sim_buf_read(msg->buf, (char*)iov[i].iov_base + off, iov[i].iov_len - off);
+    off += nb;
+    total += nb;
 
-  if (status == RDY_OK) {
-    nb = sim_buf_read(msg->buf, buf, bufsz);
     if (sim_buf_eof(msg->buf)) {
-      sim_msg_free(msg);
-      msg = NULL;
+      if (locked)
+        sim_msg_freeI(msg);
+      else
+        sim_msg_free(msg);
+      read_cur[hid] = NULL;
     }
   }
 
-  return status == RDY_OK ? nb : status;
+  return total || status == RDY_OK ? (ssize_t)total : status;
 }
 
 /**
  * @brief Standard sim_read_timeout
  */
 extern ssize_t sim_read_timeout(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout) {
-  return sim_read_timeout_fetch(hid, buf, bufsz, timeout, chMBFetch);
+  struct iovec iov = { buf, bufsz };
+  return _sim_readv(hid, &iov, 1, timeout, FALSE, FALSE);
 }
 
 /**
  * @brief S-class sim_read_timeout
  */
 extern ssize_t sim_read_timeoutS(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout) {
-  return sim_read_timeout_fetch(hid, buf, bufsz, timeout, chMBFetchS);
+  struct iovec iov = { buf, bufsz };
+  return _sim_readv(hid, &iov, 1, timeout, FALSE, TRUE);
 }
 
 /**
- * @brief   encode and write buffer to multiplexed IO stream
+ * @brief   Scatter read from the messages queued for a HID
+ * @details Waits for the first message, then keeps filling the
+ *          buffers from messages that are already queued.
+ *
+ * @param[in] hid       hal id
+ * @param[in] iov       buffers to be filled
+ * @param[in] iovcnt    the number of buffers in iov
+ * @param[in] timeout   maximum time to wait for the first message
+ *
+ * @return              the number of bytes read or, if negative an error
+ *
+ * @api
+ */
+extern ssize_t sim_readv_timeout(sim_hal_id_t hid, const struct iovec *iov,
+                                 int iovcnt, int timeout) {
+  return _sim_readv(hid, iov, iovcnt, timeout, FALSE, FALSE);
+}
+
+/**
+ * @brief   Read exactly @p bufsz bytes
+ * @details The data may span any number of messages.
+ *
+ * @param[in] hid       hal id
+ * @param[out] buf      buffer to be filled
+ * @param[in] bufsz     the size of buf
+ * @param[in] timeout   maximum time to wait for each message
+ *
+ * @return              the number of bytes read, short only on timeout,
+ *                      or if negative an error
+ *
+ * @api
+ */
+extern ssize_t sim_read_exact_timeout(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout) {
+  struct iovec iov = { buf, bufsz };
+  return _sim_readv(hid, &iov, 1, timeout, TRUE, FALSE);
+}
+
+/**
+ * @brief S-class sim_read_exact_timeout
+ */
+extern ssize_t sim_read_exact_timeoutS(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout) {
+  struct iovec iov = { buf, bufsz };
+  return _sim_readv(hid, &iov, 1, timeout, TRUE, TRUE);
+}
+
+/**
+ * @brief   Mark queued frames as written and wake flushing threads
+ *
+ * @param[in] n         the number of frames taken off the queues
+ *
+ * @notapi
+ */
+static void _sim_write_done(cnt_t n) {
+  chSysLock();
+  write_pending -= n;
+  if (write_pending == 0) {
+    chSemResetI(&flush_sem, 0);
+    chSchRescheduleS();
+  }
+  chSysUnlock();
+}
+
+/**
+ * @brief   Gather queued frames into an io vector
+ * @details HIDs routed to @p c are drained round robin so
+ *          a busy LLD can not starve the others.
+ *
+ * @param[in] c         the connection to gather frames for
+ * @param[out] code     the dequeued frames
+ * @param[out] iov      io vector pointing into the frames
+ *
+ * @return              the number of frames dequeued
+ *
+ * @notapi
+ */
+static int _sim_write_gather(sim_conn_t *c, sim_buf_t **code,
+                             struct iovec *iov) {
+  int hid, n = 0, more = TRUE;
+  msg_t m;
+
+  while (more && n < SIM_WRITEV_MAX) {
+    more = FALSE;
+    for (hid = 0; hid < HID_COUNT && n < SIM_WRITEV_MAX; hid++) {
+      if (CONN(hid) != c)
+        continue;
+      if (chMBFetch(&write_mb[hid], &m, TIME_IMMEDIATE) != RDY_OK)
+        continue;
+      code[n] = (sim_buf_t*)m;
+      iov[n].iov_base = code[n]->dptr;
+      iov[n].iov_len = code[n]->dlen;
+      n++;
+      more = TRUE;
+    }
+  }
+
+  return n;
+}
+
+/**
+ * @brief   The thread responsible for writing to a VHA.
+ * @details Frames queued by the LLDs are written several
+ *          at a time with writev(). A write is never split
+ *          by another frame because only this thread touches
+ *          the socket for writing. The socket is non blocking,
+ *          when it is full the thread sleeps in port_wait_io()
+ *          and resumes from the iovec offset reached, so a
+ *          slow VHA never stalls the host thread.
+ *
+ * @param[in] arg       the connection to write to
+ *
+ * @notapi
+ */
+static msg_t write_thread(void *arg) {
+  sim_conn_t *c = arg;
+  sim_buf_t *code[SIM_WRITEV_MAX];
+  struct iovec iov[SIM_WRITEV_MAX], *iovp;
+  struct pollfd pfd;
+  ssize_t nb;
+  int i, n, iovcnt;
+
+  while (TRUE) {
+    (void)chBSemWait(&c->write_bsem);
+
+    while ((n = _sim_write_gather(c, code, iov)) > 0) {
+      iovp = iov;
+      iovcnt = n;
+
+      while (iovcnt && c->sock != INVALID_SOCKET) {
+        if ((nb = writev(c->sock, iovp, iovcnt)) < 0) {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* the reader waits on sock, wait on its dup, or poll every
+               tick when no wait slot is left */
+            pfd.fd = c->wsock;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (port_wait_io(&pfd, 1, SIM_WRITE_WAIT) == RDY_RESET)
+              chThdSleep(1);
+            continue;
+          }
+          eprintf("writev %s", strerror(errno));
+          (void)_sim_close(c);
+          break;
+        }
+
+        /* skip over whatever was completely written */
+        while (iovcnt && (size_t)nb >= iovp->iov_len) {
+          nb -= iovp->iov_len;
+          iovp++;
+          iovcnt--;
+        }
+        if (iovcnt) {
+          iovp->iov_base = (char*)iovp->iov_base + nb;
+          iovp->iov_len -= nb;
+        }
+      }
+
+      for (i = 0; i < n; i++)
+        sim_buf_free(code[i]);
+
+      _sim_write_done(n);
+    }
+  }
+
+  /* squash warning */
+  return 0;
+}
+
+/**
+ * @brief   copy a buffer into the shared memory ring for @p hid
  *
  * @param[in] hid       hal identifier
  * @param[in] buf       data to be written to the VHA
  * @param[in] bufsz     size of buf
+ * @param[in] timeout   time to wait for room in the ring
  *
- * @return              the number of byte written or negative if an
- *                      error occurred
- * @api
+ * @return              bufsz if queued or negative if an error
+ *                      occurred
+ *
+ * @notapi
  */
-extern int sim_write(sim_hal_id_t hid, void *buf, size_t bufsz) {
+static ssize_t _sim_shm_write(sim_hal_id_t hid, void *buf, size_t bufsz,
+                              systime_t timeout) {
+  systime_t start = chTimeNow();
+  int rv;
+
+  while (TRUE) {
+    chSysLock();
+    rv = simshm_send(&sim_host.shm, hid, buf, bufsz);
+    chSysUnlock();
+
+    if (rv == 0)
+      return (ssize_t)bufsz;
+    if (errno != EAGAIN || timeout == TIME_IMMEDIATE)
+      return -1;
+    if (timeout != TIME_INFINITE && !chTimeIsWithin(start, start + timeout))
+      return -1;
+
+    /* ring full, give the VHA a tick to drain it */
+    chThdSleep(1);
+  }
+}
+
+/**
+ * @brief   encode and queue buffer for the writer thread
+ *
+ * @param[in] hid       hal identifier
+ * @param[in] buf       data to be written to the VHA
+ * @param[in] bufsz     size of buf
+ * @param[in] timeout   time to wait for room in the write queue
+ *
+ * @return              bufsz if queued or negative if an error
+ *                      occurred
+ *
+ * @notapi
+ */
+static ssize_t _sim_write_post(sim_hal_id_t hid, void *buf, size_t bufsz,
+                               systime_t timeout) {
+  sim_conn_t *c = CONN(hid);
   sim_buf_t *code;
-  int nb = 0;
+  msg_t status;
 
-  if (!sim_host.sock) {
-    if (_sim_connect() < 0) {
+  if (c->sock == INVALID_SOCKET) {
+    if (_sim_connect(c) < 0) {
       errno = EBADF;
       return -1;
     }
   }
 
-  code = _sim_encode(hid, buf, bufsz);
+  simcap_record(hid, SIMCAP_OUT, buf, bufsz);
 
-  /* this section of code could probably use a *
-   * write thread with queued messages - the   *
-   * write isn't guaranteed to write the       *
-   * entire buffer and could be preempted      */
-  while (code->dlen) {
-    if ((nb = write(sim_host.sock, code->data, code->dlen)) <= 0)
-      break;
-    code->dlen -= nb;
-    code->dptr += nb;
+  /* with a replay there is nobody to write to */
+  if (sim_host.transport == SIM_TRANSPORT_REPLAY) {
+    simcap_replay_match(hid, buf, bufsz);
+    return (ssize_t)bufsz;
   }
 
-  if (nb < 0) {
-    eprintf("%s write %s", hid2str(hid), strerror(errno));
-    (void)sim_disconnect();
+  /* no framing or writer thread needed for the rings */
+  if (sim_host.transport == SIM_TRANSPORT_SHM)
+    return _sim_shm_write(hid, buf, bufsz, timeout);
+
+  code = _sim_encode(c, hid, buf, bufsz);
+
+  chSysLock();
+  status = chMBPostS(&write_mb[hid], (msg_t)code, timeout);
+  if (status == RDY_OK) {
+    write_pending++;
+    chBSemSignalI(&c->write_bsem);
+  }
+  chSysUnlock();
+
+  if (status != RDY_OK) {
+    sim_buf_free(code);
+    errno = status == RDY_TIMEOUT ? EAGAIN : EBADF;
+    return -1;
   }
 
-  // end lock
+  return (ssize_t)bufsz;
+}
+
+/**
+ * @brief   encode and write buffer to multiplexed IO stream
+ * @details The frame is handed to the writer thread, this
+ *          function only waits if the write queue for @p hid
+ *          is full.
+ *
+ * @param[in] hid       hal identifier
+ * @param[in] buf       data to be written to the VHA
+ * @param[in] bufsz     size of buf
+ *
+ * @return              the number of byte written or negative if an
+ *                      error occurred
+ * @api
+ */
+extern ssize_t sim_write(sim_hal_id_t hid, void *buf, size_t bufsz) {
+  return _sim_write_post(hid, buf, bufsz, TIME_INFINITE);
+}
 
-  sim_buf_free(code);
+/**
+ * @brief   encode and write buffer without waiting
+ * @details Sets errno to EAGAIN if the write queue for
+ *          @p hid is full.
+ *
+ * @param[in] hid       hal identifier
+ * @param[in] buf       data to be written to the VHA
+ * @param[in] bufsz     size of buf
+ *
+ * @return              the number of byte queued or negative if an
+ *                      error occurred
+ * @api
+ */
+extern ssize_t sim_write_async(sim_hal_id_t hid, void *buf, size_t bufsz) {
+  return _sim_write_post(hid, buf, bufsz, TIME_IMMEDIATE);
+}
 
-  return nb < 0 ? nb : (int)bufsz;
+/**
+ * @brief   Wait until every queued frame has been written
+ * @note    Frames queued while waiting also delay the return.
+ *
+ * @api
+ */
+extern void sim_write_flush(void) {
+  chSysLock();
+  while (write_pending > 0)
+    (void)chSemWaitS(&flush_sem);
+  chSysUnlock();
 }
 
 /**
@@ -449,6 +1221,106 @@ extern int sim_printf(sim_hal_id_t hid, char *fmt, ...) {
   return sim_write(hid, bufp, nb);
 }
 
+/**
+ * @brief   Get the framing currently used for writes
+ *
+ * @param[in] hid       hal identifier, each endpoint negotiates
+ *                      its own framing
+ *
+ * @return              @p SIM_PROTO_BIN once the VHA has accepted
+ *                      the binary framing, otherwise @p SIM_PROTO_HEX
+ *
+ * @api
+ */
+extern sim_proto_t sim_get_proto(sim_hal_id_t hid) {
+  return CONN(hid)->proto;
+}
+
+/**
+ * @brief   Get the arrival time of the last frame read
+ * @details With @p --sim_clock=virtual this is virtual time, so
+ *          LLDs can timestamp their input deterministically.
+ *
+ * @param[in] hid       hal identifier
+ *
+ * @return              the system time the frame the last read
+ *                      from @p hid took data from was received
+ *
+ * @api
+ */
+extern systime_t sim_read_time(sim_hal_id_t hid) {
+  return read_time[hid];
+}
+
+/**
+ * @brief   Get the transport selected on the command line
+ *
+ * @api
+ */
+extern sim_transport_t sim_get_transport(void) {
+  return sim_host.transport;
+}
+
+/**
+ * @brief   Get the SDC disk image selected on the command line
+ *
+ * @return              the image path, NULL when the VHA serves
+ *                      the card
+ *
+ * @api
+ */
+extern const char *sim_get_sdc_image(void) {
+  return sim_host.sdc_image;
+}
+
+/**
+ * @brief   Get the simulated SDC command latency
+ *
+ * @return              the latency in microseconds, 0 for none
+ *
+ * @api
+ */
+extern unsigned sim_get_sdc_latency(void) {
+  return sim_host.sdc_latency;
+}
+
+/**
+ * @brief   Get the ADC samples source selected on the command line
+ *
+ * @return              the source, "vha", "file:<path>", "sine",
+ *                      "sine:<hz>", "ramp" or "noise", NULL when the
+ *                      VHA provides the samples
+ *
+ * @api
+ */
+extern const char *sim_get_adc_source(void) {
+  return sim_host.adc_source;
+}
+
+/**
+ * @brief   Get the shared GPIO bank name
+ *
+ * @return              the name given with --sim_gpio, NULL when the
+ *                      ports are private to the simulator
+ *
+ * @api
+ */
+extern const char *sim_get_gpio_name(void) {
+  return sim_host.gpio_name;
+}
+
+/**
+ * @brief   Get the PWM width trace path
+ *
+ * @return              the path given with --sim_pwm_trace, NULL when
+ *                      not tracing
+ *
+ * @api
+ */
+extern const char *sim_get_pwm_trace(void) {
+  return sim_host.pwm_trace;
+}
+
 /**
  * @brief   Disconnect IO stream
  * @note    Will reconnect if another IO call is used
@@ -458,53 +1330,139 @@ extern int sim_printf(sim_hal_id_t hid, char *fmt, ...) {
  * @api
  */
 extern int sim_disconnect() {
-  int rv = close(sim_host.sock);
-  sim_host.sock = 0;
+  int i, rv = 0;
+
+  sim_write_flush();
+  for (i = 0; i < sim_conn_count; i++)
+    if (sim_conn[i].sock != INVALID_SOCKET && _sim_close(&sim_conn[i]) < 0)
+      rv = -1;
+  return rv;
+}
+
+/**
+ * @brief   Close IO stream without waiting for queued writes
+ *
+ * @param[in] c         the connection to close
+ *
+ * @return              0 on success, -1 on failure
+ *
+ * @notapi
+ */
+static int _sim_close(sim_conn_t *c) {
+  int rv = 0;
+
+  /* the doorbell fd belongs to the shm end and the *
+   * capture stays open to resume on reconnect      */
+  if (sim_host.transport == SIM_TRANSPORT_SHM)
+    simshm_close(&sim_host.shm);
+  else if (sim_host.transport == SIM_TRANSPORT_TCP) {
+    rv = close(c->sock);
+    if (c->wsock != INVALID_SOCKET)
+      (void)close(c->wsock);
+  }
+  c->sock = INVALID_SOCKET;
+  c->wsock = INVALID_SOCKET;
+  c->proto = SIM_PROTO_HEX;
   return rv;
 }
 
 /**
  * @brief   Establish network IO
- * @note    Spawns VHA reader thread. Implicitly
- *          called from other IO functions.
+ * @note    Spawns the reader and writer of the connection
+ *          on first use. Implicitly called from other IO
+ *          functions.
+ *
+ * @param[in] c         the connection to establish
  *
  * @return              0 on success, -1 on failure
  *
  * @notapi
  */
-static int _sim_connect() {
+static int _sim_connect(sim_conn_t *c) {
   struct sockaddr_in addr;
+  sim_buf_t *code;
 
   _sim_init_once();
 
   /* ignore repeated calls */
-  if (sim_host.sock) {
+  if (c->sock != INVALID_SOCKET) {
     eprintf("already connected");
     return 0;
   }
 
-  (void)chThdCreateStatic(wap, sizeof(wap), NORMALPRIO, read_thread, NULL);
+  /* shm and replay carry every HID on the default connection */
+  if (sim_host.transport != SIM_TRANSPORT_TCP && sim_conn_count > 1) {
+    eprintf("--sim_endpoint requires the tcp transport");
+    exit(EXIT_FAILURE);
+  }
+
+  _sim_conn_start(c);
+
+  /* replay a capture instead of talking to a VHA */
+  if (sim_host.transport == SIM_TRANSPORT_REPLAY) {
+    if ((c->sock = simcap_replay_open(sim_host.replay, sim_host.speed)) < 0) {
+      eprintf("replay %s %s", sim_host.replay, strerror(errno));
+      c->sock = INVALID_SOCKET;
+      return -1;
+    }
+    printf("simio replaying %s\n", sim_host.replay);
+    return 0;
+  }
+
+  /* attach to the rings created by the VHA */
+  if (sim_host.transport == SIM_TRANSPORT_SHM) {
+    if (HID_COUNT > SIMSHM_RINGS) {
+      eprintf("shm has %d rings for %d hids", SIMSHM_RINGS, HID_COUNT);
+      exit(EXIT_FAILURE);
+    }
+    if (simshm_open(&sim_host.shm, sim_host.shm_name) < 0) {
+      eprintf("shm %s %s", sim_host.shm_name, strerror(errno));
+      return -1;
+    }
+    c->sock = simshm_fd(&sim_host.shm);
+    printf("simio attached to shm:%s\n", sim_host.shm_name);
+    return 0;
+  }
 
   /* build addr struct */
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(sim_host.port);
+  addr.sin_port = htons(c->port);
 
-  if (!inet_aton(sim_host.ip_addr, &addr.sin_addr)) {
-    eprintf("invalid host %s", sim_host.ip_addr);
+  if (!inet_aton(c->ip_addr, &addr.sin_addr)) {
+    eprintf("invalid host %s", c->ip_addr);
     exit(EXIT_FAILURE);
   }
 
   /* create socket and connect to remote */
-  sim_host.sock = _sim_socket();
-  if (connect(sim_host.sock, (struct sockaddr*)&addr, sizeof addr)) {
+  c->sock = _sim_socket();
+  if (connect(c->sock, (struct sockaddr*)&addr, sizeof addr)) {
     eprintf("connect %s:%d %s",
-      sim_host.ip_addr, sim_host.port, strerror(errno));
-    sim_host.sock = 0;
+      c->ip_addr, c->port, strerror(errno));
+    (void)close(c->sock);
+    c->sock = INVALID_SOCKET;
     return -1;
   }
 
   printf("simio connected to %s:%d\n",
-    sim_host.ip_addr, sim_host.port);
+    c->ip_addr, c->port);
+
+  /* ask the VHA to switch to binary framing - writes *
+   * stay in hex until the VHA answers with a hello.  *
+   * The writer has nothing queued for a connection   *
+   * that was down, so the hello goes out directly.   */
+  if (sim_host.want == SIM_PROTO_BIN) {
+    code = _sim_encode(c, SIM_IO, SIM_PROTO_HELLO, sizeof SIM_PROTO_HELLO - 1);
+    if (write(c->sock, code->dptr, code->dlen) != (ssize_t)code->dlen)
+      eprintf("hello %s", strerror(errno));
+    sim_buf_free(code);
+  }
+
+  /* the writer must not block the host thread on a slow VHA */
+  if (fcntl(c->sock, F_SETFL, fcntl(c->sock, F_GETFL) | O_NONBLOCK) < 0 ||
+      (c->wsock = dup(c->sock)) < 0) {
+    eprintf("socket %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
 
   return 0;
 }
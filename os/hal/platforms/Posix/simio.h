@@ -38,6 +38,7 @@
 #if defined(SIMULATOR) || defined(__DOXYGEN__)
 
 #include <stdio.h>
+#include <sys/uio.h>
 #include "ch.h"
 
 /* data buffer size for sim_printf */
@@ -61,6 +62,19 @@ typedef enum {
   HID_COUNT /* HID_COUNT must be last */
 } sim_hal_id_t;
 
+/* wire protocol framing */
+typedef enum {
+  SIM_PROTO_HEX,  /* HID<tab>hex<newline> text lines */
+  SIM_PROTO_BIN   /* fixed binary header followed by raw bytes */
+} sim_proto_t;
+
+/* transport to the VHA */
+typedef enum {
+  SIM_TRANSPORT_TCP,  /* multiplexed loopback socket */
+  SIM_TRANSPORT_SHM,  /* shared memory rings, see simshm.h */
+  SIM_TRANSPORT_REPLAY /* recorded traffic, see simcap.h */
+} sim_transport_t;
+
 /* configure based on command line arguments */
 extern void sim_getopt(int argc, char **argv);
 
@@ -69,11 +83,39 @@ extern ssize_t sim_read_timeout(sim_hal_id_t hid, void *buf, size_t bufsz, int t
 extern ssize_t sim_read_timeoutS(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout);
 #define sim_read(a,b,c) sim_read_timeout((a),(b),(c),TIME_INFINITE)
 #define sim_readS(a,b,c) sim_read_timeoutS((a),(b),(c),TIME_INFINITE)
+extern ssize_t sim_readv_timeout(sim_hal_id_t hid, const struct iovec *iov, int iovcnt, int timeout);
+#define sim_readv(a,b,c) sim_readv_timeout((a),(b),(c),TIME_INFINITE)
+extern ssize_t sim_read_exact_timeout(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout);
+extern ssize_t sim_read_exact_timeoutS(sim_hal_id_t hid, void *buf, size_t bufsz, int timeout);
+#define sim_read_exact(a,b,c) sim_read_exact_timeout((a),(b),(c),TIME_INFINITE)
+#define sim_read_exactS(a,b,c) sim_read_exact_timeoutS((a),(b),(c),TIME_INFINITE)
 
 /* write data from the HAL */
 extern ssize_t sim_write(sim_hal_id_t hid, void *buf, size_t bufsz);
+extern ssize_t sim_write_async(sim_hal_id_t hid, void *buf, size_t bufsz);
+extern void sim_write_flush(void);
 extern int sim_printf(sim_hal_id_t hid, char *fmt, ...);
 
+/* framing currently used for writes */
+extern sim_proto_t sim_get_proto(sim_hal_id_t hid);
+extern sim_transport_t sim_get_transport(void);
+
+/* in-process SDC backend, see sdc_lld.c */
+extern const char *sim_get_sdc_image(void);
+extern unsigned sim_get_sdc_latency(void);
+
+/* ADC samples source, see adc_lld.c */
+extern const char *sim_get_adc_source(void);
+
+/* shared GPIO bank, see pal_lld.c */
+extern const char *sim_get_gpio_name(void);
+
+/* PWM width trace, see pwm_lld.c */
+extern const char *sim_get_pwm_trace(void);
+
+/* arrival time of the last frame read */
+extern systime_t sim_read_time(sim_hal_id_t hid);
+
 /* shutdown */
 extern int sim_disconnect(void);
 
@@ -0,0 +1,423 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simshm.c
+ * @brief   Shared memory ring transport.
+ *
+ * @addtogroup SIMSHM
+ * @{
+ */
+
+#if defined(SIMULATOR) || defined(SIMSHM_VHA) || defined(__DOXYGEN__)
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simshm.h"
+
+#define RING_MASK (SIMSHM_RING_SIZE - 1)
+
+/**
+ * @brief   Copy into a ring, wrapping at the end
+ *
+ * @notapi
+ */
+static void ring_copy_in(simshm_ring_t *r, uint32_t pos, const void *src, size_t len) {
+  size_t off = pos & RING_MASK;
+  size_t n = SIMSHM_RING_SIZE - off;
+
+  if (n > len)
+    n = len;
+  memcpy(r->data + off, src, n);
+  memcpy(r->data, (const uint8_t*)src + n, len - n);
+}
+
+/**
+ * @brief   Copy out of a ring, wrapping at the end
+ *
+ * @notapi
+ */
+static void ring_copy_out(simshm_ring_t *r, uint32_t pos, void *dst, size_t len) {
+  size_t off = pos & RING_MASK;
+  size_t n = SIMSHM_RING_SIZE - off;
+
+  if (n > len)
+    n = len;
+  memcpy(dst, r->data + off, n);
+  memcpy((uint8_t*)dst + n, r->data, len - n);
+}
+
+/**
+ * @brief   Open both doorbells of a region
+ * @note    The FIFOs are opened read/write so neither end
+ *          has to wait for the other to show up.
+ *
+ * @notapi
+ */
+static int bell_open(simshm_t *shm) {
+  char path[sizeof shm->name + 32];
+
+  snprintf(path, sizeof path, SIMSHM_BELL_FMT, shm->name, shm->rx);
+  if ((shm->bell_rx = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    return -1;
+
+  snprintf(path, sizeof path, SIMSHM_BELL_FMT, shm->name, shm->tx);
+  if ((shm->bell_tx = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * @brief   Map a region
+ *
+ * @notapi
+ */
+static int region_map(simshm_t *shm, int flags) {
+  int fd;
+
+  if ((fd = shm_open(shm->name, flags, 0600)) < 0)
+    return -1;
+
+  if ((flags & O_CREAT) && ftruncate(fd, sizeof(simshm_region_t)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  shm->rgn = mmap(NULL, sizeof(simshm_region_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm->rgn == MAP_FAILED) {
+    shm->rgn = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief   Initialize an end structure
+ *
+ * @notapi
+ */
+static int shm_init(simshm_t *shm, const char *name, int tx) {
+  memset(shm, 0, sizeof *shm);
+  shm->bell_rx = shm->bell_tx = -1;
+  shm->tx = tx;
+  shm->rx = !tx;
+
+  if (strlen(name) >= sizeof shm->name || strchr(name, '/')) {
+    errno = EINVAL;
+    return -1;
+  }
+  strcpy(shm->name, name);
+
+  return 0;
+}
+
+/**
+ * @brief   Create a region and its doorbells, VHA side
+ *
+ * @param[out] shm      the end to initialize
+ * @param[in] name      region name without a leading slash
+ *
+ * @return              0 on success, -1 and errno on failure
+ *
+ * @api
+ */
+extern int simshm_create(simshm_t *shm, const char *name) {
+  char path[sizeof shm->name + 32];
+  int dir;
+
+  if (shm_init(shm, name, SIMSHM_TO_SIM) < 0)
+    return -1;
+  shm->owner = 1;
+
+  for (dir = 0; dir < 2; dir++) {
+    snprintf(path, sizeof path, SIMSHM_BELL_FMT, shm->name, dir);
+    if (mkfifo(path, 0600) < 0 && errno != EEXIST)
+      return -1;
+  }
+
+  if (region_map(shm, O_RDWR | O_CREAT | O_TRUNC) < 0 || bell_open(shm) < 0) {
+    simshm_close(shm);
+    return -1;
+  }
+
+  shm->rgn->nrings = SIMSHM_RINGS;
+  shm->rgn->ring_size = SIMSHM_RING_SIZE;
+  shm->rgn->version = SIMSHM_VERSION;
+  __atomic_store_n(&shm->rgn->magic, SIMSHM_MAGIC, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/**
+ * @brief   Attach to a region created by the VHA, simulator side
+ *
+ * @param[out] shm      the end to initialize
+ * @param[in] name      region name without a leading slash
+ *
+ * @return              0 on success, -1 and errno on failure
+ *
+ * @api
+ */
+extern int simshm_open(simshm_t *shm, const char *name) {
+  if (shm_init(shm, name, SIMSHM_TO_VHA) < 0)
+    return -1;
+
+  if (region_map(shm, O_RDWR) < 0)
+    return -1;
+
+  if (__atomic_load_n(&shm->rgn->magic, __ATOMIC_ACQUIRE) != SIMSHM_MAGIC ||
+      shm->rgn->version != SIMSHM_VERSION ||
+      shm->rgn->nrings != SIMSHM_RINGS ||
+      shm->rgn->ring_size != SIMSHM_RING_SIZE) {
+    simshm_close(shm);
+    errno = EPROTO;
+    return -1;
+  }
+
+  if (bell_open(shm) < 0) {
+    simshm_close(shm);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief   Detach from a region
+ * @note    The creating end also removes the region and doorbells.
+ *
+ * @param[in,out] shm   the end to close
+ *
+ * @api
+ */
+extern void simshm_close(simshm_t *shm) {
+  char path[sizeof shm->name + 32];
+  int dir;
+
+  if (shm->bell_rx >= 0)
+    close(shm->bell_rx);
+  if (shm->bell_tx >= 0)
+    close(shm->bell_tx);
+  shm->bell_rx = shm->bell_tx = -1;
+
+  if (shm->rgn)
+    munmap(shm->rgn, sizeof(simshm_region_t));
+  shm->rgn = NULL;
+
+  if (shm->owner) {
+    (void)shm_unlink(shm->name);
+    for (dir = 0; dir < 2; dir++) {
+      snprintf(path, sizeof path, SIMSHM_BELL_FMT, shm->name, dir);
+      (void)unlink(path);
+    }
+    shm->owner = 0;
+  }
+}
+
+/**
+ * @brief   Append a record to a ring
+ * @details The other end's doorbell is rung only if it is asleep.
+ *
+ * @param[in] shm       the sending end
+ * @param[in] ring      ring index, the HID
+ * @param[in] buf       the payload
+ * @param[in] len       the payload size
+ *
+ * @return              0 on success, -1 and errno EAGAIN if the ring
+ *                      is full or EMSGSIZE if it can never fit
+ *
+ * @api
+ */
+extern int simshm_send(simshm_t *shm, unsigned ring, const void *buf, size_t len) {
+  simshm_ring_t *r;
+  uint32_t head, tail, rlen = (uint32_t)len;
+  char c = 0;
+
+  if (ring >= SIMSHM_RINGS || len + sizeof rlen > SIMSHM_RING_SIZE) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  r = &shm->rgn->ring[shm->tx][ring];
+  head = r->head;
+  tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  if (SIMSHM_RING_SIZE - (head - tail) < len + sizeof rlen) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  ring_copy_in(r, head, &rlen, sizeof rlen);
+  ring_copy_in(r, head + sizeof rlen, buf, len);
+  __atomic_store_n(&r->head, head + sizeof rlen + rlen, __ATOMIC_RELEASE);
+
+  /* pairs with the fence in simshm_arm() */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shm->rgn->sleeping[shm->tx], __ATOMIC_RELAXED))
+    (void)write(shm->bell_tx, &c, 1);
+
+  return 0;
+}
+
+/**
+ * @brief   Size of the next record in a ring
+ *
+ * @param[in] shm       the receiving end
+ * @param[in] ring      ring index, the HID
+ *
+ * @return              the payload size or -1 if the ring is empty
+ *
+ * @api
+ */
+extern ssize_t simshm_peek(simshm_t *shm, unsigned ring) {
+  simshm_ring_t *r;
+  uint32_t head, rlen;
+
+  if (ring >= SIMSHM_RINGS)
+    return -1;
+
+  r = &shm->rgn->ring[shm->rx][ring];
+  head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  if (head == r->tail)
+    return -1;
+
+  ring_copy_out(r, r->tail, &rlen, sizeof rlen);
+  return rlen;
+}
+
+/**
+ * @brief   Take the next record from a ring
+ *
+ * @param[in] shm       the receiving end
+ * @param[in] ring      ring index, the HID
+ * @param[out] buf      buffer for the payload
+ * @param[in] bufsz     the size of buf
+ *
+ * @return              the payload size or -1 and errno EAGAIN if
+ *                      the ring is empty or EMSGSIZE if the record
+ *                      does not fit in @p buf
+ *
+ * @api
+ */
+extern ssize_t simshm_recv(simshm_t *shm, unsigned ring, void *buf, size_t bufsz) {
+  ssize_t len = simshm_peek(shm, ring);
+  simshm_ring_t *r;
+
+  if (len < 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  if ((size_t)len > bufsz) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  r = &shm->rgn->ring[shm->rx][ring];
+  ring_copy_out(r, r->tail + sizeof(uint32_t), buf, len);
+  __atomic_store_n(&r->tail, r->tail + sizeof(uint32_t) + len, __ATOMIC_RELEASE);
+
+  return len;
+}
+
+/**
+ * @brief   Announce that this end is about to sleep
+ * @details After this call producers ring the doorbell, the
+ *          rings are checked again to close the race with a
+ *          record sent just before.
+ *
+ * @param[in] shm       the receiving end
+ *
+ * @return              nonzero if a record is already waiting, the
+ *                      caller should not sleep
+ *
+ * @api
+ */
+extern int simshm_arm(simshm_t *shm) {
+  unsigned ring;
+
+  __atomic_store_n(&shm->rgn->sleeping[shm->rx], 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (ring = 0; ring < SIMSHM_RINGS; ring++)
+    if (simshm_peek(shm, ring) >= 0)
+      return 1;
+
+  return 0;
+}
+
+/**
+ * @brief   Announce that this end is awake and drain its doorbell
+ *
+ * @param[in] shm       the receiving end
+ *
+ * @api
+ */
+extern void simshm_disarm(simshm_t *shm) {
+  char buf[64];
+
+  __atomic_store_n(&shm->rgn->sleeping[shm->rx], 0, __ATOMIC_RELAXED);
+  while (read(shm->bell_rx, buf, sizeof buf) > 0)
+    ;
+}
+
+/**
+ * @brief   Block until a record arrives
+ * @note    Blocks the whole process, the simulator waits on
+ *          @p simshm_fd() through its own reactor instead.
+ *
+ * @param[in] shm       the receiving end
+ * @param[in] timeout   milliseconds, negative waits forever
+ *
+ * @return              1 if a record may be waiting, 0 on timeout,
+ *                      -1 on error
+ *
+ * @api
+ */
+extern int simshm_wait(simshm_t *shm, int timeout) {
+  struct pollfd pfd = { shm->bell_rx, POLLIN, 0 };
+  int rv = 1;
+
+  if (!simshm_arm(shm))
+    rv = poll(&pfd, 1, timeout);
+  simshm_disarm(shm);
+
+  return rv;
+}
+
+#endif /* SIMULATOR || SIMSHM_VHA */
+
+/** @} */
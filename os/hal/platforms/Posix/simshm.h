@@ -0,0 +1,125 @@
+/*
+    ChibiOS/RT - Copyright (C) 2014 Nicholas T. Lamkins
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    simshm.h
+ * @brief   Shared memory ring transport.
+ * @details The region holds one single producer, single consumer
+ *          ring per HID in each direction. Each ring carries records
+ *          made of a 32 bit length in host byte order followed by the
+ *          raw payload. A consumer with nothing to do sets its
+ *          @p sleeping flag and blocks on a doorbell FIFO, producers
+ *          only write to the doorbell when that flag is set.
+ * @note    This file has no ChibiOS dependencies so a C VHA can build
+ *          simshm.c with -DSIMSHM_VHA and use the same code. The
+ *          python VHA side is simshm.py.
+ *
+ * @addtogroup SIMSHM
+ * @{
+ */
+
+#ifndef SIMSHM_H
+#define SIMSHM_H
+
+#if defined(SIMULATOR) || defined(SIMSHM_VHA) || defined(__DOXYGEN__)
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SIMSHM_MAGIC    0x53494d52  /* "SIMR" */
+#define SIMSHM_VERSION  1
+
+/* rings per direction, one per HID */
+#define SIMSHM_RINGS    16
+
+/* bytes per ring, must be a power of two */
+#ifndef SIMSHM_RING_SIZE
+#define SIMSHM_RING_SIZE (64 * 1024)
+#endif
+
+/* ring directions */
+#define SIMSHM_TO_VHA   0
+#define SIMSHM_TO_SIM   1
+
+/* doorbell FIFO path from region name and direction */
+#define SIMSHM_BELL_FMT "/dev/shm/%s.bell%d"
+
+/**
+ * @brief   Ring layout
+ * @note    The indexes are free running byte counts, head and tail
+ *          sit on separate cache lines.
+ */
+typedef struct {
+  volatile uint32_t   head;       /* written by the producer */
+  uint8_t             _pad0[60];
+  volatile uint32_t   tail;       /* written by the consumer */
+  uint8_t             _pad1[60];
+  uint8_t             data[SIMSHM_RING_SIZE];
+} simshm_ring_t;
+
+/**
+ * @brief   Region layout
+ */
+typedef struct {
+  uint32_t            magic;
+  uint32_t            version;
+  uint32_t            nrings;     /* SIMSHM_RINGS */
+  uint32_t            ring_size;  /* SIMSHM_RING_SIZE */
+  volatile uint32_t   sleeping[2];
+  uint8_t             _pad[40];
+  simshm_ring_t       ring[2][SIMSHM_RINGS];
+} simshm_region_t;
+
+/**
+ * @brief   One end of a shared memory transport
+ */
+typedef struct {
+  simshm_region_t     *rgn;
+  int                 tx;         /* direction written by this end */
+  int                 rx;         /* direction read by this end */
+  int                 bell_tx;    /* doorbell of the other end */
+  int                 bell_rx;    /* doorbell this end waits on */
+  int                 owner;      /* created the region */
+  char                name[64];
+} simshm_t;
+
+extern int simshm_create(simshm_t *shm, const char *name);
+extern int simshm_open(simshm_t *shm, const char *name);
+extern void simshm_close(simshm_t *shm);
+
+extern int simshm_send(simshm_t *shm, unsigned ring, const void *buf, size_t len);
+extern ssize_t simshm_peek(simshm_t *shm, unsigned ring);
+extern ssize_t simshm_recv(simshm_t *shm, unsigned ring, void *buf, size_t bufsz);
+
+extern int simshm_arm(simshm_t *shm);
+extern void simshm_disarm(simshm_t *shm);
+extern int simshm_wait(simshm_t *shm, int timeout);
+#define simshm_fd(shm) ((shm)->bell_rx)
+
+#endif /* SIMULATOR || SIMSHM_VHA */
+#endif /* SIMSHM_H */
+
+/** @} */
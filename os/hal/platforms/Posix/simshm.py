@@ -0,0 +1,153 @@
+"""VHA side of the simio shared memory ring transport.
+
+Mirrors the layout in simshm.h. The VHA creates the region before
+starting the simulator with --sim_transport=shm:<name>.
+
+  shm = SimShm('rig0')
+  shm.send(HIDS.index('SDC_IO'), data)
+  for hid, data in shm.recv(timeout=1.0):
+    ...
+  shm.close()
+"""
+import errno
+import mmap
+import os
+import select
+import struct
+import time
+
+MAGIC     = 0x53494d52
+VERSION   = 1
+RINGS     = 16
+RING_SIZE = 64 * 1024
+
+TO_VHA = 0
+TO_SIM = 1
+
+HDR      = struct.Struct('=IIII')  # magic, version, nrings, ring_size
+SLEEPING = 16                      # offset of sleeping[2]
+RING0    = 64                      # offset of the first ring
+HEAD     = 0                       # ring offsets
+TAIL     = 64
+DATA     = 128
+U32      = struct.Struct('=I')
+
+BELL_FMT = '/dev/shm/%s.bell%d'
+
+class SimShm(object):
+  def __init__(self, name, ring_size=RING_SIZE):
+    self.name = name
+    self.ring_size = ring_size
+    self.mask = ring_size - 1
+    self.stride = DATA + ring_size
+    self.tx, self.rx = TO_SIM, TO_VHA
+
+    # doorbells
+    self.bells = []
+    for d in (TO_VHA, TO_SIM):
+      path = BELL_FMT % (name, d)
+      try:
+        os.mkfifo(path, 0600)
+      except OSError as e:
+        if e.errno != errno.EEXIST:
+          raise
+      self.bells.append(os.open(path, os.O_RDWR | os.O_NONBLOCK))
+
+    # region
+    size = RING0 + 2 * RINGS * self.stride
+    fd = os.open('/dev/shm/' + name, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0600)
+    os.ftruncate(fd, size)
+    self.mem = mmap.mmap(fd, size)
+    os.close(fd)
+
+    HDR.pack_into(self.mem, 0, 0, VERSION, RINGS, ring_size)
+    U32.pack_into(self.mem, 0, MAGIC)
+
+  def close(self):
+    self.mem.close()
+    for fd in self.bells:
+      os.close(fd)
+    os.unlink('/dev/shm/' + self.name)
+    for d in (TO_VHA, TO_SIM):
+      os.unlink(BELL_FMT % (self.name, d))
+
+  def _ring(self, d, hid):
+    return RING0 + (d * RINGS + hid) * self.stride
+
+  def _get(self, off):
+    return U32.unpack_from(self.mem, off)[0]
+
+  def _copy_in(self, base, pos, data):
+    pos &= self.mask
+    n = min(len(data), self.ring_size - pos)
+    self.mem[base + DATA + pos:base + DATA + pos + n] = data[:n]
+    if n < len(data):
+      self.mem[base + DATA:base + DATA + len(data) - n] = data[n:]
+
+  def _copy_out(self, base, pos, length):
+    pos &= self.mask
+    n = min(length, self.ring_size - pos)
+    data = self.mem[base + DATA + pos:base + DATA + pos + n]
+    if n < length:
+      data += self.mem[base + DATA:base + DATA + length - n]
+    return data
+
+  def send(self, hid, data):
+    """Queue one record, returns False if the ring is full"""
+    data = bytes(data)
+    r = self._ring(self.tx, hid)
+    head, tail = self._get(r + HEAD), self._get(r + TAIL)
+    if self.ring_size - ((head - tail) & 0xffffffff) < len(data) + 4:
+      return False
+    self._copy_in(r, head, U32.pack(len(data)))
+    self._copy_in(r, head + 4, data)
+    U32.pack_into(self.mem, r + HEAD, (head + 4 + len(data)) & 0xffffffff)
+    if self._get(SLEEPING + 4 * self.tx):
+      try:
+        os.write(self.bells[self.tx], '\0')
+      except OSError as e:
+        if e.errno != errno.EAGAIN:
+          raise
+    return True
+
+  def poll(self):
+    """Take every waiting record as (hid, data) without blocking"""
+    out = []
+    for hid in range(RINGS):
+      r = self._ring(self.rx, hid)
+      head, tail = self._get(r + HEAD), self._get(r + TAIL)
+      while tail != head:
+        length = U32.unpack(self._copy_out(r, tail, 4))[0]
+        out.append((hid, self._copy_out(r, tail + 4, length)))
+        tail = (tail + 4 + length) & 0xffffffff
+      U32.pack_into(self.mem, r + TAIL, tail)
+    return out
+
+  def recv(self, timeout=None):
+    """Wait up to timeout seconds for records, see poll()"""
+    out = self.poll()
+    if out:
+      return out
+
+    # sleep on the doorbell, then look again in case
+    # a record landed before the flag was seen
+    U32.pack_into(self.mem, SLEEPING + 4 * self.rx, 1)
+    out = self.poll()
+
+    # python has no store fence so a doorbell may be missed,
+    # sleeping in short slices bounds the damage to latency
+    end = None if timeout is None else time.time() + timeout
+    while not out:
+      wait = 0.01 if end is None else min(0.01, end - time.time())
+      if wait <= 0:
+        break
+      select.select([self.bells[self.rx]], [], [], wait)
+      out = self.poll()
+    U32.pack_into(self.mem, SLEEPING + 4 * self.rx, 0)
+    try:
+      while os.read(self.bells[self.rx], 64):
+        pass
+    except OSError as e:
+      if e.errno != errno.EAGAIN:
+        raise
+    return out
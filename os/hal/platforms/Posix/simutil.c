@@ -36,12 +36,124 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "ch.h"
 #include "simutil.h"
 
-#define MIN(a,b) ((a)<(b)?(a):(b))
+/**
+ * @brief   Pooled buffer, the data directly follows the header
+ */
+typedef struct {
+  sim_buf_t     buf;
+  char          data[SIM_BUF_SIZE];
+} sim_buf_obj_t;
+
+/**
+ * @brief   Buffer and message pools
+ * @details Every simio frame in flight lives in one of these so
+ *          the read and write paths do not go through malloc().
+ */
+static sim_buf_obj_t buf_objs[SIM_BUF_POOL_SIZE];
+static sim_msg_t msg_objs[SIM_MSG_POOL_SIZE];
+static MemoryPool buf_pool;
+static MemoryPool msg_pool;
+static sim_pool_stats_t buf_stats;
+static sim_pool_stats_t msg_stats;
+
+/**
+ * @brief   Fill the pools
+ * @note    Must be called after chSysInit() and before
+ *          any other function in this file.
+ *
+ * @notapi
+ */
+extern void sim_pool_init(void) {
+  static bool once = FALSE;
+  if (!once) {
+    once = TRUE;
+    chPoolInit(&buf_pool, sizeof(sim_buf_obj_t), NULL);
+    chPoolLoadArray(&buf_pool, buf_objs, SIM_BUF_POOL_SIZE);
+    chPoolInit(&msg_pool, sizeof(sim_msg_t), NULL);
+    chPoolLoadArray(&msg_pool, msg_objs, SIM_MSG_POOL_SIZE);
+  }
+}
+
+/**
+ * @brief   Copy the pool usage counters
+ *
+ * @param[out] bufs     buffer pool counters, may be NULL
+ * @param[out] msgs     message pool counters, may be NULL
+ *
+ * @api
+ */
+extern void sim_pool_stats(sim_pool_stats_t *bufs, sim_pool_stats_t *msgs) {
+  chSysLock();
+  if (bufs)
+    *bufs = buf_stats;
+  if (msgs)
+    *msgs = msg_stats;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Take an object from a pool
+ *
+ * @param[in] mp        the pool
+ * @param[in,out] st    the pool counters
+ *
+ * @return              the object or NULL if the pool is empty
+ *
+ * @notapi
+ */
+static void* _sim_pool_get(MemoryPool *mp, sim_pool_stats_t *st) {
+  void *objp;
+
+  chSysLock();
+  if ((objp = chPoolAllocI(mp)) != NULL) {
+    if (++st->used > st->hwm)
+      st->hwm = st->used;
+  }
+  else
+    st->exhausted++;
+  chSysUnlock();
+
+  return objp;
+}
+
+/**
+ * @brief   Return an object to a pool
+ * @param[in] mp        the pool
+ * @param[in,out] st    the pool counters
+ * @param[in] objp      the object
+ *
+ * @notapi
+ */
+static void _sim_pool_putI(MemoryPool *mp, sim_pool_stats_t *st, void *objp) {
+  chPoolFreeI(mp, objp);
+  st->used--;
+}
+
+/**
+ * @brief   Heap allocation for whatever does not fit the pools
+ *
+ * @param[in] len       number of bytes
+ *
+ * @return              the memory, never NULL
+ *
+ * @notapi
+ */
+static void* _sim_heap_alloc(size_t len) {
+  void *p = malloc(len);
+  if (!p) {
+    eprintf("out of memory");
+    abort();
+  }
+  return p;
+}
 
 /**
  * @brief   Allocate a new message struct
+ * @details Buffers of up to @p SIM_BUF_SIZE bytes come from the
+ *          buffer pool and always have that capacity.
  * @note    Return value must be freed
  *
  * @param[in] len       initial buffer size
@@ -51,30 +163,36 @@
  * @notapi
  */
 extern sim_buf_t* sim_buf_alloc(size_t len) {
-  /* build the struct */
-  sim_buf_t *buf = malloc(sizeof(sim_buf_t));
-  if (!buf) {
-    eprintf("out of memory");
-    abort();
-  }
-  memset((void*)buf, '\0', sizeof(sim_buf_t));
+  sim_buf_obj_t *obj = NULL;
+  sim_buf_t *buf;
 
-  /* allocate room for message data */
-  buf->data = malloc(len);
-  if (!buf->data) {
-    eprintf("out of memory");
-    abort();
+  if (len <= SIM_BUF_SIZE)
+    obj = _sim_pool_get(&buf_pool, &buf_stats);
+
+  if (obj) {
+    buf = &obj->buf;
+    buf->dsz = SIM_BUF_SIZE;
+    buf->pooled = TRUE;
+  }
+  else {
+    /* same layout as a pool object, data follows the header */
+    buf = _sim_heap_alloc(sizeof(sim_buf_t) + len);
+    buf->dsz = len;
+    buf->pooled = FALSE;
   }
 
   /* initialize members */
+  buf->data = (char*)(buf + 1);
   buf->dptr = buf->data;
-  buf->dsz = len;
+  buf->dlen = 0;
 
   return buf;
 }
 
 /**
  * @brief   Increase the size of an allocated buffer
+ * @details The data moves to the heap, the buffer header
+ *          stays where it was allocated.
  *
  * @param[in,out] buf   The buffer to reallocate
  * @param[in] len       The new size of the buffer
@@ -82,10 +200,20 @@ extern sim_buf_t* sim_buf_alloc(size_t len) {
  * @notapi
  */
 static void sim_buf_realloc(sim_buf_t *buf, size_t len) {
-  buf->data = realloc(buf->data, len);
+  char *data = _sim_heap_alloc(len);
 
-  /* move the data pointer to the start *
-   * of the newly allocated area        */
+  memcpy(data, buf->data, buf->dlen);
+  if (buf->data != (char*)(buf + 1))
+    free(buf->data);
+  else if (buf->pooled) {
+    chSysLock();
+    buf_stats.oversize++;
+    chSysUnlock();
+  }
+  buf->data = data;
+
+  /* move the data pointer to the end *
+   * of the copied data               */
   sim_buf_setpos(buf, buf->dlen);
 
   /* update buffer size */
@@ -100,12 +228,29 @@ static void sim_buf_realloc(sim_buf_t *buf, size_t len) {
  * @notapi
  */
 extern void sim_buf_free(sim_buf_t *buf) {
-  free(buf->data);
+  chSysLock();
+  sim_buf_freeI(buf);
+  chSysUnlock();
+}
+
+/**
+ * @brief   Free all message data
+ *
+ * @param[in] buf       The pointer to free
+ *
+ * @iclass
+ */
+extern void sim_buf_freeI(sim_buf_t *buf) {
+  if (buf->data != (char*)(buf + 1))
+    free(buf->data);
   buf->dsz = 0;
   buf->dlen = 0;
   buf->data = NULL;
   buf->dptr = NULL;
-  free(buf);
+  if (buf->pooled)
+    _sim_pool_putI(&buf_pool, &buf_stats, buf);
+  else
+    free(buf);
 }
 
 /**
@@ -118,13 +263,8 @@ extern void sim_buf_free(sim_buf_t *buf) {
  * @notapi
  */
 extern void sim_buf_putc(sim_buf_t *buf, char c) {
-  if (buf->dlen == buf->dsz) {
+  if (buf->dlen == buf->dsz)
     sim_buf_realloc(buf, buf->dsz + MSG_BLOCK_SIZE);
-    if (!buf->data) {
-      eprintf("out of memory");
-      abort();
-    }
-  }
   *buf->dptr++ = c;
   buf->dlen++;
 }
@@ -138,8 +278,56 @@ extern void sim_buf_putc(sim_buf_t *buf, char c) {
  * @notapi
  */
 extern void sim_buf_puts(sim_buf_t *buf, char *str) {
-  while (*str)
-    sim_buf_putc(buf, *str++);
+  sim_buf_write(buf, str, strlen(str));
+}
+
+/**
+ * @brief   Append a block of bytes to a buffer
+ * @note    Implicitly expands the buffer if necessary
+ *
+ * @param[in,out] buf   The buffer to write
+ * @param[in] src       The bytes to append
+ * @param[in] len       The number of bytes to append
+ *
+ * @notapi
+ */
+extern void sim_buf_write(sim_buf_t *buf, const void *src, size_t len) {
+  if (buf->dlen + len > buf->dsz)
+    sim_buf_realloc(buf, buf->dlen + len + MSG_BLOCK_SIZE);
+  memcpy(buf->dptr, src, len);
+  buf->dptr += len;
+  buf->dlen += len;
+}
+
+/**
+ * @brief   Make room to append to a buffer in place
+ * @note    Implicitly expands the buffer if necessary
+ *
+ * @param[in,out] buf   The buffer to write
+ * @param[in] len       The number of bytes that will be appended
+ *
+ * @return              where to write, @p sim_buf_commit() appends
+ *                      what was written
+ *
+ * @notapi
+ */
+extern char* sim_buf_reserve(sim_buf_t *buf, size_t len) {
+  if (buf->dlen + len > buf->dsz)
+    sim_buf_realloc(buf, buf->dlen + len + MSG_BLOCK_SIZE);
+  return buf->dptr;
+}
+
+/**
+ * @brief   Append bytes written to reserved room
+ *
+ * @param[in,out] buf   The buffer written
+ * @param[in] len       The number of bytes written
+ *
+ * @notapi
+ */
+extern void sim_buf_commit(sim_buf_t *buf, size_t len) {
+  buf->dptr += len;
+  buf->dlen += len;
 }
 
 /**
@@ -198,11 +386,10 @@ extern int sim_buf_eof(sim_buf_t *buf) {
  */
 extern sim_msg_t* sim_msg_alloc(size_t len) {
   /* build the struct */
-  sim_msg_t *msg = malloc(sizeof(sim_msg_t));
-  if (!msg) {
-    eprintf("out of memory");
-    abort();
-  }
+  sim_msg_t *msg = _sim_pool_get(&msg_pool, &msg_stats);
+  uint8_t pooled = msg != NULL;
+  if (!pooled)
+    msg = _sim_heap_alloc(sizeof(sim_msg_t));
   memset((void*)msg, '\0', sizeof(sim_msg_t));
 
   /* allocate room for message data */
@@ -212,6 +399,7 @@ extern sim_msg_t* sim_msg_alloc(size_t len) {
   msg->state = ST_HEADER;
   msg->hptr = msg->header;
   msg->hlen = 0;
+  msg->pooled = pooled;
 
   return msg;
 }
@@ -224,8 +412,24 @@ extern sim_msg_t* sim_msg_alloc(size_t len) {
  * @notapi
  */
 extern void sim_msg_free(sim_msg_t *msg) {
-  sim_buf_free(msg->buf);
-  free(msg);
+  chSysLock();
+  sim_msg_freeI(msg);
+  chSysUnlock();
+}
+
+/**
+ * @brief   Free a message structure
+ *
+ * @param[in,out] msg   The pointer to be freed
+ *
+ * @iclass
+ */
+extern void sim_msg_freeI(sim_msg_t *msg) {
+  sim_buf_freeI(msg->buf);
+  if (msg->pooled)
+    _sim_pool_putI(&msg_pool, &msg_stats, msg);
+  else
+    free(msg);
 }
 
 #endif /* SIMULATOR */
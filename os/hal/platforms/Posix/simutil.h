@@ -38,6 +38,7 @@
 #if defined(SIMULATOR) || defined(__DOXYGEN__)
 
 #include <stdio.h>
+#include <stdint.h>
 
 /**
  * @brief   Console errors
@@ -47,9 +48,64 @@
 #define eprintf(fmt, args...) \
   (void)fprintf(stderr, "ERROR simio " fmt " at %s:%d\n" , ##args , __FILE__, __LINE__)
 
+#ifndef MIN
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#endif
+
 #define MSG_BLOCK_SIZE 256
 #define DUMMY_HEADER "XXXXXX_XX -1234567890"
 
+/**
+ * @brief   Largest payload a LLD moves with one read or write
+ * @note    Larger frames still work but spill to the heap.
+ */
+#ifndef SIM_MAX_TRANSFER
+#define SIM_MAX_TRANSFER 4096
+#endif
+
+/**
+ * @brief   Data capacity of a pooled buffer
+ * @details Fits a hex encoded frame of @p SIM_MAX_TRANSFER bytes,
+ *          which is always longer than the binary encoding.
+ */
+#define SIM_BUF_SIZE (sizeof(DUMMY_HEADER "\t") + SIM_MAX_TRANSFER*2 + 1)
+
+/**
+ * @brief   Number of pooled buffers and messages
+ * @note    An empty pool falls back to the heap and is
+ *          counted in the pool statistics.
+ */
+#ifndef SIM_BUF_POOL_SIZE
+#define SIM_BUF_POOL_SIZE 64
+#endif
+#ifndef SIM_MSG_POOL_SIZE
+#define SIM_MSG_POOL_SIZE 32
+#endif
+
+/**
+ * @brief   Binary frame marker
+ * @details Text headers always start with an upper case HID name so
+ *          a frame starting with this byte is known to be binary.
+ */
+#define SIM_FRAME_MAGIC 0xA5
+
+/**
+ * @brief   Binary frame flags
+ */
+#define SIM_FRAME_F_HELLO 0x01  /* protocol negotiation, no payload */
+
+/**
+ * @brief   Binary frame header
+ * @note    The payload length is sent in network byte order.
+ */
+typedef struct __attribute__((packed)) {
+  uint8_t       magic;
+  uint8_t       hid;
+  uint8_t       flags;
+  uint8_t       reserved;
+  uint32_t      len;
+} sim_frame_hdr_t;
+
 /**
  * @brief   IO message data
  */
@@ -58,11 +114,14 @@ typedef struct {
   char          *dptr;
   size_t        dsz;
   size_t        dlen;
+  uint8_t       pooled;
 } sim_buf_t;
 
 typedef enum {
   ST_HEADER,
-  ST_DATA
+  ST_DATA,
+  ST_BIN_HEADER,
+  ST_BIN_DATA
 } sim_state_t;
 
 typedef struct {
@@ -70,19 +129,44 @@ typedef struct {
   char        header[sizeof DUMMY_HEADER];
   char        *hptr;
   ssize_t     hlen;
+  int         hid;
+  uint8_t     flags;
+  uint32_t    time;       /* system time the frame arrived */
+  size_t      remain;
+  char        half;       /* hex digit split from its pair by a read */
+  uint8_t     invalid;    /* hex payload held a non digit */
   sim_buf_t   *buf;
+  uint8_t     pooled;
 } sim_msg_t;
 
+/**
+ * @brief   Pool usage counters
+ */
+typedef struct {
+  uint32_t    used;       /* objects currently allocated */
+  uint32_t    hwm;        /* most objects allocated at once */
+  uint32_t    exhausted;  /* allocations the empty pool sent to the heap */
+  uint32_t    oversize;   /* buffers that outgrew SIM_BUF_SIZE */
+} sim_pool_stats_t;
+
+extern void sim_pool_init(void);
+extern void sim_pool_stats(sim_pool_stats_t *bufs, sim_pool_stats_t *msgs);
+
 extern sim_buf_t* sim_buf_alloc(size_t);
 extern void sim_buf_free(sim_buf_t*);
+extern void sim_buf_freeI(sim_buf_t*);
 extern void sim_buf_putc(sim_buf_t*, char);
 extern void sim_buf_puts(sim_buf_t*, char*);
+extern void sim_buf_write(sim_buf_t*, const void*, size_t);
+extern char* sim_buf_reserve(sim_buf_t*, size_t);
+extern void sim_buf_commit(sim_buf_t*, size_t);
 extern void sim_buf_setpos(sim_buf_t*, off_t pos);
 extern size_t sim_buf_read(sim_buf_t *ibuf, void *obuf, size_t obufsz);
 extern int sim_buf_eof(sim_buf_t*);
 
 extern sim_msg_t* sim_msg_alloc(size_t);
 extern void sim_msg_free(sim_msg_t*);
+extern void sim_msg_freeI(sim_msg_t*);
 
 #endif /* SIMULATOR */
 #endif /* SIMUTIL_H */
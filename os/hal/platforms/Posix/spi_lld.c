@@ -28,6 +28,7 @@
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
+#include "simutil.h"
 
 #if HAL_USE_SPI || defined(__DOXYGEN__)
 
@@ -35,6 +36,25 @@
 /* Driver local definitions.                                                 */
 /*===========================================================================*/
 
+/**
+ * @name    Operations queued for the transfer thread
+ * @details The chip select operations carry the pad number in the
+ *          upper bits, the transfers take their parameters from the
+ *          driver because only one can be in progress.
+ * @{
+ */
+#define SPI_OP_SELECT       1
+#define SPI_OP_UNSELECT     2
+#define SPI_OP_IGNORE       3
+#define SPI_OP_EXCHANGE     4
+#define SPI_OP_SEND         5
+#define SPI_OP_RECEIVE      6
+#define SPI_OP_POLLED       7
+#define SPI_OP_TRANSACTION  8
+#define SPI_OP_MASK         0xFF
+#define SPI_OP_PAD_SHIFT    8
+/** @} */
+
 /*===========================================================================*/
 /* Driver exported variables.                                                */
 /*===========================================================================*/
@@ -49,40 +69,226 @@ SPIDriver SPID1;
 /*===========================================================================*/
 /* Driver local variables and types.                                         */
 /*===========================================================================*/
-static WORKING_AREA(wsp, 128);
-MUTEX_DECL(read_lock);
+static WORKING_AREA(wsp, 256);
 
 /*===========================================================================*/
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+/**
+ * @brief   Queues an operation for the transfer thread.
+ * @note    Callable from any context, the hardware would not block either.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] op        the operation code
+ *
+ * @iclass
+ */
+static void spi_post_i(SPIDriver *spip, msg_t op) {
+  msg_t status;
+
+  status = chMBPostI(&spip->opmb, op);
+  chDbgAssert(status == RDY_OK, "spi_post_i(), #1", "queue full");
+  (void)status;
+}
+
+/**
+ * @brief   Queues a chip select operation for the transfer thread.
+ * @details The chip select can be toggled any number of times while a
+ *          transfer is in progress, the caller waits for room in the
+ *          queue rather than losing the operation. The transfer thread,
+ *          from the end of transfer callback, can not wait for itself
+ *          and always finds the room of the transfer it took.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] op        the operation code
+ *
+ * @sclass
+ */
+static void spi_post_cs_s(SPIDriver *spip, msg_t op) {
+
+  if (chThdSelf() == spip->thd)
+    spi_post_i(spip, op);
+  else
+    (void)chMBPostS(&spip->opmb, op, TIME_INFINITE);
+}
+
+/**
+ * @brief   Sends data to the VHA.
+ *
+ * @param[in] txbuf     the data
+ * @param[in] n         size of @p txbuf
+ * @return              The operation status.
+ * @retval TRUE         the data was sent.
+ * @retval FALSE        the VHA is gone, the failure has been logged.
+ *
+ * @notapi
+ */
+static bool_t spi_vha_send(const void *txbuf, size_t n) {
+
+  if (sim_write(SPI_IO, (void*)txbuf, n) != (ssize_t)n) {
+    eprintf("SPI send of %u bytes failed", (unsigned)n);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * @brief   Receives data from the VHA.
+ * @details On failure the buffer reads as an idle MISO line, all ones.
+ *
+ * @param[out] rxbuf    the buffer to fill
+ * @param[in] n         size of @p rxbuf
+ * @param[in] ok        FALSE if the request already failed, nothing is
+ *                      read then
+ * @return              The operation status, as @p spi_vha_send().
+ *
+ * @notapi
+ */
+static bool_t spi_vha_receive(void *rxbuf, size_t n, bool_t ok) {
+  ssize_t nb;
+
+  if (ok && (nb = sim_read_exact(SPI_IO, rxbuf, n)) != (ssize_t)n) {
+    eprintf("SPI receive got %d of %u bytes", (int)nb, (unsigned)n);
+    ok = FALSE;
+  }
+  if (!ok)
+    memset(rxbuf, 0xFF, n);
+  return ok;
+}
+
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Carries out a transaction in a single VHA round trip.
+ * @details The frame is the line "transaction <steps>" followed by a
+ *          record per step: the operation byte, the word count (the pad
+ *          for the select steps) as a little endian 32 bits word and the
+ *          data of the exchange and send steps. The VHA replies with a
+ *          single frame holding the data of the exchange and receive
+ *          steps in order, or nothing if there are none.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ *
+ * @notapi
+ */
+static void spi_transaction(SPIDriver *spip) {
+  const SPIStep *sp, *end = spip->steps + spip->nsteps;
+  size_t size = 32;
+  uint8_t *frame, *p;
+  uint32_t arg;
+  bool_t ok;
+
+  for (sp = spip->steps; sp < end; sp++)
+    size += 5 + (sp->op == SPI_STEP_EXCHANGE || sp->op == SPI_STEP_SEND ?
+                 sp->n : 0);
+  frame = malloc(size);
+  chDbgAssert(frame != NULL, "spi_transaction(), #1", "out of memory");
+
+  p = frame + sprintf((char*)frame, "transaction %u\n",
+                      (unsigned)spip->nsteps);
+  for (sp = spip->steps; sp < end; sp++) {
+    if (sp->op == SPI_STEP_SELECT || sp->op == SPI_STEP_UNSELECT)
+      arg = spip->config->sspad;
+    else
+      arg = sp->n;
+    *p++ = (uint8_t)sp->op;
+    *p++ = (uint8_t)arg;
+    *p++ = (uint8_t)(arg >> 8);
+    *p++ = (uint8_t)(arg >> 16);
+    *p++ = (uint8_t)(arg >> 24);
+    if (sp->op == SPI_STEP_EXCHANGE || sp->op == SPI_STEP_SEND) {
+      memcpy(p, sp->txbuf, sp->n);
+      p += sp->n;
+    }
+  }
+  ok = spi_vha_send(frame, p - frame);
+  free(frame);
+
+  /* the reply is consumed piecewise, straight into the buffers */
+  for (sp = spip->steps; sp < end; sp++)
+    if (sp->op == SPI_STEP_EXCHANGE || sp->op == SPI_STEP_RECEIVE)
+      ok = spi_vha_receive(sp->rxbuf, sp->n, ok);
+}
+#endif /* SPI_USE_TRANSACTIONS */
+
+/**
+ * @brief   Carries out a transfer with the VHA.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] op        the transfer operation code
+ *
+ * @notapi
+ */
+static void spi_transfer(SPIDriver *spip, msg_t op) {
+  switch (op) {
+  case SPI_OP_IGNORE:
+    sim_printf(SPI_IO, "ignore %u", (unsigned)spip->n);
+    break;
+  case SPI_OP_EXCHANGE:
+    sim_printf(SPI_IO, "exchange");
+    (void)spi_vha_receive(spip->rxbuf, spip->n,
+                          spi_vha_send(spip->txbuf, spip->n));
+    break;
+  case SPI_OP_SEND:
+    sim_printf(SPI_IO, "send");
+    (void)spi_vha_send(spip->txbuf, spip->n);
+    break;
+  case SPI_OP_RECEIVE:
+    sim_printf(SPI_IO, "receive %u", (unsigned)spip->n);
+    (void)spi_vha_receive(spip->rxbuf, spip->n, TRUE);
+    break;
+#if SPI_USE_TRANSACTIONS
+  case SPI_OP_TRANSACTION:
+    spi_transaction(spip);
+    break;
+#endif
+  }
+}
+
 /*===========================================================================*/
 /* Driver interrupt handlers.                                                */
 /*===========================================================================*/
 
 /**
- * @brief   Thread waits for complete signal from VHA
- * @details SPI threads are put to sleep to wait for the driver
- *          to complete an operation. This is handled by reading
- *          a single byte from the VHA to signal completion and
- *          then waking up the thread.
+ * @brief   Transfer thread, plays the part of the DMA engine
+ * @details The start functions run with the kernel locked and only
+ *          queue the operation. This thread talks to the VHA with
+ *          the kernel unlocked and signals the completion of each
+ *          transfer as an interrupt would, so the caller can keep
+ *          working while a transfer is in progress.
  */
-static msg_t complete_thread(void *arg) {
+static msg_t transfer_thread(void *arg) {
   SPIDriver *spip = (SPIDriver*)arg;
-  uint8_t c;
-
-  /* only one reader at a time */
-  chMtxLock(&read_lock);
-
-  int nb = sim_read(SPI_IO, &c, sizeof c);
-  if (nb > 0) {
-    CH_IRQ_PROLOGUE();
-    _spi_isr_code(spip);
-    CH_IRQ_EPILOGUE();
+  uint16_t frame;
+  msg_t op;
+
+  chRegSetThreadName("spi_transfer");
+  while (TRUE) {
+    chMBFetch(&spip->opmb, &op, TIME_INFINITE);
+
+    switch (op & SPI_OP_MASK) {
+    case SPI_OP_SELECT:
+      sim_printf(SPI_IO, "select %d", (int)(op >> SPI_OP_PAD_SHIFT));
+      break;
+    case SPI_OP_UNSELECT:
+      sim_printf(SPI_IO, "unselect %d", (int)(op >> SPI_OP_PAD_SHIFT));
+      break;
+    case SPI_OP_POLLED:
+      frame = spip->frame;
+      sim_printf(SPI_IO, "polled_exchange");
+      (void)spi_vha_receive(&frame, sizeof frame,
+                            spi_vha_send(&frame, sizeof frame));
+      spip->frame = frame;
+      chBSemSignal(&spip->polled);
+      break;
+    default:
+      spi_transfer(spip, op);
+      CH_IRQ_PROLOGUE();
+      _spi_isr_code(spip);
+      CH_IRQ_EPILOGUE();
+    }
   }
 
-  chMtxUnlock();
-
   return 0;
 }
 
@@ -100,6 +306,9 @@ void spi_lld_init(void) {
 #if PLATFORM_SPI_USE_SPI1
   /* Driver initialization.*/
   spiObjectInit(&SPID1);
+  chMBInit(&SPID1.opmb, SPID1.opbuf, PLATFORM_SPI_QUEUE_SIZE);
+  chBSemInit(&SPID1.polled, TRUE);
+  SPID1.thd = NULL;
 #endif /* PLATFORM_SPI_USE_SPI1 */
 }
 
@@ -111,7 +320,13 @@ void spi_lld_init(void) {
  * @notapi
  */
 void spi_lld_start(SPIDriver *spip) {
-  (void)spip;
+
+  /* the transfer thread is created once and kept across stops */
+  if (spip->thd == NULL) {
+    spip->thd = chThdCreateI(wsp, sizeof(wsp), PLATFORM_SPI_THREAD_PRIORITY,
+                             transfer_thread, (void*)spip);
+    chSchWakeupS(spip->thd, RDY_OK);
+  }
 }
 
 /**
@@ -133,7 +348,8 @@ void spi_lld_stop(SPIDriver *spip) {
  * @notapi
  */
 void spi_lld_select(SPIDriver *spip) {
-  sim_printf(SPI_IO, "select %d", spip->config->sspad);
+  spi_post_cs_s(spip, SPI_OP_SELECT |
+                      ((msg_t)spip->config->sspad << SPI_OP_PAD_SHIFT));
 }
 
 /**
@@ -145,7 +361,8 @@ void spi_lld_select(SPIDriver *spip) {
  * @notapi
  */
 void spi_lld_unselect(SPIDriver *spip) {
-  sim_printf(SPI_IO, "unselect %d", spip->config->sspad);
+  spi_post_cs_s(spip, SPI_OP_UNSELECT |
+                      ((msg_t)spip->config->sspad << SPI_OP_PAD_SHIFT));
 }
 
 /**
@@ -160,10 +377,8 @@ void spi_lld_unselect(SPIDriver *spip) {
  * @notapi
  */
 void spi_lld_ignore(SPIDriver *spip, size_t n) {
-  sim_printf(SPI_IO, "ignore %d", n);
-
-  /* ready for the next message */
-  _spi_isr_code(spip);
+  spip->n = n;
+  spi_post_i(spip, SPI_OP_IGNORE);
 }
 
 /**
@@ -183,19 +398,10 @@ void spi_lld_ignore(SPIDriver *spip, size_t n) {
  */
 void spi_lld_exchange(SPIDriver *spip, size_t n,
                       const void *txbuf, void *rxbuf) {
-  (void)spip;
-
-  /* signal an exchange */
-  sim_printf(SPI_IO, "exchange");
-
-  /* write exchange message */
-  sim_write(SPI_IO, (void*)txbuf, n);
-
-  /* read in exchange message */
-  sim_readS(SPI_IO, rxbuf, n);
-
-  /* ready for the next message */
-  _spi_isr_code(spip);
+  spip->n = n;
+  spip->txbuf = txbuf;
+  spip->rxbuf = rxbuf;
+  spi_post_i(spip, SPI_OP_EXCHANGE);
 }
 
 /**
@@ -212,12 +418,9 @@ void spi_lld_exchange(SPIDriver *spip, size_t n,
  * @notapi
  */
 void spi_lld_send(SPIDriver *spip, size_t n, const void *txbuf) {
-  /* signal a send and write the data */
-  sim_printf(SPI_IO, "send");
-  sim_write(SPI_IO, (void*)txbuf, n);
-
-  /* ready for the next message */
-  _spi_isr_code(spip);
+  spip->n = n;
+  spip->txbuf = txbuf;
+  spi_post_i(spip, SPI_OP_SEND);
 }
 
 /**
@@ -234,12 +437,9 @@ void spi_lld_send(SPIDriver *spip, size_t n, const void *txbuf) {
  * @notapi
  */
 void spi_lld_receive(SPIDriver *spip, size_t n, void *rxbuf) {
-  /* signal a receive and read the data */
-  sim_printf(SPI_IO, "receive");
-  sim_readS(SPI_IO, rxbuf, n);
-
-  /* ready for the next message */
-  _spi_isr_code(spip);
+  spip->n = n;
+  spip->rxbuf = rxbuf;
+  spi_post_i(spip, SPI_OP_RECEIVE);
 }
 
 /**
@@ -249,21 +449,41 @@ void spi_lld_receive(SPIDriver *spip, size_t n, void *rxbuf) {
  *          small amount of data on high speed channels, usually in this
  *          situation is much more efficient just wait for completion using
  *          polling than suspending the thread waiting for an interrupt.
+ * @note    The frame goes through the transfer thread too, after the
+ *          chip select operations queued before it.
  *
  * @param[in] spip      pointer to the @p SPIDriver object
  * @param[in] frame     the data frame to send over the SPI bus
  * @return              The received data frame from the SPI bus.
  */
 uint16_t spi_lld_polled_exchange(SPIDriver *spip, uint16_t frame) {
-  uint16_t inFrame;
-  (void)spip;
 
-  sim_printf(SPI_IO, "polled_exchange");
-  sim_write(SPI_IO, &frame, sizeof frame);
-  sim_read(SPI_IO, &inFrame, sizeof inFrame);
+  spip->frame = frame;
+  chMBPost(&spip->opmb, SPI_OP_POLLED, TIME_INFINITE);
+  chBSemWait(&spip->polled);
+
+  return spip->frame;
+}
 
-  return inFrame;
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Starts a transaction.
+ * @details This asynchronous function starts the steps of a transaction,
+ *          they reach the VHA as a single frame.
+ * @post    At the end of the operation the configured callback is invoked.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] steps     the transaction steps
+ * @param[in] n         number of steps
+ *
+ * @notapi
+ */
+void spi_lld_transaction(SPIDriver *spip, const SPIStep *steps, size_t n) {
+  spip->steps = steps;
+  spip->nsteps = n;
+  spi_post_i(spip, SPI_OP_TRANSACTION);
 }
+#endif /* SPI_USE_TRANSACTIONS */
 
 #endif /* HAL_USE_SPI */
 
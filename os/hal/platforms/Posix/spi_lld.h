@@ -46,12 +46,33 @@
 #if !defined(PLATFORM_SPI_USE_SPI1) || defined(__DOXYGEN__)
 #define PLATFORM_SPI_USE_SPI1               TRUE
 #endif
+
+/**
+ * @brief   Depth of the operations queue.
+ * @details Bounds the chip select operations that can be queued while
+ *          the transfer thread is busy, the callers of @p spiSelect()
+ *          and @p spiUnselect() wait for room beyond that.
+ */
+#if !defined(PLATFORM_SPI_QUEUE_SIZE) || defined(__DOXYGEN__)
+#define PLATFORM_SPI_QUEUE_SIZE             8
+#endif
+
+/**
+ * @brief   Priority of the transfer thread.
+ */
+#if !defined(PLATFORM_SPI_THREAD_PRIORITY) || defined(__DOXYGEN__)
+#define PLATFORM_SPI_THREAD_PRIORITY        (NORMALPRIO + 1)
+#endif
 /** @} */
 
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
 
+#if !CH_USE_MAILBOXES || !CH_USE_SEMAPHORES
+#error "the SPI driver requires CH_USE_MAILBOXES and CH_USE_SEMAPHORES"
+#endif
+
 /*===========================================================================*/
 /* Driver data structures and types.                                         */
 /*===========================================================================*/
@@ -132,19 +153,54 @@ struct SPIDriver {
   SPI_DRIVER_EXT_FIELDS
 #endif
   /* End of the mandatory fields.*/
+  /**
+   * @brief Operations queued for the transfer thread.
+   */
+  Mailbox               opmb;
+  /**
+   * @brief Storage of the operations queue.
+   */
+  msg_t                 opbuf[PLATFORM_SPI_QUEUE_SIZE];
+  /**
+   * @brief Transfer thread.
+   */
+  Thread                *thd;
+  /**
+   * @brief Words of the transfer in progress.
+   */
+  size_t                n;
+  /**
+   * @brief Transmit buffer of the transfer in progress.
+   */
+  const void            *txbuf;
+  /**
+   * @brief Receive buffer of the transfer in progress.
+   */
+  void                  *rxbuf;
+  /**
+   * @brief Polled exchange frame.
+   */
+  uint16_t              frame;
+  /**
+   * @brief Polled exchange completion.
+   */
+  BinarySemaphore       polled;
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+  /**
+   * @brief Steps of the transaction in progress.
+   */
+  const SPIStep         *steps;
+  /**
+   * @brief Number of steps of the transaction in progress.
+   */
+  size_t                nsteps;
+#endif
 };
 
 /*===========================================================================*/
 /* Driver macros.                                                            */
 /*===========================================================================*/
 
-/* SPI_USE_WAIT is unsupported in the simulator.
- * Use the async instructions instead.            */
-#undef SPI_USE_WAIT
-#define spiExchange(a,b,c,d) spiStartExchange((a),(b),(c),(d))
-#define spiSend(a,b,c) spiStartSend((a),(b),(c))
-#define spiReceive(a,b,c) spiStartReceive((a),(b),(c))
-
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
@@ -167,6 +223,9 @@ extern "C" {
   void spi_lld_send(SPIDriver *spip, size_t n, const void *txbuf);
   void spi_lld_receive(SPIDriver *spip, size_t n, void *rxbuf);
   uint16_t spi_lld_polled_exchange(SPIDriver *spip, uint16_t frame);
+#if SPI_USE_TRANSACTIONS
+  void spi_lld_transaction(SPIDriver *spip, const SPIStep *steps, size_t n);
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -173,6 +173,12 @@ void sdcStop(SDCDriver *sdcp) {
 
   chDbgCheck(sdcp != NULL, "sdcStop");
 
+#if SDC_USE_ASYNC
+  /* the queued requests still use the card */
+  if (sdcp->state != BLK_STOP)
+    sdc_lld_wait_idle(sdcp);
+#endif
+
   chSysLock();
   chDbgAssert((sdcp->state == BLK_STOP) || (sdcp->state == BLK_ACTIVE),
               "sdcStop(), #1", "invalid state");
@@ -347,6 +353,11 @@ bool_t sdcDisconnect(SDCDriver *sdcp) {
 
   chDbgCheck(sdcp != NULL, "sdcDisconnect");
 
+#if SDC_USE_ASYNC
+  if (sdcp->state == BLK_READY)
+    sdc_lld_wait_idle(sdcp);
+#endif
+
   chSysLock();
   chDbgAssert((sdcp->state == BLK_ACTIVE) || (sdcp->state == BLK_READY),
               "sdcDisconnect(), #1", "invalid state");
@@ -398,6 +409,10 @@ bool_t sdcRead(SDCDriver *sdcp, uint32_t startblk,
     return CH_FAILED;
   }
 
+#if SDC_USE_ASYNC
+  sdc_lld_wait_idle(sdcp);
+#endif
+
   /* Read operation in progress.*/
   sdcp->state = BLK_READING;
 
@@ -436,6 +451,10 @@ bool_t sdcWrite(SDCDriver *sdcp, uint32_t startblk,
     return CH_FAILED;
   }
 
+#if SDC_USE_ASYNC
+  sdc_lld_wait_idle(sdcp);
+#endif
+
   /* Write operation in progress.*/
   sdcp->state = BLK_WRITING;
 
@@ -487,6 +506,10 @@ bool_t sdcSync(SDCDriver *sdcp) {
   if (sdcp->state != BLK_READY)
     return CH_FAILED;
 
+#if SDC_USE_ASYNC
+  sdc_lld_wait_idle(sdcp);
+#endif
+
   /* Synchronization operation in progress.*/
   sdcp->state = BLK_SYNCING;
 
@@ -542,6 +565,10 @@ bool_t sdcErase(SDCDriver *sdcp, uint32_t startblk, uint32_t endblk) {
   chDbgCheck((sdcp != NULL), "sdcErase");
   chDbgAssert(sdcp->state == BLK_READY, "sdcErase(), #1", "invalid state");
 
+#if SDC_USE_ASYNC
+  sdc_lld_wait_idle(sdcp);
+#endif
+
   /* Erase operation in progress.*/
   sdcp->state = BLK_WRITING;
 
@@ -582,6 +609,118 @@ failed:
   return CH_FAILED;
 }
 
+#if SDC_USE_ASYNC || defined(__DOXYGEN__)
+/**
+ * @brief   Queues an asynchronous block transfer.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[in] rqp       pointer to the request, filled by the caller
+ *
+ * @return              The operation status.
+ * @retval CH_SUCCESS   the request has been queued.
+ * @retval CH_FAILED    out of range or the request queue is full.
+ *
+ * @notapi
+ */
+static bool_t sdc_start_request(SDCDriver *sdcp, SDCRequest *rqp) {
+
+  chDbgAssert(sdcp->state == BLK_READY,
+              "sdc_start_request(), #1", "invalid state");
+
+  if ((rqp->startblk + rqp->n - 1) > sdcp->capacity){
+    sdcp->errors |= SDC_OVERFLOW_ERROR;
+    return CH_FAILED;
+  }
+
+  return sdc_lld_start_request(sdcp, rqp);
+}
+
+/**
+ * @brief   Starts reading one or more blocks.
+ * @details The function returns as soon as the request is queued, the
+ *          requests are served in order and each one ends by invoking
+ *          its callback from ISR context.
+ * @pre     The driver must be in the @p BLK_READY state after a successful
+ *          sdcConnect() invocation.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[out] rqp      pointer to the request storage
+ * @param[in] startblk  first block to read
+ * @param[out] buf      pointer to the read buffer
+ * @param[in] n         number of blocks to read
+ * @param[in] end_cb    completion callback or @p NULL
+ *
+ * @return              The operation status.
+ * @retval CH_SUCCESS   the request has been queued.
+ * @retval CH_FAILED    out of range or the request queue is full.
+ *
+ * @api
+ */
+bool_t sdcStartRead(SDCDriver *sdcp, SDCRequest *rqp, uint32_t startblk,
+                    uint8_t *buf, uint32_t n, sdccallback_t end_cb) {
+
+  chDbgCheck((sdcp != NULL) && (rqp != NULL) && (buf != NULL) && (n > 0),
+             "sdcStartRead");
+
+  rqp->write    = FALSE;
+  rqp->startblk = startblk;
+  rqp->buf      = buf;
+  rqp->n        = n;
+  rqp->end_cb   = end_cb;
+  return sdc_start_request(sdcp, rqp);
+}
+
+/**
+ * @brief   Starts writing one or more blocks.
+ * @details The function returns as soon as the request is queued, the
+ *          requests are served in order and each one ends by invoking
+ *          its callback from ISR context.
+ * @pre     The driver must be in the @p BLK_READY state after a successful
+ *          sdcConnect() invocation.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ * @param[out] rqp      pointer to the request storage
+ * @param[in] startblk  first block to write
+ * @param[in] buf       pointer to the write buffer
+ * @param[in] n         number of blocks to write
+ * @param[in] end_cb    completion callback or @p NULL
+ *
+ * @return              The operation status.
+ * @retval CH_SUCCESS   the request has been queued.
+ * @retval CH_FAILED    out of range or the request queue is full.
+ *
+ * @api
+ */
+bool_t sdcStartWrite(SDCDriver *sdcp, SDCRequest *rqp, uint32_t startblk,
+                     const uint8_t *buf, uint32_t n, sdccallback_t end_cb) {
+
+  chDbgCheck((sdcp != NULL) && (rqp != NULL) && (buf != NULL) && (n > 0),
+             "sdcStartWrite");
+
+  rqp->write    = TRUE;
+  rqp->startblk = startblk;
+  rqp->buf      = (uint8_t *)buf;
+  rqp->n        = n;
+  rqp->end_cb   = end_cb;
+  return sdc_start_request(sdcp, rqp);
+}
+
+/**
+ * @brief   Waits for all the queued requests to complete.
+ * @note    The synchronous functions do this implicitly.
+ *
+ * @param[in] sdcp      pointer to the @p SDCDriver object
+ *
+ * @api
+ */
+void sdcWaitIdle(SDCDriver *sdcp) {
+
+  chDbgCheck(sdcp != NULL, "sdcWaitIdle");
+
+  sdc_lld_wait_idle(sdcp);
+}
+#endif /* SDC_USE_ASYNC */
+
 #endif /* HAL_USE_SDC */
 
 /** @} */
@@ -278,6 +278,33 @@ void spiStartReceive(SPIDriver *spip, size_t n, void *rxbuf) {
   chSysUnlock();
 }
 
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Starts a transaction.
+ * @details This asynchronous function starts the steps of a transaction as
+ *          a single operation, the slave select is driven by the steps.
+ * @post    At the end of the last step the configured callback is invoked.
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] steps     the transaction steps, must stay valid until the
+ *                      operation completes
+ * @param[in] n         number of steps
+ *
+ * @api
+ */
+void spiStartTransaction(SPIDriver *spip, const SPIStep *steps, size_t n) {
+
+  chDbgCheck((spip != NULL) && (steps != NULL) && (n > 0),
+             "spiStartTransaction");
+
+  chSysLock();
+  chDbgAssert(spip->state == SPI_READY,
+              "spiStartTransaction(), #1", "not ready");
+  spiStartTransactionI(spip, steps, n);
+  chSysUnlock();
+}
+#endif /* SPI_USE_TRANSACTIONS */
+
 #if SPI_USE_WAIT || defined(__DOXYGEN__)
 /**
  * @brief   Ignores data on the SPI bus.
@@ -395,6 +422,37 @@ void spiReceive(SPIDriver *spip, size_t n, void *rxbuf) {
   _spi_wait_s(spip);
   chSysUnlock();
 }
+
+#if SPI_USE_TRANSACTIONS || defined(__DOXYGEN__)
+/**
+ * @brief   Performs a transaction.
+ * @details This synchronous function performs the steps of a transaction as
+ *          a single operation, the slave select is driven by the steps.
+ * @pre     In order to use this function the options @p SPI_USE_WAIT and
+ *          @p SPI_USE_TRANSACTIONS must be enabled.
+ * @pre     In order to use this function the driver must have been configured
+ *          without callbacks (@p end_cb = @p NULL).
+ *
+ * @param[in] spip      pointer to the @p SPIDriver object
+ * @param[in] steps     the transaction steps
+ * @param[in] n         number of steps
+ *
+ * @api
+ */
+void spiTransaction(SPIDriver *spip, const SPIStep *steps, size_t n) {
+
+  chDbgCheck((spip != NULL) && (steps != NULL) && (n > 0),
+             "spiTransaction");
+
+  chSysLock();
+  chDbgAssert(spip->state == SPI_READY, "spiTransaction(), #1", "not ready");
+  chDbgAssert(spip->config->end_cb == NULL,
+              "spiTransaction(), #2", "has callback");
+  spiStartTransactionI(spip, steps, n);
+  _spi_wait_s(spip);
+  chSysUnlock();
+}
+#endif /* SPI_USE_TRANSACTIONS */
 #endif /* SPI_USE_WAIT */
 
 #if SPI_USE_MUTUAL_EXCLUSION || defined(__DOXYGEN__)
@@ -289,6 +289,14 @@
 #if !defined(SDC_NICE_WAITING) || defined(__DOXYGEN__)
 #define SDC_NICE_WAITING            TRUE
 #endif
+
+/**
+ * @brief   Enables the asynchronous block API.
+ * @note    Only available on platforms whose low level driver supports it.
+ */
+#if !defined(SDC_USE_ASYNC) || defined(__DOXYGEN__)
+#define SDC_USE_ASYNC               FALSE
+#endif
 /** @} */
 
 /*===========================================================================*/
@@ -360,6 +368,14 @@
 #if !defined(SPI_USE_MUTUAL_EXCLUSION) || defined(__DOXYGEN__)
 #define SPI_USE_MUTUAL_EXCLUSION    TRUE
 #endif
+
+/**
+ * @brief   Enables the transactions API.
+ * @note    Only available on platforms whose low level driver supports it.
+ */
+#if !defined(SPI_USE_TRANSACTIONS) || defined(__DOXYGEN__)
+#define SPI_USE_TRANSACTIONS        FALSE
+#endif
 /** @} */
 
 #endif /* _HALCONF_H_ */
@@ -0,0 +1,666 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006,2007,2008,2009,2010,
+                 2011,2012,2013 Giovanni Di Sirio.
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    SIMCOMMON/simhost.c
+ * @brief   Host side code shared by the simulator ports.
+ * @details System tick, host I/O reactor, tickless idle, virtual clock
+ *          and preemption. The ports only provide the context switch.
+ * @note    The reactor, tickless idle, virtual clock and preemption
+ *          need Linux. Other hosts keep the polled tick, there
+ *          @p port_wait_io() returns @p RDY_RESET and the clock and
+ *          preemption settings are ignored.
+ *
+ * @addtogroup SIMCOMMON
+ * @{
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#if defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#endif
+
+#include "ch.h"
+#include "hal.h"
+
+/**
+ * Halts the system. In this implementation it just exits the simulation.
+ */
+void port_halt(void) {
+
+  exit(2);
+}
+
+#if defined(__linux__) || defined(__DOXYGEN__)
+#define PORT_TICK_NS    (1000000000LL / CH_FREQUENCY)
+
+static struct timespec nextcnt;
+
+/**
+ * @brief   Host I/O reactor state.
+ * @details Each slot binds a host fd to the thread sleeping on it,
+ *          the slot index is stored in the epoll event data.
+ */
+static int epfd = -1;
+static struct {
+  int               fd;
+  Thread            *tp;
+  uint32_t          events;         /* epoll events that woke it */
+} iowait[PORT_MAX_IO_WAITS];
+
+/**
+ * @brief   Virtual clock state.
+ * @details @p vpolls counts interrupt checks made by busy threads
+ *          since the last virtual tick.
+ */
+static bool_t vclock;
+static unsigned vpolls;
+
+/**
+ * @brief   Tickless idle statistics.
+ */
+static port_idle_stats_t idle_stats;
+
+/**
+ * @brief   Preemption state.
+ * @details With preemption the system tick is a host timer signal that
+ *          interrupts the running thread and masking it is the kernel
+ *          lock. The idle thread sleeps with @p idle_mask.
+ */
+static bool_t preempt;
+static timer_t tick_timer;
+static int tick_debt;
+static sigset_t tick_mask, idle_mask;
+
+/* bounds of the simulator's own code */
+extern char __executable_start[], etext[];
+
+static void ts_add_ns(struct timespec *tsp, int64_t ns) {
+  ns += tsp->tv_nsec;
+  tsp->tv_sec += ns / 1000000000;
+  tsp->tv_nsec = ns % 1000000000;
+}
+
+static int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b) {
+  return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000 +
+         (a->tv_nsec - b->tv_nsec);
+}
+
+/**
+ * @brief   Preemption tick handler.
+ * @details Runs the tick like the timer interrupt of the target.
+ *          Ticks the host timer overran are caught up as in
+ *          @p ChkIntSources(), stopping at one that readies a thread.
+ *          The running thread is switched out only if it was
+ *          interrupted in the simulator's own code, inside a host
+ *          library it could hold locks of that library. It is then
+ *          switched out at a later tick or kernel call.
+ */
+static void port_tick_signal(int sig, siginfo_t *si, void *ucp) {
+  uintptr_t pc = ((ucontext_t *)ucp)->uc_mcontext.gregs[PORT_PC_REG];
+  int err = errno;
+
+  (void)sig;
+
+  CH_IRQ_PROLOGUE();
+
+  chSysLockFromIsr();
+  tick_debt += si->si_overrun + 1;
+  do {
+    tick_debt--;
+    chSysTimerHandlerI();
+  } while (tick_debt > 0 && !chSchIsPreemptionRequired());
+  chSysUnlockFromIsr();
+
+  CH_IRQ_EPILOGUE();
+
+  if (pc >= (uintptr_t)__executable_start && pc < (uintptr_t)etext) {
+    dbg_check_lock();
+    if (chSchIsPreemptionRequired())
+      chSchDoReschedule();
+    dbg_check_unlock();
+  }
+
+  errno = err;
+}
+
+/**
+ * @brief   Port initialization.
+ * @details Starts the system tick at the host monotonic clock. With
+ *          preemption the tick timer is armed here with its signal
+ *          masked until @p chSysInit() enables the system.
+ */
+void _port_init(void) {
+  struct sigaction sa;
+  struct sigevent sev;
+  struct itimerspec its;
+
+  clock_gettime(CLOCK_MONOTONIC, &nextcnt);
+  ts_add_ns(&nextcnt, PORT_TICK_NS);
+
+  /* the virtual clock takes precedence */
+  if (vclock)
+    preempt = FALSE;
+  if (!preempt)
+    return;
+
+  sigemptyset(&tick_mask);
+  sigaddset(&tick_mask, PORT_PREEMPT_SIGNAL);
+  (void)sigprocmask(SIG_BLOCK, &tick_mask, &idle_mask);
+  sigdelset(&idle_mask, PORT_PREEMPT_SIGNAL);
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_sigaction = port_tick_signal;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  memset(&sev, 0, sizeof sev);
+  sev.sigev_notify = SIGEV_SIGNAL;
+  sev.sigev_signo = PORT_PREEMPT_SIGNAL;
+
+  memset(&its, 0, sizeof its);
+  ts_add_ns(&its.it_interval, PORT_TICK_NS);
+  its.it_value = its.it_interval;
+
+  if (sigaction(PORT_PREEMPT_SIGNAL, &sa, NULL) < 0 ||
+      timer_create(CLOCK_MONOTONIC, &sev, &tick_timer) < 0 ||
+      timer_settime(tick_timer, 0, &its, NULL) < 0) {
+    perror("preemption tick");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief   Kernel-lock action.
+ * @details Masks the tick signal when preemption is enabled, see
+ *          @p port_set_preemption().
+ */
+void _port_lock(void) {
+  if (preempt)
+    (void)sigprocmask(SIG_BLOCK, &tick_mask, NULL);
+}
+
+/**
+ * @brief   Kernel-unlock action.
+ * @details Unmasks the tick signal when preemption is enabled.
+ */
+void _port_unlock(void) {
+  if (preempt)
+    (void)sigprocmask(SIG_UNBLOCK, &tick_mask, NULL);
+}
+
+/**
+ * @brief   Waits for host I/O readiness.
+ * @details The calling thread sleeps until one of the fds becomes ready
+ *          or the timeout expires. Readiness is detected by
+ *          @p ChkIntSources() and handled like an interrupt that wakes
+ *          the thread. The events seen are reported in @p revents,
+ *          the caller is expected to poll the fds again.
+ * @note    Only one thread at a time may wait on a given fd.
+ * @note    The slots are claimed under the kernel lock.
+ *
+ * @param[in] fds       fds and events to wait for
+ * @param[in] nfds      number of entries in @p fds
+ * @param[in] timeout   timeout in system ticks
+ *
+ * @return              The wakeup reason.
+ * @retval RDY_OK       at least one fd is ready.
+ * @retval RDY_TIMEOUT  the timeout expired.
+ * @retval RDY_RESET    the fds could not be registered.
+ */
+msg_t port_wait_io(struct pollfd *fds, unsigned nfds, systime_t timeout) {
+  struct epoll_event ev;
+  unsigned i, slot, used = 0;
+  int slots[PORT_MAX_IO_WAITS];
+  msg_t msg = RDY_RESET;
+
+  chSysLock();
+  if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    goto out;
+
+  /* bind each fd to a free slot */
+  for (i = 0, slot = 0; i < nfds; i++) {
+    while (slot < PORT_MAX_IO_WAITS && iowait[slot].tp != NULL)
+      slot++;
+    if (slot == PORT_MAX_IO_WAITS)
+      goto out;
+
+    ev.events = EPOLLONESHOT;
+    if (fds[i].events & POLLIN)
+      ev.events |= EPOLLIN;
+    if (fds[i].events & POLLPRI)
+      ev.events |= EPOLLPRI;
+    if (fds[i].events & POLLOUT)
+      ev.events |= EPOLLOUT;
+    ev.data.u32 = slot;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) < 0)
+      goto out;
+
+    iowait[slot].fd = fds[i].fd;
+    iowait[slot].tp = currp;
+    iowait[slot].events = 0;
+    slots[used++] = slot;
+  }
+
+  msg = chSchGoSleepTimeoutS(THD_STATE_SUSPENDED, timeout);
+
+out:
+  /* the slots follow the order of the fds */
+  for (i = 0; i < used; i++) {
+    (void)epoll_ctl(epfd, EPOLL_CTL_DEL, iowait[slots[i]].fd, NULL);
+    iowait[slots[i]].tp = NULL;
+    fds[i].revents = (iowait[slots[i]].events & EPOLLIN  ? POLLIN  : 0) |
+                     (iowait[slots[i]].events & EPOLLPRI ? POLLPRI : 0) |
+                     (iowait[slots[i]].events & EPOLLOUT ? POLLOUT : 0) |
+                     (iowait[slots[i]].events & EPOLLERR ? POLLERR : 0) |
+                     (iowait[slots[i]].events & EPOLLHUP ? POLLHUP : 0);
+  }
+  chSysUnlock();
+
+  return msg;
+}
+
+/**
+ * @brief   Host I/O interrupt simulation.
+ * @details Waits up to @p tsp for host I/O then wakes the threads
+ *          waiting on the ready fds.
+ *
+ * @param[in] tsp       maximum time to block, zero to just poll
+ *
+ * @return              The number of threads woken.
+ */
+static int port_dispatch_io(const struct timespec *tsp) {
+  struct epoll_event evs[PORT_MAX_IO_WAITS];
+  struct pollfd pfd = {epfd, POLLIN, 0};
+  Thread *tp;
+  int i, n, woken = 0;
+
+  /* just sleeping if nothing is registered */
+  if (ppoll(&pfd, epfd < 0 ? 0 : 1, tsp, NULL) <= 0)
+    return 0;
+
+  n = epoll_wait(epfd, evs, PORT_MAX_IO_WAITS, 0);
+  for (i = 0; i < n; i++) {
+    tp = iowait[evs[i].data.u32].tp;
+    if (tp == NULL)
+      continue;
+    iowait[evs[i].data.u32].events = evs[i].events;
+
+    /* the thread may have been woken by its timeout or another fd */
+    if (tp->p_state != THD_STATE_SUSPENDED)
+      continue;
+
+    CH_IRQ_PROLOGUE();
+
+    chSysLockFromIsr();
+    chSchReadyI(tp)->p_u.rdymsg = RDY_OK;
+    chSysUnlockFromIsr();
+
+    CH_IRQ_EPILOGUE();
+    woken++;
+  }
+
+  return woken;
+}
+
+/**
+ * @brief   Is any thread waiting on host I/O?
+ */
+static bool_t port_io_waiting(void) {
+  unsigned i;
+
+  for (i = 0; i < PORT_MAX_IO_WAITS; i++)
+    if (iowait[i].tp != NULL)
+      return TRUE;
+  return FALSE;
+}
+
+/**
+ * @brief   Tickless idle.
+ * @details Blocks the host process until the tick that expires the
+ *          first virtual timer, at most @p PORT_IDLE_MAX_SLEEP ticks
+ *          away, or until host I/O wakes a thread. The ticks that
+ *          elapsed meanwhile are caught up by @p ChkIntSources().
+ * @note    The demo serial driver polls its sockets, there the idle
+ *          thread still wakes on every tick.
+ */
+static void port_idle(void) {
+  struct timespec start, end, ts, deadline = nextcnt;
+  int64_t ns;
+  int woken = 0;
+
+#if !CH_DEMO
+  systime_t ticks = PORT_IDLE_MAX_SLEEP;
+
+  if (vtlist.vt_next != (VirtualTimer *)&vtlist &&
+      vtlist.vt_next->vt_time < ticks)
+    ticks = vtlist.vt_next->vt_time;
+  if (ticks > 1)
+    ts_add_ns(&deadline, (int64_t)(ticks - 1) * PORT_TICK_NS);
+#endif
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ((ns = ts_diff_ns(&deadline, &start)) <= 0) {
+    ts.tv_sec = ts.tv_nsec = 0;
+    (void)port_dispatch_io(&ts);
+    return;
+  }
+
+  if (port_io_waiting()) {
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    woken = port_dispatch_io(&ts);
+  }
+  else
+    (void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  idle_stats.idle_ns += ts_diff_ns(&end, &start);
+  idle_stats.sleeps++;
+  if (woken > 0)
+    idle_stats.io_wakeups++;
+}
+
+/**
+ * @brief   Copies the tickless idle statistics.
+ *
+ * @param[out] st       the statistics
+ */
+void port_get_idle_stats(port_idle_stats_t *st) {
+  chSysLock();
+  *st = idle_stats;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Preemptive mode interrupt check.
+ * @details The idle thread sleeps until host I/O or the tick signal,
+ *          the tick is handled by @p port_tick_signal(). Other threads
+ *          just poll host I/O.
+ */
+static void port_preempt_io(void) {
+  struct pollfd pfd = {epfd, POLLIN, 0};
+  struct timespec start, end, ts = {0, 0};
+
+  if (chThdGetPriority() == IDLEPRIO) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ppoll(&pfd, epfd < 0 ? 0 : 1, NULL, &idle_mask) > 0)
+      idle_stats.io_wakeups++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    idle_stats.idle_ns += ts_diff_ns(&end, &start);
+    idle_stats.sleeps++;
+  }
+
+  (void)port_dispatch_io(&ts);
+}
+
+/**
+ * @brief   Selects preemptive scheduling.
+ * @details The system tick becomes a host timer signal that interrupts
+ *          the running thread, a busy thread no longer starves the
+ *          others and @p CH_TIME_QUANTUM applies as on the target. The
+ *          idle thread wakes on every tick instead of going tickless.
+ * @note    Must be called before @p chSysInit(), the virtual clock
+ *          takes precedence.
+ *
+ * @param[in] on        TRUE for preemptive scheduling
+ */
+void port_set_preemption(bool_t on) {
+  preempt = on;
+}
+
+/**
+ * @brief   Is preemptive scheduling in use?
+ */
+bool_t port_is_preemptive(void) {
+  return preempt;
+}
+
+/**
+ * @brief   Selects the simulated clock.
+ * @details With the virtual clock the system time is decoupled from
+ *          the host clock. Busy threads advance it by one tick every
+ *          @p PORT_VCLOCK_POLLS interrupt checks, once only the idle
+ *          thread is left time jumps straight to the next virtual
+ *          timer deadline.
+ * @note    Must be called before @p chSysInit().
+ *
+ * @param[in] on        TRUE for the virtual clock, FALSE for the
+ *                      host clock
+ */
+void port_set_virtual_clock(bool_t on) {
+  vclock = on;
+}
+
+/**
+ * @brief   Is the virtual clock in use?
+ */
+bool_t port_is_virtual_clock(void) {
+  return vclock;
+}
+
+/**
+ * @brief   Virtual clock interrupt simulation.
+ * @details An idle system gives threads waiting on host fds
+ *          @p PORT_VCLOCK_IO_SLACK microseconds of host time to
+ *          become ready before the jump. Without any armed timer
+ *          the clock falls back to host pace so an idle system
+ *          does not spin.
+ *
+ * @return              The number of ticks elapsed.
+ */
+static systime_t port_vclock_ticks(void) {
+  struct timespec ts = {0, 0};
+
+  if (chThdGetPriority() != IDLEPRIO) {
+    (void)port_dispatch_io(&ts);
+    if (++vpolls < PORT_VCLOCK_POLLS)
+      return 0;
+    vpolls = 0;
+    return 1;
+  }
+
+  /* nothing to jump to, wait for host I/O one host tick at a time */
+  if (vtlist.vt_next == (VirtualTimer *)&vtlist) {
+    ts.tv_nsec = 1000000000 / CH_FREQUENCY;
+    (void)port_dispatch_io(&ts);
+    return 1;
+  }
+
+  if (port_io_waiting())
+    ts.tv_nsec = PORT_VCLOCK_IO_SLACK * 1000;
+  if (port_dispatch_io(&ts) > 0)
+    return 0;
+
+  vpolls = 0;
+  return vtlist.vt_next->vt_time > 0 ? vtlist.vt_next->vt_time : 1;
+}
+
+/**
+ * @brief Interrupt simulation.
+ * @details When invoked from the idle thread the host process blocks
+ *          until the next virtual timer deadline or until host I/O is
+ *          ready, see @p port_get_idle_stats(). With the virtual clock
+ *          see @p port_set_virtual_clock(), with preemption see
+ *          @p port_set_preemption().
+ */
+void ChkIntSources(void) {
+  struct timespec ts = {0, 0};
+  systime_t n;
+
+  /* the tick signal must not interrupt a simulated interrupt */
+  if (preempt)
+    _port_lock();
+
+#if CH_DEMO
+  if (sd_lld_interrupt_pending())
+    goto reschedule;
+#endif
+
+  if (preempt) {
+    port_preempt_io();
+    goto reschedule;
+  }
+
+  if (vclock) {
+    n = port_vclock_ticks();
+    if (n > 0) {
+      CH_IRQ_PROLOGUE();
+
+      chSysLockFromIsr();
+      while (n-- > 0)
+        chSysTimerHandlerI();
+      chSysUnlockFromIsr();
+
+      CH_IRQ_EPILOGUE();
+    }
+    goto reschedule;
+  }
+
+  if (chThdGetPriority() == IDLEPRIO)
+    port_idle();
+  else
+    (void)port_dispatch_io(&ts);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (ts_diff_ns(&ts, &nextcnt) >= 0) {
+    CH_IRQ_PROLOGUE();
+
+    /* every tick elapsed since the last check, stopping early if one
+       readies a thread so that it runs at the tick that woke it */
+    chSysLockFromIsr();
+    do {
+      ts_add_ns(&nextcnt, PORT_TICK_NS);
+      chSysTimerHandlerI();
+    } while (ts_diff_ns(&ts, &nextcnt) >= 0 && !chSchIsPreemptionRequired());
+    chSysUnlockFromIsr();
+
+    CH_IRQ_EPILOGUE();
+  }
+
+reschedule:
+  dbg_check_lock();
+  if (chSchIsPreemptionRequired())
+    chSchDoReschedule();
+  dbg_check_unlock();
+
+  if (preempt)
+    _port_unlock();
+}
+
+#else /* !defined(__linux__) */
+
+static struct timeval nextcnt;
+static struct timeval tick = {0, 1000000 / CH_FREQUENCY};
+
+void _port_init(void) {
+
+  gettimeofday(&nextcnt, NULL);
+  timeradd(&nextcnt, &tick, &nextcnt);
+}
+
+void _port_lock(void) {
+}
+
+void _port_unlock(void) {
+}
+
+msg_t port_wait_io(struct pollfd *fds, unsigned nfds, systime_t timeout) {
+
+  (void)fds;
+  (void)nfds;
+  (void)timeout;
+  return RDY_RESET;
+}
+
+void port_set_virtual_clock(bool_t on) {
+  (void)on;
+}
+
+bool_t port_is_virtual_clock(void) {
+  return FALSE;
+}
+
+void port_get_idle_stats(port_idle_stats_t *st) {
+  st->idle_ns = 0;
+  st->sleeps = 0;
+  st->io_wakeups = 0;
+}
+
+void port_set_preemption(bool_t on) {
+  (void)on;
+}
+
+bool_t port_is_preemptive(void) {
+  return FALSE;
+}
+
+void ChkIntSources(void) {
+  struct timeval tv;
+
+#if CH_DEMO
+  if (sd_lld_interrupt_pending()) {
+    dbg_check_lock();
+    if (chSchIsPreemptionRequired())
+      chSchDoReschedule();
+    dbg_check_unlock();
+    return;
+  }
+#endif
+
+  gettimeofday(&tv, NULL);
+  if (timercmp(&tv, &nextcnt, >=)) {
+    timeradd(&nextcnt, &tick, &nextcnt);
+
+    CH_IRQ_PROLOGUE();
+
+    chSysLockFromIsr();
+    chSysTimerHandlerI();
+    chSysUnlockFromIsr();
+
+    CH_IRQ_EPILOGUE();
+
+    dbg_check_lock();
+    if (chSchIsPreemptionRequired())
+      chSchDoReschedule();
+    dbg_check_unlock();
+  }
+}
+
+#endif /* !defined(__linux__) */
+
+/** @} */
@@ -0,0 +1,105 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006,2007,2008,2009,2010,
+                 2011,2012,2013 Giovanni Di Sirio.
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @file    SIMCOMMON/simhost.h
+ * @brief   Host side code shared by the simulator ports.
+ *
+ * @addtogroup SIMCOMMON
+ * @{
+ */
+
+#ifndef _SIMHOST_H_
+#define _SIMHOST_H_
+
+/**
+ * Maximum number of host fds threads can wait on at the same time.
+ */
+#ifndef PORT_MAX_IO_WAITS
+#define PORT_MAX_IO_WAITS               16
+#endif
+
+/**
+ * Interrupt checks per tick made by busy threads with the virtual clock.
+ */
+#ifndef PORT_VCLOCK_POLLS
+#define PORT_VCLOCK_POLLS               100
+#endif
+
+/**
+ * Host microseconds an idle system waits for host I/O before a virtual
+ * clock jump.
+ */
+#ifndef PORT_VCLOCK_IO_SLACK
+#define PORT_VCLOCK_IO_SLACK            1000
+#endif
+
+/**
+ * Maximum ticks the idle thread sleeps in one go.
+ */
+#ifndef PORT_IDLE_MAX_SLEEP
+#define PORT_IDLE_MAX_SLEEP             CH_FREQUENCY
+#endif
+
+/**
+ * @brief   Tickless idle statistics.
+ */
+typedef struct {
+  uint64_t      idle_ns;        /* host time the idle thread slept */
+  uint32_t      sleeps;         /* host sleeps taken by the idle thread */
+  uint32_t      io_wakeups;     /* sleeps ended by host I/O */
+} port_idle_stats_t;
+
+/**
+ * Host signal of the preemption tick.
+ */
+#ifndef PORT_PREEMPT_SIGNAL
+#define PORT_PREEMPT_SIGNAL             SIGRTMIN
+#endif
+
+struct pollfd;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void _port_init(void);
+  void _port_lock(void);
+  void _port_unlock(void);
+  void ChkIntSources(void);
+  msg_t port_wait_io(struct pollfd *fds, unsigned nfds, systime_t timeout);
+  void port_set_virtual_clock(bool_t on);
+  bool_t port_is_virtual_clock(void);
+  void port_get_idle_stats(port_idle_stats_t *st);
+  void port_set_preemption(bool_t on);
+  bool_t port_is_preemptive(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SIMHOST_H_ */
+
+/** @} */
@@ -30,14 +30,9 @@
  * @{
  */
 
-#include <stdlib.h>
-#include <sys/time.h>
+#include <stddef.h>
 
 #include "ch.h"
-#include "hal.h"
-
-static struct timeval nextcnt;
-static struct timeval tick = {0, 1000000 / CH_FREQUENCY};
 
 /**
  * Performs a context switch between two threads.
@@ -72,15 +67,6 @@ static void __dummy(Thread *ntp, Thread *otp) {
                 "ret");
 }
 
-/**
- * Halts the system. In this implementation it just exits the simulation.
- */
-__attribute__((fastcall))
-void port_halt(void) {
-
-  exit(2);
-}
-
 /**
  * @brief   Start a thread by invoking its work function.
  * @details If the work function returns @p chThdExit() is automatically
@@ -94,39 +80,4 @@ void _port_thread_start(msg_t (*pf)(void *), void *p) {
   while(1);
 }
 
-/**
- * @brief Interrupt simulation.
- */
-void ChkIntSources(void) {
-  struct timeval tv;
-
-#if CH_DEMO
-  if (sd_lld_interrupt_pending()) {
-    dbg_check_lock();
-    if (chSchIsPreemptionRequired())
-      chSchDoReschedule();
-    dbg_check_unlock();
-    return;
-  }
-#endif
-
-  gettimeofday(&tv, NULL);
-  if (timercmp(&tv, &nextcnt, >=)) {
-    timeradd(&nextcnt, &tick, &nextcnt);
-
-    CH_IRQ_PROLOGUE();
-
-    chSysLockFromIsr();
-    chSysTimerHandlerI();
-    chSysUnlockFromIsr();
-
-    CH_IRQ_EPILOGUE();
-
-    dbg_check_lock();
-    if (chSchIsPreemptionRequired())
-      chSchDoReschedule();
-    dbg_check_unlock();
-  }
-}
-
 /** @} */
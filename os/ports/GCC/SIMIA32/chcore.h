@@ -60,7 +60,7 @@
 /**
  * @brief   Port-specific information string.
  */
-#define CH_PORT_INFO                    "No preemption"
+#define CH_PORT_INFO                    "Optional preemption"
 
 /**
  * 16 bytes stack alignment.
@@ -190,17 +190,17 @@ struct context {
 /**
  * Simulator initialization.
  */
-#define port_init()
+#define port_init() _port_init()
 
 /**
- * Does nothing in this simulator.
+ * Locks system mutex.
  */
-#define port_lock() asm volatile("nop")
+#define port_lock() _port_lock()
 
 /**
- * Does nothing in this simulator.
+ * Unlocks system mutex.
  */
-#define port_unlock() asm volatile("nop")
+#define port_unlock() _port_unlock()
 
 /**
  * Does nothing in this simulator.
@@ -213,19 +213,19 @@ struct context {
 #define port_unlock_from_isr()
 
 /**
- * Does nothing in this simulator.
+ * Masks the tick signal with preemption, otherwise does nothing.
  */
-#define port_disable()
+#define port_disable() _port_lock()
 
 /**
- * Does nothing in this simulator.
+ * Masks the tick signal with preemption, otherwise does nothing.
  */
-#define port_suspend()
+#define port_suspend() _port_lock()
 
 /**
- * Does nothing in this simulator.
+ * Unmasks the tick signal with preemption, otherwise does nothing.
  */
-#define port_enable()
+#define port_enable() _port_unlock()
 
 /**
  * In the simulator this does a polling pass on the simulated interrupt
@@ -233,6 +233,14 @@ struct context {
  */
 #define port_wait_for_interrupt() ChkIntSources()
 
+/**
+ * Register holding the interrupted program counter in a host signal
+ * context.
+ */
+#define PORT_PC_REG                     REG_EIP
+
+#include "simhost.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -240,7 +248,6 @@ extern "C" {
   __attribute__((fastcall)) void port_halt(void);
   __attribute__((cdecl, noreturn)) void _port_thread_start(msg_t (*pf)(void *),
                                                            void *p);
-  void ChkIntSources(void);
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,11 @@
 # List of the ChibiOS/RT SIMIA32 port files.
-PORTSRC = ${CHIBIOS}/os/ports/GCC/SIMIA32/chcore.c
+PORTSRC = ${CHIBIOS}/os/ports/GCC/SIMIA32/chcore.c \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON/simhost.c
 
 PORTASM = 
 
-PORTINC = ${CHIBIOS}/os/ports/GCC/SIMIA32
+PORTINC = ${CHIBIOS}/os/ports/GCC/SIMIA32 \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON
+
+# Host code model
+PORTARCH = -m32
@@ -65,7 +65,7 @@
 /**
  * @brief   Port-specific information string.
  */
-#define CH_PORT_INFO                    "No preemption"
+#define CH_PORT_INFO                    "Optional preemption"
 
 /**
  * @brief   MAC Never used in simulation.
@@ -223,19 +223,19 @@ struct context {
 #define port_unlock_from_isr() _port_unlock_from_isr()
 
 /**
- * Does nothing in this simulator.
+ * Masks the tick signal with preemption, otherwise does nothing.
  */
-#define port_disable()
+#define port_disable() _port_lock()
 
 /**
- * Does nothing in this simulator.
+ * Masks the tick signal with preemption, otherwise does nothing.
  */
-#define port_suspend()
+#define port_suspend() _port_lock()
 
 /**
- * Does nothing in this simulator.
+ * Unmasks the tick signal with preemption, otherwise does nothing.
  */
-#define port_enable()
+#define port_enable() _port_unlock()
 
 /**
  * In the simulator this does a polling pass on the simulated interrupt
@@ -243,12 +243,17 @@ struct context {
  */
 #define port_wait_for_interrupt() ChkIntSources()
 
+/**
+ * Register holding the interrupted program counter in a host signal
+ * context.
+ */
+#define PORT_PC_REG                     REG_EIP
+
+#include "simhost.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
-  void _port_init(void);
-  void _port_lock(void);
-  void _port_unlock(void);
   void _port_lock_from_isr(void);
   void _port_unlock_from_isr(void);
 
@@ -256,7 +261,6 @@ extern "C" {
   __attribute__((fastcall)) void port_halt(void);
   __attribute__((cdecl, noreturn)) void _port_thread_start(msg_t (*pf)(void *),
                                                            void *p);
-  void ChkIntSources(void);
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,6 @@
 # List of the ChibiOS/RT SIMSTM32 port files.
 PORTSRC = ${CHIBIOS}/os/ports/GCC/SIMSTM32/chcore.c \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON/simhost.c \
           ${CHIBIOS}/os/various/memstreams.c \
           ${CHIBIOS}/os/various/chrtclib.c
 
@@ -8,6 +9,10 @@ BOARDSRC = ${CHIBIOS}/boards/simulator/board.c
 PORTASM =
 
 PORTINC = ${CHIBIOS}/os/ports/GCC/SIMSTM32 \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON \
           ${CHIBIOS}/boards/simulator
 
+# Host code model
+PORTARCH = -m32
+
 SZ = size
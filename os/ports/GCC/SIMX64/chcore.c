@@ -0,0 +1,109 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006,2007,2008,2009,2010,
+                 2011,2012,2013 Giovanni Di Sirio.
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @addtogroup SIMX64_CORE
+ * @{
+ */
+
+#include <stddef.h>
+
+#include "ch.h"
+
+/**
+ * @brief   Kernel-lock action from an interrupt handler.
+ * @details This function is invoked before invoking I-class APIs from
+ *          interrupt handlers. The implementation is architecture dependent,
+ *          in its simplest form it is void.
+ */
+void _port_lock_from_isr(void) {
+}
+
+/**
+ * @brief   Kernel-unlock action from an interrupt handler.
+ * @details This function is invoked after invoking I-class APIs from interrupt
+ *          handlers. The implementation is architecture dependent, in its
+ *          simplest form it is void.
+ */
+void _port_unlock_from_isr(void) {
+}
+
+/**
+ * Performs a context switch between two threads.
+ * @details System V passes @p ntp in rdi and @p otp in rsi, only the
+ *          callee-saved registers need to survive the call.
+ * @param otp the thread to be switched out
+ * @param ntp the thread to be switched in
+ */
+__attribute__((naked))
+void port_switch(Thread *ntp, Thread *otp) {
+  (void)ntp; (void)otp;
+
+  asm volatile ("push    %%rbp                                  \n\t"
+                "push    %%rbx                                  \n\t"
+                "push    %%r12                                  \n\t"
+                "push    %%r13                                  \n\t"
+                "push    %%r14                                  \n\t"
+                "push    %%r15                                  \n\t"
+                "movq    %%rsp, %c0(%%rsi)                      \n\t"
+                "movq    %c0(%%rdi), %%rsp                      \n\t"
+                "pop     %%r15                                  \n\t"
+                "pop     %%r14                                  \n\t"
+                "pop     %%r13                                  \n\t"
+                "pop     %%r12                                  \n\t"
+                "pop     %%rbx                                  \n\t"
+                "pop     %%rbp                                  \n\t"
+                "ret" : : "i" (offsetof(Thread, p_ctx)));
+}
+
+/**
+ * First code run by a new thread.
+ * @details Moves the work function and its argument left in r12 and r13
+ *          by @p SETUP_CONTEXT into the argument registers.
+ */
+__attribute__((naked))
+void _port_thread_trampoline(void) {
+
+  asm volatile ("movq    %r12, %rdi                             \n\t"
+                "movq    %r13, %rsi                             \n\t"
+                "call    _port_thread_start");
+}
+
+/**
+ * @brief   Start a thread by invoking its work function.
+ * @details If the work function returns @p chThdExit() is automatically
+ *          invoked.
+ */
+__attribute__((noreturn))
+void _port_thread_start(msg_t (*pf)(void *), void *p) {
+
+  chSysUnlock();
+  chThdExit(pf(p));
+  while(1);
+}
+
+/** @} */
@@ -0,0 +1,268 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006,2007,2008,2009,2010,
+                 2011,2012,2013 Giovanni Di Sirio.
+
+    This file is part of ChibiOS/RT.
+
+    ChibiOS/RT is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    ChibiOS/RT is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+                                      ---
+
+    A special exception to the GPL can be applied should you wish to distribute
+    a combined work that includes ChibiOS/RT, without being obliged to provide
+    the source code for any proprietary components. See the file exception.txt
+    for full details of how and when the exception can be applied.
+*/
+
+/**
+ * @addtogroup SIMX64_CORE
+ * @{
+ */
+
+#ifndef _CHCORE_H_
+#define _CHCORE_H_
+
+#include "stm32.h"
+
+/**
+ * Unsupported.
+ */
+#if CH_DBG_ENABLE_STACK_CHECK
+# error CH_DBG_ENABLE_STACK_CHECK is not supported on this platform
+#endif
+
+/**
+ * Macro defining the a simulated architecture into x86.
+ */
+#define CH_ARCHITECTURE_SIMX64
+
+/**
+ * Name of the implemented architecture.
+ */
+#define CH_ARCHITECTURE_NAME            "Simulator"
+
+/**
+ * @brief   Name of the architecture variant (optional).
+ */
+#define CH_CORE_VARIANT_NAME            "x86-64 (integer only)"
+
+/**
+ * @brief   Name of the compiler supported by this port.
+ */
+#define CH_COMPILER_NAME                "GCC " __VERSION__
+
+/**
+ * @brief   Port-specific information string.
+ */
+#define CH_PORT_INFO                    "Optional preemption"
+
+/**
+ * @brief   MAC Never used in simulation.
+ */
+#define HAL_USE_MAC                     FALSE
+
+/**
+ * 16 bytes stack alignment.
+ */
+typedef struct {
+  uint8_t a[16];
+} stkalign_t __attribute__((aligned(16)));
+
+/**
+ * Generic x86-64 register.
+ */
+typedef void *regx86;
+
+/**
+ * Interrupt saved context.
+ * This structure represents the stack frame saved during a preemption-capable
+ * interrupt handler.
+ */
+struct extctx {
+};
+
+/**
+ * System saved context.
+ * @note Only the System V callee-saved registers, the floating point
+ *       registers are not saved.
+ */
+struct intctx {
+  regx86  r15;
+  regx86  r14;
+  regx86  r13;
+  regx86  r12;
+  regx86  rbx;
+  regx86  rbp;
+  regx86  rip;
+};
+
+/**
+ * Platform dependent part of the @p Thread structure.
+ * This structure usually contains just the saved stack pointer defined as a
+ * pointer to a @p intctx structure.
+ */
+struct context {
+  struct intctx volatile *rsp;
+};
+
+/**
+ * Platform dependent part of the @p chThdCreateI() API.
+ * This code usually setup the context switching frame represented by a
+ * @p intctx structure.
+ * @details The work function and its argument travel in r12 and r13 to
+ *          @p _port_thread_trampoline(). The frame leaves the stack
+ *          16 bytes aligned at the trampoline entry as the ABI wants
+ *          before a call.
+ */
+#define SETUP_CONTEXT(workspace, wsize, pf, arg) {                      \
+  uint8_t *rsp = (uint8_t *)(((uintptr_t)(workspace) + (wsize)) &       \
+                             ~(uintptr_t)15);                           \
+  rsp -= 16;                                                            \
+  rsp -= sizeof(struct intctx);                                         \
+  ((struct intctx *)rsp)->rip = (void *)_port_thread_trampoline;        \
+  ((struct intctx *)rsp)->r12 = (void *)(pf);                           \
+  ((struct intctx *)rsp)->r13 = (void *)(arg);                          \
+  ((struct intctx *)rsp)->r14 = 0;                                      \
+  ((struct intctx *)rsp)->r15 = 0;                                      \
+  ((struct intctx *)rsp)->rbx = 0;                                      \
+  ((struct intctx *)rsp)->rbp = 0;                                      \
+  tp->p_ctx.rsp = (struct intctx *)rsp;                                 \
+}
+
+/**
+ * Stack size for the system idle thread.
+ */
+#ifndef PORT_IDLE_THREAD_STACK_SIZE
+#define PORT_IDLE_THREAD_STACK_SIZE     256
+#endif
+
+/**
+ * Per-thread stack overhead for interrupts servicing, it is used in the
+ * calculation of the correct working area size.
+ * It requires stack space because the simulated "interrupt handlers" can
+ * invoke host library functions inside so it better have a lot of space.
+ */
+#ifndef PORT_INT_REQUIRED_STACK
+#define PORT_INT_REQUIRED_STACK         16384
+#endif
+
+/**
+ * Enforces a correct alignment for a stack area size value.
+ */
+#define STACK_ALIGN(n) ((((n) - 1) | (sizeof(stkalign_t) - 1)) + 1)
+
+ /**
+  * Computes the thread working area global size.
+  */
+#define THD_WA_SIZE(n) STACK_ALIGN(sizeof(Thread) +                     \
+                                   sizeof(void *) * 4 +                 \
+                                   sizeof(struct intctx) +              \
+                                   sizeof(struct extctx) +              \
+                                   (n) + (PORT_INT_REQUIRED_STACK))
+
+/**
+ * Macro used to allocate a thread working area aligned as both position and
+ * size.
+ */
+#define WORKING_AREA(s, n) stkalign_t s[THD_WA_SIZE(n) / sizeof(stkalign_t)]
+
+/**
+ * IRQ prologue code, inserted at the start of all IRQ handlers enabled to
+ * invoke system APIs.
+ */
+#define PORT_IRQ_PROLOGUE()
+
+/**
+ * IRQ epilogue code, inserted at the end of all IRQ handlers enabled to
+ * invoke system APIs.
+ */
+#define PORT_IRQ_EPILOGUE()
+
+/**
+ * IRQ handler function declaration.
+ */
+#define PORT_IRQ_HANDLER(id) void id(void)
+
+/**
+ * Simulator initialization.
+ */
+#define port_init() _port_init()
+
+/**
+ * Locks system mutex.
+ */
+#define port_lock() _port_lock()
+
+/**
+ * Unlocks system mutex.
+ */
+#define port_unlock() _port_unlock()
+
+/**
+ * Locks isr mutex.
+ */
+#define port_lock_from_isr() _port_lock_from_isr()
+
+/**
+ * Unlocks isr mutex.
+ */
+#define port_unlock_from_isr() _port_unlock_from_isr()
+
+/**
+ * Masks the tick signal with preemption, otherwise does nothing.
+ */
+#define port_disable() _port_lock()
+
+/**
+ * Masks the tick signal with preemption, otherwise does nothing.
+ */
+#define port_suspend() _port_lock()
+
+/**
+ * Unmasks the tick signal with preemption, otherwise does nothing.
+ */
+#define port_enable() _port_unlock()
+
+/**
+ * In the simulator this does a polling pass on the simulated interrupt
+ * sources.
+ */
+#define port_wait_for_interrupt() ChkIntSources()
+
+/**
+ * Register holding the interrupted program counter in a host signal
+ * context.
+ */
+#define PORT_PC_REG                     REG_RIP
+
+#include "simhost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void _port_lock_from_isr(void);
+  void _port_unlock_from_isr(void);
+
+  void port_switch(Thread *ntp, Thread *otp);
+  void port_halt(void);
+  void _port_thread_trampoline(void);
+  __attribute__((noreturn)) void _port_thread_start(msg_t (*pf)(void *),
+                                                    void *p);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CHCORE_H_ */
+
+/** @} */
@@ -0,0 +1,18 @@
+# List of the ChibiOS/RT SIMX64 port files.
+PORTSRC = ${CHIBIOS}/os/ports/GCC/SIMX64/chcore.c \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON/simhost.c \
+          ${CHIBIOS}/os/various/memstreams.c \
+          ${CHIBIOS}/os/various/chrtclib.c
+
+BOARDSRC = ${CHIBIOS}/boards/simulator/board.c
+
+PORTASM =
+
+PORTINC = ${CHIBIOS}/os/ports/GCC/SIMX64 \
+          ${CHIBIOS}/os/ports/GCC/SIMCOMMON \
+          ${CHIBIOS}/boards/simulator
+
+# Host code model
+PORTARCH = -m64
+
+SZ = size
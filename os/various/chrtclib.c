@@ -39,7 +39,7 @@
      defined(STM32F30X) || defined(STM32F37X) ||                              \
      defined(STM32F1XX) || defined(STM32F10X_MD) || defined(STM32F10X_LD) ||  \
      defined(STM32F10X_HD) || defined(STM32F10X_CL) || defined(STM32F0XX) ||  \
-     defined(LPC122X) || defined(__DOXYGEN__))
+     defined(LPC122X) || defined(SIMULATOR) || defined(__DOXYGEN__))
 #if STM32_RTC_IS_CALENDAR
 /**
  * @brief   Converts from STM32 BCD to canonicalized time format.
@@ -328,6 +328,11 @@ uint64_t rtcGetTimeUnixUsec(RTCDriver *rtcp) {
   rtcGetTime(rtcp, &timespec);
   result = (uint64_t)timespec.tv_sec * 1000000;
   return result + timespec.tv_msec * 1000;
+#elif RTC_SUPPORTS_USEC
+  RTCTime timespec = {0};
+
+  rtcGetTime(rtcp, &timespec);
+  return (uint64_t)timespec.tv_sec * 1000000 + timespec.tv_usec;
 #else
   return (uint64_t)rtcGetTimeUnixSec(rtcp) * 1000000;
 #endif
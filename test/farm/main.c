@@ -0,0 +1,79 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "test.h"
+
+/*
+ * Test suite output on stdout.
+ */
+static size_t out_write(void *ip, const uint8_t *bp, size_t n) {
+  (void)ip;
+  return fwrite(bp, 1, n, stdout);
+}
+
+static size_t out_read(void *ip, uint8_t *bp, size_t n) {
+  (void)ip; (void)bp; (void)n;
+  return 0;
+}
+
+static msg_t out_put(void *ip, uint8_t b) {
+  (void)ip;
+  return putchar(b) == EOF ? RDY_RESET : RDY_OK;
+}
+
+static msg_t out_get(void *ip) {
+  (void)ip;
+  return RDY_RESET;
+}
+
+static const struct BaseSequentialStreamVMT out_vmt = {
+  out_write, out_read, out_put, out_get
+};
+
+static BaseSequentialStream out = { &out_vmt };
+
+/*
+ * Application entry point.
+ * ch [--sim_clock real|virtual] [--sim_preempt]
+ */
+int main(int argc, char **argv) {
+  int i;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* the same clock options as simio, without the HAL */
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--sim_clock") && i + 1 < argc)
+      port_set_virtual_clock(!strcmp(argv[++i], "virtual"));
+    else if (!strcmp(argv[i], "--sim_preempt"))
+      port_set_preemption(TRUE);
+    else {
+      fprintf(stderr, "usage: %s [--sim_clock real|virtual] [--sim_preempt]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  chSysInit();
+
+  return TestThread(&out) ? 1 : 0;
+}
@@ -14,52 +14,92 @@
     limitations under the License.
 */
 
-#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include "ch.h"
 #include "hal.h"
+#include "simio.h"
 
-#define DEPTH 1
-#define CHANNEL 8
-
-static adcsample_t sample_1[DEPTH * CHANNEL]= {1,2,3,4,5,3,3,5};
-static adcsample_t sample_2[4]= {1,2,3,4};
-static float out_1[DEPTH * CHANNEL];
-static float out_2[4];
-/*Adc config driver 1 */
-static const ADCConversionGroup adccfg ={
-    FALSE,
-    CHANNEL,
-    NULL,
-    NULL, 
-    10,
-    3,
-    4
+#define CHANNELS        2
+#define LINEAR_DEPTH    16
+#define CIRCULAR_DEPTH  64
+#define CIRCULAR_RATE   8000
+#define RAMP_MASK       0xFFF
+
+static adcsample_t linear[LINEAR_DEPTH * CHANNELS];
+static adcsample_t circular[CIRCULAR_DEPTH * CHANNELS];
+
+static unsigned callbacks, late, gaps;
+static bool_t stall;
+static systime_t start;
+static adcsample_t next;
+
+/*
+ * Checks the half buffers are handed over on time and, with a ramp
+ * source, that no sample went missing.
+ */
+static void circular_cb(ADCDriver *adcp, adcsample_t *buffer, size_t n) {
+
+  (void)adcp;
+  callbacks++;
+  if (chTimeNow() - start >
+      (systime_t)((uint64_t)callbacks * n * CH_FREQUENCY / CIRCULAR_RATE))
+    late++;
+  if (buffer[0] != next)
+    gaps++;
+  next = (buffer[n * CHANNELS - 1] + 1) & RAMP_MASK;
+
+  /* a consumer falling behind, the host stalls for five half buffers */
+  if (stall && callbacks == 10) {
+    stall = FALSE;
+    usleep(5 * 1000000 / (CIRCULAR_RATE / (CIRCULAR_DEPTH / 2)));
+  }
+}
+
+/* 12 bits, 2 channels, 1kHz */
+static const ADCConversionGroup lingrp = {
+  FALSE,
+  CHANNELS,
+  NULL,
+  NULL,
+  1000,
+  12
 };
-static const ADCConversionGroup adccfg_1 ={
-    TRUE,
-    CHANNEL,
-    NULL,
-    NULL,
-    10,
-    3,
-    8
+
+/* 12 bits, 2 channels, 8kHz, a callback every 4ms */
+static const ADCConversionGroup circgrp = {
+  TRUE,
+  CHANNELS,
+  circular_cb,
+  NULL,
+  CIRCULAR_RATE,
+  12
 };
-static WORKING_AREA(dummy_1, 128);
-static msg_t led_thread(void *arg)
-{
-    (void)arg; 
-    chRegSetThreadName("blinker");
-    while(TRUE){
-        palSetPad(IOPORT1,0);
-        chThdSleepMilliseconds(500);
-        palClearPad(IOPORT1, 0);
-        chThdSleepMilliseconds(500);
-    }
+
+/*
+ * Streams for a second, returns the overruns.
+ */
+static unsigned stream(void) {
+  unsigned overruns = ADCD1.overruns;
+
+  callbacks = late = gaps = 0;
+  next = 0;
+  start = chTimeNow();
+  adcStartConversion(&ADCD1, &circgrp, circular, CIRCULAR_DEPTH);
+  chThdSleepMilliseconds(1000);
+  adcStopConversion(&ADCD1);
+  return ADCD1.overruns - overruns;
 }
- /* Application entry point.
+
+/*
+ * Application entry point.
  */
-int main(void) {
+int main(int argc, char *argv[]) {
+  unsigned overruns;
+  msg_t msg;
+
+  sim_getopt(argc, argv);
 
   /*
    * System initializations.
@@ -70,21 +110,27 @@ int main(void) {
    */
   halInit();
   chSysInit();
-  chThdCreateStatic(dummy_1, sizeof(dummy_1), NORMALPRIO, led_thread, NULL);
- //Starting the adc driver
+
   adcStart(&ADCD1, NULL);
-  //single buffer
 
-  adcStartConversion(&ADCD1, &adccfg,sample_2,DEPTH);
+  /* linear conversion, 16 samples at 1kHz */
+  start = chTimeNow();
+  msg = adcConvert(&ADCD1, &lingrp, linear, LINEAR_DEPTH);
+  printf("Linear conversion %s in %u ticks, samples %u %u %u %u\r\n",
+         msg == RDY_OK ? "OK" : "FAILED", (unsigned)(chTimeNow() - start),
+         linear[0], linear[1], linear[2], linear[3]);
 
-  chThdSleepMilliseconds(1000);
+  /* circular conversion */
+  overruns = stream();
+  printf("Circular conversion %u callbacks, %u late, %u gaps, %u overruns\r\n",
+         callbacks, late, gaps, overruns);
 
-  //circular buffer
-  adcStartConversion(&ADCD1, &adccfg_1,sample_1,DEPTH);
- 
-  while (TRUE) {
-    chThdSleepMilliseconds(10000);
-          adcStopConversion(&ADCD1);
+  /* circular conversion with a stalled consumer */
+  stall = TRUE;
+  overruns = stream();
+  printf("Stalled conversion %u callbacks, %u gaps, %u overruns\r\n",
+         callbacks, gaps, overruns);
 
-  }
+  adcStop(&ADCD1);
+  return 0;
 }
@@ -15,50 +15,45 @@
 */
 
 #include <stdio.h>
-#include <unistd.h>
-#include <stdlib.h>
 
 #include "ch.h"
 #include "hal.h"
 #include "simio.h"
 
-/*===========================================================================*/
-/* Driver exported variables.                                                */
-/*===========================================================================*/
-
-/**
- * @brief   EXTD1 driver identifier.
+/*
+ * The VHA plays a quadrature encoder on the channels 0 and 1, an edge
+ * every EDGE_US from START_US after the time it is sent. Event k is on
+ * channel k & 1, rising when bit 1 of k is clear.
  */
-EXTDriver EXTD1;
-
-static void led4off(void *arg) {
-
-  (void)arg;
+#define EDGES           2000
+#define EDGE_US         50
+#define START_US        10000
 
-  palClearPad(IOPORT1, 0);
+static systime_t dispatched[EDGES];
+static unsigned count, order_errors;
 
+/* the channel 0 takes both edges, the channel 1 only the rising ones */
+static bool_t expected(unsigned k) {
+  return !(k & 1) || !(k & 2);
 }
 
-/* Triggered when the button is pressed or released. The LED4 is set to ON.*/
-static void extcb1(EXTDriver *extp, expchannel_t channel) {
-  static VirtualTimer vt4;
-  (void)extp;
-  (void)channel;
-
-  palSetPad(IOPORT1, 0);
+static void edgecb(EXTDriver *extp, expchannel_t channel) {
+  static unsigned k;
 
-  chSysLockFromIsr();
-  if (chVTIsArmedI(&vt4))
-    chVTResetI(&vt4);
-  /* LED4 set to OFF after 200mS.*/
-  chVTSetI(&vt4, MS2ST(200), led4off, NULL);
-  chSysUnlockFromIsr();
+  (void)extp;
+  while (k < EDGES && !expected(k))
+    k++;
+  if (k >= EDGES || channel != (k & 1))
+    order_errors++;
+  if (count < EDGES)
+    dispatched[count++] = chTimeNow();
+  k++;
 }
 
 static const EXTConfig extcfg = {
   {
-    { EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART, extcb1},
-    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART, edgecb },
+    { EXT_CH_MODE_RISING_EDGE | EXT_CH_MODE_AUTOSTART, edgecb },
     { EXT_CH_MODE_DISABLED, NULL },
     { EXT_CH_MODE_DISABLED, NULL },
     { EXT_CH_MODE_DISABLED, NULL },
@@ -84,6 +79,13 @@ static const EXTConfig extcfg = {
  * Application entry point.
  */
 int main(int argc, char **argv) {
+  unsigned i, n, wanted = 0, tick_errors = 0;
+  uint32_t start;
+  EXTStats st;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
   sim_getopt(argc, argv);
 
   /*
@@ -101,16 +103,37 @@ int main(int argc, char **argv) {
    */
   extStart(&EXTD1, &extcfg);
 
-  /*
-   * Normal main() thread activity, in this demo it enables and disables the
-   * button EXT channel using 5 seconds intervals.
-   */
-  while (TRUE) {
-    chThdSleepMilliseconds(5000);
-    fprintf(stderr, "extChannelDisable\n");
-    extChannelDisable(&EXTD1, 0);
-    chThdSleepMilliseconds(5000);
-    fprintf(stderr, "extChannelEnable\n");
-    extChannelEnable(&EXTD1, 0);
+  /* the VHA schedules the burst from our time */
+  start = (uint32_t)((uint64_t)chTimeNow() * 1000000 / CH_FREQUENCY);
+  sim_printf(EXT_IO, "start %u\n", start);
+
+  for (i = 0; i < EDGES; i++)
+    if (expected(i))
+      wanted++;
+  while (count < wanted)
+    chThdSleepMilliseconds(10);
+  chThdSleepMilliseconds(10);
+
+  /* each callback at the first tick not before its edge */
+  for (i = n = 0; i < EDGES; i++) {
+    if (!expected(i))
+      continue;
+    if (dispatched[n++] !=
+        (start + START_US + i * EDGE_US + 999999 / CH_FREQUENCY) /
+        (1000000 / CH_FREQUENCY))
+      tick_errors++;
   }
+
+  ext_lld_get_stats(&EXTD1, &st);
+  printf("%u callbacks, %u dropped, %u late in %u batches\n",
+         st.events, st.dropped, st.late, st.batches);
+  printf("latency min %d us max %d us mean %d us\n",
+         (int)st.latency_min, (int)st.latency_max,
+         st.events ? (int)(st.latency_sum / st.events) : 0);
+  printf("%u order errors, %u tick errors\n", order_errors, tick_errors);
+
+  return count != wanted || st.events != wanted ||
+         st.dropped != EDGES - wanted || st.late != 0 ||
+         order_errors != 0 || tick_errors != 0 ||
+         st.latency_min < 0 || st.latency_max >= 1000000 / CH_FREQUENCY;
 }
@@ -14,103 +14,149 @@
     limitations under the License.
 */
 
+#include <stdio.h>
+#include <time.h>
+
 #include "ch.h"
 #include "hal.h"
+#include "simio.h"
+
+/* 100kHz timer clock, 10us per tick */
+#define GPT_FREQUENCY       100000
+
+/* allowed mean delay between a timer expiry and its callback */
+#define MAX_MEAN_JITTER_US  500
 
+/* one shots chained from the callback */
+#define ONESHOTS            100
+
+static unsigned ticks, oneshots;
 
 /*
-* GPT2 callback.
-*/
-static void gpt2cb(GPTDriver *gptp) {
+ * Host monotonic clock microseconds.
+ */
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * GPT1 callback, continuous mode.
+ */
+static void gpt1cb(GPTDriver *gptp) {
 
   (void)gptp;
-  printf("callback to LED5, timer id:  %x\n", (unsigned int)gptp->timerid);
-  palSetPad(GPIOD, GPIOD_LED5);
-  printf("Got here1\n");
-  chSysLockFromIsr();
-  printf("Got here2\n");
-  gptStartOneShotI(&GPTD2, 1000); /* 0.1 second pulse.*/
-  printf("Got here3\n");
-  chSysUnlockFromIsr();
-  printf("Got here4\n");
+  ticks++;
 }
 
 /*
-* GPT1 callback.
-*/
-static void gpt1cb(GPTDriver *gptp) {
+ * GPT2 callback, restarts its one shot until done.
+ */
+static void gpt2cb(GPTDriver *gptp) {
 
   (void)gptp;
-  printf("Callback to LED5, timer id: %x\n", (unsigned int)gptp->timerid);
-  palClearPad(GPIOD, GPIOD_LED5);
+  if (++oneshots < ONESHOTS) {
+    chSysLockFromIsr();
+    gptStartOneShotI(&GPTD2, 50);           /* 0.5ms */
+    chSysUnlockFromIsr();
+  }
 }
 
 /*
-* GPT1 configuration.
-*/
+ * GPT1 configuration.
+ */
 static const GPTConfig gpt1cfg = {
-  10000, /* 10kHz timer clock.*/
-  gpt1cb, /* Timer callback.*/
+  GPT_FREQUENCY,
+  gpt1cb
 };
 
 /*
-* GPT2 configuration.
-*/
+ * GPT2 configuration.
+ */
 static const GPTConfig gpt2cfg = {
-  10000, /* 10kHz timer clock.*/
-  gpt2cb /* Timer callback.*/
+  GPT_FREQUENCY,
+  gpt2cb
 };
 
 /*
-* Application entry point.
-*/
-int main(void) {
-
-  /*
-* System initializations.
-* - HAL initialization, this also initializes the configured device drivers
-* and performs the board-specific initializations.
-* - Kernel initialization, the main() function becomes a thread and the
-* RTOS is active.
-*/
+ * Prints and checks the callback statistics.
+ */
+static int report(const char *name, GPTDriver *gptp,
+                  unsigned min, unsigned max) {
+  GPTStats st;
+  double mean;
+
+  gpt_lld_get_stats(gptp, &st);
+  mean = st.callbacks ? st.jitter_sum / 1e3 / st.callbacks : 0;
+  printf("%s %u callbacks, %u missed, jitter min %.1f us mean %.1f us "
+         "max %.1f us\n", name, st.callbacks, st.missed,
+         st.jitter_min / 1e3, mean, st.jitter_max / 1e3);
+  if (st.callbacks < min || st.callbacks + st.missed > max) {
+    printf("FAILED: %s callbacks out of %u..%u\n", name, min, max);
+    return 1;
+  }
+  if (mean > MAX_MEAN_JITTER_US) {
+    printf("FAILED: %s callbacks late\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  GPTStats st;
+  double start, elapsed;
+  int failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
+
   halInit();
   chSysInit();
 
-  /*
-* Initializes the GPT drivers 2 and 3.
-*/
-  printf("Start GPTD1\n");
   gptStart(&GPTD1, &gpt1cfg);
-  printf("timer ID is 0x%lx\n", (long) GPTD1.timerid);
-  printf("Finished gptStartD1\n");
-  printf("Going to sleep D1 for: %d \n", 10);
-  gptPolledDelay(&GPTD1, 10); /* Small delay.*/
-  printf("Finished polledDelay1\n");
-  printf("Start GPTD2\n");
   gptStart(&GPTD2, &gpt2cfg);
-  printf("timer ID is 0x%lx\n", (long) GPTD2.timerid);
-  printf("Going to sleep D2 for: %d \n", 10);
-  gptPolledDelay(&GPTD2, 10); /* Small delay.*/
-  printf("polledDelay2\n");
-
-  /*
-* Normal main() thread activity, it changes the GPT1 period every
-* five seconds and the GPT2 period every 2.5 seconds.
-*/
-  while (TRUE) {
-    //palSetPad(GPIOD, GPIOD_LED4);
-    printf("Start Continuous: GPTD1\n");
-    gptStartContinuous(&GPTD1, 5000);
-    printf("Sleep for 5 seconds\n");
-    chThdSleepMilliseconds(5000);
-    printf("Stopping GPTD1\n");
-    gptStopTimer(&GPTD1);
-    //palClearPad(GPIOD, GPIOD_LED4);
-    printf("Start Continuous: GPTD2\n");
-    gptStartContinuous(&GPTD2, 2500);
-    printf("Sleep for 2.5 seconds\n");
-    chThdSleepMilliseconds(2500);
-    printf("Stopping GPTD2\n");
-    gptStopTimer(&GPTD2);
+
+  /* polled delays below the system tick */
+  start = now_us();
+  gptPolledDelay(&GPTD1, 25);               /* 250us */
+  elapsed = now_us() - start;
+  printf("polled delay 250 us took %.1f us\n", elapsed);
+  if (elapsed < 250 || elapsed > 250 + MAX_MEAN_JITTER_US) {
+    printf("FAILED: polled delay\n");
+    failed = 1;
+  }
+
+  /* continuous mode at 1kHz for a second, then 500Hz for a second */
+  gptStartContinuous(&GPTD1, 100);
+  chThdSleepMilliseconds(1000);
+  failed |= report("continuous 1kHz", &GPTD1, 900, 1001);
+  gptChangeInterval(&GPTD1, 200);
+  chThdSleepMilliseconds(1000);
+  gptStopTimer(&GPTD1);
+  failed |= report("continuous 1kHz then 500Hz", &GPTD1, 1350, 1502);
+  gpt_lld_get_stats(&GPTD1, &st);
+  if (ticks != st.callbacks) {
+    printf("FAILED: %u callbacks seen by the application\n", ticks);
+    failed = 1;
+  }
+
+  /* one shots chained from the callback */
+  gptStartOneShot(&GPTD2, 50);
+  chThdSleepMilliseconds(ONESHOTS);
+  failed |= report("one shot", &GPTD2, ONESHOTS, ONESHOTS);
+  if (GPTD2.state != GPT_READY) {
+    printf("FAILED: one shot left running\n");
+    failed = 1;
   }
+
+  gptStop(&GPTD1);
+  gptStop(&GPTD2);
+  return failed;
 }
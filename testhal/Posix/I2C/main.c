@@ -14,96 +14,180 @@
     limitations under the License.
 */
 
-#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "ch.h"
 #include "hal.h"
-
 #include "simio.h"
-#define rx_DEPTH  128
-#define tx_DEPTH  128
 
-static i2cflags_t errors = 0;
+#define SENSOR_ADDR     0x48    /* register map, in-process */
+#define SENSOR_WHOAMI   0x0F
+#define EEPROM_ADDR     0x50    /* 4KiB EEPROM, in-process */
+#define EEPROM_PAGE     32
+#define EEPROM_WRITE_MS 5
+#define VHA_ADDR        0x60    /* register map served by the VHA */
+#define ABSENT_ADDR     0x61    /* NACKed by the VHA */
+#define VHA_SLOW_REG    0xEE    /* read late by the VHA */
+#define READS           1000
+
+static uint8_t sensor_regs[256];
+static I2CMemModel sensor;
+static uint8_t eeprom_mem[4096];
+static I2CMemModel eeprom;
+
+static const I2CConfig i2cfg1 = {
+  OPMODE_I2C,
+  400000,
+  FAST_DUTY_CYCLE_2,
+};
 
+static int failed;
 
+/*
+ * Host monotonic clock microseconds.
+ */
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
 
-static const I2CConfig i2cfg1 ={
-    OPMODE_I2C,
-    400000,
-    FAST_DUTY_CYCLE_2,
-};
+static void check(bool_t ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failed = 1;
+  }
+}
 
+/*
+ * Register read, the register address then the value after a repeated
+ * start.
+ */
+static msg_t read_reg(i2caddr_t addr, uint8_t reg, uint8_t *val) {
+  msg_t msg;
 
-//Send data
-static WORKING_AREA(dummy_1, 256);
-static msg_t dummy_1_thread(void *arg)
-{
-    chRegSetThreadName("dummy1");
-    (void)arg;
-    uint8_t rx_buf[rx_DEPTH];
-    uint8_t tx_buf[tx_DEPTH];
-    while(TRUE){
-
-        chThdSleepMilliseconds(1000);
-        msg_t status = RDY_OK;
-        i2cAcquireBus(&I2CD1);
-        systime_t tmo = 10000;
-        status = i2cMasterTransmitTimeout(&I2CD1, 0, rx_buf, rx_DEPTH, tx_buf
-                ,tx_DEPTH, tmo);
-        i2cReleaseBus(&I2CD1);
-        if(status != RDY_OK)
-        {
-            errors = i2cGetErrors(&I2CD1);           
-        }
-    }
-    return 0;
+  i2cAcquireBus(&I2CD1);
+  msg = i2cMasterTransmitTimeout(&I2CD1, addr, &reg, 1, val, 1, MS2ST(100));
+  i2cReleaseBus(&I2CD1);
+  return msg;
 }
 
-//transmit data
-static WORKING_AREA(dummy_2, 256);
-static msg_t dummy_2_thread(void *arg)
-{
-    chRegSetThreadName("dummy2");
-    (void)arg;
-    uint8_t tx_buf[tx_DEPTH];
-    while(TRUE){
-        chThdSleepMilliseconds(1000); 
-        msg_t status = RDY_OK;
-        systime_t tmo = 10000;
-        i2cAcquireBus(&I2CD1);
-        status = i2cMasterReceiveTimeout(&I2CD1, 0, tx_buf, tx_DEPTH, tmo);
-        i2cReleaseBus(&I2CD1);
-        if(status != RDY_OK){
-            errors = i2cGetErrors(&I2CD1);
-        }
-        printf("\n"); 
-    }
-    return 0;
+/*
+ * Times register reads, returns the ticks taken.
+ */
+static systime_t time_reads(i2caddr_t addr, unsigned n, double *us) {
+  systime_t start = chTimeNow();
+  double host = now_us();
+  uint8_t val;
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    check(read_reg(addr, SENSOR_WHOAMI, &val) == RDY_OK, "timed read");
+  *us = (now_us() - host) / n;
+  return chTimeNow() - start;
 }
 
-
 /*
  * Application entry point.
  */
-int main(void) {
-
-  /*
-   * System initializations.
-   * - HAL initialization, this also initializes the configured device drivers
-   *   and performs the board-specific initializations.
-   * - Kernel initialization, the main() function becomes a thread and the
-   *   RTOS is active.
-   */
+int main(int argc, char *argv[]) {
+  uint8_t tx[2 + EEPROM_PAGE + 2], rx[EEPROM_PAGE], val;
+  systime_t start, ticks;
+  unsigned i, nacks;
+  double us;
+  msg_t msg;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  sim_getopt(argc, argv);
+
   halInit();
   chSysInit();
-  chThdSleepMilliseconds(200);
-  i2cInit();
+
+  sensor_regs[SENSOR_WHOAMI] = 0x33;
+  i2c_lld_mem_init(&sensor, SENSOR_ADDR, sensor_regs, sizeof(sensor_regs),
+                   1, 0, 0);
+  i2c_lld_mem_init(&eeprom, EEPROM_ADDR, eeprom_mem, sizeof(eeprom_mem),
+                   2, EEPROM_PAGE, MS2ST(EEPROM_WRITE_MS));
+  i2c_lld_attach(&I2CD1, &sensor.model);
+  i2c_lld_attach(&I2CD1, &eeprom.model);
   i2cStart(&I2CD1, &i2cfg1);
-  palSetPadMode(IOPORT2, 6, 17);
-  chThdSleepMilliseconds(100);
-  chThdCreateStatic(dummy_1, sizeof(dummy_1), NORMALPRIO, dummy_1_thread, NULL);
-//  chThdCreateStatic(dummy_2, sizeof(dummy_2), NORMALPRIO, dummy_2_thread, NULL);
-  while (TRUE) {
-    chThdSleepMilliseconds(5000);
+
+  /* register read and burst access */
+  check(read_reg(SENSOR_ADDR, SENSOR_WHOAMI, &val) == RDY_OK && val == 0x33,
+        "sensor WHO_AM_I");
+  tx[0] = 0x20; tx[1] = 1; tx[2] = 2; tx[3] = 3;
+  i2cAcquireBus(&I2CD1);
+  msg = i2cMasterTransmitTimeout(&I2CD1, SENSOR_ADDR, tx, 4, NULL, 0,
+                                 TIME_INFINITE);
+  check(msg == RDY_OK, "sensor burst write");
+  msg = i2cMasterTransmitTimeout(&I2CD1, SENSOR_ADDR, tx, 1, rx, 3,
+                                 TIME_INFINITE);
+  i2cReleaseBus(&I2CD1);
+  check(msg == RDY_OK && memcmp(rx, tx + 1, 3) == 0, "sensor burst read");
+
+  /* 39 bits a register read, 97.5us at 400kHz */
+  ticks = time_reads(SENSOR_ADDR, READS, &us);
+  printf("%u in-process register reads took %u ticks, %.1f us each\n",
+         READS, (unsigned)ticks, us);
+
+  /* an EEPROM page write wrapping at the page end, then ACK polling */
+  tx[0] = 0x01; tx[1] = 0x00;
+  for (i = 0; i < EEPROM_PAGE + 2; i++)
+    tx[2 + i] = (uint8_t)(0x80 + i);
+  i2cAcquireBus(&I2CD1);
+  start = chTimeNow();
+  msg = i2cMasterTransmitTimeout(&I2CD1, EEPROM_ADDR, tx, sizeof(tx), NULL, 0,
+                                 TIME_INFINITE);
+  check(msg == RDY_OK, "EEPROM page write");
+  nacks = 0;
+  while (i2cMasterTransmitTimeout(&I2CD1, EEPROM_ADDR, tx, 2, NULL, 0,
+                                  TIME_INFINITE) != RDY_OK) {
+    check(i2cGetErrors(&I2CD1) == I2CD_ACK_FAILURE, "EEPROM busy NACK");
+    nacks++;
   }
+  ticks = chTimeNow() - start;
+  msg = i2cMasterReceiveTimeout(&I2CD1, EEPROM_ADDR, rx, EEPROM_PAGE,
+                                TIME_INFINITE);
+  i2cReleaseBus(&I2CD1);
+  printf("EEPROM write cycle %u NACKs in %u ticks\n", nacks, (unsigned)ticks);
+  check(nacks > 0 && ticks >= MS2ST(EEPROM_WRITE_MS), "EEPROM write cycle");
+  check(msg == RDY_OK && rx[0] == 0x80 + EEPROM_PAGE &&
+        rx[1] == 0x81 + EEPROM_PAGE &&
+        memcmp(rx + 2, tx + 4, EEPROM_PAGE - 2) == 0, "EEPROM page wrap");
+
+  /* the other addresses go to the VHA */
+  check(read_reg(VHA_ADDR, SENSOR_WHOAMI, &val) == RDY_OK &&
+        val == (SENSOR_WHOAMI ^ 0xA5), "VHA register read");
+  msg = read_reg(ABSENT_ADDR, SENSOR_WHOAMI, &val);
+  check(msg == RDY_RESET && i2cGetErrors(&I2CD1) == I2CD_ACK_FAILURE,
+        "VHA NACK");
+  ticks = time_reads(VHA_ADDR, READS / 10, &us);
+  printf("%u VHA register reads took %u ticks, %.1f us each\n",
+         READS / 10, (unsigned)ticks, us);
+
+  /* the late reply of a timed out read must not reach the next one */
+  memset(rx, 0x55, sizeof(rx));
+  tx[0] = VHA_SLOW_REG;
+  i2cAcquireBus(&I2CD1);
+  msg = i2cMasterTransmitTimeout(&I2CD1, VHA_ADDR, tx, 1, rx, 8, MS2ST(50));
+  i2cReleaseBus(&I2CD1);
+  check(msg == RDY_TIMEOUT, "VHA read timeout");
+  i2cStop(&I2CD1);
+  i2cStart(&I2CD1, &i2cfg1);
+  memset(rx, 0x55, sizeof(rx));
+  tx[0] = SENSOR_WHOAMI;
+  i2cAcquireBus(&I2CD1);
+  msg = i2cMasterTransmitTimeout(&I2CD1, VHA_ADDR, tx, 1, rx, 1,
+                                 TIME_INFINITE);
+  i2cReleaseBus(&I2CD1);
+  check(msg == RDY_OK && rx[0] == (SENSOR_WHOAMI ^ 0xA5) && rx[1] == 0x55,
+        "VHA read after a timeout");
+
+  i2cStop(&I2CD1);
+  sim_disconnect();
+  return failed;
 }
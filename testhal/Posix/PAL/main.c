@@ -15,15 +15,64 @@
 */
 
 #include <stdio.h>
+
 #include "ch.h"
 #include "hal.h"
+#include "simio.h"
+
+#define BYTES           256     /* bit-banged on the IOPORT1 low byte */
+#define READY_PAD       31      /* IOPORT1, the bytes are out */
+#define PULSE_PAD       0       /* IOPORT2, pulsed by the test process */
+#define DONE_PAD        1       /* IOPORT2, the pulses are over */
+#define PULSES          100
+
+static unsigned rising, falling;
 
+static void edgecb(EXTDriver *extp, expchannel_t channel) {
+
+  (void)extp;
+  if (palReadPad(IOPORT2, channel))
+    rising++;
+  else
+    falling++;
+}
+
+static const EXTConfig extcfg = {
+  {
+    { EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART |
+      (EXT_MODE_VIO2 << EXT_MODE_GPIO_OFF), edgecb },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL },
+    { EXT_CH_MODE_DISABLED, NULL }
+  }
+};
 
 /*
  * Application entry point.
  */
-int main(void) {
-  int i;
+int main(int argc, char *argv[]) {
+  unsigned i;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  sim_getopt(argc, argv);
 
   /*
    * System initializations.
@@ -35,10 +84,22 @@ int main(void) {
   halInit();
   chSysInit();
 
-  for (i = 0; i < 5; i++) {
-    palWritePad(IOPORT1, i, PAL_HIGH);
-    chThdSleep(S2ST(1));
+  palSetGroupMode(IOPORT1, 0xFF, 0, PAL_MODE_OUTPUT_PUSHPULL);
+  palSetPadMode(IOPORT1, READY_PAD, PAL_MODE_OUTPUT_PUSHPULL);
+  palSetGroupMode(IOPORT2, PAL_WHOLE_PORT, 0, PAL_MODE_INPUT);
+  extStart(&EXTD1, &extcfg);
+
+  /* a byte a tick, each one a latch event */
+  for (i = 0; i < BYTES; i++) {
+    palWriteGroup(IOPORT1, 0xFF, 0, i + 1);
+    chThdSleep(1);
   }
+  palSetPad(IOPORT1, READY_PAD);
+
+  /* the pulses raise the EXT channel 0 callbacks */
+  while (!palReadPad(IOPORT2, DONE_PAD))
+    chThdSleepMilliseconds(1);
 
-  return 0;
+  printf("%u rising and %u falling edges\n", rising, falling);
+  return rising != PULSES || falling != PULSES;
 }
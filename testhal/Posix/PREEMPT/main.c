@@ -0,0 +1,159 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "test.h"
+#include "simio.h"
+
+/* length of the scenario in system seconds */
+#define SCENARIO_SECONDS    2
+
+/* period of the latency probe */
+#define PROBE_PERIOD        MS2ST(10)
+
+/*
+ * Test suite output on stdout.
+ */
+static size_t out_write(void *ip, const uint8_t *bp, size_t n) {
+  (void)ip;
+  return fwrite(bp, 1, n, stdout);
+}
+
+static size_t out_read(void *ip, uint8_t *bp, size_t n) {
+  (void)ip; (void)bp; (void)n;
+  return 0;
+}
+
+static msg_t out_put(void *ip, uint8_t b) {
+  (void)ip;
+  return putchar(b) == EOF ? RDY_RESET : RDY_OK;
+}
+
+static msg_t out_get(void *ip) {
+  (void)ip;
+  return RDY_RESET;
+}
+
+static const struct BaseSequentialStreamVMT out_vmt = {
+  out_write, out_read, out_put, out_get
+};
+
+static BaseSequentialStream out = { &out_vmt };
+
+/*
+ * Host monotonic clock microseconds.
+ */
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * CPU bound threads that never call the kernel, they only make
+ * progress if the tick preempts them.
+ */
+static WORKING_AREA(waHog1, 256);
+static WORKING_AREA(waHog2, 256);
+static volatile bool_t stop;
+static volatile uint32_t spins[2];
+
+static msg_t hog(void *arg) {
+  volatile uint32_t *n = arg;
+
+  while (!stop)
+    (*n)++;
+  return 0;
+}
+
+/*
+ * Higher priority periodic thread, measures how late it runs.
+ */
+static WORKING_AREA(waProbe, 256);
+static uint32_t probes, late_ticks;
+static double max_late_us;
+
+static msg_t probe(void *arg) {
+  systime_t t0 = chTimeNow(), next = t0;
+  double h0 = now_us(), late;
+
+  (void)arg;
+  while (!stop) {
+    next += PROBE_PERIOD;
+    chThdSleepUntil(next);
+    late = now_us() - h0 - (double)(next - t0) * 1e6 / CH_FREQUENCY;
+    if (late > max_late_us)
+      max_late_us = late;
+    late_ticks += chTimeNow() - next;
+    probes++;
+  }
+  return 0;
+}
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  Thread *tp[3];
+  int i, failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
+
+  halInit();
+  chSysInit();
+
+  if (!port_is_preemptive()) {
+    printf("run with --sim_preempt, the hogs would starve the system\n");
+    return 1;
+  }
+
+  tp[0] = chThdCreateStatic(waHog1, sizeof(waHog1), NORMALPRIO - 1, hog, (void *)&spins[0]);
+  tp[1] = chThdCreateStatic(waHog2, sizeof(waHog2), NORMALPRIO - 1, hog, (void *)&spins[1]);
+  tp[2] = chThdCreateStatic(waProbe, sizeof(waProbe), NORMALPRIO + 1, probe, NULL);
+  chThdSleep(S2ST(SCENARIO_SECONDS));
+  stop = TRUE;
+  for (i = 0; i < 3; i++)
+    chThdWait(tp[i]);
+
+  printf("hogs: %u and %u spins\n", spins[0], spins[1]);
+  printf("probe: %u runs, %u ticks late in total, worst %.0f us after its deadline\n",
+         probes, late_ticks, max_late_us);
+
+  if (spins[0] == 0 || spins[1] == 0 ||
+      spins[0] > 2 * spins[1] || spins[1] > 2 * spins[0]) {
+    printf("FAILED: round robin did not share the CPU\n");
+    failed = 1;
+  }
+  if (probes < SCENARIO_SECONDS * CH_FREQUENCY / PROBE_PERIOD - 1 || late_ticks > 0) {
+    printf("FAILED: the probe was not run at its deadlines\n");
+    failed = 1;
+  }
+
+  /* the kernel test suite as on the target */
+  if (TestThread(&out))
+    failed = 1;
+
+  return failed;
+}
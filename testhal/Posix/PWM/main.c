@@ -1,66 +1,101 @@
-#include <stdio.h>
-#include <string.h>
-#include <stdbool.h>
-
-#include "ch.h"
-#include "hal.h"
-
-void show_pwm(void) {
-	printf("pwm state:\t%d\r\n", PWMD1.state);
-	printf("pwm freq:\t%d\r\n", PWMD1.config->frequency);
-	puts("");
-}
-
-#define INIT_PWM_FREQ 1000000 /* 1 Mhz PWM clock frequency, 1 uS per tick */
-#define INIT_PWM_PERIOD 400   /* PWM period in freq ticks, 400uS */
-#define INIT_PWM_WIDTH_TICS 20
-
-PWMConfig pwmcfg_led = {
-	INIT_PWM_FREQ,    /* Frequency */
-	INIT_PWM_PERIOD, /* Period */
-	NULL,            /* Callback (Not used here) */
-	{
-		{PWM_OUTPUT_DISABLED, NULL},
-		{PWM_OUTPUT_DISABLED, NULL},
-		{PWM_OUTPUT_DISABLED, NULL},
-		{PWM_OUTPUT_ACTIVE_HIGH, NULL}, /* Only channel 4 enabled */
-	},
-};
-
-int main(void) {
-	halInit();
-	chSysInit();
-	pwmStart(&PWMD1, &pwmcfg_led);
-
-	unsigned int pwm_period_new = INIT_PWM_PERIOD;
-	bool upcount = TRUE;
-
-	show_pwm();
-
-	while (TRUE) {
-		pwmEnableChannel(&PWMD1, 3, INIT_PWM_WIDTH_TICS);
-
-
-		if(upcount) {
-			pwm_period_new += 1;
-		} else {
-			pwm_period_new -= 1;
-		}
-
-		if(pwm_period_new > (INIT_PWM_PERIOD * 0.5)) {
-			upcount = FALSE;
-		}
-
-		if(pwm_period_new < (INIT_PWM_WIDTH_TICS+1)) {
-			upcount = TRUE;
-		}
-
-		pwmChangePeriod(&PWMD1, pwm_period_new);
-
-		pwmDisableChannel(&PWMD1, 3);
-
-		chThdSleep(MS2ST(20));
-	}
-
-	return 0;
-}
+#include <stdio.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "simio.h"
+
+#define PWM_FREQUENCY       1000000   /* 1MHz timer clock, 1us per tick */
+#define PWM_PERIOD          1000      /* 1kHz cycles */
+#define CH0_WIDTH           250
+
+/* allowed mean delay between a cycle start or match and its callback */
+#define MAX_MEAN_JITTER_US  500
+
+static unsigned periods, matches;
+
+static void periodcb(PWMDriver *pwmp) {
+
+  (void)pwmp;
+  periods++;
+}
+
+static void ch0cb(PWMDriver *pwmp) {
+
+  (void)pwmp;
+  matches++;
+}
+
+static const PWMConfig pwmcfg = {
+  PWM_FREQUENCY,
+  PWM_PERIOD,
+  periodcb,
+  {
+    {PWM_OUTPUT_ACTIVE_HIGH, ch0cb},
+    {PWM_OUTPUT_DISABLED, NULL},
+    {PWM_OUTPUT_DISABLED, NULL},
+    {PWM_OUTPUT_ACTIVE_HIGH, NULL},
+  },
+};
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  unsigned i;
+  PWMStats st;
+  double mean;
+  int failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  sim_getopt(argc, argv);
+
+  halInit();
+  chSysInit();
+
+  pwmStart(&PWMD1, &pwmcfg);
+  pwmEnableChannel(&PWMD1, 0, CH0_WIDTH);
+
+  /* a control loop ramping the channel 3 duty cycle every 10ms */
+  for (i = 0; i <= 50; i++) {
+    pwmEnableChannel(&PWMD1, 3, i * PWM_PERIOD / 50);
+    chThdSleepMilliseconds(10);
+  }
+
+  /* 2kHz cycles, the channel 3 width is now the whole cycle */
+  pwmChangePeriod(&PWMD1, PWM_PERIOD / 2);
+  chThdSleepMilliseconds(200);
+
+  pwmDisableChannel(&PWMD1, 0);
+  pwmDisableChannel(&PWMD1, 3);
+  chSysLock();
+  if (pwmIsChannelEnabledI(&PWMD1, 0) || pwmIsChannelEnabledI(&PWMD1, 3)) {
+    printf("FAILED: channels left enabled\n");
+    failed = 1;
+  }
+  chSysUnlock();
+  pwmStop(&PWMD1);
+
+  pwm_lld_get_stats(&PWMD1, &st);
+  mean = st.callbacks ? st.jitter_sum / 1e3 / st.callbacks : 0;
+  printf("%u cycle and %u match callbacks, %u missed, jitter min %.1f us "
+         "mean %.1f us max %.1f us\n", periods, matches, st.missed,
+         st.jitter_min / 1e3, mean, st.jitter_max / 1e3);
+
+  /* 510 cycles at 1kHz then 400 at 2kHz */
+  if (periods + st.missed < 850 || periods + st.missed > 915 ||
+      periods + matches != st.callbacks) {
+    printf("FAILED: callbacks\n");
+    failed = 1;
+  }
+  if (matches < periods * 9 / 10 || matches > periods) {
+    printf("FAILED: channel match callbacks\n");
+    failed = 1;
+  }
+  if (mean > MAX_MEAN_JITTER_US) {
+    printf("FAILED: callbacks late\n");
+    failed = 1;
+  }
+  return failed;
+}
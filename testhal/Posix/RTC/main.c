@@ -14,109 +14,191 @@
     limitations under the License.
 */
 
+#include <stdio.h>
+#include <time.h>
+
 #include "ch.h"
 #include "hal.h"
 #include "chrtclib.h"
+#include "simio.h"
 
-#include <stdio.h>
-
-RTCTime timespec;
-RTCAlarm alarmspec;
-
-#define TEST_ALARM_WAKEUP FALSE
-
+/* allowed distance between the RTC and the host clock */
+#define MAX_SKEW_US         2000
 
-#if TEST_ALARM_WAKEUP
+/* allowed delay of an alarm or second callback */
+#define MAX_LATENCY_US      10000
 
-/* sleep indicator thread */
-static WORKING_AREA(blinkWA, 128);
-static msg_t blink_thd(void *arg){
-  (void)arg;
-  while (TRUE) {
-    chThdSleepMilliseconds(100);
-    palTogglePad(GPIOC, GPIOC_LED);
-  }
-  return 0;
-}
-
-int main(void) {
-  halInit();
-  chSysInit();
+/* sub-second alarms chained from the test thread */
+#define ALARMS              10
+#define ALARM_PERIOD_US     50000
 
-  chThdCreateStatic(blinkWA, sizeof(blinkWA), NORMALPRIO, blink_thd, NULL);
-  /* set alarm in near future */
-  rtcGetTime(&RTCD1, &timespec);
-  alarmspec.tv_sec = timespec.tv_sec + 30;
-  rtcSetAlarm(&RTCD1, 0, &alarmspec);
+static BinarySemaphore alarm_sem;
+static unsigned seconds, late_seconds;
+static uint64_t alarm_seen_us;
 
-  while (TRUE){
-    chThdSleepSeconds(10);
-  }
-  return 0;
+/*
+ * Host real time clock microseconds.
+ */
+static uint64_t host_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-#else /* TEST_ALARM_WAKEUP */
-
-/* Manually reloaded test alarm period.*/
-#define RTC_ALARMPERIOD   10
-
-BinarySemaphore alarm_sem;
-
-static void my_cb(RTCDriver *rtcp, rtcevent_t event) {
-  (void)rtcp;
+/*
+ * RTC callback, served as an interrupt.
+ */
+static void rtccb(RTCDriver *rtcp, rtcevent_t event) {
+  RTCTime now;
 
+  chSysLockFromIsr();
+  rtcGetTimeI(rtcp, &now);
   switch (event) {
-  case RTC_EVENT_OVERFLOW:
-    palTogglePad(GPIOC, GPIOC_LED);
-    break;
   case RTC_EVENT_SECOND:
-    palTogglePad(GPIOB, GPIOC_LED);
+    /* on the RTC second boundary */
+    seconds++;
+    if (now.tv_usec > MAX_LATENCY_US)
+      late_seconds++;
     break;
   case RTC_EVENT_ALARM:
-    palTogglePad(GPIOC, GPIOC_LED);
-    chSysLockFromIsr();
+    alarm_seen_us = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
     chBSemSignalI(&alarm_sem);
-    chSysUnlockFromIsr();
     break;
   default:
-    printf("ERROR my_cb unknown event\n");
     break;
   }
+  chSysUnlockFromIsr();
+}
+
+/*
+ * Sets an alarm at an RTC time in microseconds.
+ */
+static void set_alarm_us(uint64_t t) {
+  RTCAlarm alarmspec;
+
+  alarmspec.tv_sec = (uint32_t)(t / 1000000);
+  alarmspec.tv_usec = (uint32_t)(t % 1000000);
+  rtcSetAlarm(&RTCD1, 0, &alarmspec);
 }
 
-int main(void) {
-  msg_t status = RDY_TIMEOUT;
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  RTCTime timespec;
+  RTCAlarm alarmspec;
+  RTCStats st;
+  uint64_t t, due;
+  int64_t skew;
+  unsigned i, count;
+  int failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
 
   halInit();
   chSysInit();
   chBSemInit(&alarm_sem, TRUE);
 
-  rtcGetTime(&RTCD1, &timespec);
-  alarmspec.tv_sec = timespec.tv_sec + RTC_ALARMPERIOD;
-  rtcSetAlarm(&RTCD1, 0, &alarmspec);
-
-  rtcSetCallback(&RTCD1, my_cb);
-  while (TRUE){
-
-    /* Wait until alarm callback signaled semaphore.*/
-    status = chBSemWaitTimeout(&alarm_sem, S2ST(RTC_ALARMPERIOD + 5));
+  /* microsecond reads track the host real time clock */
+  skew = (int64_t)(rtcGetTimeUnixUsec(&RTCD1) - host_us());
+  printf("RTC skew from the host clock %lld us\n", (long long)skew);
+  if (skew < -MAX_SKEW_US || skew > MAX_SKEW_US) {
+    printf("FAILED: RTC skew\n");
+    failed = 1;
+  }
+  t = rtcGetTimeUnixUsec(&RTCD1);
+  chThdSleepMilliseconds(3);
+  t = rtcGetTimeUnixUsec(&RTCD1) - t;
+  printf("3 ms sleep read as %llu us\n", (unsigned long long)t);
+  if (t < 2000 || t > 3000 + MAX_SKEW_US) {
+    printf("FAILED: RTC resolution\n");
+    failed = 1;
+  }
 
-    if (status == RDY_TIMEOUT)
-      chSysHalt(); /* doesn't return */
+  /* setting the time keeps the fraction */
+  timespec.tv_sec = 1000000000;
+  timespec.tv_usec = 250000;
+  rtcSetTime(&RTCD1, &timespec);
+  rtcGetTime(&RTCD1, &timespec);
+  printf("set 1000000000.250000 read %u.%06u\n",
+         (unsigned)timespec.tv_sec, (unsigned)timespec.tv_usec);
+  if (timespec.tv_sec != 1000000000 ||
+      timespec.tv_usec < 250000 || timespec.tv_usec > 250000 + MAX_SKEW_US ||
+      timespec.tv_msec != timespec.tv_usec / 1000) {
+    printf("FAILED: set time\n");
+    failed = 1;
+  }
 
+  /* sub-second alarms, each set from the last one */
+  rtcSetCallback(&RTCD1, rtccb);
+  due = rtcGetTimeUnixUsec(&RTCD1);
+  for (i = 0; i < ALARMS; i++) {
+    due += ALARM_PERIOD_US;
+    set_alarm_us(due);
+    if (chBSemWaitTimeout(&alarm_sem, MS2ST(1000)) == RDY_TIMEOUT) {
+      printf("FAILED: alarm %u lost\n", i);
+      failed = 1;
+      break;
+    }
+    if (alarm_seen_us < due || alarm_seen_us > due + MAX_LATENCY_US) {
+      printf("FAILED: alarm %u at %+lld us\n", i,
+             (long long)(alarm_seen_us - due));
+      failed = 1;
+    }
+  }
+  rtcGetAlarm(&RTCD1, 0, &alarmspec);
+  if ((uint64_t)alarmspec.tv_sec * 1000000 + alarmspec.tv_usec != due) {
+    printf("FAILED: alarm read back\n");
+    failed = 1;
+  }
 
-    rtcGetTime(&RTCD1, &timespec);
-    alarmspec.tv_sec = timespec.tv_sec + RTC_ALARMPERIOD;
-    rtcSetAlarm(&RTCD1, 0, &alarmspec);
+  /* an alarm already due fires at once, a zero one never */
+  set_alarm_us(rtcGetTimeUnixUsec(&RTCD1) - 1000000);
+  if (chBSemWaitTimeout(&alarm_sem, MS2ST(100)) == RDY_TIMEOUT) {
+    printf("FAILED: past alarm lost\n");
+    failed = 1;
+  }
+  set_alarm_us(rtcGetTimeUnixUsec(&RTCD1) + 100000);
+  set_alarm_us(0);
+  if (chBSemWaitTimeout(&alarm_sem, MS2ST(300)) != RDY_TIMEOUT) {
+    printf("FAILED: disarmed alarm fired\n");
+    failed = 1;
+  }
 
-    /* toggle the cb occasionally */
-    if (timespec.tv_sec % 2 == 0) {
-      rtcSetCallback(&RTCD1, NULL);
-      chThdSleep(2000);
-      rtcSetCallback(&RTCD1, my_cb);
-    }
+  /* second events on the boundaries while the callback is set */
+  chSysLock();
+  seconds = late_seconds = 0;
+  chSysUnlock();
+  chThdSleepMilliseconds(3500);
+  count = seconds;
+  printf("%u second events in 3.5 s, %u late\n", count, late_seconds);
+  if (count < 3 || count > 4 || late_seconds > 0) {
+    printf("FAILED: second events\n");
+    failed = 1;
+  }
+  rtcSetCallback(&RTCD1, NULL);
+  chThdSleepMilliseconds(1500);
+  if (seconds != count) {
+    printf("FAILED: second events without a callback\n");
+    failed = 1;
+  }
 
+  rtc_lld_get_stats(&RTCD1, &st);
+  printf("%u alarms, latency min %.1f us mean %.1f us max %.1f us, "
+         "%u seconds, %u missed\n", st.alarms, st.latency_min / 1e3,
+         st.alarms ? st.latency_sum / 1e3 / st.alarms : 0,
+         st.latency_max / 1e3, st.seconds, st.missed);
+  if (st.alarms != ALARMS + 1) {
+    printf("FAILED: %u alarms counted\n", st.alarms);
+    failed = 1;
+  }
+  if (st.latency_max > MAX_LATENCY_US * 1000) {
+    printf("FAILED: alarms late\n");
+    failed = 1;
   }
-  return 0;
+  return failed;
 }
-#endif /* TEST_ALARM_WAKEUP */
@@ -18,6 +18,7 @@
 #include <string.h>
 #include "ch.h"
 #include "hal.h"
+#include "simio.h"
 
 #define SDC_DATA_DESTRUCTIVE_TEST   TRUE
 
@@ -25,6 +26,14 @@
 static uint8_t outbuf[MMCSD_BLOCK_SIZE * SDC_BURST_SIZE + 1];
 static uint8_t  inbuf[MMCSD_BLOCK_SIZE * SDC_BURST_SIZE + 1];
 
+#define LOG_START           0x12000 /* first block of the log */
+#define LOG_CHUNKS          64      /* chunks of SDC_BURST_SIZE blocks */
+static uint8_t logbuf[2][MMCSD_BLOCK_SIZE * SDC_BURST_SIZE];
+static SDCRequest logrq[2];
+static Semaphore logfree;
+static SDCRequest idlerq[PLATFORM_SDC_ASYNC_DEPTH];
+static WORKING_AREA(waiter_wa, 1024);
+
 /**
  * @brief   Returns the card insertion status.
  * @note    this function must be provided by the application because
@@ -120,10 +129,107 @@ void fillbuffers(uint8_t pattern){
   fillbuffer(pattern, outbuf);
 }
 
+/**
+ * @brief   Write completion, gives the buffer back to the logger.
+ */
+static void logwritten(SDCDriver *sdcp, SDCRequest *rqp) {
+  (void)sdcp;
+  if (rqp->status)
+    chSysHalt();
+  chSysLockFromIsr();
+  chSemSignalI(&logfree);
+  chSysUnlockFromIsr();
+}
+
+/**
+ * @brief   Logs LOG_CHUNKS chunks, producing each one takes a tick.
+ *
+ * @param[in] async     double buffered asynchronous writes
+ *
+ * @return              The elapsed ticks.
+ */
+systime_t logtest(bool_t async){
+  systime_t start = chTimeNow();
+  unsigned i;
+
+  chSemInit(&logfree, 2);
+  for (i = 0; i < LOG_CHUNKS; i++) {
+    uint8_t *b = logbuf[i & 1];
+
+    chSemWait(&logfree);
+    chThdSleep(1);
+    memset(b, i, sizeof logbuf[0]);
+    if (async) {
+      if (sdcStartWrite(&SDCD1, &logrq[i & 1], LOG_START + i * SDC_BURST_SIZE,
+                        b, SDC_BURST_SIZE, logwritten))
+        chSysHalt();
+    }
+    else {
+      if (sdcWrite(&SDCD1, LOG_START + i * SDC_BURST_SIZE, b, SDC_BURST_SIZE))
+        chSysHalt();
+      chSemSignal(&logfree);
+    }
+  }
+  sdcWaitIdle(&SDCD1);
+  return chTimeNow() - start;
+}
+
+/**
+ * @brief   Checks the log written by logtest().
+ */
+void logcheck(void){
+  unsigned i, j;
+
+  for (i = 0; i < LOG_CHUNKS; i++) {
+    if (sdcStartRead(&SDCD1, &logrq[0], LOG_START + i * SDC_BURST_SIZE,
+                     inbuf, SDC_BURST_SIZE, NULL))
+      chSysHalt();
+    sdcWaitIdle(&SDCD1);
+    if (logrq[0].status)
+      chSysHalt();
+    for (j = 0; j < sizeof logbuf[0]; j++)
+      if (inbuf[j] != (uint8_t)i)
+        chSysHalt();
+  }
+}
+
+/**
+ * @brief   Waits for the idle card along with the main thread.
+ */
+static msg_t idlewaiter(void *arg) {
+
+  (void)arg;
+  sdcWaitIdle(&SDCD1);
+  return 0;
+}
+
+/**
+ * @brief   Two threads waiting for a full requests queue at once.
+ */
+void idletest(void){
+  Thread *tp;
+  unsigned i;
+
+  for (i = 0; i < PLATFORM_SDC_ASYNC_DEPTH; i++)
+    if (sdcStartRead(&SDCD1, &idlerq[i], LOG_START + i * SDC_BURST_SIZE,
+                     inbuf, SDC_BURST_SIZE, NULL))
+      chSysHalt();
+  tp = chThdCreateStatic(waiter_wa, sizeof waiter_wa, NORMALPRIO + 1,
+                         idlewaiter, NULL);
+  /* the read drains the queue first */
+  if (sdcRead(&SDCD1, LOG_START, inbuf, SDC_BURST_SIZE))
+    chSysHalt();
+  chThdWait(tp);
+}
+
 /**
  *
  */
 void sdiotest(void){
+#if SDC_DATA_DESTRUCTIVE_TEST
+  systime_t start;
+#endif
+
   printf("Trying to connect SDIO... ");
   chThdSleepMilliseconds(100);
 
@@ -209,8 +315,26 @@ void sdiotest(void){
 
     printf("Running badblocks at 0x10000 offset...");
     chThdSleepMilliseconds(100);
+    start = chTimeNow();
     if(badblocks(0x10000, 0x11000, SDC_BURST_SIZE, 0xAA))
       chSysHalt();
+    printf(" OK in %u ticks\r\n", (unsigned)(chTimeNow() - start));
+
+    printf("Sync...");
+    if (sdcSync(&SDCD1))
+      chSysHalt();
+    printf(" OK\r\n");
+
+    printf("Synchronous logging...");
+    printf(" OK in %u ticks\r\n", (unsigned)logtest(FALSE));
+    logcheck();
+
+    printf("Asynchronous logging...");
+    printf(" OK in %u ticks\r\n", (unsigned)logtest(TRUE));
+    logcheck();
+
+    printf("Concurrent idle waits...");
+    idletest();
     printf(" OK\r\n");
 #endif /* !SDC_DATA_DESTRUCTIVE_TEST */
 
@@ -231,7 +355,9 @@ static const SDCConfig sdccfg = {
 /*
  * Application entry point.
  */
-int main(void) {
+int main(int argc, char *argv[]) {
+  sim_getopt(argc, argv);
+
   halInit();
   chSysInit();
 
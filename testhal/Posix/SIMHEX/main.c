@@ -0,0 +1,172 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "simutil.h"
+#include "simhex.h"
+
+/* payload bytes per call and calls per measurement */
+#define BENCH_LEN           SIM_MAX_TRANSFER
+#define BENCH_ROUNDS        20000
+
+static uint8_t data[BENCH_LEN], back[BENCH_LEN];
+static char hex[BENCH_LEN*2], ref[BENCH_LEN*2];
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+
+/*
+ * Wall clock microseconds, the system tick is too coarse here.
+ */
+static double now_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static double mb_per_s(unsigned rounds, double start) {
+  return (double)rounds * BENCH_LEN / (now_us() - start);
+}
+
+/*
+ * The byte at a time codec simio used before, for comparison.
+ */
+static void legacy_encode(char *dst, const uint8_t *src, size_t len) {
+  char pair[3];
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    snprintf(pair, sizeof pair, "%02x", src[i]);
+    memcpy(dst + i*2, pair, 2);
+  }
+}
+
+static void legacy_decode(uint8_t *dst, const char *src, size_t len) {
+  char byte[3];
+  size_t i;
+
+  for (i = 0; i < len/2; i++) {
+    snprintf(byte, sizeof byte, "%c%c", src[i*2], src[i*2+1]);
+    dst[i] = (uint8_t)strtoul(byte, NULL, 16);
+  }
+}
+
+static void bench_legacy(void) {
+  unsigned rounds = BENCH_ROUNDS / 100, i;
+  double start, enc, dec;
+
+  start = now_us();
+  for (i = 0; i < rounds; i++)
+    legacy_encode(ref, data, BENCH_LEN);
+  enc = mb_per_s(rounds, start);
+
+  start = now_us();
+  for (i = 0; i < rounds; i++)
+    legacy_decode(back, ref, sizeof ref);
+  dec = mb_per_s(rounds, start);
+
+  printf("%-8s encode %8.1f MB/s, decode %8.1f MB/s\n", "legacy", enc, dec);
+}
+
+static int bench(const char *name) {
+  double start, enc, dec;
+  unsigned i;
+
+  if (simhex_select(name) < 0) {
+    printf("%-8s not supported\n", name);
+    return 0;
+  }
+
+  start = now_us();
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    (void)simhex_encode(hex, data, BENCH_LEN);
+  enc = mb_per_s(BENCH_ROUNDS, start);
+
+  if (memcmp(hex, ref, sizeof hex)) {
+    fprintf(stderr, "ERROR %s encode mismatch\n", name);
+    return 1;
+  }
+
+  start = now_us();
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    (void)simhex_decode(back, hex, sizeof hex);
+  dec = mb_per_s(BENCH_ROUNDS, start);
+
+  if (memcmp(back, data, sizeof back)) {
+    fprintf(stderr, "ERROR %s decode mismatch\n", name);
+    return 1;
+  }
+
+  /* upper case and stray characters */
+  hex[1] = 'A';
+  if (simhex_decode(back, hex, sizeof hex) != BENCH_LEN || back[0] != (data[0] & 0xf0) + 10) {
+    fprintf(stderr, "ERROR %s upper case\n", name);
+    return 1;
+  }
+  hex[sizeof hex - 1] = 'g';
+  if (simhex_decode(back, hex, sizeof hex) >= 0) {
+    fprintf(stderr, "ERROR %s accepted a non digit\n", name);
+    return 1;
+  }
+
+  /* the digits have no case, the control characters below them */
+  hex[sizeof hex - 1] = 0x10;
+  if (simhex_decode(back, hex, sizeof hex) >= 0) {
+    fprintf(stderr, "ERROR %s accepted 0x10 in the tail\n", name);
+    return 1;
+  }
+  hex[sizeof hex - 1] = '0';
+  hex[2] = 0x19;
+  if (simhex_decode(back, hex, sizeof hex) >= 0) {
+    fprintf(stderr, "ERROR %s accepted 0x19\n", name);
+    return 1;
+  }
+
+  printf("%-8s encode %8.1f MB/s, decode %8.1f MB/s\n", name, enc, dec);
+  return 0;
+}
+
+/*
+ * Application entry point.
+ */
+int main(void) {
+  unsigned i;
+  int failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  halInit();
+  chSysInit();
+
+  srand(1);
+  for (i = 0; i < sizeof data; i++)
+    data[i] = (uint8_t)rand();
+
+  printf("hex codec, %d byte payloads, default kernel %s\n",
+         BENCH_LEN, simhex_kernel());
+
+  bench_legacy();
+  for (i = 0; i < sizeof kernels / sizeof kernels[0]; i++)
+    failed |= bench(kernels[i]);
+
+  return failed;
+}
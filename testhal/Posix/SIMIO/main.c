@@ -0,0 +1,136 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "simio.h"
+#include "simutil.h"
+
+/* number of 512 byte blocks moved in each direction */
+#define BENCH_BLOCKS        2000
+
+static uint8_t outbuf[MMCSD_BLOCK_SIZE];
+static uint8_t  inbuf[MMCSD_BLOCK_SIZE];
+
+/*
+ * SDIO configuration.
+ */
+static const SDCConfig sdccfg = {
+  0
+};
+
+bool_t sdc_lld_is_write_protected(SDCDriver *sdcp) {
+  (void)sdcp;
+  return FALSE;
+}
+
+bool_t sdc_lld_is_card_inserted(SDCDriver *sdcp) {
+  (void)sdcp;
+  return TRUE;
+}
+
+/*
+ * Wall clock microseconds, the system tick is too coarse here.
+ */
+static double now_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void report(const char *op, double start) {
+  double us = now_us() - start;
+  printf("%s %s: %d blocks in %.0f ms, %.1f KB/s\n",
+         sim_get_transport() == SIM_TRANSPORT_SHM ? "shm" :
+         sim_get_transport() == SIM_TRANSPORT_REPLAY ? "replay" :
+         sim_get_proto(SDC_IO) == SIM_PROTO_BIN ? "bin" : "hex", op,
+         BENCH_BLOCKS, us / 1000,
+         BENCH_BLOCKS * MMCSD_BLOCK_SIZE / 1024.0 / (us / 1e6));
+}
+
+static void report_pool(const char *name, sim_pool_stats_t *st) {
+  printf("%s pool: %u in use, high-water %u, exhausted %u, oversize %u\n",
+         name, st->used, st->hwm, st->exhausted, st->oversize);
+}
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  sim_pool_stats_t bufs, msgs;
+  double start;
+  uint32_t i;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
+
+  halInit();
+  chSysInit();
+
+  sdcStart(&SDCD1, &sdccfg);
+  if (sdcConnect(&SDCD1)) {
+    fprintf(stderr, "ERROR sdcConnect\n");
+    exit(1);
+  }
+
+  for (i = 0; i < sizeof outbuf; i++)
+    outbuf[i] = (uint8_t)i;
+
+  /* the first transfer finishes the protocol negotiation */
+  if (sdcWrite(&SDCD1, 0, outbuf, 1) || sdcRead(&SDCD1, 0, inbuf, 1)) {
+    fprintf(stderr, "ERROR warm up transfer\n");
+    exit(1);
+  }
+
+  start = now_us();
+  for (i = 0; i < BENCH_BLOCKS; i++) {
+    if (sdcWrite(&SDCD1, i, outbuf, 1)) {
+      fprintf(stderr, "ERROR sdcWrite block %u\n", i);
+      exit(1);
+    }
+  }
+  sim_write_flush();
+  report("write", start);
+
+  start = now_us();
+  for (i = 0; i < BENCH_BLOCKS; i++) {
+    if (sdcRead(&SDCD1, i, inbuf, 1)) {
+      fprintf(stderr, "ERROR sdcRead block %u\n", i);
+      exit(1);
+    }
+  }
+  report("read", start);
+
+  if (memcmp(inbuf, outbuf, sizeof inbuf) != 0) {
+    fprintf(stderr, "ERROR read back mismatch\n");
+    exit(1);
+  }
+
+  sim_pool_stats(&bufs, &msgs);
+  report_pool("buffer", &bufs);
+  report_pool("message", &msgs);
+
+  sim_disconnect();
+  return 0;
+}
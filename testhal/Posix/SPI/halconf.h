@@ -307,6 +307,13 @@
 #define SPI_USE_MUTUAL_EXCLUSION    TRUE
 #endif
 
+/**
+ * @brief   Enables the transactions API.
+ */
+#if !defined(SPI_USE_TRANSACTIONS) || defined(__DOXYGEN__)
+#define SPI_USE_TRANSACTIONS        TRUE
+#endif
+
 #endif /* _HALCONF_H_ */
 
 /** @} */
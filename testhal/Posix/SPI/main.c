@@ -15,9 +15,18 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ch.h"
 #include "hal.h"
 
+#define CHAINED_EXCHANGES   8   /* exchanges restarted from the callback */
+#define CONTENDER_ROUNDS    10
+#define REGISTER_READS      1000
+#define CS_TOGGLES          (4 * PLATFORM_SPI_QUEUE_SIZE)
+
+static void chained_cb(SPIDriver *spip);
+
 /*
  * Generic SPI configuration.
  */
@@ -29,21 +38,80 @@ static const SPIConfig spicfg = {
   0
 };
 
+/*
+ * SPI configuration with a completion callback.
+ */
+static const SPIConfig spicfg_cb = {
+  chained_cb,
+  GPIOB,
+  12,
+  0,
+  0
+};
+
 /*
  * SPI TX and RX buffers.
  */
 static uint8_t txbuf[512];
 static uint8_t rxbuf[512];
 
+static BinarySemaphore done;
+static unsigned exchanges;
+
+/*
+ * Register read, the way a sensor driver does it.
+ */
+static uint8_t regcmd[2] = {0x8F, 0};
+static uint8_t regval[2];
+static const SPIStep regread[] = {
+  {SPI_STEP_SELECT,   0, NULL,   NULL},
+  {SPI_STEP_EXCHANGE, 2, regcmd, regval},
+  {SPI_STEP_UNSELECT, 0, NULL,   NULL}
+};
+
+/*
+ * Transaction using every step type.
+ */
+static const SPIStep mixed[] = {
+  {SPI_STEP_SELECT,   0,  NULL,  NULL},
+  {SPI_STEP_SEND,     4,  txbuf, NULL},
+  {SPI_STEP_RECEIVE,  8,  NULL,  rxbuf},
+  {SPI_STEP_IGNORE,   2,  NULL,  NULL},
+  {SPI_STEP_EXCHANGE, 16, txbuf, rxbuf + 8},
+  {SPI_STEP_UNSELECT, 0,  NULL,  NULL}
+};
+
+/*
+ * Completion callback, invoked from ISR context. Restarts the exchange
+ * until CHAINED_EXCHANGES are done, the way a DMA driver would chain
+ * buffers.
+ */
+static void chained_cb(SPIDriver *spip) {
+
+  chSysLockFromIsr();
+  if (++exchanges < CHAINED_EXCHANGES) {
+    spiStartExchangeI(spip, sizeof txbuf, txbuf, rxbuf);
+  }
+  else
+    chBSemSignalI(&done);
+  chSysUnlockFromIsr();
+}
+
+static void fail(const char *msg) {
+  fprintf(stderr, "ERROR %s\n", msg);
+  exit(1);
+}
+
 /*
  * SPI bus contender 1.
  */
 static WORKING_AREA(spi_thread_1_wa, 256);
 static msg_t spi_thread_1(void *p) {
+  unsigned i;
 
   (void)p;
   chRegSetThreadName("SPI thread 1");
-  while (TRUE) {
+  for (i = 0; i < CONTENDER_ROUNDS; i++) {
     spiAcquireBus(&SPID1);              /* Acquire ownership of the bus.    */
     palSetPad(GPIOD, GPIOD_LED5);       /* LED ON.                          */
     spiStart(&SPID1, &spicfg);          /* Setup transfer parameters.       */
@@ -52,7 +120,7 @@ static msg_t spi_thread_1(void *p) {
                 txbuf, rxbuf);          /* Atomic transfer operations.      */
     spiUnselect(&SPID1);                /* Slave Select de-assertion.       */
     spiReleaseBus(&SPID1);              /* Ownership release.               */
-    chThdSleep(S2ST(1));
+    chThdSleepMilliseconds(10);
   }
   return 0;
 }
@@ -62,10 +130,11 @@ static msg_t spi_thread_1(void *p) {
  */
 static WORKING_AREA(spi_thread_2_wa, 256);
 static msg_t spi_thread_2(void *p) {
+  unsigned i;
 
   (void)p;
   chRegSetThreadName("SPI thread 2");
-  while (TRUE) {
+  for (i = 0; i < CONTENDER_ROUNDS; i++) {
     spiAcquireBus(&SPID1);              /* Acquire ownership of the bus.    */
     palClearPad(GPIOD, GPIOD_LED5);     /* LED OFF.                         */
     spiStart(&SPID1, &spicfg);          /* Setup transfer parameters.       */
@@ -74,7 +143,7 @@ static msg_t spi_thread_2(void *p) {
                 txbuf, rxbuf);          /* Atomic transfer operations.      */
     spiUnselect(&SPID1);                /* Slave Select de-assertion.       */
     spiReleaseBus(&SPID1);              /* Ownership release.               */
-    chThdSleep(S2ST(1));
+    chThdSleepMilliseconds(10);
   }
   return 0;
 }
@@ -83,8 +152,10 @@ static msg_t spi_thread_2(void *p) {
  * Application entry point.
  */
 int main(void) {
-  unsigned i;
+  unsigned i, overlap;
+  systime_t start, separate, batched;
   uint16_t frame;
+  Thread *tp1, *tp2;
 
   /*
    * System initializations.
@@ -111,36 +182,107 @@ int main(void) {
   spiStart(&SPID1, &spicfg);          /* Setup transfer parameters.       */
   spiSelect(&SPID1);                  /* Slave Select assertion.          */
 
+  /*
+   * Synchronous transfers, the VHA echoes exchanges and receives zeros.
+   */
   spiExchange(&SPID1, 512, txbuf, rxbuf);
-  spiStartExchange(&SPID1, 512, txbuf, rxbuf);
+  if (memcmp(txbuf, rxbuf, sizeof rxbuf) != 0)
+    fail("spiExchange data mismatch");
 
   spiSend(&SPID1, sizeof txbuf, txbuf);
-  spiStartSend(&SPID1, sizeof txbuf, txbuf);
 
   spiReceive(&SPID1, sizeof rxbuf, rxbuf);
-  spiStartReceive(&SPID1, sizeof rxbuf, rxbuf);
+  for (i = 0; i < sizeof(rxbuf); i++)
+    if (rxbuf[i] != 0)
+      fail("spiReceive data mismatch");
+
+  spiIgnore(&SPID1, 16);
 
   if ((frame = spiPolledExchange(&SPID1, 0xaa)) != 0xaa) {
     fprintf(stderr, "ERROR spiPolledExchange expected 0xaa got 0x%x", frame);
     exit(1);
   }
 
+  /*
+   * Asynchronous transfers, the start returns before the completion and
+   * the callback chains the next exchanges.
+   */
+  chBSemInit(&done, TRUE);
+  spiStart(&SPID1, &spicfg_cb);
+  memset(rxbuf, 0, sizeof rxbuf);
+  spiStartExchange(&SPID1, 512, txbuf, rxbuf);
+  overlap = 0;
+  while (chBSemWaitTimeout(&done, TIME_IMMEDIATE) != RDY_OK) {
+    overlap++;
+    chThdSleep(1);
+  }
+  if (overlap == 0)
+    fail("spiStartExchange completed before returning");
+  if (exchanges != CHAINED_EXCHANGES)
+    fail("chained exchanges missing");
+  if (memcmp(txbuf, rxbuf, sizeof rxbuf) != 0)
+    fail("spiStartExchange data mismatch");
+
   spiUnselect(&SPID1);                /* Slave Select de-assertion.       */
-  spiReleaseBus(&SPID1);              /* Ownership release.               */
 
   /*
-   * Starting the transmitter and receiver threads.
+   * Chip select toggles queued behind a transfer in progress, more than
+   * the queue holds, wait for room instead of being lost.
    */
-  chThdCreateStatic(spi_thread_1_wa, sizeof(spi_thread_1_wa),
-                    NORMALPRIO + 1, spi_thread_1, NULL);
-  chThdCreateStatic(spi_thread_2_wa, sizeof(spi_thread_2_wa),
-                    NORMALPRIO + 1, spi_thread_2, NULL);
+  spiStart(&SPID1, &spicfg);
+  spiStartExchange(&SPID1, 512, txbuf, rxbuf);
+  chSysLock();
+  for (i = 0; i < CS_TOGGLES; i++) {
+    spiSelectI(&SPID1);
+    spiUnselectI(&SPID1);
+  }
+  chSysUnlock();
+  while (SPID1.state != SPI_READY)
+    chThdSleep(1);
 
   /*
-   * Normal main() thread activity, in this demo it does nothing.
+   * Transactions, one VHA round trip each.
    */
-  while (TRUE) {
-    chThdSleep(S2ST(1));
+  spiStart(&SPID1, &spicfg);
+  memset(rxbuf, 0xFF, sizeof rxbuf);
+  spiTransaction(&SPID1, mixed, sizeof mixed / sizeof mixed[0]);
+  for (i = 0; i < 8; i++)
+    if (rxbuf[i] != 0)
+      fail("transaction receive data mismatch");
+  if (memcmp(txbuf, rxbuf + 8, 16) != 0)
+    fail("transaction exchange data mismatch");
+
+  start = chTimeNow();
+  for (i = 0; i < REGISTER_READS; i++) {
+    spiSelect(&SPID1);
+    spiExchange(&SPID1, sizeof regcmd, regcmd, regval);
+    spiUnselect(&SPID1);
+  }
+  separate = chTimeNow() - start;
+
+  start = chTimeNow();
+  for (i = 0; i < REGISTER_READS; i++) {
+    regval[0] = 0;
+    spiTransaction(&SPID1, regread, sizeof regread / sizeof regread[0]);
+    if (regval[0] != regcmd[0])
+      fail("transaction register read mismatch");
   }
+  batched = chTimeNow() - start;
+  printf("%u register reads: %u ticks separate, %u ticks batched\n",
+         REGISTER_READS, (unsigned)separate, (unsigned)batched);
+
+  spiReleaseBus(&SPID1);              /* Ownership release.               */
+
+  /*
+   * Starting the bus contenders and waiting for them.
+   */
+  tp1 = chThdCreateStatic(spi_thread_1_wa, sizeof(spi_thread_1_wa),
+                          NORMALPRIO + 1, spi_thread_1, NULL);
+  tp2 = chThdCreateStatic(spi_thread_2_wa, sizeof(spi_thread_2_wa),
+                          NORMALPRIO + 1, spi_thread_2, NULL);
+  chThdWait(tp1);
+  chThdWait(tp2);
+
+  printf("SPI test OK, %u ticks of overlap\n", overlap);
   return 0;
 }
@@ -0,0 +1,140 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "simio.h"
+
+/* length of the scenario in host seconds */
+#define SCENARIO_SECONDS    5
+
+/* allowed difference between system time and host time */
+#define MAX_DRIFT_TICKS     2
+
+/* allowed host CPU use of the mostly idle system, in percent */
+#define MAX_CPU_PERCENT     5
+
+/*
+ * Host monotonic clock milliseconds.
+ */
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Host CPU milliseconds used by the process.
+ */
+static double cpu_ms(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+/*
+ * Periodic tasks with mostly idle time in between.
+ */
+static WORKING_AREA(waTask1, 256);
+static WORKING_AREA(waTask2, 256);
+static WORKING_AREA(waTask3, 256);
+static const systime_t periods[3] = {MS2ST(50), MS2ST(200), MS2ST(1000)};
+static uint32_t wakeups[3];
+static systime_t end;
+
+static msg_t task(void *arg) {
+  uint32_t *n = arg;
+  systime_t period = periods[n - wakeups];
+  systime_t next = chTimeNow();
+
+  while ((systime_t)(end - next) >= period) {
+    next += period;
+    chThdSleepUntil(next);
+    (*n)++;
+  }
+  return 0;
+}
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  port_idle_stats_t st;
+  double wall, cpu, drift;
+  systime_t t0;
+  int failed = 0;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
+
+  halInit();
+  chSysInit();
+
+  if (port_is_virtual_clock()) {
+    printf("tickless idle needs the real clock\n");
+    return 1;
+  }
+
+  wall = now_ms();
+  cpu = cpu_ms();
+  t0 = chTimeNow();
+  end = t0 + S2ST(SCENARIO_SECONDS);
+
+  chThdCreateStatic(waTask1, sizeof(waTask1), NORMALPRIO + 1, task, &wakeups[0]);
+  chThdCreateStatic(waTask2, sizeof(waTask2), NORMALPRIO + 2, task, &wakeups[1]);
+  chThdCreateStatic(waTask3, sizeof(waTask3), NORMALPRIO + 3, task, &wakeups[2]);
+  chThdSleepUntil(end);
+
+  wall = now_ms() - wall;
+  cpu = cpu_ms() - cpu;
+  drift = wall - (double)(chTimeNow() - t0) * 1000 / CH_FREQUENCY;
+  port_get_idle_stats(&st);
+
+  printf("wakeups %u %u %u\n", wakeups[0], wakeups[1], wakeups[2]);
+  printf("host %.0f ms, system %u ticks, drift %.2f ms\n",
+         wall, (unsigned)(chTimeNow() - t0), drift);
+  printf("idle %.0f ms in %u sleeps, %u ended by I/O\n",
+         st.idle_ns / 1e6, st.sleeps, st.io_wakeups);
+  printf("cpu %.1f ms (%.2f%%)\n", cpu, cpu * 100 / wall);
+
+  if (drift < 0)
+    drift = -drift;
+  if (drift > MAX_DRIFT_TICKS * 1000.0 / CH_FREQUENCY) {
+    printf("FAILED: system time drifted from host time\n");
+    failed = 1;
+  }
+  if (cpu * 100 / wall > MAX_CPU_PERCENT) {
+    printf("FAILED: idle system uses the host CPU\n");
+    failed = 1;
+  }
+  if (wakeups[0] != SCENARIO_SECONDS * 20 ||
+      wakeups[1] != SCENARIO_SECONDS * 5 ||
+      wakeups[2] != SCENARIO_SECONDS) {
+    printf("FAILED: missed task wakeups\n");
+    failed = 1;
+  }
+
+  return failed;
+}
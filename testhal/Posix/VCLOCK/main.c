@@ -0,0 +1,120 @@
+/*
+    ChibiOS/RT - Copyright (C) 2006-2013 Giovanni Di Sirio
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "test.h"
+#include "simio.h"
+
+/* simulated length of the scenario */
+#define SCENARIO_SECONDS    600
+
+/*
+ * Test suite output on stdout.
+ */
+static size_t out_write(void *ip, const uint8_t *bp, size_t n) {
+  (void)ip;
+  return fwrite(bp, 1, n, stdout);
+}
+
+static size_t out_read(void *ip, uint8_t *bp, size_t n) {
+  (void)ip; (void)bp; (void)n;
+  return 0;
+}
+
+static msg_t out_put(void *ip, uint8_t b) {
+  (void)ip;
+  return putchar(b) == EOF ? RDY_RESET : RDY_OK;
+}
+
+static msg_t out_get(void *ip) {
+  (void)ip;
+  return RDY_RESET;
+}
+
+static const struct BaseSequentialStreamVMT out_vmt = {
+  out_write, out_read, out_put, out_get
+};
+
+static BaseSequentialStream out = { &out_vmt };
+
+/*
+ * Wall clock milliseconds.
+ */
+static double now_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/*
+ * Periodic tasks of a flight like scenario, each counts its wakeups.
+ */
+static WORKING_AREA(waTask1, 256);
+static WORKING_AREA(waTask2, 256);
+static WORKING_AREA(waTask3, 256);
+static uint32_t wakeups[3];
+
+static msg_t task(void *arg) {
+  uint32_t *n = arg;
+  systime_t period = (systime_t)(n - wakeups + 1) * MS2ST(10);
+  systime_t next = chTimeNow();
+
+  while (chTimeNow() < S2ST(SCENARIO_SECONDS)) {
+    next += period;
+    chThdSleepUntil(next);
+    (*n)++;
+  }
+  return 0;
+}
+
+/*
+ * Application entry point.
+ */
+int main(int argc, char **argv) {
+  double start;
+  msg_t failed;
+
+  /* no stdout buffering */
+  setbuf(stdout, NULL);
+
+  /* send args to simulator */
+  sim_getopt(argc, argv);
+
+  halInit();
+  chSysInit();
+
+  printf("clock %s\n", port_is_virtual_clock() ? "virtual" : "real");
+
+  start = now_ms();
+  chThdCreateStatic(waTask1, sizeof(waTask1), NORMALPRIO + 1, task, &wakeups[0]);
+  chThdCreateStatic(waTask2, sizeof(waTask2), NORMALPRIO + 2, task, &wakeups[1]);
+  chThdCreateStatic(waTask3, sizeof(waTask3), NORMALPRIO + 3, task, &wakeups[2]);
+  chThdSleep(S2ST(SCENARIO_SECONDS) + MS2ST(100));
+  printf("scenario: %d s simulated in %.0f ms, wakeups %u %u %u\n",
+         SCENARIO_SECONDS, now_ms() - start,
+         wakeups[0], wakeups[1], wakeups[2]);
+
+  start = now_ms();
+  failed = TestThread(&out);
+  printf("test suite: %.0f ms\n", now_ms() - start);
+
+  return failed ? 1 : 0;
+}